@@ -0,0 +1,360 @@
+//
+// cache.c
+// reference-counted resource cache
+//
+// Textures, samplers and materials are shared by everything which uses them,
+// keyed by their path and parameters. A resource is created on the first
+// acquisition which misses, and destroyed when its last reference is
+// released. Lookups may come from the loader thread, so the cache is guarded
+// by a lock.
+//
+// A texture which is still being read is claimed by its reader, so that
+// nobody else reads it in the meantime. Its claim holds a pending entry,
+// which acquisitions miss, until the texture is cached or the claim dropped.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "dict.h"
+#include "texture.h"
+#include "shader.h"
+#include "material.h"
+#include "state.h"
+#include "cache.h"
+
+enum resourceType {
+	RESOURCE_TEXTURE,
+	RESOURCE_SAMPLER,
+	RESOURCE_MATERIAL
+};
+
+enum { KEY_SIZE = 512 };
+
+struct resource {
+	enum resourceType type;
+	void              *value;  // Texture or material
+	GLuint            handle;  // Sampler
+	const void        *owner;  // Reader of a pending texture, or NULL
+	int               refs;
+	char              key[];
+};
+
+static struct {
+	pthread_mutex_t      lock;
+	dict_t               byKey;   // Resources by path and parameters
+	dict_t               byValue; // Resources by the address or handle of their value
+	struct resourceStats stats;
+} CACHE;
+
+static void textureKey(char *key, const char *path, GLint format)
+{
+	snprintf(key, KEY_SIZE, "texture:%s:%d", path, format);
+}
+
+static void materialKey(char *key, const char *shader, const char *dir, const char *name)
+{
+	snprintf(key, KEY_SIZE, "material:%s:%s/%s", shader, dir, name);
+}
+
+static void valueKey(char *key, enum resourceType type, const void *value, GLuint handle)
+{
+	if (type == RESOURCE_SAMPLER) {
+		snprintf(key, KEY_SIZE, "sampler#%u", handle);
+	} else {
+		snprintf(key, KEY_SIZE, "%p", value);
+	}
+}
+
+void rInitCache(void)
+{
+	pthread_mutex_init(&CACHE.lock, NULL);
+
+	CACHE.byKey = dict(NULL);
+	CACHE.byValue = dict(NULL);
+}
+
+//
+// Find the resource at `key` and take a reference to it. Pending entries are
+// missed.
+//
+static struct resource *acquire(const char *key)
+{
+	struct resource *r;
+
+	pthread_mutex_lock(&CACHE.lock);
+
+	if ((r = dictLookup(CACHE.byKey, key)) && ! r->owner) {
+		r->refs++;
+		CACHE.stats.hits++;
+	} else {
+		r = NULL;
+		CACHE.stats.misses++;
+	}
+	pthread_mutex_unlock(&CACHE.lock);
+
+	return r;
+}
+
+//
+// Add a resource at `key`, with a single reference. It takes the place of the
+// pending entry at `key`, if there is one.
+//
+static struct resource *insert(const char *key, enum resourceType type, void *value, GLuint handle)
+{
+	struct resource *r = malloc(sizeof(*r) + strlen(key) + 1);
+	struct resource *pending;
+	char vkey[KEY_SIZE];
+
+	r->type = type;
+	r->value = value;
+	r->handle = handle;
+	r->owner = NULL;
+	r->refs = 1;
+	strcpy(r->key, key);
+
+	valueKey(vkey, type, value, handle);
+
+	pthread_mutex_lock(&CACHE.lock);
+
+	if ((pending = dictLookup(CACHE.byKey, key)) && pending->owner) {
+		dictRemove(CACHE.byKey, key);
+		free(pending);
+	}
+	dictInsert(CACHE.byKey, key, r);
+	dictInsert(CACHE.byValue, vkey, r);
+	CACHE.stats.resident++;
+	pthread_mutex_unlock(&CACHE.lock);
+
+	return r;
+}
+
+//
+// Drop a reference to the resource holding `value` or `handle`. Returns the
+// resource if that was the last reference, in which case it's no longer in the
+// cache, and it's up to the caller to destroy it and free the resource.
+// Returns NULL otherwise, and for values which were never cached.
+//
+static struct resource *release(enum resourceType type, const void *value, GLuint handle)
+{
+	struct resource *r;
+	char vkey[KEY_SIZE];
+
+	valueKey(vkey, type, value, handle);
+
+	pthread_mutex_lock(&CACHE.lock);
+
+	if ((r = dictLookup(CACHE.byValue, vkey)) && --r->refs == 0) {
+		dictRemove(CACHE.byKey, r->key);
+		dictRemove(CACHE.byValue, vkey);
+		CACHE.stats.resident--;
+	} else {
+		r = NULL;
+	}
+	pthread_mutex_unlock(&CACHE.lock);
+
+	return r;
+}
+
+//
+// Get the texture loaded from `path` with internal format `format`, or NULL
+// if it isn't cached yet.
+//
+struct texture *rAcquireTexture(const char *path, GLint format)
+{
+	char key[KEY_SIZE];
+	struct resource *r;
+
+	textureKey(key, path, format);
+
+	return (r = acquire(key)) ? r->value : NULL;
+}
+
+void rCacheTexture(const char *path, GLint format, struct texture *t)
+{
+	char key[KEY_SIZE];
+
+	textureKey(key, path, format);
+	insert(key, RESOURCE_TEXTURE, t, 0);
+}
+
+//
+// Claim the texture loaded from `path` with internal format `format` for
+// `owner`, which is about to read it. Returns false if the texture is already
+// cached or claimed, in which case it's up to whoever has it to create it.
+// The claim lasts until the texture is cached, or `rUnclaimTexture`.
+//
+bool rClaimTexture(const char *path, GLint format, const void *owner)
+{
+	char key[KEY_SIZE];
+	struct resource *r;
+	bool claimed = false;
+
+	textureKey(key, path, format);
+
+	pthread_mutex_lock(&CACHE.lock);
+
+	if (! dictLookup(CACHE.byKey, key)) {
+		r = calloc(1, sizeof(*r) + strlen(key) + 1);
+		r->type = RESOURCE_TEXTURE;
+		r->owner = owner;
+		strcpy(r->key, key);
+
+		dictInsert(CACHE.byKey, key, r);
+		claimed = true;
+	}
+	pthread_mutex_unlock(&CACHE.lock);
+
+	return claimed;
+}
+
+//
+// Drop the claim of `owner` on the texture loaded from `path` with internal
+// format `format`, if it still has one.
+//
+void rUnclaimTexture(const char *path, GLint format, const void *owner)
+{
+	char key[KEY_SIZE];
+	struct resource *r;
+
+	textureKey(key, path, format);
+
+	pthread_mutex_lock(&CACHE.lock);
+
+	if ((r = dictLookup(CACHE.byKey, key)) && r->owner == owner) {
+		dictRemove(CACHE.byKey, key);
+		free(r);
+	}
+	pthread_mutex_unlock(&CACHE.lock);
+}
+
+void rReleaseTexture(struct texture *t)
+{
+	struct resource *r;
+
+	if (! (r = release(RESOURCE_TEXTURE, t, 0)))
+		return;
+
+	rReleaseSampler(t->sampler);
+	glDeleteTextures(1, &t->handle);
+	rInvalidateState();
+	free(t);
+	free(r);
+}
+
+//
+// Get a sampler with the given filters, creating it if there isn't one yet.
+//
+GLuint rAcquireSampler(GLuint minFilter, GLuint magFilter)
+{
+	char key[KEY_SIZE];
+	struct resource *r;
+	GLuint sampler;
+
+	snprintf(key, sizeof(key), "sampler:%u:%u", minFilter, magFilter);
+
+	if ((r = acquire(key)))
+		return r->handle;
+
+	sampler = rNewSampler(minFilter, magFilter);
+	insert(key, RESOURCE_SAMPLER, NULL, sampler);
+
+	return sampler;
+}
+
+void rReleaseSampler(GLuint sampler)
+{
+	struct resource *r;
+
+	if (! (r = release(RESOURCE_SAMPLER, NULL, sampler)))
+		return;
+
+	glDeleteSamplers(1, &sampler);
+	rInvalidateState();
+	free(r);
+}
+
+//
+// Get the material `name` in `dir` for shader `s`, or NULL if it isn't
+// cached yet.
+//
+struct material *rAcquireMaterial(struct shader *s, const char *dir, const char *name)
+{
+	char key[KEY_SIZE];
+	struct resource *r;
+
+	materialKey(key, s->name, dir, name);
+
+	return (r = acquire(key)) ? r->value : NULL;
+}
+
+//
+// Check whether the material `name` in `dir` for the shader named `shader` is
+// cached, without taking a reference to it.
+//
+bool rIsMaterialCached(const char *shader, const char *dir, const char *name)
+{
+	char key[KEY_SIZE];
+	bool cached;
+
+	materialKey(key, shader, dir, name);
+
+	pthread_mutex_lock(&CACHE.lock);
+	cached = dictLookup(CACHE.byKey, key) != NULL;
+	pthread_mutex_unlock(&CACHE.lock);
+
+	return cached;
+}
+
+void rCacheMaterial(struct shader *s, const char *dir, const char *name, struct material *m)
+{
+	char key[KEY_SIZE];
+
+	materialKey(key, s->name, dir, name);
+	insert(key, RESOURCE_MATERIAL, m, 0);
+}
+
+//
+// Drop a reference to material `m`, along with its textures when it's the
+// last one. Materials which were never cached are freed outright.
+//
+void rReleaseMaterial(struct material *m)
+{
+	char vkey[KEY_SIZE];
+	struct resource *r;
+	bool cached;
+
+	valueKey(vkey, RESOURCE_MATERIAL, m, 0);
+
+	pthread_mutex_lock(&CACHE.lock);
+	cached = dictLookup(CACHE.byValue, vkey) != NULL;
+	pthread_mutex_unlock(&CACHE.lock);
+
+	r = release(RESOURCE_MATERIAL, m, 0);
+
+	if (cached && ! r)
+		return;
+
+	for (int i = 0; i < TEXTURE_TYPES; i++) {
+		if (m->textures[i])
+			rReleaseTexture(m->textures[i]);
+	}
+	free(m);
+	free(r);
+}
+
+struct resourceStats rResourceStats(void)
+{
+	struct resourceStats stats;
+
+	pthread_mutex_lock(&CACHE.lock);
+	stats = CACHE.stats;
+	pthread_mutex_unlock(&CACHE.lock);
+
+	return stats;
+}
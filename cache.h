@@ -0,0 +1,19 @@
+struct resourceStats {
+	size_t hits;     // Acquisitions served from the cache
+	size_t misses;   // Acquisitions which had to create the resource
+	size_t resident; // Resources currently in the cache
+};
+
+extern void rInitCache(void);
+extern struct texture *rAcquireTexture(const char *, GLint);
+extern void rCacheTexture(const char *, GLint, struct texture *);
+extern bool rClaimTexture(const char *, GLint, const void *);
+extern void rUnclaimTexture(const char *, GLint, const void *);
+extern void rReleaseTexture(struct texture *);
+extern GLuint rAcquireSampler(GLuint, GLuint);
+extern void rReleaseSampler(GLuint);
+extern struct material *rAcquireMaterial(struct shader *, const char *, const char *);
+extern bool rIsMaterialCached(const char *, const char *, const char *);
+extern void rCacheMaterial(struct shader *, const char *, const char *, struct material *);
+extern void rReleaseMaterial(struct material *);
+extern struct resourceStats rResourceStats(void);
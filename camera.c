@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "linmath.h"
 #include "camera.h"
@@ -12,8 +13,13 @@ struct camera *rNewCamera(vec3 pos, int width, int height, float fov, float znea
 	c->fov = fov;
 	c->znear = znear;
 	c->zfar = zfar;
+	c->resx = width;
+	c->resy = height;
 	c->proj = mat4perspective(fov * PI/180, (float)width/(float)height, znear, zfar);
 
+	// Nothing is culled until the frustum is first updated.
+	c->frustum = (struct frustum){{{0}}};
+
 	return c;
 }
 
@@ -26,3 +32,59 @@ void rCameraMove(struct camera *c, vec3 dir)
 {
 	c->pos = vec3add(c->pos, dir);
 }
+
+//
+// Number of pixels covered by one unit of length at the nearest point of the
+// sphere at `center` with radius `radius`, as seen from `c`.
+//
+float rCameraPixelScale(struct camera *c, vec3 center, float radius)
+{
+	float d = vec3len(vec3sub(center, c->pos)) - radius;
+
+	if (d < c->znear)
+		d = c->znear;
+
+	return c->resy / (2.0f * tanf(c->fov * PI/360.0f) * d);
+}
+
+//
+// Extract the frustum planes of `c` from its view-projection matrix, after
+// Gribb & Hartmann. Must be called whenever the camera moves.
+//
+void rCameraUpdateFrustum(struct camera *c)
+{
+	mat4 m = mat4mul(c->proj, c->view);
+	vec4 r0 = mat4row(m, 0), r1 = mat4row(m, 1), r2 = mat4row(m, 2), r3 = mat4row(m, 3);
+	vec4 planes[FRUSTUM_PLANES] = {
+		vec4add(r3, r0), vec4add(r3, vec4scale(r0, -1.0f)),
+		vec4add(r3, r1), vec4add(r3, vec4scale(r1, -1.0f)),
+		vec4add(r3, r2), vec4add(r3, vec4scale(r2, -1.0f))
+	};
+	for (int i = 0; i < FRUSTUM_PLANES; i++) {
+		vec4 p = planes[i];
+		float len = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+
+		c->frustum.planes[i] = vec4scale(p, 1.0f / len);
+	}
+}
+
+//
+// Corners of the slice of the frustum of `c` between view distances `near`
+// and `far`, in world space. The near corners come first.
+//
+void rCameraSliceCorners(const struct camera *c, float near, float far, vec3 corners[8])
+{
+	mat4 world = mat4invert(c->view);
+	float tx = 1.0f / c->proj.cols[0].x, ty = 1.0f / c->proj.cols[1].y;
+	float depths[2] = {near, far};
+
+	for (int i = 0; i < 8; i++) {
+		float d = depths[i / 4];
+		vec3 p = {
+			(i & 1 ? 1.0f : -1.0f) * d * tx,
+			(i & 2 ? 1.0f : -1.0f) * d * ty,
+			-d
+		};
+		corners[i] = vec3transform(p, world);
+	}
+}
@@ -1,4 +1,15 @@
 
+enum { FRUSTUM_PLANES = 6 };
+
+//
+// Planes of a view frustum, with normals pointing inwards, in the order left,
+// right, bottom, top, near and far. A point `p` is in front of a plane when
+// `dot(plane.xyz, p) + plane.w` is positive.
+//
+struct frustum {
+    vec4 planes[FRUSTUM_PLANES];
+};
+
 struct camera {
     vec3 pos;
     vec3 center;
@@ -13,8 +24,13 @@ struct camera {
 
     int resx;
     int resy;
+
+    struct frustum frustum; // In world space, as of the last `rCameraUpdateFrustum`
 };
 
 extern struct camera *rNewCamera(vec3, int, int, float, float, float);
 extern void rCameraMove(struct camera *c, vec3 dir);
 extern void rCameraLookAt(struct camera *c, vec3 dir, vec3 up);
+extern float rCameraPixelScale(struct camera *c, vec3 center, float radius);
+extern void rCameraUpdateFrustum(struct camera *c);
+extern void rCameraSliceCorners(const struct camera *c, float near, float far, vec3 corners[8]);
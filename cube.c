@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <GL/glew.h>
 
@@ -87,11 +88,3 @@ struct mesh *rNewSphere(float radius, int reso)
 	}
 	return rNewMesh("sphere", mat, nverts, verts, 0, NULL, NULL);
 }
-
-//TODO(cloudhead): Don't recreate mesh every time.
-void rDrawSphere(float radius, int reso, mat4 transform)
-{
-	struct mesh *m = rNewSphere(radius, reso);
-	rDrawMesh(m, &transform);
-	meshFree(m);
-}
@@ -1,3 +1,2 @@
 struct mesh *rNewCube();
 struct mesh *rNewSphere(float, int);
-extern void rDrawSphere(float, int, mat4);
@@ -0,0 +1,134 @@
+//
+// cull.c
+// frustum culling of bounding boxes
+//
+// A box is outside the frustum if it lies entirely behind one of its planes,
+// that is if the distance of its center to the plane is less than minus the
+// extent of the box along the plane's normal. Boxes straddling a corner of
+// the frustum can pass without being visible, which only costs a draw.
+//
+// Boxes are tested four at a time, one per SSE lane, against each plane in
+// turn, and a group stops being tested once all four are out.
+//
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "linmath.h"
+#include "camera.h"
+#include "cull.h"
+
+void boxListClear(struct boxList *l)
+{
+	l->n = 0;
+}
+
+void boxListAdd(struct boxList *l, vec3 min, vec3 max)
+{
+	if (l->n == l->cap) {
+		l->cap = l->cap ? l->cap * 2 : 64;
+
+		float **arrays[] = {&l->cx, &l->cy, &l->cz, &l->ex, &l->ey, &l->ez};
+
+		for (int k = 0; k < 6; k++) {
+			*arrays[k] = realloc(*arrays[k], l->cap * sizeof(float));
+		}
+	}
+	// Clear every new group of four, so that the lanes past the end of the
+	// list hold empty boxes rather than garbage.
+	if (l->n % 4 == 0) {
+		float *arrays[] = {l->cx, l->cy, l->cz, l->ex, l->ey, l->ez};
+
+		for (int k = 0; k < 6; k++) {
+			memset(&arrays[k][l->n], 0, 4 * sizeof(float));
+		}
+	}
+	l->cx[l->n] = (min.x + max.x) * 0.5f;
+	l->cy[l->n] = (min.y + max.y) * 0.5f;
+	l->cz[l->n] = (min.z + max.z) * 0.5f;
+	l->ex[l->n] = (max.x - min.x) * 0.5f;
+	l->ey[l->n] = (max.y - min.y) * 0.5f;
+	l->ez[l->n] = (max.z - min.z) * 0.5f;
+	l->n++;
+}
+
+void boxListFree(struct boxList *l)
+{
+	free(l->cx);
+	free(l->cy);
+	free(l->cz);
+	free(l->ex);
+	free(l->ey);
+	free(l->ez);
+	memset(l, 0, sizeof(*l));
+}
+
+//
+// Test a single box, from `min` to `max`, against `f`. Returns false if it's
+// entirely outside.
+//
+bool frustumTestBox(const struct frustum *f, vec3 min, vec3 max)
+{
+	vec3 c = vec3scale(vec3add(min, max), 0.5f);
+	vec3 e = vec3scale(vec3sub(max, min), 0.5f);
+
+	for (int p = 0; p < FRUSTUM_PLANES; p++) {
+		vec4 pl = f->planes[p];
+		float d = pl.x * c.x + pl.y * c.y + pl.z * c.z + pl.w;
+		float r = fabsf(pl.x) * e.x + fabsf(pl.y) * e.y + fabsf(pl.z) * e.z;
+
+		if (d + r < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+//
+// Test every box of `l` against `f`, and store whether each one may be
+// visible in `visible`. Returns the number of boxes which may be visible.
+//
+size_t frustumCullBoxes(const struct frustum *f, const struct boxList *l, bool *visible)
+{
+	__m128 px[FRUSTUM_PLANES], py[FRUSTUM_PLANES], pz[FRUSTUM_PLANES], pw[FRUSTUM_PLANES];
+	__m128 ax[FRUSTUM_PLANES], ay[FRUSTUM_PLANES], az[FRUSTUM_PLANES];
+	__m128 zero = _mm_setzero_ps();
+	size_t nvisible = 0;
+
+	for (int p = 0; p < FRUSTUM_PLANES; p++) {
+		vec4 pl = f->planes[p];
+
+		px[p] = _mm_set1_ps(pl.x);
+		py[p] = _mm_set1_ps(pl.y);
+		pz[p] = _mm_set1_ps(pl.z);
+		pw[p] = _mm_set1_ps(pl.w);
+		ax[p] = _mm_set1_ps(fabsf(pl.x));
+		ay[p] = _mm_set1_ps(fabsf(pl.y));
+		az[p] = _mm_set1_ps(fabsf(pl.z));
+	}
+	for (size_t i = 0; i < l->n; i += 4) {
+		__m128 cx = _mm_loadu_ps(&l->cx[i]), ex = _mm_loadu_ps(&l->ex[i]);
+		__m128 cy = _mm_loadu_ps(&l->cy[i]), ey = _mm_loadu_ps(&l->ey[i]);
+		__m128 cz = _mm_loadu_ps(&l->cz[i]), ez = _mm_loadu_ps(&l->ez[i]);
+		__m128i inside = _mm_set1_epi32(-1);
+
+		for (int p = 0; p < FRUSTUM_PLANES; p++) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, px[p]), _mm_mul_ps(cy, py[p])),
+			                      _mm_add_ps(_mm_mul_ps(cz, pz[p]), pw[p]));
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ax[p]), _mm_mul_ps(ey, ay[p])),
+			                      _mm_mul_ps(ez, az[p]));
+
+			inside = _mm_and_si128(inside, _mm_castps_si128(_mm_cmpge_ps(_mm_add_ps(d, r), zero)));
+
+			if (_mm_testz_si128(inside, inside))
+				break;
+		}
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+
+		for (size_t j = i; j < i + 4 && j < l->n; j++) {
+			visible[j] = mask >> (j - i) & 1;
+			nvisible += visible[j];
+		}
+	}
+	return nvisible;
+}
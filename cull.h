@@ -0,0 +1,29 @@
+//
+// cull.h
+// frustum culling of bounding boxes
+//
+// dependencies:
+//
+//   stdbool.h
+//   stddef.h
+//   linmath.h
+//
+struct frustum;
+
+//
+// Bounding boxes in structure of arrays layout, as centers and half extents,
+// so that they can be tested four at a time. The arrays are padded to a
+// multiple of four.
+//
+struct boxList {
+	float  *cx, *cy, *cz;
+	float  *ex, *ey, *ez;
+	size_t n;
+	size_t cap;
+};
+
+extern void boxListClear(struct boxList *);
+extern void boxListAdd(struct boxList *, vec3, vec3);
+extern void boxListFree(struct boxList *);
+extern bool frustumTestBox(const struct frustum *, vec3, vec3);
+extern size_t frustumCullBoxes(const struct frustum *, const struct boxList *, bool *);
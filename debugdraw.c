@@ -0,0 +1,312 @@
+//
+// debugdraw.c
+// batched debug drawing
+//
+// Lines, boxes, spheres and axes are accumulated over the frame as instances
+// of a few unit primitives, which live in one shared vertex and index
+// buffer. Each instance is a transform, mapping the primitive onto the
+// shape, and a color. Every instance of the frame is written into the
+// stream buffer at once, and drawn with one instanced draw per primitive.
+//
+// Debug drawing is off by default. While it's off, shapes are dropped as
+// they're added, and nothing is uploaded or drawn.
+//
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "shader.h"
+#include "common.h"
+#include "renderer.h"
+#include "state.h"
+#include "stream.h"
+#include "debugdraw.h"
+
+enum debugPrimitive {
+	DEBUG_LINE,   // From the origin to +x
+	DEBUG_BOX,    // Edges of the unit cube, from the origin to (1, 1, 1)
+	DEBUG_SPHERE, // Three unit circles, around each axis
+	DEBUG_PRIMITIVES
+};
+
+enum {
+	DEBUG_SPHERE_SEGMENTS = 32, // Per circle
+	DEBUG_VERTICES        = 2 + 8 + 3 * DEBUG_SPHERE_SEGMENTS,
+	DEBUG_INDICES         = 2 + 24 + 3 * 2 * DEBUG_SPHERE_SEGMENTS
+};
+
+struct debugInstance {
+	mat4 transform;
+	vec4 color;
+};
+
+struct debugBatch {
+	struct debugInstance *instances;
+	size_t               n;
+	size_t               cap;
+	GLint                baseVertex;  // Of the primitive in the shared buffers
+	size_t               indexOffset; // Byte offset of its first index
+	GLsizei              nindices;
+};
+
+static struct {
+	bool              enabled;
+	struct shader     *shader;
+	GLuint            vao;
+	GLuint            vbo; // Unit primitives
+	GLuint            ebo;
+	struct debugBatch batches[DEBUG_PRIMITIVES];
+} DEBUG_DRAW;
+
+//
+// Build the unit primitives into `vertices` and `indices`, and record where
+// each one starts.
+//
+static void buildPrimitives(vec3 *vertices, GLushort *indices)
+{
+	static const GLushort BOX_EDGES[24] = {
+		0, 1, 1, 3, 3, 2, 2, 0, // z = 0
+		4, 5, 5, 7, 7, 6, 6, 4, // z = 1
+		0, 4, 1, 5, 2, 6, 3, 7
+	};
+	size_t nv = 0, ni = 0;
+
+	DEBUG_DRAW.batches[DEBUG_LINE] = (struct debugBatch){.baseVertex = nv, .indexOffset = ni * sizeof(GLushort), .nindices = 2};
+	vertices[nv++] = (vec3){0, 0, 0};
+	vertices[nv++] = (vec3){1, 0, 0};
+	indices[ni++] = 0;
+	indices[ni++] = 1;
+
+	DEBUG_DRAW.batches[DEBUG_BOX] = (struct debugBatch){.baseVertex = nv, .indexOffset = ni * sizeof(GLushort), .nindices = 24};
+
+	for (int i = 0; i < 8; i++) {
+		vertices[nv++] = (vec3){i & 1, (i >> 1) & 1, (i >> 2) & 1};
+	}
+	memcpy(&indices[ni], BOX_EDGES, sizeof(BOX_EDGES));
+	ni += 24;
+
+	DEBUG_DRAW.batches[DEBUG_SPHERE] = (struct debugBatch){.baseVertex = nv, .indexOffset = ni * sizeof(GLushort), .nindices = 3 * 2 * DEBUG_SPHERE_SEGMENTS};
+
+	for (int axis = 0; axis < 3; axis++) {
+		GLushort first = axis * DEBUG_SPHERE_SEGMENTS;
+
+		for (int i = 0; i < DEBUG_SPHERE_SEGMENTS; i++) {
+			float a = i * 2.0f * PI / DEBUG_SPHERE_SEGMENTS;
+			float c = cosf(a), s = sinf(a);
+
+			vertices[nv++] = axis == 0 ? (vec3){0, c, s} : axis == 1 ? (vec3){s, 0, c} : (vec3){c, s, 0};
+			indices[ni++] = first + i;
+			indices[ni++] = first + (i + 1) % DEBUG_SPHERE_SEGMENTS;
+		}
+	}
+}
+
+//
+// Create the unit primitives and the instance buffer. Shaders must be loaded.
+//
+void rInitDebugDraw(void)
+{
+	vec3 vertices[DEBUG_VERTICES];
+	GLushort indices[DEBUG_INDICES];
+
+	memset(&DEBUG_DRAW, 0, sizeof(DEBUG_DRAW));
+	buildPrimitives(vertices, indices);
+
+	DEBUG_DRAW.shader = rGetShader("debug");
+
+	glGenVertexArrays(1, &DEBUG_DRAW.vao);
+	rBindVertexArray(DEBUG_DRAW.vao);
+
+	glGenBuffers(1, &DEBUG_DRAW.vbo);
+	rBindBuffer(GL_ARRAY_BUFFER, DEBUG_DRAW.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(ATTRIB_POSITION);
+	glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), 0);
+
+	glGenBuffers(1, &DEBUG_DRAW.ebo);
+	rBindBuffer(GL_ELEMENT_ARRAY_BUFFER, DEBUG_DRAW.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+	// The instance attributes are pointed at each batch when it's drawn.
+	for (int c = 0; c < 4; c++) {
+		glEnableVertexAttribArray(ATTRIB_INSTANCE + c);
+		glVertexAttribDivisor(ATTRIB_INSTANCE + c, 1);
+	}
+	glEnableVertexAttribArray(ATTRIB_COLOR);
+	glVertexAttribDivisor(ATTRIB_COLOR, 1);
+
+	rBindVertexArray(0);
+}
+
+void rQuitDebugDraw(void)
+{
+	glDeleteVertexArrays(1, &DEBUG_DRAW.vao);
+	glDeleteBuffers(1, &DEBUG_DRAW.vbo);
+	glDeleteBuffers(1, &DEBUG_DRAW.ebo);
+	rInvalidateState();
+
+	for (int i = 0; i < DEBUG_PRIMITIVES; i++) {
+		free(DEBUG_DRAW.batches[i].instances);
+	}
+}
+
+static void clearBatches(void)
+{
+	for (int i = 0; i < DEBUG_PRIMITIVES; i++) {
+		DEBUG_DRAW.batches[i].n = 0;
+	}
+}
+
+//
+// Turn debug drawing on or off. Shapes added while it's off are dropped.
+//
+void rSetDebugDraw(bool enabled)
+{
+	DEBUG_DRAW.enabled = enabled;
+	clearBatches();
+}
+
+//
+// Whether debug drawing is on. Callers which do work to produce shapes should
+// skip it when it isn't.
+//
+bool rDebugDrawEnabled(void)
+{
+	return DEBUG_DRAW.enabled;
+}
+
+static void addInstance(enum debugPrimitive p, vec3 x, vec3 y, vec3 z, vec3 origin, vec4 color)
+{
+	struct debugBatch *b = &DEBUG_DRAW.batches[p];
+
+	if (b->n == b->cap) {
+		b->cap = b->cap ? b->cap * 2 : 64;
+		b->instances = realloc(b->instances, b->cap * sizeof(*b->instances));
+	}
+	struct debugInstance *inst = &b->instances[b->n++];
+
+	// The primitive's axes map onto `x`, `y` and `z`, and its origin onto
+	// `origin`.
+	inst->transform.cols[0] = vec4new(x.x, x.y, x.z, 0.0f);
+	inst->transform.cols[1] = vec4new(y.x, y.y, y.z, 0.0f);
+	inst->transform.cols[2] = vec4new(z.x, z.y, z.z, 0.0f);
+	inst->transform.cols[3] = vec4new(origin.x, origin.y, origin.z, 1.0f);
+	inst->color = color;
+}
+
+//
+// Draw a line from `a` to `b`.
+//
+void rDebugLine(vec3 a, vec3 b, vec4 color)
+{
+	if (! DEBUG_DRAW.enabled)
+		return;
+
+	addInstance(DEBUG_LINE, vec3sub(b, a), (vec3){0, 0, 0}, (vec3){0, 0, 0}, a, color);
+}
+
+//
+// Draw the edges of the axis-aligned box from `min` to `max`.
+//
+void rDebugBox(vec3 min, vec3 max, vec4 color)
+{
+	if (! DEBUG_DRAW.enabled)
+		return;
+
+	addInstance(DEBUG_BOX, (vec3){max.x - min.x, 0, 0}, (vec3){0, max.y - min.y, 0}, (vec3){0, 0, max.z - min.z}, min, color);
+}
+
+//
+// Draw a sphere of `radius` around `center`, as a circle around each axis.
+//
+void rDebugSphere(vec3 center, float radius, vec4 color)
+{
+	if (! DEBUG_DRAW.enabled)
+		return;
+
+	addInstance(DEBUG_SPHERE, (vec3){radius, 0, 0}, (vec3){0, radius, 0}, (vec3){0, 0, radius}, center, color);
+}
+
+//
+// Draw the axes of `transform`, of length `size`, in red, green and blue.
+//
+void rDebugAxes(mat4 transform, float size)
+{
+	if (! DEBUG_DRAW.enabled)
+		return;
+
+	vec3 origin = vec3transform((vec3){0, 0, 0}, transform);
+
+	rDebugLine(origin, vec3transform((vec3){size, 0, 0}, transform), vec4new(1, 0, 0, 1));
+	rDebugLine(origin, vec3transform((vec3){0, size, 0}, transform), vec4new(0, 1, 0, 1));
+	rDebugLine(origin, vec3transform((vec3){0, 0, size}, transform), vec4new(0, 0, 1, 1));
+}
+
+//
+// Draw every shape added since the last flush over the scene, blended and
+// without depth testing, then clear them.
+//
+void rFlushDebugDraw(void)
+{
+	size_t total = 0, offset;
+
+	if (! DEBUG_DRAW.enabled)
+		return;
+
+	for (int i = 0; i < DEBUG_PRIMITIVES; i++) {
+		total += DEBUG_DRAW.batches[i].n;
+	}
+	if (total == 0)
+		return;
+
+	struct debugInstance *instances = rMapStream(total * sizeof(struct debugInstance), &offset);
+
+	// Shapes which don't fit in the stream buffer are dropped.
+	if (! instances) {
+		clearBatches();
+		return;
+	}
+	for (int i = 0, n = 0; i < DEBUG_PRIMITIVES; i++) {
+		memcpy(&instances[n], DEBUG_DRAW.batches[i].instances, DEBUG_DRAW.batches[i].n * sizeof(struct debugInstance));
+		n += DEBUG_DRAW.batches[i].n;
+	}
+	rUnmapStream();
+
+	rBindVertexArray(DEBUG_DRAW.vao);
+	rBindBuffer(GL_ARRAY_BUFFER, rStreamBuffer());
+
+	rSetCap(STATE_DEPTH_TEST, false);
+	rSetCap(STATE_BLEND, true);
+	rBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	rUseShader(DEBUG_DRAW.shader);
+	RENDER_STATS.programSwitches++;
+	RENDER_STATS.vaoSwitches++;
+
+	for (int i = 0; i < DEBUG_PRIMITIVES; i++) {
+		struct debugBatch *b = &DEBUG_DRAW.batches[i];
+		size_t size = b->n * sizeof(struct debugInstance);
+
+		if (b->n == 0)
+			continue;
+
+		for (int c = 0; c < 4; c++) {
+			GL(glVertexAttribPointer(ATTRIB_INSTANCE + c, 4, GL_FLOAT, GL_FALSE, sizeof(struct debugInstance),
+			                         (void *)(offset + offsetof(struct debugInstance, transform) + c * sizeof(vec4))));
+		}
+		GL(glVertexAttribPointer(ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(struct debugInstance),
+		                         (void *)(offset + offsetof(struct debugInstance, color))));
+
+		GL(glDrawElementsInstancedBaseVertex(GL_LINES, b->nindices, GL_UNSIGNED_SHORT, (void *)b->indexOffset, b->n, b->baseVertex));
+		RENDER_STATS.drawCalls++;
+
+		offset += size;
+		b->n = 0;
+	}
+	rSetCap(STATE_BLEND, false);
+	rSetCap(STATE_DEPTH_TEST, true);
+}
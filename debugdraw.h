@@ -0,0 +1,18 @@
+//
+// debugdraw.h
+// batched debug drawing
+//
+// dependencies:
+//
+//   stdbool.h
+//   linmath.h
+//
+extern void rInitDebugDraw(void);
+extern void rQuitDebugDraw(void);
+extern void rSetDebugDraw(bool);
+extern bool rDebugDrawEnabled(void);
+extern void rDebugLine(vec3, vec3, vec4);
+extern void rDebugBox(vec3, vec3, vec4);
+extern void rDebugSphere(vec3, float, vec4);
+extern void rDebugAxes(mat4, float);
+extern void rFlushDebugDraw(void);
@@ -0,0 +1,103 @@
+//
+// deferred.c
+// deferred shading
+//
+// Meshes whose shader has a deferred variant are drawn into the G-buffer
+// first, which stores their albedo, specular intensity and normal. Positions
+// aren't stored, but reconstructed from depth. The G-buffer is then resolved
+// into the default framebuffer with a single full screen triangle, which
+// shades every pixel once with the lights of its cluster, so the cost of
+// lighting depends on the number of pixels and lights, not meshes.
+//
+// The G-buffer depth is written along with the lit color, so that forward
+// draws which follow are depth tested against the scene.
+//
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "shader.h"
+#include "gbuffer.h"
+#include "renderer.h"
+#include "state.h"
+#include "deferred.h"
+
+static const char *GBUFFER_SAMPLERS[] = {
+	[GBUFFER_TEXTURE_TYPE_ALBEDO] = "albedoSampler",
+	[GBUFFER_TEXTURE_TYPE_NORMAL] = "normalSampler"
+};
+
+static struct {
+	struct gbuffer *gbuffer;
+	struct shader  *shader;
+	GLuint         vao; // Empty, the vertices are generated by the shader
+} DEFERRED;
+
+//
+// Create the G-buffer, of the size of the default framebuffer. Shaders must
+// be loaded.
+//
+bool rInitDeferred(int width, int height)
+{
+	if (! (DEFERRED.shader = rGetShader("deferred")))
+		return false;
+
+	if (! (DEFERRED.gbuffer = rNewGbuffer(width, height)))
+		return false;
+
+	glGenVertexArrays(1, &DEFERRED.vao);
+
+	return true;
+}
+
+void rQuitDeferred(void)
+{
+	if (DEFERRED.gbuffer)
+		rFreeGbuffer(DEFERRED.gbuffer);
+
+	glDeleteVertexArrays(1, &DEFERRED.vao);
+	rInvalidateState();
+
+	DEFERRED.gbuffer = NULL;
+}
+
+//
+// Direct draws to the G-buffer, and clear it.
+//
+void rBeginGeometryPass(void)
+{
+	rGbufferWBind(DEFERRED.gbuffer);
+	GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT));
+}
+
+//
+// Shade the G-buffer into the default framebuffer. The depth test stays
+// enabled, since depth is only written while it is.
+//
+void rResolveDeferred(void)
+{
+	struct gbuffer *g = DEFERRED.gbuffer;
+	struct shader *s = DEFERRED.shader;
+
+	rBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	rSetCap(STATE_DEPTH_TEST, true);
+	rSetCap(STATE_BLEND, false);
+
+	rUseShader(s);
+	RENDER_STATS.programSwitches++;
+
+	for (int i = 0; i < GBUFFER_NTEXTURES; i++) {
+		GL(glUniform1i(rUniformLocation(s, GBUFFER_SAMPLERS[i]), i));
+		rBindTexture(i, GL_TEXTURE_2D, g->textures[i]);
+		rBindSampler(i, 0);
+	}
+	GL(glUniform1i(rUniformLocation(s, "depthSampler"), GBUFFER_NTEXTURES));
+	rBindTexture(GBUFFER_NTEXTURES, GL_TEXTURE_2D, g->depth);
+	rBindSampler(GBUFFER_NTEXTURES, 0);
+
+	rBindVertexArray(DEFERRED.vao);
+	GL(glDrawArrays(GL_TRIANGLES, 0, 3));
+	RENDER_STATS.drawCalls++;
+}
@@ -0,0 +1,12 @@
+//
+// deferred.h
+// deferred shading
+//
+// dependencies:
+//
+//   stdbool.h
+//
+extern bool rInitDeferred(int, int);
+extern void rQuitDeferred(void);
+extern void rBeginGeometryPass(void);
+extern void rResolveDeferred(void);
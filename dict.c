@@ -5,7 +5,6 @@
 // (c) 2014, Alexis Sellier
 //
 // TODO(cloudhead): Use dynamic array for bucket list
-// TODO(cloudhead): Implement `dictRemove`
 // TODO(cloudhead): Implement incremental resizing
 // TODO(cloudhead): Figure out `dictInsert` semantics when key already exists
 //
@@ -92,6 +91,34 @@ void dictInsert(struct dict *d, const char *k, void *v)
     }
 }
 
+//
+// Remove key `k` from dict `d`, and return its value, or NULL if
+// there is no such key.
+//
+void *dictRemove(struct dict *d, const char *k)
+{
+    uint32_t h = 0;
+    int index = bucketIndex(d, k, &h);
+    struct bucket **list = &d->data[index];
+
+    while (*list && (*list)->head) {
+        struct bucket *b = *list;
+        struct entry *e = b->head;
+
+        if (e->hash == h && strcmp(e->name, k) == 0) {
+            void *v = e->value;
+
+            *list = b->tail;
+            free(e);
+            free(b);
+
+            return v;
+        }
+        list = &b->tail;
+    }
+    return NULL;
+}
+
 //
 // Get the index of the bucket which contains key `k` and set `h` to `k`'s hash.
 //
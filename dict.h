@@ -24,4 +24,5 @@ struct dict *dict(uint32_t (*hash)(const char *k, size_t len));
 void         dictFree(struct dict *d);
 void        *dictLookup(struct dict *d, const char *k);
 void         dictInsert(struct dict *d, const char *k, void *v);
+void        *dictRemove(struct dict *d, const char *k);
 
@@ -0,0 +1,73 @@
+//
+// frame.c
+// per-frame uniform block
+//
+// Uniforms which are the same for every draw of a frame, such as the camera
+// matrices, are stored in a single uniform buffer. It is uploaded once per
+// frame and bound to the same binding point in every program, instead of
+// setting each uniform in each program.
+//
+#include <stddef.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "renderer.h"
+#include "state.h"
+#include "frame.h"
+
+_Static_assert(offsetof(struct frameUniforms, cameraPos) == 256, "mat4 members are tightly packed");
+_Static_assert(offsetof(struct frameUniforms, lightPos) == 272, "vec3 members are 16 byte aligned");
+_Static_assert(offsetof(struct frameUniforms, clusterScale) == 304, "vec4 members are 16 byte aligned");
+_Static_assert(offsetof(struct frameUniforms, shadowSplits) == 592, "mat4 arrays are tightly packed");
+_Static_assert(FRAME_SHADOW_CASCADES == 4, "the block declares four shadow cascades");
+_Static_assert(sizeof(struct frameUniforms) % 16 == 0, "the block size is a multiple of a vec4");
+
+const char FRAME_BLOCK_NAME[] = "Frame";
+
+//
+// Declaration of the block, inserted after the `#version` directive of every
+// shader.
+//
+const char FRAME_BLOCK_SOURCE[] =
+	"layout(std140) uniform Frame {\n"
+	"	mat4 proj;\n"
+	"	mat4 view;\n"
+	"	mat4 viewProj;\n"
+	"	mat4 invViewProj;\n"
+	"	vec3 cameraPos;\n"
+	"	vec3 lightPos;\n"
+	"	int  renderMode;\n"
+	"	bool tonemapEnabled;\n"
+	"	bool debugMode;\n"
+	"	vec4 clusterScale;\n"
+	"	ivec4 clusterSize;\n"
+	"	mat4 shadowMatrices[4];\n"
+	"	vec4 shadowSplits;\n"
+	"	int  shadowLight;\n"
+	"};\n";
+
+static GLuint FRAME_UBO;
+
+void rInitFrame(void)
+{
+	glGenBuffers(1, &FRAME_UBO);
+	rBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, FRAME_UBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(struct frameUniforms), NULL, GL_STREAM_DRAW);
+}
+
+void rQuitFrame(void)
+{
+	glDeleteBuffers(1, &FRAME_UBO);
+	rInvalidateState();
+}
+
+//
+// Upload the uniforms of the next frame. The previous contents are orphaned,
+// so that this doesn't wait on draws of the last frame still reading them.
+//
+void rUpdateFrame(const struct frameUniforms *f)
+{
+	rBindBuffer(GL_UNIFORM_BUFFER, FRAME_UBO);
+	GL(glBufferData(GL_UNIFORM_BUFFER, sizeof(*f), f, GL_STREAM_DRAW));
+}
@@ -0,0 +1,38 @@
+//
+// Uniform block binding point of the per-frame uniforms, in every program.
+//
+enum { FRAME_BLOCK_BINDING = 0 };
+
+// Shadow cascades of the key light, as declared in the block.
+enum { FRAME_SHADOW_CASCADES = 4 };
+
+//
+// Per-frame uniforms, shared by every program through the `Frame` uniform
+// block. The layout follows the std140 rules of the block in `FRAME_BLOCK_SOURCE`.
+//
+struct frameUniforms {
+	mat4  proj;
+	mat4  view;
+	mat4  viewProj;
+	mat4  invViewProj;
+	vec3  cameraPos;
+	float padding0;
+	vec3  lightPos;
+	GLint renderMode;
+	GLint tonemapEnabled;
+	GLint debugMode;
+	GLint padding1[2];
+	vec4  clusterScale; // Maps window position and log view depth to a light cluster
+	GLint clusterSize[4];
+	mat4  shadowMatrices[FRAME_SHADOW_CASCADES]; // World space to shadow map coordinates
+	vec4  shadowSplits; // View distance at which each cascade ends
+	GLint shadowLight;  // Index of the light casting shadows, or -1
+	GLint padding2[3];
+};
+
+extern const char FRAME_BLOCK_NAME[];
+extern const char FRAME_BLOCK_SOURCE[];
+
+extern void rInitFrame(void);
+extern void rQuitFrame(void);
+extern void rUpdateFrame(const struct frameUniforms *);
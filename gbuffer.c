@@ -1,14 +1,39 @@
 #include <stdlib.h>
+#include <stdbool.h>
 #include <GL/glew.h>
 #include <stdio.h>
 
 #include "gbuffer.h"
+#include "state.h"
 
 #define elemsof(a) (sizeof(a) / sizeof(a[0]))
 
 _Static_assert(sizeof(GLenum) == sizeof(int), "GLenum is the size of an integer");
 
-struct gbuffer *rNewGbuffer(unsigned int width, unsigned int height, GLint format, GLint type)
+//
+// Storage of each color target. Albedo is stored in sRGB, which keeps the
+// precision of dark colors in eight bits.
+//
+static const struct {
+	GLint  internalFormat;
+	GLenum format;
+	GLenum type;
+} GBUFFER_FORMATS[GBUFFER_NTEXTURES] = {
+	[GBUFFER_TEXTURE_TYPE_ALBEDO] = {GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE},
+	[GBUFFER_TEXTURE_TYPE_NORMAL] = {GL_RG16F,        GL_RG,   GL_FLOAT}
+};
+
+static void rNewGbufferTexture(GLuint tex, GLint internalFormat, unsigned int width, unsigned int height, GLenum format, GLenum type)
+{
+	rBindTexture(0, GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+struct gbuffer *rNewGbuffer(unsigned int width, unsigned int height)
 {
 	struct gbuffer *g = malloc(sizeof(*g));
 
@@ -16,43 +41,52 @@ struct gbuffer *rNewGbuffer(unsigned int width, unsigned int height, GLint forma
 	g->height = height;
 
 	glGenFramebuffers(1, &g->fbo);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g->fbo);
+	rBindFramebuffer(GL_DRAW_FRAMEBUFFER, g->fbo);
 
 	glGenTextures(elemsof(g->textures), g->textures);
 	glGenTextures(1, &g->depth);
 
 	// Color textures
 	for (int i = 0; i < elemsof(g->textures); i++) {
-		glBindTexture(GL_TEXTURE_2D, g->textures[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, type, NULL);
+		rNewGbufferTexture(g->textures[i], GBUFFER_FORMATS[i].internalFormat, width, height, GBUFFER_FORMATS[i].format, GBUFFER_FORMATS[i].type);
 		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, g->textures[i], 0);
 	}
 
-	// Depth texture
-	glBindTexture(GL_TEXTURE_2D, g->depth);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, g->depth, 0);
+	// Depth and stencil texture, in the same format as the default framebuffer.
+	rNewGbufferTexture(g->depth, GL_DEPTH24_STENCIL8, width, height, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, g->depth, 0);
 
-	GLenum drawbufs[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+	GLenum drawbufs[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	_Static_assert(elemsof(drawbufs) == GBUFFER_NTEXTURES, "every color target is drawn to");
 	glDrawBuffers(elemsof(drawbufs), drawbufs);
 
-	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	rBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
 	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		rFreeGbuffer(g);
 		return NULL;
 	}
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
 	return g;
 }
 
+void rFreeGbuffer(struct gbuffer *g)
+{
+	glDeleteFramebuffers(1, &g->fbo);
+	glDeleteTextures(elemsof(g->textures), g->textures);
+	glDeleteTextures(1, &g->depth);
+	rInvalidateState();
+	free(g);
+}
+
 void rGbufferRBind(struct gbuffer *g)
 {
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, g->fbo);
+	rBindFramebuffer(GL_READ_FRAMEBUFFER, g->fbo);
 }
 
 void rGbufferWBind(struct gbuffer *g)
 {
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g->fbo);
+	rBindFramebuffer(GL_DRAW_FRAMEBUFFER, g->fbo);
 }
 
 void rGbufferSetRBuffer(struct gbuffer *g, enum gbufferTextureType t)
@@ -1,9 +1,10 @@
-
+//
+// Color targets of the G-buffer. Positions aren't stored: they're
+// reconstructed from the depth buffer.
+//
 enum gbufferTextureType {
-	GBUFFER_TEXTURE_TYPE_POSITION,
-	GBUFFER_TEXTURE_TYPE_DIFFUSE,
-	GBUFFER_TEXTURE_TYPE_NORMAL,
-	GBUFFER_TEXTURE_TYPE_TEXCOORD,
+	GBUFFER_TEXTURE_TYPE_ALBEDO, // Diffuse albedo, and specular intensity in alpha
+	GBUFFER_TEXTURE_TYPE_NORMAL, // World space normal, octahedral encoded
 	GBUFFER_NTEXTURES
 };
 
@@ -14,7 +15,8 @@ struct gbuffer {
 	GLuint depth;
 };
 
-extern struct gbuffer *rNewGbuffer(unsigned int, unsigned int, GLint, GLint);
+extern struct gbuffer *rNewGbuffer(unsigned int, unsigned int);
+extern void rFreeGbuffer(struct gbuffer *);
 extern void rGbufferRBind(struct gbuffer *);
 extern void rGbufferWBind(struct gbuffer *);
 extern void rGbufferSetRBuffer(struct gbuffer *g, enum gbufferTextureType);
@@ -0,0 +1,338 @@
+//
+// geometry.c
+// shared geometry arena
+//
+// Instead of owning buffers, meshes are sub-allocated out of a few large
+// vertex and index buffers, called pages. Every page holds meshes of a single
+// vertex format, and has one vertex array which all of them share. Meshes
+// are drawn with a base vertex and index offset into their page, so that
+// drawing different meshes of the same page doesn't switch vertex arrays.
+//
+// Every page's vertex array also takes a per-instance model matrix from the
+// stream buffer, where the render queue writes the instances of every frame.
+//
+// Pages also keep a copy of the positions of their vertices in a stream of
+// their own, with a second vertex array reading only from it. Depth-only
+// passes draw with that vertex array, so they fetch 12 bytes per vertex
+// instead of the whole vertex.
+//
+// Free space is kept in a list of ranges sorted by offset, allocated from
+// first fit. Freed ranges are merged with their free neighbours, so the list
+// stays as short as possible.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "shader.h"
+#include "mesh.h"
+#include "state.h"
+#include "stream.h"
+#include "geometry.h"
+
+// Default capacity of a page, in bytes. Larger meshes get a page of their own.
+enum {
+	PAGE_VERTEX_BYTES = 16 << 20,
+	PAGE_INDEX_BYTES  = 8 << 20
+};
+
+// Index ranges are aligned to the size of the largest index type.
+enum { INDEX_ALIGNMENT = sizeof(uint32_t) };
+
+struct range {
+	size_t offset;
+	size_t size;
+};
+
+struct rangeList {
+	struct range *free; // Free ranges, sorted by offset
+	size_t       nfree;
+	size_t       cap;
+	size_t       size;  // Total size of the ranges, free or not
+	size_t       used;
+};
+
+struct geometryPage {
+	enum vertexFormat   format;
+	GLuint              vao;
+	GLuint              vbo;
+	GLuint              ebo;
+	GLuint              pbo;      // Positions, as three floats per vertex
+	GLuint              depthVao; // Reads positions from `pbo`
+	struct rangeList    vertices; // In vertices
+	struct rangeList    indices;  // In bytes
+	struct geometryPage *next;
+};
+
+static struct geometryPage *PAGES[VERTEX_FORMATS];
+
+static void rangeInit(struct rangeList *l, size_t size)
+{
+	l->cap = 16;
+	l->free = malloc(l->cap * sizeof(*l->free));
+	l->free[0] = (struct range){0, size};
+	l->nfree = size > 0;
+	l->size = size;
+	l->used = 0;
+}
+
+//
+// Allocate `size` units from the first free range they fit in. Returns false
+// if there is no such range.
+//
+static bool rangeAlloc(struct rangeList *l, size_t size, size_t *offset)
+{
+	if (size == 0) {
+		*offset = 0;
+		return true;
+	}
+	for (size_t i = 0; i < l->nfree; i++) {
+		struct range *r = &l->free[i];
+
+		if (r->size < size)
+			continue;
+
+		*offset = r->offset;
+		r->offset += size;
+		r->size -= size;
+		l->used += size;
+
+		if (r->size == 0) {
+			memmove(r, r + 1, (l->nfree - i - 1) * sizeof(*r));
+			l->nfree--;
+		}
+		return true;
+	}
+	return false;
+}
+
+//
+// Return `size` units at `offset` to the free list, merging them with the
+// free ranges right before and after.
+//
+static void rangeFree(struct rangeList *l, size_t offset, size_t size)
+{
+	size_t i = 0;
+
+	if (size == 0)
+		return;
+
+	l->used -= size;
+
+	while (i < l->nfree && l->free[i].offset < offset)
+		i++;
+
+	bool mergePrev = i > 0 && l->free[i - 1].offset + l->free[i - 1].size == offset;
+	bool mergeNext = i < l->nfree && offset + size == l->free[i].offset;
+
+	if (mergePrev && mergeNext) {
+		l->free[i - 1].size += size + l->free[i].size;
+		memmove(&l->free[i], &l->free[i + 1], (l->nfree - i - 1) * sizeof(*l->free));
+		l->nfree--;
+	} else if (mergePrev) {
+		l->free[i - 1].size += size;
+	} else if (mergeNext) {
+		l->free[i].offset = offset;
+		l->free[i].size += size;
+	} else {
+		if (l->nfree == l->cap) {
+			l->cap *= 2;
+			l->free = realloc(l->free, l->cap * sizeof(*l->free));
+		}
+		memmove(&l->free[i + 1], &l->free[i], (l->nfree - i) * sizeof(*l->free));
+		l->free[i] = (struct range){offset, size};
+		l->nfree++;
+	}
+}
+
+static size_t rangeLargest(const struct rangeList *l)
+{
+	size_t largest = 0;
+
+	for (size_t i = 0; i < l->nfree; i++) {
+		if (l->free[i].size > largest)
+			largest = l->free[i].size;
+	}
+	return largest;
+}
+
+static size_t indexBytes(const struct mesh *m)
+{
+	size_t n = m->nfaces * 3 * indexTypeSize(m->indexType);
+
+	return (n + INDEX_ALIGNMENT - 1) / INDEX_ALIGNMENT * INDEX_ALIGNMENT;
+}
+
+//
+// Create a page of format `format`, holding at least `nvertices` vertices
+// and `nbytes` bytes of indices.
+//
+static struct geometryPage *rNewPage(enum vertexFormat format, size_t nvertices, size_t nbytes)
+{
+	struct geometryPage *p = malloc(sizeof(*p));
+	size_t stride = vertexFormatSize(format);
+
+	if (nvertices < PAGE_VERTEX_BYTES / stride)
+		nvertices = PAGE_VERTEX_BYTES / stride;
+	if (nbytes < PAGE_INDEX_BYTES)
+		nbytes = PAGE_INDEX_BYTES;
+
+	p->format = format;
+	rangeInit(&p->vertices, nvertices);
+	rangeInit(&p->indices, nbytes);
+
+	glGenVertexArrays(1, &p->vao);
+	rBindVertexArray(p->vao);
+
+	glGenBuffers(1, &p->vbo);
+	rBindBuffer(GL_ARRAY_BUFFER, p->vbo);
+	glBufferData(GL_ARRAY_BUFFER, nvertices * stride, NULL, GL_STATIC_DRAW);
+
+	rSetVertexAttribs(format);
+
+	rBindBuffer(GL_ARRAY_BUFFER, rStreamBuffer());
+	rEnableInstanceAttribs();
+
+	glGenBuffers(1, &p->ebo);
+	rBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p->ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, nbytes, NULL, GL_STATIC_DRAW);
+
+	rBindVertexArray(0);
+
+	glGenVertexArrays(1, &p->depthVao);
+	rBindVertexArray(p->depthVao);
+
+	glGenBuffers(1, &p->pbo);
+	rBindBuffer(GL_ARRAY_BUFFER, p->pbo);
+	glBufferData(GL_ARRAY_BUFFER, nvertices * sizeof(vec3), NULL, GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(ATTRIB_POSITION);
+	glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), 0);
+
+	rBindBuffer(GL_ARRAY_BUFFER, rStreamBuffer());
+	rEnableInstanceAttribs();
+	rBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p->ebo);
+
+	rBindVertexArray(0);
+
+	p->next = PAGES[format];
+	PAGES[format] = p;
+
+	return p;
+}
+
+static bool rPageAlloc(struct geometryPage *p, size_t nvertices, size_t nbytes, size_t *vertex, size_t *index)
+{
+	if (! rangeAlloc(&p->vertices, nvertices, vertex))
+		return false;
+
+	if (! rangeAlloc(&p->indices, nbytes, index)) {
+		rangeFree(&p->vertices, *vertex, nvertices);
+		return false;
+	}
+	return true;
+}
+
+//
+// Allocate room for the vertices and indices of `m`, and point its vertex
+// array and buffers at the page they were allocated from. Their contents are
+// left undefined. The sizes allocated are kept on `m`, since its face count
+// may be lowered afterwards, to that of its first level of detail.
+//
+void rAllocMeshGeometry(struct mesh *m)
+{
+	size_t nbytes = indexBytes(m);
+	size_t vertex, index;
+	struct geometryPage *p;
+
+	for (p = PAGES[m->format]; p; p = p->next) {
+		if (rPageAlloc(p, m->nvertices, nbytes, &vertex, &index))
+			break;
+	}
+	if (! p) {
+		p = rNewPage(m->format, m->nvertices, nbytes);
+		rPageAlloc(p, m->nvertices, nbytes, &vertex, &index);
+	}
+	m->page = p;
+	m->vao = p->vao;
+	m->vbo = p->vbo;
+	m->ebo = nbytes > 0 ? p->ebo : 0;
+	m->pbo = p->pbo;
+	m->depthVao = p->depthVao;
+	m->baseVertex = vertex;
+	m->indexOffset = index;
+	m->pageVertices = m->nvertices;
+	m->pageIndexBytes = nbytes;
+}
+
+void rFreeMeshGeometry(struct mesh *m)
+{
+	struct geometryPage *p = m->page;
+
+	if (! p)
+		return;
+
+	rangeFree(&p->vertices, m->baseVertex, m->pageVertices);
+	rangeFree(&p->indices, m->indexOffset, m->pageIndexBytes);
+
+	m->page = NULL;
+}
+
+//
+// Delete every page. Meshes allocated from them must already be freed.
+//
+void rQuitGeometry(void)
+{
+	for (int f = 0; f < VERTEX_FORMATS; f++) {
+		struct geometryPage *p = PAGES[f];
+
+		while (p) {
+			struct geometryPage *next = p->next;
+
+			glDeleteVertexArrays(1, &p->vao);
+			glDeleteVertexArrays(1, &p->depthVao);
+			glDeleteBuffers(1, &p->vbo);
+			glDeleteBuffers(1, &p->pbo);
+			glDeleteBuffers(1, &p->ebo);
+			free(p->vertices.free);
+			free(p->indices.free);
+			free(p);
+
+			p = next;
+		}
+		PAGES[f] = NULL;
+	}
+	rInvalidateState();
+}
+
+struct geometryStats rGeometryStats(void)
+{
+	struct geometryStats s = {0};
+	size_t unused = 0, fragmented = 0;
+
+	for (int f = 0; f < VERTEX_FORMATS; f++) {
+		size_t stride = vertexFormatSize(f) + sizeof(vec3); // Along with the position stream
+
+		for (struct geometryPage *p = PAGES[f]; p; p = p->next) {
+			s.pages++;
+			s.vertexBytes += p->vertices.size * stride;
+			s.vertexBytesUsed += p->vertices.used * stride;
+			s.indexBytes += p->indices.size;
+			s.indexBytesUsed += p->indices.used;
+			s.freeRanges += p->vertices.nfree + p->indices.nfree;
+
+			unused += (p->vertices.size - p->vertices.used) * stride + p->indices.size - p->indices.used;
+			fragmented += (p->vertices.size - p->vertices.used - rangeLargest(&p->vertices)) * stride;
+			fragmented += p->indices.size - p->indices.used - rangeLargest(&p->indices);
+		}
+	}
+	s.fragmentation = unused > 0 ? (float)fragmented / unused : 0.0f;
+
+	return s;
+}
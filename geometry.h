@@ -0,0 +1,16 @@
+struct mesh;
+
+struct geometryStats {
+	size_t pages;
+	size_t vertexBytes;     // Capacity of every vertex buffer
+	size_t vertexBytesUsed;
+	size_t indexBytes;      // Capacity of every index buffer
+	size_t indexBytesUsed;
+	size_t freeRanges;
+	float  fragmentation;   // Share of free space outside of the largest free range of each buffer
+};
+
+extern void rAllocMeshGeometry(struct mesh *);
+extern void rFreeMeshGeometry(struct mesh *);
+extern void rQuitGeometry(void);
+extern struct geometryStats rGeometryStats(void);
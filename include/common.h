@@ -6,3 +6,213 @@ struct vertex {
 	int   bones[4];
 	float weights[4];
 };
+
+enum vertexFormat {
+	VERTEX_FORMAT_FULL,           // `struct vertex`
+	VERTEX_FORMAT_PACKED,         // `struct packedVertex`, without bone data
+	VERTEX_FORMAT_PACKED_SKINNED, // `struct packedVertex`
+	VERTEX_FORMATS
+};
+
+//
+// Compressed vertex layout. Static meshes omit the trailing bone data.
+//
+struct packedVertex {
+	uint16_t pos[4];     // Half-float position, with w = 1
+	uint32_t normal;     // Signed, normalized 2_10_10_10
+	uint32_t tangent;    // Signed, normalized 2_10_10_10, bitangent sign in w
+	uint16_t uv[2];      // Half-float texture coordinates
+	uint8_t  bones[4];   // Bone indices
+	uint8_t  weights[4]; // Unsigned, normalized bone weights
+};
+
+_Static_assert(sizeof(struct packedVertex) == 28, "packedVertex is tightly packed");
+
+//
+// Mesh file, version 2.
+//
+// A fixed header is followed by a table of `nmeshes` entries. Each entry
+// records the counts, bounds and absolute file offsets of the mesh's bone,
+// vertex and index blobs. Blobs start on a 16-byte boundary, so they can be
+// referenced directly from a mapping of the file. Occluders, if any, come
+// after every mesh, in a table of their own, so that files written without
+// them are unchanged.
+//
+enum {
+	MDL_VERSION   = 2,
+	MDL_ALIGNMENT = 16
+};
+
+static const char MDL_MAGIC[4] = {'L', 'M', 'S', 'H'};
+
+struct mdlHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t nmeshes;
+	uint32_t flags;
+	uint64_t size;      // Total file size
+	uint64_t occluders; // Offset of the `struct mdlOccluder` table, with one entry per mesh, or zero
+};
+
+struct mdlMeshEntry {
+	char     name[64];
+	char     shader[32];
+	uint32_t material;
+	uint32_t nbones;
+	uint32_t nvertices;
+	uint32_t nfaces;
+	uint32_t format;    // Layout of the vertex array, an `enum vertexFormat`
+	uint32_t stride;    // Size of a vertex, in bytes
+	uint32_t indexSize; // Size of an index, either 2 or 4 bytes
+	uint32_t nclusters;
+	uint32_t nlods;
+	uint32_t nindices;  // Number of indices, across all levels of detail
+	uint64_t bones;     // Offset of the `struct mdlBone` array
+	uint64_t vertices;  // Offset of the vertex array
+	uint64_t indices;   // Offset of the index array
+	uint64_t clusters;  // Offset of the `struct mdlCluster` array
+	uint64_t lods;      // Offset of the `struct mdlLod` array
+	uint64_t size;      // Size of all of the mesh's blobs, including padding
+	float    min[3];    // Bounding box, in model space
+	float    max[3];
+};
+
+struct mdlBone {
+	char     name[64];
+	float    offset[16];
+	float    transform[16];
+	int32_t  parentId;
+	uint32_t padding[3];
+};
+
+//
+// A cluster is a contiguous range of a mesh's index buffer, with bounds that
+// allow it to be culled on its own. The cluster faces away from a viewer at
+// `eye` if `dot(center - eye, axis) >= cutoff * length(center - eye) + radius`.
+//
+struct mdlCluster {
+	float    center[3]; // Bounding sphere
+	float    radius;
+	float    axis[3];   // Normal cone
+	float    cutoff;
+	uint32_t first;     // First index
+	uint32_t count;     // Number of indices
+	uint32_t padding[2];
+};
+
+//
+// A level of detail is a range of a mesh's index buffer, which references the
+// same vertices as the full-detail mesh. Level 0 is always the full-detail
+// mesh. `error` is the largest deviation from it, in model units.
+//
+enum { MDL_MAX_LODS = 8 };
+
+struct mdlLod {
+	uint32_t first; // First index
+	uint32_t count; // Number of indices
+	float    error;
+	uint32_t padding;
+};
+
+//
+// An occluder is a coarse hull of a mesh, which lies within the mesh's
+// bounds and is rasterized on the CPU to cull what's behind it. It has its
+// own positions, as three floats per vertex, and 32-bit indices. Meshes
+// without an occluder have no vertices.
+//
+struct mdlOccluder {
+	uint32_t nvertices;
+	uint32_t nindices;
+	uint64_t vertices; // Offset of the position array
+	uint64_t indices;  // Offset of the index array
+};
+
+//
+// Asset pack. A pack is a header, followed by a directory of `nbuckets`
+// entries, followed by the contents of every asset, each aligned to
+// PACK_ALIGNMENT bytes. The directory is an open-addressed hash table, keyed
+// by the `hash` of the asset's path truncated to 32 bits, and probed
+// linearly. `nbuckets` is a power of two, and unused entries have an empty
+// name.
+//
+enum {
+	PACK_VERSION   = 1,
+	PACK_ALIGNMENT = 16,
+	PACK_NAME_SIZE = 104
+};
+
+static const char PACK_MAGIC[4] = {'L', 'P', 'A', 'K'};
+
+struct packHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t nentries;
+	uint32_t nbuckets;
+	uint64_t size;     // Size of the whole pack, in bytes
+	uint64_t reserved;
+};
+
+struct packEntry {
+	char     name[PACK_NAME_SIZE]; // Path of the asset, NUL-terminated
+	uint32_t hash;
+	uint32_t padding;
+	uint64_t offset;
+	uint64_t size;
+};
+
+//
+// Precompressed texture, as written by tools/texconv. A header is followed by
+// a table of `nlevels` entries, one per level of the mip chain, largest
+// first. The blocks of each level start on a TEX_ALIGNMENT boundary, so they
+// can be uploaded directly from a mapping of the file.
+//
+enum {
+	TEX_VERSION    = 1,
+	TEX_ALIGNMENT  = 16,
+	TEX_MAX_LEVELS = 16
+};
+
+static const char TEX_MAGIC[4] = {'L', 'T', 'E', 'X'};
+
+enum texFormat {
+	TEX_FORMAT_BC1, // Color, in 8-byte blocks, 1-bit alpha at most
+	TEX_FORMAT_BC3, // Color and alpha, in 16-byte blocks
+	TEX_FORMAT_BC5, // Two channels, in 16-byte blocks, for normal maps
+	TEX_FORMATS
+};
+
+enum texFlags {
+	TEX_FLAG_SRGB = 1 << 0 // Color is sRGB encoded, and was filtered in linear space
+};
+
+struct texHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t format;  // An `enum texFormat`
+	uint32_t flags;   // A combination of `enum texFlags`
+	uint32_t width;   // Of level 0, in texels
+	uint32_t height;
+	uint32_t nlevels;
+	uint32_t padding;
+	uint64_t size;    // Total file size
+	uint64_t reserved;
+};
+
+struct texLevel {
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;  // Of the level's blocks
+	uint64_t size;    // Of the level's blocks, in bytes, without padding
+	uint64_t padding;
+};
+
+_Static_assert(sizeof(struct mdlHeader) == 32, "mdlHeader is tightly packed");
+_Static_assert(sizeof(struct mdlMeshEntry) == 208, "mdlMeshEntry is tightly packed");
+_Static_assert(sizeof(struct mdlBone) == 208, "mdlBone is tightly packed");
+_Static_assert(sizeof(struct mdlCluster) == 48, "mdlCluster is tightly packed");
+_Static_assert(sizeof(struct mdlLod) == 16, "mdlLod is tightly packed");
+_Static_assert(sizeof(struct mdlOccluder) == 24, "mdlOccluder is tightly packed");
+_Static_assert(sizeof(struct packHeader) == 32, "packHeader is tightly packed");
+_Static_assert(sizeof(struct packEntry) == 128, "packEntry is tightly packed");
+_Static_assert(sizeof(struct texHeader) == 48, "texHeader is tightly packed");
+_Static_assert(sizeof(struct texLevel) == 32, "texLevel is tightly packed");
@@ -345,6 +345,20 @@ static inline mat4 mat4perspective(float fov, float aspect, float n, float f)
 	return out;
 }
 
+static inline mat4 mat4ortho(float l, float r, float b, float t, float n, float f)
+{
+	mat4 out = mat4identity();
+
+	out.cols[0].x = 2.0f / (r - l);
+	out.cols[1].y = 2.0f / (t - b);
+	out.cols[2].z = -2.0f / (f - n);
+	out.cols[3].x = -(r + l) / (r - l);
+	out.cols[3].y = -(t + b) / (t - b);
+	out.cols[3].z = -(f + n) / (f - n);
+
+	return out;
+}
+
 static inline mat4 mat4lookAt(vec3 eye, vec3 center, vec3 up)
 {
 	mat4 out;
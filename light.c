@@ -1,11 +1,13 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <math.h>
 #include <GL/glew.h>
 
 #include "linmath.h"
 #include "light.h"
-#include "mesh.h"
-#include "cube.h"
+#include "common.h"
+#include "debugdraw.h"
 
 enum visibility {
 	VISIBILITY_HIDDEN,
@@ -13,7 +15,11 @@ enum visibility {
 	VISIBILITY_DEBUG
 };
 
-struct mesh *LIGHT_SOURCE = NULL;
+//
+// Intensity below which a light is considered to have no effect, which
+// bounds its range.
+//
+static const float LIGHT_CUTOFF = 1.0f / 256.0f;
 
 struct light *rNewLight()
 {
@@ -28,11 +34,15 @@ void rDrawLight(struct light *l)
 	}
 
 	if (l->visibility == VISIBILITY_DEBUG) { // Draw light source
-		if (LIGHT_SOURCE == NULL) {
-			LIGHT_SOURCE = rNewSphere(1, 10);
-		}
-		mat4 model = mat4scale(mat4identity(), 0.1f);
-		model = mat4translate(model, l->pos);
-		rDrawMesh(LIGHT_SOURCE, &model);
+		rDebugSphere(l->pos, 0.1f, vec4new(l->rgb.x, l->rgb.y, l->rgb.z, 1.0f));
 	}
 }
+
+//
+// Distance at which the intensity of `l` falls to the cutoff, given the
+// `1 / (1 + d^2)` attenuation of the lighting shaders.
+//
+float rLightRange(const struct light *l)
+{
+	return sqrtf(fmaxf(l->brightness / LIGHT_CUTOFF - 1.0f, 0.0f));
+}
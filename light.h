@@ -8,3 +8,4 @@ struct light {
 
 extern struct light *rNewLight();
 extern void rDrawLight(struct light *);
+extern float rLightRange(const struct light *);
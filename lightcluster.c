@@ -0,0 +1,331 @@
+//
+// lightcluster.c
+// clustered light culling
+//
+// The view frustum is divided into a grid of clusters: screen tiles, by
+// slices of view depth which grow exponentially with distance, so that
+// clusters stay roughly cubic. Every frame, the sphere of influence of each
+// light is tested against the view space bounds of the clusters it may
+// touch, four clusters at a time with SSE, and the lights of every cluster
+// are packed into a single list.
+//
+// The grid, the light lists and the lights themselves are uploaded to
+// texture buffers. Shaders find the cluster of a fragment from its window
+// position and view depth, and only loop over the lights of that cluster.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "camera.h"
+#include "light.h"
+#include "frame.h"
+#include "renderer.h"
+#include "state.h"
+#include "lightcluster.h"
+
+enum {
+	SLICE_CLUSTERS = LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y,
+	LIGHT_TEXELS   = 2 // Texels of `lightData` per light
+};
+
+_Static_assert(SLICE_CLUSTERS % 4 == 0, "slices are a whole number of SSE vectors");
+
+//
+// A light touching a cluster, found while binning.
+//
+struct lightHit {
+	uint32_t cluster;
+	uint32_t light;
+};
+
+enum lightBuffer {
+	BUFFER_GRID,
+	BUFFER_INDICES,
+	BUFFER_LIGHTS,
+	BUFFERS
+};
+
+static const struct {
+	GLenum format;
+	GLuint unit;
+} BUFFER_TEXTURES[BUFFERS] = {
+	[BUFFER_GRID]    = {GL_RG32UI,   LIGHT_CLUSTER_GRID_UNIT},
+	[BUFFER_INDICES] = {GL_R32UI,    LIGHT_CLUSTER_INDEX_UNIT},
+	[BUFFER_LIGHTS]  = {GL_RGBA32F,  LIGHT_CLUSTER_LIGHT_UNIT}
+};
+
+static struct {
+	// View space bounds of every cluster, for the projection in `proj`.
+	_Alignas(16) float minx[LIGHT_CLUSTER_COUNT];
+	_Alignas(16) float miny[LIGHT_CLUSTER_COUNT];
+	_Alignas(16) float minz[LIGHT_CLUSTER_COUNT];
+	_Alignas(16) float maxx[LIGHT_CLUSTER_COUNT];
+	_Alignas(16) float maxy[LIGHT_CLUSTER_COUNT];
+	_Alignas(16) float maxz[LIGHT_CLUSTER_COUNT];
+	mat4                     proj;
+	float                    znear, zfar;
+	int                      width, height; // Of the framebuffer, in pixels
+	uint32_t                 grid[LIGHT_CLUSTER_COUNT][2]; // Offset and count
+	uint32_t                 counts[LIGHT_CLUSTER_COUNT];
+	struct lightHit          *hits;
+	uint32_t                 *indices;
+	size_t                   hitCap;
+	vec4                     *lights;
+	size_t                   lightCap;
+	GLuint                   buffers[BUFFERS];
+	GLuint                   textures[BUFFERS];
+	struct lightClusterStats stats;
+} CLUSTERS;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//
+// Depth slice of view distance `d`, clamped to the grid.
+//
+static int depthSlice(float d)
+{
+	// Spheres around the camera reach behind the near plane, and past the
+	// far one, where the logarithm isn't defined or converts out of range.
+	d = fminf(fmaxf(d, CLUSTERS.znear), CLUSTERS.zfar);
+
+	int k = floorf(logf(d / CLUSTERS.znear) / logf(CLUSTERS.zfar / CLUSTERS.znear) * LIGHT_CLUSTER_Z);
+
+	if (k < 0) return 0;
+	if (k >= LIGHT_CLUSTER_Z) return LIGHT_CLUSTER_Z - 1;
+
+	return k;
+}
+
+//
+// Compute the view space bounds of every cluster, for a symmetric
+// perspective projection.
+//
+static void computeBounds(const struct camera *cam)
+{
+	float sx = cam->proj.cols[0].x, sy = cam->proj.cols[1].y;
+
+	CLUSTERS.proj = cam->proj;
+	CLUSTERS.znear = cam->znear;
+	CLUSTERS.zfar = cam->zfar;
+
+	for (int k = 0; k < LIGHT_CLUSTER_Z; k++) {
+		float dn = cam->znear * powf(cam->zfar / cam->znear, (float)k / LIGHT_CLUSTER_Z);
+		float df = cam->znear * powf(cam->zfar / cam->znear, (float)(k + 1) / LIGHT_CLUSTER_Z);
+
+		for (int j = 0; j < LIGHT_CLUSTER_Y; j++) {
+			float y0 = -1.0f + 2.0f * j / LIGHT_CLUSTER_Y;
+			float y1 = -1.0f + 2.0f * (j + 1) / LIGHT_CLUSTER_Y;
+
+			for (int i = 0; i < LIGHT_CLUSTER_X; i++) {
+				float x0 = -1.0f + 2.0f * i / LIGHT_CLUSTER_X;
+				float x1 = -1.0f + 2.0f * (i + 1) / LIGHT_CLUSTER_X;
+				int c = i + LIGHT_CLUSTER_X * (j + LIGHT_CLUSTER_Y * k);
+
+				// A tile's edges spread out with distance, so its extremes
+				// are at either the near or the far depth of the slice.
+				CLUSTERS.minx[c] = fminf(x0 * dn, x0 * df) / sx;
+				CLUSTERS.maxx[c] = fmaxf(x1 * dn, x1 * df) / sx;
+				CLUSTERS.miny[c] = fminf(y0 * dn, y0 * df) / sy;
+				CLUSTERS.maxy[c] = fmaxf(y1 * dn, y1 * df) / sy;
+				CLUSTERS.minz[c] = -df;
+				CLUSTERS.maxz[c] = -dn;
+			}
+		}
+	}
+}
+
+void rInitLightClusters(int width, int height)
+{
+	memset(&CLUSTERS, 0, sizeof(CLUSTERS));
+
+	CLUSTERS.width = width;
+	CLUSTERS.height = height;
+	CLUSTERS.hitCap = 1024;
+	CLUSTERS.hits = malloc(CLUSTERS.hitCap * sizeof(*CLUSTERS.hits));
+	CLUSTERS.indices = malloc(CLUSTERS.hitCap * sizeof(*CLUSTERS.indices));
+	CLUSTERS.lightCap = 64;
+	CLUSTERS.lights = malloc(CLUSTERS.lightCap * LIGHT_TEXELS * sizeof(*CLUSTERS.lights));
+
+	glGenBuffers(BUFFERS, CLUSTERS.buffers);
+	glGenTextures(BUFFERS, CLUSTERS.textures);
+
+	// Every cluster is empty until lights are binned.
+	for (int i = 0; i < BUFFERS; i++) {
+		rBindBuffer(GL_TEXTURE_BUFFER, CLUSTERS.buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(CLUSTERS.grid), CLUSTERS.grid, GL_STREAM_DRAW);
+
+		rBindTexture(BUFFER_TEXTURES[i].unit, GL_TEXTURE_BUFFER, CLUSTERS.textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, BUFFER_TEXTURES[i].format, CLUSTERS.buffers[i]);
+	}
+}
+
+void rQuitLightClusters(void)
+{
+	glDeleteTextures(BUFFERS, CLUSTERS.textures);
+	glDeleteBuffers(BUFFERS, CLUSTERS.buffers);
+	rInvalidateState();
+
+	free(CLUSTERS.hits);
+	free(CLUSTERS.indices);
+	free(CLUSTERS.lights);
+}
+
+static void addHit(uint32_t cluster, uint32_t light)
+{
+	size_t n = CLUSTERS.stats.references;
+
+	if (n == CLUSTERS.hitCap) {
+		CLUSTERS.hitCap *= 2;
+		CLUSTERS.hits = realloc(CLUSTERS.hits, CLUSTERS.hitCap * sizeof(*CLUSTERS.hits));
+		CLUSTERS.indices = realloc(CLUSTERS.indices, CLUSTERS.hitCap * sizeof(*CLUSTERS.indices));
+	}
+	CLUSTERS.hits[n] = (struct lightHit){cluster, light};
+	CLUSTERS.counts[cluster]++;
+	CLUSTERS.stats.references++;
+}
+
+//
+// Find the clusters touched by a sphere at `p` in view space, of radius `r`.
+// Returns whether there was any.
+//
+static bool binSphere(vec3 p, float r, uint32_t light)
+{
+	float d = -p.z;
+
+	if (d + r < CLUSTERS.znear || d - r > CLUSTERS.zfar)
+		return false;
+
+	__m128 cx = _mm_set1_ps(p.x), cy = _mm_set1_ps(p.y), cz = _mm_set1_ps(p.z);
+	__m128 r2 = _mm_set1_ps(r * r);
+	__m128 zero = _mm_setzero_ps();
+	int first = depthSlice(d - r) * SLICE_CLUSTERS;
+	int last = (depthSlice(d + r) + 1) * SLICE_CLUSTERS;
+	bool hit = false;
+
+	for (int c = first; c < last; c += 4) {
+		// Distance from the sphere center to the box, along each axis.
+		// At most one of the two differences is positive.
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(&CLUSTERS.minx[c]), cx), _mm_sub_ps(cx, _mm_load_ps(&CLUSTERS.maxx[c]))), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(&CLUSTERS.miny[c]), cy), _mm_sub_ps(cy, _mm_load_ps(&CLUSTERS.maxy[c]))), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(&CLUSTERS.minz[c]), cz), _mm_sub_ps(cz, _mm_load_ps(&CLUSTERS.maxz[c]))), zero);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+
+		for (int i = 0; mask; i++, mask >>= 1) {
+			if (mask & 1) {
+				addHit(c + i, light);
+				hit = true;
+			}
+		}
+	}
+	return hit;
+}
+
+//
+// Upload `size` bytes of `data` to the light buffer `b`, orphaning its
+// previous contents.
+//
+static void uploadBuffer(enum lightBuffer b, const void *data, size_t size)
+{
+	rBindBuffer(GL_TEXTURE_BUFFER, CLUSTERS.buffers[b]);
+	GL(glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW));
+	rBindTexture(BUFFER_TEXTURES[b].unit, GL_TEXTURE_BUFFER, CLUSTERS.textures[b]);
+}
+
+//
+// Bin `n` lights into the clusters of `cam`'s frustum, and upload the result
+// for the shaders. Lights are seen through the view of `cam` as it is now,
+// which should be the view of the frame uniforms.
+//
+void rBinLights(const struct camera *cam, struct light *const *lights, size_t n)
+{
+	double start = now();
+
+	if (memcmp(&cam->proj, &CLUSTERS.proj, sizeof(cam->proj)) != 0 ||
+	    cam->znear != CLUSTERS.znear || cam->zfar != CLUSTERS.zfar) {
+		computeBounds(cam);
+	}
+	if (n > CLUSTERS.lightCap) {
+		while (n > CLUSTERS.lightCap)
+			CLUSTERS.lightCap *= 2;
+
+		CLUSTERS.lights = realloc(CLUSTERS.lights, CLUSTERS.lightCap * LIGHT_TEXELS * sizeof(*CLUSTERS.lights));
+	}
+	memset(CLUSTERS.counts, 0, sizeof(CLUSTERS.counts));
+	CLUSTERS.stats = (struct lightClusterStats){0};
+	CLUSTERS.stats.lights = n;
+
+	for (size_t i = 0; i < n; i++) {
+		const struct light *l = lights[i];
+		float range = rLightRange(l);
+
+		CLUSTERS.lights[i * LIGHT_TEXELS + 0] = vec4new(l->pos.x, l->pos.y, l->pos.z, range);
+		CLUSTERS.lights[i * LIGHT_TEXELS + 1] = vec4new(l->rgb.x, l->rgb.y, l->rgb.z, l->brightness);
+
+		if (binSphere(vec3transform(l->pos, cam->view), range, i))
+			CLUSTERS.stats.visible++;
+	}
+
+	// Lay the lists out in cluster order. Hits are in light order, which
+	// each list keeps.
+	for (size_t c = 0, offset = 0; c < LIGHT_CLUSTER_COUNT; c++) {
+		CLUSTERS.grid[c][0] = offset;
+		CLUSTERS.grid[c][1] = 0;
+		offset += CLUSTERS.counts[c];
+
+		if (CLUSTERS.counts[c] > 0)
+			CLUSTERS.stats.occupied++;
+		if (CLUSTERS.counts[c] > CLUSTERS.stats.maxLights)
+			CLUSTERS.stats.maxLights = CLUSTERS.counts[c];
+	}
+	for (size_t i = 0; i < CLUSTERS.stats.references; i++) {
+		uint32_t *cell = CLUSTERS.grid[CLUSTERS.hits[i].cluster];
+
+		CLUSTERS.indices[cell[0] + cell[1]++] = CLUSTERS.hits[i].light;
+	}
+
+	// Texture buffers can't be empty, so there's always room for one entry.
+	uploadBuffer(BUFFER_GRID, CLUSTERS.grid, sizeof(CLUSTERS.grid));
+	uploadBuffer(BUFFER_INDICES, CLUSTERS.indices, (CLUSTERS.stats.references ? CLUSTERS.stats.references : 1) * sizeof(*CLUSTERS.indices));
+	uploadBuffer(BUFFER_LIGHTS, CLUSTERS.lights, (n ? n : 1) * LIGHT_TEXELS * sizeof(*CLUSTERS.lights));
+
+	CLUSTERS.stats.binMs = now() - start;
+}
+
+//
+// Set the uniforms which map a fragment of `cam` to its cluster.
+//
+void rLightClusterUniforms(const struct camera *cam, struct frameUniforms *f)
+{
+	float slices = LIGHT_CLUSTER_Z / logf(cam->zfar / cam->znear);
+
+	f->clusterScale = vec4new(
+		(float)LIGHT_CLUSTER_X / CLUSTERS.width,
+		(float)LIGHT_CLUSTER_Y / CLUSTERS.height,
+		slices,
+		-slices * logf(cam->znear)
+	);
+	f->clusterSize[0] = LIGHT_CLUSTER_X;
+	f->clusterSize[1] = LIGHT_CLUSTER_Y;
+	f->clusterSize[2] = LIGHT_CLUSTER_Z;
+	f->clusterSize[3] = 0;
+}
+
+struct lightClusterStats rLightClusterStats(void)
+{
+	return CLUSTERS.stats;
+}
@@ -0,0 +1,49 @@
+//
+// lightcluster.h
+// clustered light culling
+//
+// dependencies:
+//
+//   stddef.h
+//   GL/glew.h
+//   linmath.h
+//
+struct camera;
+struct light;
+struct frameUniforms;
+
+//
+// Dimensions of the cluster grid: tiles across the screen, by slices of
+// view depth.
+//
+enum {
+	LIGHT_CLUSTER_X     = 16,
+	LIGHT_CLUSTER_Y     = 8,
+	LIGHT_CLUSTER_Z     = 24,
+	LIGHT_CLUSTER_COUNT = LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * LIGHT_CLUSTER_Z
+};
+
+//
+// Texture units of the light buffers, the same in every program. They're
+// above the units used by materials.
+//
+enum {
+	LIGHT_CLUSTER_GRID_UNIT  = 13, // `clusterGrid`: offset and count of each cluster's lights
+	LIGHT_CLUSTER_INDEX_UNIT = 14, // `clusterLights`: light indices of every cluster
+	LIGHT_CLUSTER_LIGHT_UNIT = 15  // `lightData`: position, range, color and brightness
+};
+
+struct lightClusterStats {
+	unsigned lights;
+	unsigned visible;     // Lights touching at least one cluster
+	unsigned references;  // Light indices over every cluster
+	unsigned occupied;    // Clusters with at least one light
+	unsigned maxLights;   // Lights in the fullest cluster
+	double   binMs;
+};
+
+extern void rInitLightClusters(int, int);
+extern void rQuitLightClusters(void);
+extern void rBinLights(const struct camera *, struct light *const *, size_t);
+extern void rLightClusterUniforms(const struct camera *, struct frameUniforms *);
+extern struct lightClusterStats rLightClusterStats(void);
@@ -0,0 +1,425 @@
+//
+// loader.c
+// asynchronous model loading
+//
+// Model files are read, and their textures decoded, on a worker thread. The
+// GL thread then creates the model's buffers and textures empty, and fills
+// them in from `rPumpLoader`, one chunk at a time through a staging buffer, so
+// that loading never uploads more than a fixed budget per frame.
+//
+// Precompressed textures are only mapped by the worker thread, and every
+// level of their mip chain is uploaded from the mapping. Mipmaps are only
+// generated for textures decoded from a TGA, once they're complete.
+//
+// Textures are claimed in the cache when the worker thread reads them, so
+// that requests which overlap share a single read and upload of every texture
+// they have in common.
+//
+// The worker thread also decodes the positions of every mesh, which are
+// uploaded to the position stream of its geometry page like any other
+// buffer.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "texture.h"
+#include "material.h"
+#include "mesh.h"
+#include "model.h"
+#include "loader.h"
+#include "state.h"
+
+char *strdup(const char *);
+
+// Size of the staging buffer, which bounds the size of a single upload.
+enum { STAGING_SIZE = 1 << 20 };
+
+//
+// A buffer or texture of a model, being filled in from the model's file.
+//
+struct upload {
+	GLenum         target;  // GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER or GL_TEXTURE_2D
+	GLuint         object;
+	size_t         offset;  // Where the data goes in a buffer object, in bytes
+	const void     *src;
+	size_t         size;
+	size_t         done;
+	int            width;   // Texture level dimensions, in texels
+	int            height;
+	GLint          level;
+	GLenum         format;  // Compressed internal format, or 0 for BGRA pixels
+	size_t         row;     // Bytes per row of texels, or of 4x4 blocks if compressed
+	struct texture *texture; // Set on the last upload of a texture, which completes it
+};
+
+struct mdlRequest {
+	char              *name;
+	enum loadState    state;  // Guarded by `LOADER.lock`
+	struct mdlFile    file;
+	struct model      *model;
+	struct upload     *uploads;
+	size_t            nuploads;
+	size_t            next;   // First upload which isn't done
+	struct mdlRequest *queued; // Next request for the worker thread
+	struct mdlRequest *active; // Next request the GL thread is waiting on
+};
+
+static struct {
+	pthread_t         worker;
+	pthread_mutex_t   lock;
+	pthread_cond_t    wake;
+	bool              running;
+	struct mdlRequest *queue;  // Requests for the worker thread, oldest first
+	struct mdlRequest **tail;
+	struct mdlRequest *active; // Requests which aren't ready, oldest first, GL thread only
+	GLuint            staging;
+} LOADER;
+
+static void setState(struct mdlRequest *r, enum loadState state)
+{
+	pthread_mutex_lock(&LOADER.lock);
+	r->state = state;
+	pthread_mutex_unlock(&LOADER.lock);
+}
+
+static void decodePositions(struct mdlFile *f)
+{
+	for (int i = 0; i < f->nmeshes; i++) {
+		struct mdlMeshDesc *d = &f->meshes[i];
+
+		d->positions = malloc(d->nvertices * sizeof(*d->positions));
+		meshPositions(d->format, d->vertices, d->nvertices, d->positions);
+	}
+}
+
+static void *loaderMain(void *arg)
+{
+	pthread_mutex_lock(&LOADER.lock);
+
+	while (LOADER.running) {
+		struct mdlRequest *r = LOADER.queue;
+
+		if (! r) {
+			pthread_cond_wait(&LOADER.wake, &LOADER.lock);
+			continue;
+		}
+		if (! (LOADER.queue = r->queued))
+			LOADER.tail = &LOADER.queue;
+
+		pthread_mutex_unlock(&LOADER.lock);
+		bool ok = rReadMdlFile(&r->file, r->name, r->name);
+
+		if (ok)
+			decodePositions(&r->file);
+
+		pthread_mutex_lock(&LOADER.lock);
+
+		r->state = ok ? LOAD_DECODED : LOAD_FAILED;
+	}
+	pthread_mutex_unlock(&LOADER.lock);
+
+	return NULL;
+}
+
+bool rInitLoader(void)
+{
+	LOADER.queue = NULL;
+	LOADER.tail = &LOADER.queue;
+	LOADER.active = NULL;
+	LOADER.running = true;
+
+	glGenBuffers(1, &LOADER.staging);
+
+	pthread_mutex_init(&LOADER.lock, NULL);
+	pthread_cond_init(&LOADER.wake, NULL);
+
+	return pthread_create(&LOADER.worker, NULL, loaderMain, NULL) == 0;
+}
+
+//
+// Stop the worker thread. Requests which aren't ready yet are abandoned.
+//
+void rQuitLoader(void)
+{
+	pthread_mutex_lock(&LOADER.lock);
+	LOADER.running = false;
+	pthread_cond_signal(&LOADER.wake);
+	pthread_mutex_unlock(&LOADER.lock);
+
+	pthread_join(LOADER.worker, NULL);
+	pthread_cond_destroy(&LOADER.wake);
+	pthread_mutex_destroy(&LOADER.lock);
+
+	glDeleteBuffers(1, &LOADER.staging);
+	rInvalidateState();
+}
+
+//
+// Start loading the model at `path` in the background. The returned request
+// is polled with `rPollMdl`, and makes progress with every `rPumpLoader`.
+//
+struct mdlRequest *rOpenMdlAsync(const char *path)
+{
+	struct mdlRequest *r = calloc(1, sizeof(*r));
+	struct mdlRequest **rp = &LOADER.active;
+
+	r->name = strdup(path);
+	r->state = LOAD_PENDING;
+
+	// Requests are staged in the order they're made, so that textures
+	// are created by the request which claimed them, before any other
+	// request which uses them is staged.
+	while (*rp)
+		rp = &(*rp)->active;
+	*rp = r;
+
+	pthread_mutex_lock(&LOADER.lock);
+	*LOADER.tail = r;
+	LOADER.tail = &r->queued;
+	pthread_cond_signal(&LOADER.wake);
+	pthread_mutex_unlock(&LOADER.lock);
+
+	return r;
+}
+
+enum loadState rPollMdl(struct mdlRequest *r)
+{
+	enum loadState state;
+
+	pthread_mutex_lock(&LOADER.lock);
+	state = r->state;
+	pthread_mutex_unlock(&LOADER.lock);
+
+	return state;
+}
+
+//
+// The model of `r` once it's ready, or NULL. The model belongs to the caller.
+//
+struct model *rMdlRequestModel(struct mdlRequest *r)
+{
+	return rPollMdl(r) == LOAD_READY ? r->model : NULL;
+}
+
+//
+// Free `r`, which must be either ready or failed. Its model is left alone.
+//
+void rFreeMdlRequest(struct mdlRequest *r)
+{
+	assert(rPollMdl(r) == LOAD_READY || rPollMdl(r) == LOAD_FAILED);
+
+	for (struct mdlRequest **rp = &LOADER.active; *rp; rp = &(*rp)->active) {
+		if (*rp == r) {
+			*rp = r->active;
+			break;
+		}
+	}
+	free(r->name);
+	free(r);
+}
+
+static void addUpload(struct mdlRequest *r, GLenum target, GLuint object, size_t offset, const void *src, size_t size)
+{
+	r->uploads[r->nuploads++] = (struct upload){target, object, offset, src, size, 0, 0, 0, 0, 0, 1, NULL};
+}
+
+//
+// List the uploads of every level of `img` into `t`.
+//
+static void addTextureUploads(struct mdlRequest *r, struct texture *t, const struct texImage *img)
+{
+	for (int i = 0; i < img->nlevels; i++) {
+		int w, h;
+		size_t size;
+		const void *src = rTexImageLevel(img, i, &w, &h, &size);
+		struct upload *u = &r->uploads[r->nuploads];
+
+		addUpload(r, GL_TEXTURE_2D, t->handle, 0, src, size);
+
+		u->width = w;
+		u->height = h;
+		u->level = i;
+		u->format = img->format;
+		u->row = img->format ? size / ((h + 3) / 4) : w * sizeof(uint32_t);
+		u->texture = i == img->nlevels - 1 ? t : NULL;
+	}
+}
+
+//
+// Create the model of `r` with empty buffers and textures, and list the
+// uploads needed to fill them in.
+//
+static void rStageMdl(struct mdlRequest *r)
+{
+	struct mdlFile *f = &r->file;
+
+	r->model = rNewMdl(f, false);
+	r->uploads = malloc(f->nmeshes * (3 + TEXTURE_TYPES * TEX_MAX_LEVELS) * sizeof(*r->uploads));
+	r->nuploads = 0;
+	r->next = 0;
+
+	for (int i = 0; i < f->nmeshes; i++) {
+		const struct mdlMeshDesc *d = &f->meshes[i];
+		struct mesh *m = r->model->meshes[i];
+		size_t stride = vertexFormatSize(d->format);
+
+		addUpload(r, GL_ARRAY_BUFFER, m->vbo, m->baseVertex * stride, d->vertices, d->nvertices * stride);
+		addUpload(r, GL_ELEMENT_ARRAY_BUFFER, m->ebo, m->indexOffset, d->indices, d->nindices * indexTypeSize(d->indexType));
+		addUpload(r, GL_ARRAY_BUFFER, m->pbo, m->baseVertex * sizeof(vec3), d->positions, d->nvertices * sizeof(vec3));
+
+		if (! d->images || ! m->material)
+			continue;
+
+		for (int j = 0; j < TEXTURE_TYPES; j++) {
+			struct texture *t = m->material->textures[j];
+
+			// Textures whose image was left empty are loaded by
+			// whoever claimed them, and cached ones may be loaded
+			// already.
+			if (! t || t->isLoaded || ! d->images[j].nlevels)
+				continue;
+
+			addTextureUploads(r, t, &d->images[j]);
+		}
+	}
+}
+
+//
+// Copy the next chunk of `u`, of at most `budget` bytes, through the staging
+// buffer. Textures are copied in whole rows, of texels or of compressed
+// blocks, so at least one row is copied whatever the budget. Returns the
+// number of bytes copied.
+//
+static size_t rUploadChunk(struct upload *u, size_t budget)
+{
+	bool isTexture = u->target == GL_TEXTURE_2D;
+	GLenum target = isTexture ? GL_PIXEL_UNPACK_BUFFER : GL_COPY_READ_BUFFER;
+	size_t row = u->row;
+	size_t n = u->size - u->done;
+
+	if (n > budget)
+		n = budget;
+	if (n > STAGING_SIZE)
+		n = STAGING_SIZE;
+
+	n = n < row ? row : n / row * row;
+
+	rBindBuffer(target, LOADER.staging);
+
+	// Orphan the previous contents, so we don't wait on the GPU to consume them.
+	glBufferData(target, STAGING_SIZE, NULL, GL_STREAM_DRAW);
+
+	// Mapping the buffer can fail, and its contents can be lost while mapped,
+	// in which case the chunk is retried on the next call.
+	void *p = glMapBufferRange(target, 0, n, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	bool ok = p != NULL;
+
+	if (ok) {
+		memcpy(p, (const unsigned char *)u->src + u->done, n);
+		ok = glUnmapBuffer(target);
+	}
+
+	if (ok && isTexture && u->format) {
+		// Rows of blocks are four texels high, except maybe the last.
+		int y = u->done / row * 4;
+		int h = n / row * 4;
+
+		rBindTexture(0, GL_TEXTURE_2D, u->object);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, u->level, 0, y, u->width, y + h > u->height ? u->height - y : h, u->format, n, 0);
+	} else if (ok && isTexture) {
+		rBindTexture(0, GL_TEXTURE_2D, u->object);
+		glTexSubImage2D(GL_TEXTURE_2D, u->level, 0, u->done / row, u->width, n / row, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+	} else if (ok) {
+		rBindBuffer(GL_COPY_WRITE_BUFFER, u->object);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, u->offset + u->done, n);
+	}
+
+	// Texture uploads from client memory would read from the staging buffer
+	// as long as it's bound for unpacking.
+	if (isTexture)
+		rBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (! ok)
+		return 0;
+
+	u->done += n;
+
+	if (u->done == u->size && u->texture) {
+		// Precompressed textures come with every level of their mip chain.
+		if (! u->format)
+			rGenerateMipmap(u->texture);
+
+		u->texture->isLoaded = true;
+	}
+
+	return n;
+}
+
+//
+// Upload up to `budget` bytes of `r`. Returns the number of bytes uploaded.
+//
+static size_t rUploadMdl(struct mdlRequest *r, size_t budget)
+{
+	size_t total = 0;
+
+	while (r->next < r->nuploads && total < budget) {
+		struct upload *u = &r->uploads[r->next];
+
+		if (u->done == u->size) {
+			r->next++;
+			continue;
+		}
+		size_t n = rUploadChunk(u, budget - total);
+
+		if (n == 0)
+			break;
+
+		total += n;
+	}
+	return total;
+}
+
+//
+// Advance every outstanding request, uploading at most about `budget` bytes.
+// Must be called from the GL thread, typically once per frame. Returns the
+// number of bytes uploaded.
+//
+size_t rPumpLoader(size_t budget)
+{
+	size_t uploaded = 0;
+	struct mdlRequest **rp = &LOADER.active;
+
+	while (*rp) {
+		struct mdlRequest *r = *rp;
+		enum loadState state = rPollMdl(r);
+
+		if (state == LOAD_DECODED) {
+			rStageMdl(r);
+			setState(r, state = LOAD_UPLOADING);
+		}
+		if (state == LOAD_UPLOADING && uploaded < budget) {
+			uploaded += rUploadMdl(r, budget - uploaded);
+
+			if (r->next == r->nuploads) {
+				rFreeMdlFile(&r->file);
+				free(r->uploads);
+				r->uploads = NULL;
+
+				setState(r, state = LOAD_READY);
+			}
+		}
+		if (state == LOAD_READY || state == LOAD_FAILED) {
+			*rp = r->active;
+			continue;
+		}
+		rp = &r->active;
+	}
+	return uploaded;
+}
@@ -0,0 +1,17 @@
+enum loadState {
+	LOAD_PENDING,   // Queued for, or being read by, the worker thread
+	LOAD_DECODED,   // Read and decoded, waiting for the GL thread
+	LOAD_UPLOADING, // Being uploaded, a chunk at a time
+	LOAD_READY,
+	LOAD_FAILED
+};
+
+struct mdlRequest;
+
+extern bool rInitLoader(void);
+extern void rQuitLoader(void);
+extern struct mdlRequest *rOpenMdlAsync(const char *);
+extern enum loadState rPollMdl(struct mdlRequest *);
+extern struct model *rMdlRequestModel(struct mdlRequest *);
+extern void rFreeMdlRequest(struct mdlRequest *);
+extern size_t rPumpLoader(size_t);
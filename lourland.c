@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <assert.h>
@@ -9,34 +10,67 @@
 
 #include "linmath.h"
 #include "util.h"
+#include "pack.h"
 #include "texture.h"
+#include "common.h"
 #include "mesh.h"
 #include "model.h"
+#include "loader.h"
+#include "material.h"
+#include "cube.h"
 #include "shader.h"
+#include "cache.h"
 #include "light.h"
 #include "camera.h"
 #include "command.h"
 #include "network.h"
 #include "renderer.h"
-#include "text.h"
+#include "frame.h"
+#include "queue.h"
+#include "state.h"
+#include "geometry.h"
+#include "overlay.h"
+#include "occlusion.h"
+#include "deferred.h"
+#include "lightcluster.h"
+#include "shadow.h"
+#include "debugdraw.h"
+#include "stream.h"
 
 struct options {
 	int  renderMode;
 	bool tonemapEnabled;
 	bool debugMode;
+	bool occlusionView; // Show the occlusion buffer
+	bool lightField;    // Light the scene with a field of small lights
 };
 
-static const int RENDER_MODES = 6;
+static const int RENDER_MODES = 7;
+static const int RENDER_DEFERRED = 6; // Same as in blinn.frag
 static const int WIDTH = 800;
 static const int HEIGHT = 600;
 static const int CMD_PORT = 8000;
+static const char PACK_PATH[] = "lourland.pak";
+static const size_t UPLOAD_BUDGET = 4 << 20; // Bytes the loader may upload per frame
+static const size_t STREAM_SIZE = 4 << 20;   // Bytes of dynamic vertex data, over the frames in flight
+
+// Lights of the light field, on a square grid around the origin.
+enum { LIGHT_FIELD_SIDE = 16, LIGHT_FIELD = LIGHT_FIELD_SIDE * LIGHT_FIELD_SIDE };
+static const float LIGHT_FIELD_SPACING = 2.0f;
 
 static struct shaderSource SHADER_SOURCES[] = {
-	{"blinn",    "shaders/blinn.vert",  "shaders/blinn.frag"},
-	{"constant", "shaders/mvp.vert",    "shaders/constant.frag"},
-	{"text",     "shaders/text.vert",   "shaders/text.frag"},
-	{"default",  "shaders/flat.vert",   "shaders/flat.frag"},
-	{NULL,       NULL,                  NULL}
+	{"blinn",                    "shaders/blinn.vert",    "shaders/blinn.frag",    NULL},
+	{"blinn.instanced",          "shaders/blinn.vert",    "shaders/blinn.frag",    "#define INSTANCED\n"},
+	{"blinn.deferred",           "shaders/gbuffer.vert",  "shaders/gbuffer.frag",  NULL},
+	{"blinn.instanced.deferred", "shaders/gbuffer.vert",  "shaders/gbuffer.frag",  "#define INSTANCED\n"},
+	{"deferred",                 "shaders/deferred.vert", "shaders/deferred.frag", NULL},
+	{"shadow",                   "shaders/shadow.vert",   "shaders/shadow.frag",   NULL},
+	{"debug",                    "shaders/debug.vert",    "shaders/debug.frag",    NULL},
+	{"constant",                 "shaders/mvp.vert",      "shaders/constant.frag", NULL},
+	{"overlay",                  "shaders/overlay.vert",  "shaders/overlay.frag",  NULL},
+	{"default",                  "shaders/flat.vert",     "shaders/flat.frag",     NULL},
+	{"default.instanced",        "shaders/flat.vert",     "shaders/flat.frag",     "#define INSTANCED\n"},
+	{NULL,                       NULL,                    NULL,                    NULL}
 };
 
 _Static_assert(sizeof(vec4) == sizeof(float) * 4, "vec4 is tightly packed");
@@ -60,6 +94,11 @@ static void keyCallback(GLFWwindow *win, int key, int scan, int action, int mods
 		opts->tonemapEnabled = !opts->tonemapEnabled;
 	} else if (key == GLFW_KEY_F3) {
 		opts->debugMode = !opts->debugMode;
+		rSetDebugDraw(opts->debugMode);
+	} else if (key == GLFW_KEY_F4) {
+		opts->occlusionView = !opts->occlusionView;
+	} else if (key == GLFW_KEY_F5) {
+		opts->lightField = !opts->lightField;
 	}
 }
 
@@ -101,19 +140,50 @@ int main(int argc, char *argv[])
 	glfwSetCursorEnterCallback(win, cursorEnterCallback);
 	glfwSetKeyCallback(win, keyCallback);
 
+	// Assets are read from the pack when there is one, and from the file
+	// system otherwise.
+	if (packMount(PACK_PATH)) {
+		printf("mounted %s\n", PACK_PATH);
+	}
 	rInitRenderer();
+	rInitStream(STREAM_SIZE);
+	rInitCache();
+	rInitQueue();
+	rInitOcclusion();
 	rLoadShaders(SHADER_SOURCES);
+	rInitFrame();
+	rInitDebugDraw();
+
+	{
+		int width, height;
+
+		// The G-buffer and the light clusters match the default framebuffer,
+		// which may be larger than the window. Shadows restore its viewport.
+		glfwGetFramebufferSize(win, &width, &height);
+
+		if (! rInitDeferred(width, height)) {
+			fatalf("error creating G-buffer\n");
+		}
+		rInitLightClusters(width, height);
+		rInitShadows(width, height);
+	}
 
-	struct model *mdl;
+	struct model *mdl = NULL;
+	struct mdlRequest *req;
 
-	if (! rInitText2D("assets/font.tga")) {
+	if (! rInitOverlay(WIDTH, HEIGHT) || rLoadOverlayFont("assets/font.tga") == -1) {
 		fatalf("error loading fonts\n");
 	}
-	if (! (mdl = rOpenMdl("default"))) {
-		fatalf("error importing model\n");
+	if (! rInitLoader()) {
+		fatalf("error starting loader\n");
 	}
+	req = rOpenMdlAsync("default");
 
-	struct options opts = {0, true, false};
+	// Drawn in place of the model until it's loaded.
+	struct mesh *placeholder = rNewCube();
+	rSetMaterialProperty4fv(placeholder->material, "color", (vec4){0.5f, 0.5f, 0.5f, 1.0f});
+
+	struct options opts = {0, true, false, false, false};
 	double lastFrame = 0;
 	glfwSetTime(lastFrame);
 	glfwSetWindowUserPointer(win, &opts);
@@ -128,6 +198,25 @@ int main(int argc, char *argv[])
 	struct light *keyLight = rNewLight();
 	keyLight->pos = (vec3){0, 5, 1};
 	keyLight->visibility = 2;
+	keyLight->rgb = (vec3){1.0f, 1.0f, 0.9f};
+	keyLight->brightness = 30.0f;
+
+	// The key light comes first, followed by the light field when it's on.
+	struct light field[LIGHT_FIELD];
+	struct light *lights[1 + LIGHT_FIELD] = {keyLight};
+
+	for (int i = 0; i < LIGHT_FIELD; i++) {
+		float x = (i % LIGHT_FIELD_SIDE - (LIGHT_FIELD_SIDE - 1) / 2.0f) * LIGHT_FIELD_SPACING;
+		float z = (i / LIGHT_FIELD_SIDE - (LIGHT_FIELD_SIDE - 1) / 2.0f) * LIGHT_FIELD_SPACING;
+
+		field[i] = (struct light){
+			.visibility = 0,
+			.brightness = 0.25f,
+			.pos        = (vec3){x, 0.5f, z},
+			.rgb        = (vec3){(i % 3) == 0, (i % 3) == 1, (i % 3) == 2}
+		};
+		lights[1 + i] = &field[i];
+	}
 
 	struct camera *cam = rNewCamera(pos, WIDTH, HEIGHT, fov, 0.1f, 1000.0f);
 	struct network *net = nNewCommandInterface(CMD_PORT);
@@ -137,16 +226,84 @@ int main(int argc, char *argv[])
 	}
 
 	while (! glfwWindowShouldClose(win)) {
-		// TODO(cloudhead): Frustum culling (via bounding boxes)
-		// TODO(cloudhead): Occlusion culling
-
 		double t = glfwGetTime();
 		double ft = (t - lastFrame) * 1000.0f;
 
+		// Show the counters of the previous, complete frame.
+		struct renderStats stats = RENDER_STATS;
+		RENDER_STATS = (struct renderStats){0};
+
 		rClear();
-		rDrawMdl(mdl);
+		rPumpLoader(UPLOAD_BUDGET);
+		rSetDeferredShading(opts.renderMode == RENDER_DEFERRED);
+
+		if (! mdl) {
+			enum loadState state = rPollMdl(req);
+
+			if (state == LOAD_READY) {
+				struct mdlLoadStats st = rMdlLoadStats();
+				struct resourceStats rs = rResourceStats();
+				printf("models: %zu bytes mapped, %zu bytes copied, %zu bytes uploaded\n", st.mapped, st.copied, st.uploaded);
+				printf("resources: %zu hits, %zu misses, %zu resident\n", rs.hits, rs.misses, rs.resident);
+
+				struct geometryStats gs = rGeometryStats();
+				printf("geometry: %zu pages, %zu/%zu vertex bytes, %zu/%zu index bytes, %zu free ranges, %.1f%% fragmented\n",
+				       gs.pages, gs.vertexBytesUsed, gs.vertexBytes, gs.indexBytesUsed, gs.indexBytes, gs.freeRanges, gs.fragmentation * 100.0f);
+
+				mdl = rMdlRequestModel(req);
+				rFreeMdlRequest(req);
+			} else if (state == LOAD_FAILED) {
+				fatalf("error importing model\n");
+			}
+		}
+		if (mdl) {
+			// Models are drawn with an identity transform, so the camera
+			// position is also the eye position in model space.
+			rSelectMdlLod(mdl, cam);
+			rCullMdlClusters(mdl, cam->pos);
+
+			rBeginOcclusion(cam);
+			rAddMdlOccluders(mdl);
+			rRasterizeOcclusion();
+
+			rDrawMdl(mdl, cam);
+			rAddMdlShadowCasters(mdl, true);
+			rDebugBox(mdl->min, mdl->max, vec4new(1.0f, 1.0f, 0.0f, 0.5f));
+		} else {
+			mat4 model = mat4identity();
+			rSubmitMesh(RENDER_PASS_OPAQUE, placeholder, &model, 0.0f);
+			rAddShadowCaster(placeholder, &model, true);
+		}
 		rDrawLight(keyLight);
+		rDebugAxes(mat4identity(), 1.0f);
+		rRenderShadows();
+		rFlushQueue();
+		rFlushDebugDraw();
+		rValidateState();
+
+		if (opts.occlusionView) {
+			rDrawOcclusionBuffer(WIDTH - 266, 10, 256, 128);
+		}
 		rDrawFrameTime(ft);
+		rDrawRenderStats(&stats);
+
+		struct occlusionStats os = rOcclusionStats();
+		rDrawOcclusionStats(&os);
+
+		struct lightClusterStats ls = rLightClusterStats();
+		rDrawLightClusterStats(&ls);
+
+		struct shadowStats ss = rShadowStats();
+		rDrawShadowStats(&ss);
+
+		struct streamStats sts = rStreamStats();
+		rDrawStreamStats(&sts);
+
+		struct overlayStats ovs = rOverlayStats();
+		rDrawOverlayStats(&ovs);
+
+		rFlushOverlay();
+		rEndStreamFrame();
 		glfwSwapBuffers(win);
 
 		{
@@ -221,42 +378,62 @@ int main(int argc, char *argv[])
 				rCameraMove(cam, vec3scale(right, -delta * mspeed));
 			}
 
-			// Setup shaders
-			//
-			// TODO(cloudhead): Share `proj` and `view` uniforms amongst shaders.
-			// TOOD(cloudhead): Pass the options struct directly as a uniform.
-			//
-			for (struct shaderSource *src = SHADER_SOURCES; src->name != NULL; src++) {
-				struct shader *s = rGetShader(src->name);
-
-				// Skip 'text' shader for now
-				if (! strcmp(s->name, "text"))
-					continue;
-
-				rUseShader(s);
-					if (glfwGetKey(win, GLFW_KEY_L) == GLFW_PRESS) {
-						mat4 ndc2world = mat4invert(mat4mul(cam->proj, cam->view));
-						vec3 ndc = (vec3){ // Normalized device coordinates (-x)
-							-mx / (float)width  * 2.0f + 1.0f,
-							+my / (float)height * 2.0f - 1.0f, 0.0f
-						};
-						vec3 world    = vec3transform(ndc, ndc2world);
-						vec3 zero     = vec3transform((vec3){0, 0, 0}, ndc2world);
-						vec3 delta    = vec3sub(zero, world);
-						keyLight->pos = vec3add(keyLight->pos, delta);
-					}
-					rSetUniform1i(s, "renderMode", opts.renderMode);
-					rSetUniform1i(s, "tonemapEnabled", opts.tonemapEnabled);
-					rSetUniform1i(s, "debugMode", opts.debugMode);
-					rSetUniformMatrix4fv(s, "proj", &cam->proj);
-					rSetUniformMatrix4fv(s, "view", &cam->view);
-					rSetUniform3fv(s, "lightPos", &keyLight->pos);
-				rUseShader(0);
+			if (glfwGetKey(win, GLFW_KEY_L) == GLFW_PRESS) {
+				mat4 ndc2world = mat4invert(mat4mul(cam->proj, cam->view));
+				vec3 ndc = (vec3){ // Normalized device coordinates (-x)
+					-mx / (float)width  * 2.0f + 1.0f,
+					+my / (float)height * 2.0f - 1.0f, 0.0f
+				};
+				vec3 world    = vec3transform(ndc, ndc2world);
+				vec3 zero     = vec3transform((vec3){0, 0, 0}, ndc2world);
+				vec3 delta    = vec3sub(zero, world);
+				keyLight->pos = vec3add(keyLight->pos, delta);
 			}
 		}
+
+		{ // Upload the uniforms shared by every shader for the next frame
+			struct frameUniforms frame = {
+				.proj           = cam->proj,
+				.view           = cam->view,
+				.viewProj       = mat4mul(cam->proj, cam->view),
+				.cameraPos      = cam->pos,
+				.lightPos       = keyLight->pos,
+				.renderMode     = opts.renderMode,
+				.tonemapEnabled = opts.tonemapEnabled,
+				.debugMode      = opts.debugMode
+			};
+			frame.invViewProj = mat4invert(frame.viewProj);
+			rLightClusterUniforms(cam, &frame);
+
+			// The key light shadows the scene as if it were a directional
+			// light, shining towards the origin.
+			keyLight->dir = vec3norm(vec3scale(keyLight->pos, -1.0f));
+			rFitShadowCascades(cam, keyLight->dir);
+			rShadowUniforms(&frame, 0);
+
+			rUpdateFrame(&frame);
+			rCameraUpdateFrustum(cam);
+			rBinLights(cam, lights, opts.lightField ? 1 + LIGHT_FIELD : 1);
+		}
 	}
-	rFreeMdl(mdl);
+	rQuitLoader();
+	rQuitShadows();
+	rQuitDebugDraw();
+	rQuitOverlay();
+	rQuitLightClusters();
+	rQuitDeferred();
+	rQuitFrame();
+	rQuitOcclusion();
+	rQuitQueue();
+
+	if (mdl)
+		rFreeMdl(mdl);
+
+	meshFree(placeholder);
+	rQuitGeometry();
+	rQuitStream();
 	rUnloadShaders(SHADER_SOURCES);
+	packUnmount();
 	glfwTerminate();
 
 	return 0;
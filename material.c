@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <GL/glew.h>
 
@@ -8,51 +9,148 @@
 #include "shader.h"
 #include "material.h"
 #include "sds.h"
+#include "cache.h"
 
-static bool rLoadMaterialTexture(struct material *m, const char *dir, const char *name, enum textureType type)
+static char *texturePath(const char *dir, const char *name, enum textureType type)
 {
-	char *path;
-	struct texture *t;
+	return sdscatprintf(sdsnew(dir), "/%s%s", name, rTextureExtension(type));
+}
 
-	GLint format = rTextureFormat(type);
+//
+// Read the texture of type `type` of material `name` in `dir`, preferring
+// its precompressed file over its TGA.
+//
+static bool readImage(struct texImage *img, const char *dir, const char *name, enum textureType type)
+{
+	char *path = sdscatprintf(sdsnew(dir), "/%s%s", name, rCompressedTextureExtension(type));
+	bool ok = rReadTexImage(img, path);
 
-	path = sdscatprintf(sdsnew(dir), "/%s%s", name, rTextureExtension(type));
+	sdsfree(path);
 
- 	if ((t = rTextureFromPath(path, format)) == NULL) {
-		return false;
- 	}
- 	m->textures[type] = t;
-	t->index = type;
- 	t->sampler = rNewSampler(GL_LINEAR_MIPMAP_NEAREST, GL_LINEAR);
-	rGenerateMipmap(t);
+	if (! ok) {
+		path = texturePath(dir, name, type);
+		ok = rReadTexImage(img, path);
+		sdsfree(path);
+	}
+	return ok;
+}
 
-	sdsfree(path);
+//
+// Read every texture of material `name` in `dir` into `images`, which must
+// hold TEXTURE_TYPES images. No GL calls are made, so this can be done off the
+// GL thread. Textures which are cached, or being read for another material,
+// are left empty. The rest stay claimed in the cache until they're created,
+// or the images freed with `rFreeMaterialImages`.
+//
+bool rReadMaterialImages(struct texImage *images, const char *dir, const char *name)
+{
+	memset(images, 0, TEXTURE_TYPES * sizeof(*images));
+
+	for (int i = 0; i < TEXTURE_TYPES; i++) {
+		char *path = texturePath(dir, name, i);
+		bool claimed = rClaimTexture(path, rTextureFormat(i), &images[i]);
+
+		sdsfree(path);
 
+		if (claimed && ! readImage(&images[i], dir, name, i)) {
+			rFreeMaterialImages(images, dir, name);
+			return false;
+		}
+	}
 	return true;
 }
 
+//
+// Free `images`, read with `rReadMaterialImages`, dropping the claims of
+// those which weren't made into textures.
+//
+void rFreeMaterialImages(struct texImage *images, const char *dir, const char *name)
+{
+	for (int i = 0; i < TEXTURE_TYPES; i++) {
+		char *path = texturePath(dir, name, i);
+
+		rUnclaimTexture(path, rTextureFormat(i), &images[i]);
+		rFreeTexImage(&images[i]);
+		sdsfree(path);
+	}
+}
+
 struct material *rNewBasicMaterial(struct shader *s)
 {
+	static unsigned ids = 0;
 	struct material *m = malloc(sizeof(*m));
 
 	memset(m, 0, sizeof(*m));
 	m->shader = s;
+	m->id = ++ids;
 
 	return m;
 }
 
-struct material *rNewMaterial(struct shader *s, const char *dir, const char *name)
+//
+// Get the texture of type `type` of material `name` in `dir` from the cache,
+// or create it from `img`, reading it on the spot if `img` is NULL or empty.
+// Textures created from `img` are left empty unless `upload` is set.
+//
+static struct texture *rLoadMaterialTexture(const char *dir, const char *name, enum textureType type, const struct texImage *img, bool upload)
 {
-	struct material *m = rNewBasicMaterial(s);
+	char *path = texturePath(dir, name, type);
+	GLint format = rTextureFormat(type);
+	struct texture *t;
+	struct texImage read;
+
+	if ((t = rAcquireTexture(path, format))) {
+		sdsfree(path);
+		return t;
+	}
+	if (! img || ! img->nlevels) {
+		if (! readImage(&read, dir, name, type)) {
+			sdsfree(path);
+			return NULL;
+		}
+		img = &read;
+		upload = true;
+	}
+	t = rNewImageTexture(img, format, upload);
+	t->index = type;
+	t->sampler = rAcquireSampler(GL_LINEAR_MIPMAP_NEAREST, GL_LINEAR);
+
+	if (img == &read)
+		rFreeTexImage(&read);
+
+	rCacheTexture(path, format, t);
+	sdsfree(path);
+
+	return t;
+}
+
+//
+// Get the material `name` in `dir` for shader `s`, with its textures, from
+// the cache if it's there. Otherwise, it's created and cached. Its textures
+// are created from `images` when given, or else read on the spot. Unless
+// `upload` is set, textures created from `images` are left empty, and it's up
+// to the caller to fill them in, and generate the mipmaps of those which
+// weren't precompressed. Returns NULL if any of the textures couldn't be
+// loaded.
+//
+struct material *rNewMaterial(struct shader *s, const char *dir, const char *name, const struct texImage *images, bool upload)
+{
+	struct material *m;
+
+	if ((m = rAcquireMaterial(s, dir, name)))
+		return m;
+
+	m = rNewBasicMaterial(s);
 
-	memset(m->textures, 0, sizeof(m->textures));
+	for (int i = 0; i < TEXTURE_TYPES; i++) {
+		m->textures[i] = rLoadMaterialTexture(dir, name, i, images ? &images[i] : NULL, upload);
 
-	if (! rLoadMaterialTexture(m, dir, name, TEXTURE_TYPE_DIFFUSE))
-		return NULL;
-	if (! rLoadMaterialTexture(m, dir, name, TEXTURE_TYPE_SPECULAR))
-		return NULL;
-	if (! rLoadMaterialTexture(m, dir, name, TEXTURE_TYPE_NORMAL))
-		return NULL;
+		if (! m->textures[i]) {
+			rReleaseMaterial(m);
+			return NULL;
+		}
+	}
+	rCacheMaterial(s, dir, name, m);
 
 	return m;
 }
@@ -1,9 +1,14 @@
+struct texImage;
+
 struct material {
 	struct texture *textures[TEXTURE_TYPES];
 	struct shader  *shader;
 	GLuint         sampler;
+	unsigned       id; // Unique to every material, used to sort draws
 };
 
-extern struct material *rNewMaterial(struct shader *, const char *, const char *);
+extern struct material *rNewMaterial(struct shader *, const char *, const char *, const struct texImage *, bool);
 extern struct material *rNewBasicMaterial(struct shader *);
+extern bool rReadMaterialImages(struct texImage *, const char *, const char *);
+extern void rFreeMaterialImages(struct texImage *, const char *, const char *);
 extern void rSetMaterialProperty4fv(struct material *, const char *, vec4);
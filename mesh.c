@@ -1,5 +1,9 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
 #include <GL/glew.h>
 
 #include "linmath.h"
@@ -9,46 +13,333 @@
 #include "common.h"
 #include "skeleton.h"
 #include "mesh.h"
+#include "renderer.h"
+#include "state.h"
+#include "geometry.h"
 
 char *strdup(const char *);
 
-static void rInitMesh(struct mesh *m)
+// Largest on-screen error, in pixels, tolerated when selecting a level of detail.
+static const float LOD_PIXEL_ERROR = 1.0f;
+
+//
+// Description of a single vertex attribute within a vertex format.
+//
+struct vertexAttrib {
+	GLuint     location;
+	GLint      size;
+	GLenum     type;
+	GLboolean  normalized;
+	bool       integer;
+	size_t     offset;
+};
+
+enum { MAX_VERTEX_ATTRIBS = 6 };
+
+static const struct vertexAttrib VERTEX_ATTRIBS[VERTEX_FORMATS][MAX_VERTEX_ATTRIBS] = {
+	[VERTEX_FORMAT_FULL] = {
+		{ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, false, offsetof(struct vertex, pos)},
+		{ATTRIB_NORMAL,   3, GL_FLOAT, GL_TRUE,  false, offsetof(struct vertex, normal)},
+		{ATTRIB_TANGENT,  4, GL_FLOAT, GL_TRUE,  false, offsetof(struct vertex, tangent)},
+		{ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, false, offsetof(struct vertex, uv)},
+		{ATTRIB_BONES,    4, GL_INT,   GL_FALSE, true,  offsetof(struct vertex, bones)},
+		{ATTRIB_WEIGHTS,  4, GL_FLOAT, GL_FALSE, false, offsetof(struct vertex, weights)}
+	},
+	[VERTEX_FORMAT_PACKED] = {
+		{ATTRIB_POSITION, 4, GL_HALF_FLOAT,         GL_FALSE, false, offsetof(struct packedVertex, pos)},
+		{ATTRIB_NORMAL,   4, GL_INT_2_10_10_10_REV, GL_TRUE,  false, offsetof(struct packedVertex, normal)},
+		{ATTRIB_TANGENT,  4, GL_INT_2_10_10_10_REV, GL_TRUE,  false, offsetof(struct packedVertex, tangent)},
+		{ATTRIB_TEXCOORD, 2, GL_HALF_FLOAT,         GL_FALSE, false, offsetof(struct packedVertex, uv)}
+	},
+	[VERTEX_FORMAT_PACKED_SKINNED] = {
+		{ATTRIB_POSITION, 4, GL_HALF_FLOAT,         GL_FALSE, false, offsetof(struct packedVertex, pos)},
+		{ATTRIB_NORMAL,   4, GL_INT_2_10_10_10_REV, GL_TRUE,  false, offsetof(struct packedVertex, normal)},
+		{ATTRIB_TANGENT,  4, GL_INT_2_10_10_10_REV, GL_TRUE,  false, offsetof(struct packedVertex, tangent)},
+		{ATTRIB_TEXCOORD, 2, GL_HALF_FLOAT,         GL_FALSE, false, offsetof(struct packedVertex, uv)},
+		{ATTRIB_BONES,    4, GL_UNSIGNED_BYTE,      GL_FALSE, true,  offsetof(struct packedVertex, bones)},
+		{ATTRIB_WEIGHTS,  4, GL_UNSIGNED_BYTE,      GL_TRUE,  false, offsetof(struct packedVertex, weights)}
+	}
+};
+
+//
+// Size in bytes of a single vertex of format `f`.
+//
+size_t vertexFormatSize(enum vertexFormat f)
 {
-	// Store the following attrib properties in the vao
-	glGenVertexArrays(1, &m->vao);
-	glBindVertexArray(m->vao);
+	switch (f) {
+	case VERTEX_FORMAT_FULL:           return sizeof(struct vertex);
+	case VERTEX_FORMAT_PACKED:         return offsetof(struct packedVertex, bones);
+	case VERTEX_FORMAT_PACKED_SKINNED: return sizeof(struct packedVertex);
+	default:                           return 0;
+	}
+}
 
-	glGenBuffers(1, &m->vbo); // Create a VBO
-	glBindBuffer(GL_ARRAY_BUFFER, m->vbo); // Make it the active object
-	glBufferData(GL_ARRAY_BUFFER, m->nvertices * sizeof(struct vertex), (GLfloat *)m->vertices, GL_STATIC_DRAW); // Copy vertex data to it
+//
+// Convert the IEEE 754 half-precision float `h` to a float.
+//
+static float halfToFloat(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	union { uint32_t u; float f; } bits;
 
-	if (m->faces) {
-		glGenBuffers(1, &m->ebo); // Create a EBO
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ebo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, m->nfaces * 3 * sizeof(unsigned int), m->faces, GL_STATIC_DRAW);
+	if (exponent == 0x1f) {
+		bits.u = sign | 0x7f800000 | mantissa << 13;
+	} else if (exponent != 0) {
+		bits.u = sign | (exponent + 112) << 23 | mantissa << 13;
+	} else {
+		// Zero or subnormal, scaled by 2^-24.
+		bits.f = mantissa / 16777216.0f;
+		bits.u |= sign;
 	}
-	m->isVisible = true;
+	return bits.f;
+}
+
+//
+// Decode the positions of `n` vertices of format `format` into `out`, for
+// the position stream of depth-only draws.
+//
+void meshPositions(enum vertexFormat format, const void *vertices, size_t n, vec3 *out)
+{
+	const unsigned char *v = vertices;
+	size_t stride = vertexFormatSize(format);
+
+	for (size_t i = 0; i < n; i++, v += stride) {
+		if (format == VERTEX_FORMAT_FULL) {
+			memcpy(&out[i], v + offsetof(struct vertex, pos), sizeof(out[i]));
+			continue;
+		}
+		const struct packedVertex *p = (const struct packedVertex *)v;
+
+		out[i] = (vec3){halfToFloat(p->pos[0]), halfToFloat(p->pos[1]), halfToFloat(p->pos[2])};
+	}
+}
+
+//
+// Point the attributes of the bound vertex array at the bound vertex buffer,
+// according to vertex format `format`. Attribute locations are the same in
+// every program, so this is only done once, when the vertex array is created.
+//
+void rSetVertexAttribs(enum vertexFormat format)
+{
+	GLsizei stride = vertexFormatSize(format);
+
+	for (int i = 0; i < MAX_VERTEX_ATTRIBS; i++) {
+		const struct vertexAttrib *a = &VERTEX_ATTRIBS[format][i];
+
+		if (a->size == 0)
+			break;
+
+		glEnableVertexAttribArray(a->location);
+
+		if (a->integer) {
+			glVertexAttribIPointer(a->location, a->size, a->type, stride, (void *)a->offset);
+		} else {
+			glVertexAttribPointer(a->location, a->size, a->type, a->normalized, stride, (void *)a->offset);
+		}
+	}
+}
+
+//
+// Point the per-instance model matrix of the bound vertex array at `offset`
+// bytes into the bound vertex buffer. A matrix attribute takes one location
+// per column.
+//
+void rSetInstanceAttribs(size_t offset)
+{
+	for (int c = 0; c < 4; c++) {
+		GL(glVertexAttribPointer(ATTRIB_INSTANCE + c, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void *)(offset + c * sizeof(vec4))));
+	}
+}
+
+//
+// Enable the per-instance model matrix of the bound vertex array, advancing
+// once per instance, and point it at the start of the bound vertex buffer.
+//
+void rEnableInstanceAttribs(void)
+{
+	for (int c = 0; c < 4; c++) {
+		glEnableVertexAttribArray(ATTRIB_INSTANCE + c);
+		glVertexAttribDivisor(ATTRIB_INSTANCE + c, 1);
+	}
+	rSetInstanceAttribs(0);
+}
+
+//
+// Size in bytes of an index of type `t`.
+//
+size_t indexTypeSize(GLenum t)
+{
+	return t == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
 
-	glBindVertexArray(0);
+//
+// Allocate the geometry of `m` in the shared arena, and fill it in with
+// `vertices` and `faces` when given.
+//
+static void rInitMesh(struct mesh *m, const void *vertices, const void *faces)
+{
+	rAllocMeshGeometry(m);
+
+	// The copy target is used so as not to disturb the index buffer binding
+	// of the bound vertex array.
+	if (vertices) {
+		size_t stride = vertexFormatSize(m->format);
+
+		rBindBuffer(GL_COPY_WRITE_BUFFER, m->vbo);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, m->baseVertex * stride, m->nvertices * stride, vertices);
 
-	// GL_STATIC_DRAW: The vertex data will be uploaded once and drawn many times (e.g. the world).
-	// GL_DYNAMIC_DRAW: The vertex data will be changed from time to time, but drawn many times more than that.
-	// GL_STREAM_DRAW: The vertex data will change almost every time it's drawn (e.g. user interface).
+		vec3 *positions = malloc(m->nvertices * sizeof(*positions));
+		meshPositions(m->format, vertices, m->nvertices, positions);
+
+		rBindBuffer(GL_COPY_WRITE_BUFFER, m->pbo);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, m->baseVertex * sizeof(*positions), m->nvertices * sizeof(*positions), positions);
+		free(positions);
+	}
+	if (faces && m->nfaces > 0) {
+		rBindBuffer(GL_COPY_WRITE_BUFFER, m->ebo);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, m->indexOffset, m->nfaces * 3 * indexTypeSize(m->indexType), faces);
+	}
+	m->isVisible = true;
 }
 
 void meshFree(struct mesh *m)
 {
-	glDeleteBuffers(1, &m->vbo);
+	free(m->clusters);
+	free(m->drawCounts);
+	free(m->drawOffsets);
+	free(m->drawBaseVertices);
+	free(m->lods);
+	free(m->occluderVertices);
+	free(m->occluderIndices);
 
-	if (m->ebo)
-		glDeleteBuffers(1, &m->ebo);
-	if (m->vao)
-		glDeleteVertexArrays(1, &m->vao);
+	rFreeMeshGeometry(m);
 
 	free(m->name);
 	free(m);
 }
 
+//
+// Copy `n` clusters to `m`. Until they are culled, the whole mesh is drawn.
+//
+void meshSetClusters(struct mesh *m, const struct mdlCluster *clusters, size_t n)
+{
+	m->clusters = malloc(n * sizeof(*m->clusters));
+	m->nclusters = n;
+	m->drawCounts = malloc(n * sizeof(*m->drawCounts));
+	m->drawOffsets = malloc(n * sizeof(*m->drawOffsets));
+	m->drawBaseVertices = malloc(n * sizeof(*m->drawBaseVertices));
+
+	memcpy(m->clusters, clusters, n * sizeof(*clusters));
+
+	for (size_t i = 0; i < n; i++) {
+		m->drawBaseVertices[i] = m->baseVertex;
+	}
+	m->drawCounts[0] = m->nfaces * 3;
+	m->drawOffsets[0] = (const GLvoid *)m->indexOffset;
+	m->ndraws = 1;
+}
+
+//
+// Cull the clusters of `m` which face away from a viewer at `eye`, in model
+// space. The remaining index ranges are merged where they are contiguous, and
+// stored for the next draw. Returns the number of triangles left to draw.
+//
+size_t meshCullClusters(struct mesh *m, vec3 eye)
+{
+	size_t isize = indexTypeSize(m->indexType);
+	size_t visible = 0;
+	uint32_t end = UINT32_MAX;
+
+	// Clusters only partition the full-detail mesh.
+	if (m->lod > 0)
+		return m->lods[m->lod].count / 3;
+	if (m->nclusters == 0)
+		return m->nfaces;
+
+	m->ndraws = 0;
+
+	for (size_t i = 0; i < m->nclusters; i++) {
+		const struct mdlCluster *c = &m->clusters[i];
+		vec3 center = (vec3){c->center[0], c->center[1], c->center[2]};
+		vec3 axis = (vec3){c->axis[0], c->axis[1], c->axis[2]};
+		vec3 d = vec3sub(center, eye);
+
+		if (vec3dot(d, axis) >= c->cutoff * vec3len(d) + c->radius)
+			continue;
+
+		if (c->first == end) {
+			m->drawCounts[m->ndraws - 1] += c->count;
+		} else {
+			m->drawCounts[m->ndraws] = c->count;
+			m->drawOffsets[m->ndraws] = (const GLvoid *)(m->indexOffset + c->first * isize);
+			m->ndraws++;
+		}
+		end = c->first + c->count;
+		visible += c->count / 3;
+	}
+	return visible;
+}
+
+//
+// Set the bounding box of `m`, in model space, and the bounding sphere
+// around it.
+//
+void meshSetBounds(struct mesh *m, vec3 min, vec3 max)
+{
+	m->min = min;
+	m->max = max;
+	m->center = vec3scale(vec3add(min, max), 0.5f);
+	m->radius = vec3len(vec3sub(max, min)) * 0.5f;
+}
+
+//
+// Copy the occluder hull of `m`, made of `nvertices` positions of three
+// floats each, and `nindices` indices.
+//
+void meshSetOccluder(struct mesh *m, const float *vertices, size_t nvertices, const uint32_t *indices, size_t nindices)
+{
+	m->occluderVertices = malloc(nvertices * sizeof(*m->occluderVertices));
+	m->noccluderVertices = nvertices;
+	m->occluderIndices = malloc(nindices * sizeof(*m->occluderIndices));
+	m->noccluderIndices = nindices;
+
+	for (size_t i = 0; i < nvertices; i++) {
+		m->occluderVertices[i] = (vec3){vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]};
+	}
+	memcpy(m->occluderIndices, indices, nindices * sizeof(*indices));
+}
+
+//
+// Copy `n` levels of detail to `m`. The full-detail mesh is selected.
+//
+void meshSetLods(struct mesh *m, const struct mdlLod *lods, size_t n)
+{
+	m->lods = malloc(n * sizeof(*m->lods));
+	m->nlods = n;
+	m->lod = 0;
+
+	memcpy(m->lods, lods, n * sizeof(*lods));
+}
+
+//
+// Select the coarsest level of detail of `m` whose error stays under
+// LOD_PIXEL_ERROR on screen, where `scale` is the number of pixels covered by
+// one model unit. Returns the selected level.
+//
+size_t meshSelectLod(struct mesh *m, float scale)
+{
+	m->lod = 0;
+
+	for (size_t i = 1; i < m->nlods; i++) {
+		if (m->lods[i].error * scale > LOD_PIXEL_ERROR)
+			break;
+		m->lod = i;
+	}
+	return m->lod;
+}
+
 struct mesh *rNewMesh(name, mat, nverts, verts, nfaces, faces, sk)
 	const char      *name;
 	struct material *mat;
@@ -57,47 +348,126 @@ struct mesh *rNewMesh(name, mat, nverts, verts, nfaces, faces, sk)
 	size_t          nfaces;
 	unsigned int    *faces;
 	struct skeleton *sk;
+{
+	struct mesh *m = rNewMeshFormat(name, mat, VERTEX_FORMAT_FULL, nverts, verts, GL_UNSIGNED_INT, nfaces, faces, sk);
+	m->vertices = verts;
+	m->faces = faces;
+
+	return m;
+}
+
+//
+// Create a mesh from `nverts` vertices of format `format`, and `nfaces`
+// triangles with indices of type `indexType`. Only meshes created with
+// `rNewMesh` keep a reference to their vertices and faces.
+//
+struct mesh *rNewMeshFormat(const char *name, struct material *mat, enum vertexFormat format, size_t nverts,
+                            const void *verts, GLenum indexType, size_t nfaces, const void *faces, struct skeleton *sk)
 {
 	struct mesh *m = malloc(sizeof(*m));
 	m->name = name == NULL ? NULL : strdup(name);
 	m->skeleton = sk;
 	m->material = mat;
+	m->format = format;
 	m->nvertices = nverts;
-	m->vertices = verts;
+	m->vertices = NULL;
+	m->indexType = indexType;
 	m->nfaces = nfaces;
-	m->faces = faces;
+	m->faces = NULL;
 	m->ebo = 0;
 	m->vbo = 0;
 	m->vao = 0;
+	m->pbo = 0;
+	m->depthVao = 0;
+	m->page = NULL;
+	m->baseVertex = 0;
+	m->indexOffset = 0;
+	meshSetBounds(m, (vec3){0, 0, 0}, (vec3){0, 0, 0});
+	m->clusters = NULL;
+	m->nclusters = 0;
+	m->drawCounts = NULL;
+	m->drawOffsets = NULL;
+	m->drawBaseVertices = NULL;
+	m->ndraws = 0;
+	m->lods = NULL;
+	m->nlods = 0;
+	m->lod = 0;
+	m->occluderVertices = NULL;
+	m->noccluderVertices = 0;
+	m->occluderIndices = NULL;
+	m->noccluderIndices = 0;
 
-	rInitMesh(m);
+	rInitMesh(m, verts, faces);
 
 	return m;
 }
 
-// TODO(cloudhead): Use shader API.
-// TODO(cloudhead): rDrawMdl should use this function.
-void rDrawMesh(struct mesh *m, mat4 *transform)
+//
+// Issue the draw call for the selected level of detail of `m`, or its
+// clusters which survived culling. The mesh's vertex array and program must
+// be bound.
+//
+void rDrawMeshGeometry(struct mesh *m)
 {
-	GLuint program = m->material->shader->handle;
-	glUseProgram(program);
-	glBindBuffer(GL_ARRAY_BUFFER, m->vbo); // Make it the active object
+	const GLvoid *indices = (const GLvoid *)m->indexOffset;
 
-	glBindVertexArray(m->vao);
+	if (m->lod > 0) {
+		const struct mdlLod *l = &m->lods[m->lod];
+		indices = (const GLvoid *)(m->indexOffset + l->first * indexTypeSize(m->indexType));
+		GL(glDrawElementsBaseVertex(GL_TRIANGLES, l->count, m->indexType, indices, m->baseVertex));
+	} else if (m->nclusters > 0) {
+		GL(glMultiDrawElementsBaseVertex(GL_TRIANGLES, m->drawCounts, m->indexType, m->drawOffsets, m->ndraws, m->drawBaseVertices));
+	} else if (m->ebo) {
+		GL(glDrawElementsBaseVertex(GL_TRIANGLES, m->nfaces * 3, m->indexType, indices, m->baseVertex));
+	} else {
+		GL(glDrawArrays(GL_TRIANGLES, m->baseVertex, m->nvertices));
+	}
+	RENDER_STATS.drawCalls++;
+}
 
-	GLint uniModel = glGetUniformLocation(program, "model");
-	glUniformMatrix4fv(uniModel, 1, GL_FALSE, (float *)transform->cols);
+//
+// Issue the draw call for the selected level of detail of `m` in full,
+// ignoring cluster culling, which only holds for the camera and the model
+// transform. Used by depth-only passes, with the mesh's depth vertex array
+// bound, and for copies of the mesh under other transforms.
+//
+void rDrawMeshLod(struct mesh *m)
+{
+	const GLvoid *indices = (const GLvoid *)m->indexOffset;
+	GLsizei n = m->nfaces * 3;
 
-	GLint posAttrib = glGetAttribLocation(program, "position");
-	glEnableVertexAttribArray(posAttrib);
-	glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 0);
+	if (m->lod > 0) {
+		const struct mdlLod *l = &m->lods[m->lod];
+		indices = (const GLvoid *)(m->indexOffset + l->first * indexTypeSize(m->indexType));
+		n = l->count;
+	}
+	if (m->ebo) {
+		GL(glDrawElementsBaseVertex(GL_TRIANGLES, n, m->indexType, indices, m->baseVertex));
+	} else {
+		GL(glDrawArrays(GL_TRIANGLES, m->baseVertex, m->nvertices));
+	}
+	RENDER_STATS.drawCalls++;
+}
 
-	if (m->faces) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ebo);
-		glDrawElements(GL_TRIANGLES, m->nfaces * 3, GL_UNSIGNED_INT, 0);
+//
+// Issue an instanced draw call of `m`, for `count` instances. Clusters are
+// culled against a single transform, so instances always draw the selected
+// level of detail in full.
+//
+void rDrawMeshInstances(struct mesh *m, size_t count)
+{
+	const GLvoid *indices = (const GLvoid *)m->indexOffset;
+	GLsizei n = m->nfaces * 3;
+
+	if (m->lod > 0) {
+		const struct mdlLod *l = &m->lods[m->lod];
+		indices = (const GLvoid *)(m->indexOffset + l->first * indexTypeSize(m->indexType));
+		n = l->count;
+	}
+	if (m->ebo) {
+		GL(glDrawElementsInstancedBaseVertex(GL_TRIANGLES, n, m->indexType, indices, count, m->baseVertex));
 	} else {
-		glDrawArrays(GL_TRIANGLES, 0, m->nvertices);
+		GL(glDrawArraysInstanced(GL_TRIANGLES, m->baseVertex, m->nvertices, count));
 	}
-	glUseProgram(0);
-	glBindVertexArray(0);
+	RENDER_STATS.drawCalls++;
 }
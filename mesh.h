@@ -1,18 +1,58 @@
 struct mesh {
-	char            *name;
-	GLuint          vbo;
-	GLuint          vao;
-	GLuint          ebo;
-	struct vertex   *vertices;
-	size_t          nvertices;
-	unsigned int    *faces;
-	size_t          nfaces;
-	struct material *material;
-	struct skeleton *skeleton;
-	bool            isVisible;
+	char                *name;
+	GLuint              vbo; // Buffers and vertex array of the page the mesh lives in
+	GLuint              vao;
+	GLuint              ebo;
+	GLuint              pbo;      // Position stream of the page, and the vertex array reading
+	GLuint              depthVao; // only from it, for depth-only draws
+	struct geometryPage *page;
+	GLint               baseVertex;  // First vertex of the mesh in its page
+	size_t              indexOffset; // Byte offset of the first index of the mesh in its page
+	size_t              pageVertices;   // Size of the ranges allocated from the page, which
+	size_t              pageIndexBytes; // outlive changes to the vertex and face counts
+	enum vertexFormat   format;
+	struct vertex       *vertices;
+	size_t              nvertices;
+	unsigned int        *faces;
+	GLenum              indexType; // Either GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	size_t              nfaces;
+	struct material     *material;
+	struct skeleton     *skeleton;
+	bool                isVisible;
+	vec3                min, max; // Bounding box, in model space
+	vec3                center;   // Bounding sphere, around the bounding box
+	float               radius;
+	struct mdlCluster   *clusters;
+	size_t              nclusters;
+	GLsizei             *drawCounts;  // Index ranges that survived cluster culling
+	const GLvoid        **drawOffsets;
+	GLint               *drawBaseVertices;
+	GLsizei             ndraws;
+	struct mdlLod       *lods;
+	size_t              nlods;
+	size_t              lod; // Level of detail to draw
+	vec3                *occluderVertices; // Occluder hull, in model space, if any
+	size_t              noccluderVertices;
+	uint32_t            *occluderIndices;
+	size_t              noccluderIndices;
 };
 
 extern void meshInit(struct mesh *);
 extern void meshFree(struct mesh *);
-extern void rDrawMesh(struct mesh *, mat4 *);
+extern void meshSetClusters(struct mesh *, const struct mdlCluster *, size_t);
+extern size_t meshCullClusters(struct mesh *, vec3);
+extern void meshSetBounds(struct mesh *, vec3, vec3);
+extern void meshSetOccluder(struct mesh *, const float *, size_t, const uint32_t *, size_t);
+extern void meshSetLods(struct mesh *, const struct mdlLod *, size_t);
+extern size_t meshSelectLod(struct mesh *, float);
+extern void rDrawMeshGeometry(struct mesh *);
+extern void rDrawMeshInstances(struct mesh *, size_t);
+extern void rDrawMeshLod(struct mesh *);
+extern void meshPositions(enum vertexFormat, const void *, size_t, vec3 *);
+extern size_t vertexFormatSize(enum vertexFormat);
+extern void rSetVertexAttribs(enum vertexFormat);
+extern void rSetInstanceAttribs(size_t);
+extern void rEnableInstanceAttribs(void);
+extern size_t indexTypeSize(GLenum);
+extern struct mesh *rNewMeshFormat(const char *, struct material *, enum vertexFormat, size_t, const void *, GLenum, size_t, const void *, struct skeleton *);
 extern struct mesh *rNewMesh(const char *, struct material *, size_t, struct vertex *, size_t, unsigned int *, struct skeleton *);
@@ -7,12 +7,15 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
-#include <assert.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
 #include <dirent.h>
 #include <sys/types.h>
 #include <GL/glew.h>
 
 #include "linmath.h"
+#include "camera.h"
 #include "shader.h"
 #include "texture.h"
 #include "common.h"
@@ -21,7 +24,14 @@
 #include "sds.h"
 #include "material.h"
 #include "util.h"
+#include "pack.h"
+#include "cache.h"
 #include "skeleton.h"
+#include "queue.h"
+#include "cull.h"
+#include "occlusion.h"
+#include "shadow.h"
+#include "renderer.h"
 
 static const int  MAGIC_NUMBER  = 236;
 static const char ASSET_DIR[]   = "assets";
@@ -31,254 +41,825 @@ static const char MESH_EXT[]    = ".mesh";
 
 char *strdup(const char *s);
 
-const char *textureSamplerNames[] = {
-	[TEXTURE_TYPE_DIFFUSE] = "diffuseSampler",
-	[TEXTURE_TYPE_NORMAL] = "normalSampler",
-	[TEXTURE_TYPE_SPECULAR] = "specularSampler"
-};
+// Scratch space for culling the meshes of a model, grown as needed.
+static struct {
+	struct boxList boxes;
+	bool           *visible;
+	size_t         cap;
+} CULL;
 
 void rFreeMdl(struct model *m)
 {
 	for (int i = 0; i < m->nmeshes; i++) {
+		if (m->meshes[i]->material)
+			rReleaseMaterial(m->meshes[i]->material);
+
 		meshFree(m->meshes[i]);
 	}
 	free(m->meshes);
 	free(m);
 }
 
-static struct material *rLoadMdlMaterial(char *name, const char *shader, const char *dir)
+//
+// Create the material of the mesh described by `d`. Unless `upload` is set,
+// its textures are allocated but left empty.
+//
+static struct material *rLoadMdlMaterial(const struct mdlFile *f, const struct mdlMeshDesc *d, bool upload)
 {
-	const char *parts[] = {ASSET_DIR, dir, TEXTURE_DIR};
-	char *path = sdsjoin((char **)parts, 3, "/", 1);
-
-	struct shader *s = rGetShader(shader);
-	struct material *mat;
+	const char *parts[] = {ASSET_DIR, f->dir, TEXTURE_DIR};
+	struct shader *s = rGetShader(d->shader);
+	struct material *mat = NULL;
 
 	if (! s) {
-		fprintf(stderr, "couldn't find shader '%s'.\n", shader);
+		fprintf(stderr, "couldn't find shader '%s'.\n", d->shader);
 		return NULL;
 	}
-	if (! (mat = rNewMaterial(s, path, name))) {
-		mat = rNewBasicMaterial(s);
+	if (d->textured) {
+		char *path = sdsjoin((char **)parts, 3, "/", 1);
+		mat = rNewMaterial(s, path, d->name, d->images, upload);
+		sdsfree(path);
 	}
-	sdsfree(path);
+	return mat ? mat : rNewBasicMaterial(s);
+}
+
+//
+// Read the textures of mesh `i` of `f`, if it has any. Textures which are
+// already cached, or which an earlier mesh of `f` or another file is reading,
+// are skipped.
+//
+static void rReadMdlImages(struct mdlFile *f, int i)
+{
+	const char *parts[] = {ASSET_DIR, f->dir, TEXTURE_DIR};
+	struct mdlMeshDesc *d = &f->meshes[i];
+	char *path = sdsjoin((char **)parts, 3, "/", 1);
+
+	d->images = NULL;
+	d->textured = rIsMaterialCached(d->shader, path, d->name);
+
+	for (int j = 0; j < i && ! d->textured; j++) {
+		d->textured = f->meshes[j].textured && ! strcmp(f->meshes[j].name, d->name);
+	}
+	if (! d->textured) {
+		d->images = malloc(TEXTURE_TYPES * sizeof(*d->images));
+		d->textured = rReadMaterialImages(d->images, path, d->name);
 
-	return mat;
+		if (! d->textured) {
+			free(d->images);
+			d->images = NULL;
+		}
+	}
+	sdsfree(path);
 }
 
 // File format:
 //
 //   COMMAND <space> '"' VALUE '"' '\n'
 //
-static bool rLoadMdlMetadata(struct model *mdl, const char *dir)
+static bool rLoadMdlMetadata(const char *name, const char *dir)
 {
-	const char *parts[] = {ASSET_DIR, (char *)dir, (char *)mdl->name};
+	const char *parts[] = {ASSET_DIR, (char *)dir, (char *)name};
 	char *path = sdscat(sdsjoin((char **)parts, 3, "/", 1), META_EXT);
 	char line[512], cmd[32], val[256];
+	const char *data;
+	size_t size, off = 0;
+
+	data = assetOpen(path, &size);
+	sdsfree(path);
 
-	FILE *fp = fopen(path, "r");
+	if (! data)
+		return false;
 
-	while (fgets(line, sizeof(line), fp) != NULL) {
+	while (off < size) {
 		char *lineptr = line, *cmdptr = cmd, *valptr = val;
+		size_t len = 0;
+
+		// Copy the next line out of the asset, so it's NUL-terminated.
+		while (off < size && len < sizeof(line) - 1) {
+			if ((line[len++] = data[off++]) == '\n')
+				break;
+		}
+		line[len] = '\0';
 
 		while (*lineptr != ' ') *cmdptr++ = *lineptr++;
 
 		*cmdptr = '\0'; lineptr++; // skip ' '
 
-		if (*lineptr++ != '"') return false;
+		if (*lineptr++ != '"') break;
 		while (*lineptr != '"') *valptr++ = *lineptr++;
 
 		*valptr = '\0';
 
-		if (*lineptr++ != '"')  return false;
-		if (*lineptr++ != '\n') return false;
+		if (*lineptr++ != '"')  break;
+		if (*lineptr++ != '\n') break;
 	}
-	return true;
+	assetClose(data, size);
+
+	return off == size;
 }
 
-static bool rLoadMdlMeshes(struct model *mdl, const char *dir)
+//
+// Read cursor over a memory-mapped model file.
+//
+struct reader {
+	const unsigned char *ptr;
+	const unsigned char *end;
+	struct mdlLoadStats *stats;
+};
+
+static struct mdlLoadStats MDL_LOAD_STATS;
+
+//
+// Return a pointer to the next `n` bytes of the mapping and advance past them,
+// or NULL if the file is truncated. Sizes computed from counts in the file
+// are passed as 64-bit, so that they can't wrap around.
+//
+static const void *readptr(struct reader *r, uint64_t n)
 {
-	const char *parts[] = {ASSET_DIR, dir, mdl->name};
-	char *path = sdscat(sdsjoin((char **)parts, 3, "/", 1), MESH_EXT);
+	const void *p = r->ptr;
+
+	if ((uint64_t)(r->end - r->ptr) < n)
+		return NULL;
+
+	r->ptr += n;
 
-	FILE *fp = fopen(path, "rb");
+	return p;
+}
 
-	rLoadMdlMetadata(mdl, dir);
+//
+// Copy the next `n` bytes of the mapping into `dst`.
+//
+static bool readbytes(struct reader *r, void *dst, size_t n)
+{
+	const void *p;
 
-	if (!fp) {
-		fprintf(stderr, "couldn't fopen %s\n", path);
+	if (! (p = readptr(r, n)))
 		return false;
-	}
 
-	unsigned char magic = 0;
-	fread(&magic, 1, 1, fp);
-	if (magic != MAGIC_NUMBER) {
-		fprintf(stderr, "file isn't a lourland model.\n");
+	memcpy(dst, p, n);
+	r->stats->copied += n;
+
+	return true;
+}
+
+//
+// Read a length-prefixed string into `dst`, which must hold at least 256 bytes.
+//
+static bool readstr(struct reader *r, char *dst)
+{
+	unsigned char len;
+
+	if (! readbytes(r, &len, 1))
 		return false;
+	if (! readbytes(r, dst, len))
+		return false;
+
+	dst[len] = '\0';
+
+	return true;
+}
+
+static void freeSkeleton(struct skeleton *sk)
+{
+	for (int i = 0; i < sk->nbones; i++) {
+		free(sk->bones[i].name);
 	}
+	free(sk->bones);
+	free(sk);
+}
+
+//
+// Read a bone table, or return NULL if the file ends before it does. Each
+// bone takes at least `BONE_SIZE` bytes, so the count is checked against
+// what's left of the file before anything is allocated.
+//
+static struct skeleton *rReadMdlSkeleton(struct reader *r)
+{
+	enum { BONE_SIZE = 1 + 2 * sizeof(mat4) + 4 };
+	struct skeleton *sk;
+	uint32_t nbones = 0;
+	char name[256];
 
-	fread(&mdl->nmeshes, 4, 1, fp);
-	mdl->meshes = malloc(mdl->nmeshes * sizeof(struct mesh *));
+	if (! readbytes(r, &nbones, 4))
+		return NULL;
+	if (nbones > (r->end - r->ptr) / BONE_SIZE)
+		return NULL;
 
-	for (int i = 0; i < mdl->nmeshes; i++) {
-		unsigned int material = 0;
-		struct material *mat = NULL;
-		struct vertex *vertices = NULL;
-		unsigned int *faces = NULL;
-		size_t nfaces = 0;
-		size_t nvertices = 0;
+	sk = malloc(sizeof(*sk));
+	sk->bones = malloc(nbones * sizeof(struct bone));
+	sk->nbones = 0;
 
-		// Read mesh name
-		int len = fgetc(fp);
-		char name[len + 1];
+	for (int j = 0; j < nbones; j++) {
+		struct bone *b = &sk->bones[j];
+
+		// Bone matrices are copied rather than referenced, since `mat4` requires
+		// an alignment the file doesn't guarantee.
+		bool ok = readstr(r, name) &&
+		          readbytes(r, &b->offset, sizeof(mat4)) &&
+		          readbytes(r, &b->transform, sizeof(mat4)) &&
+		          readbytes(r, &b->parentId, 4);
+
+		if (! ok) {
+			freeSkeleton(sk);
+			return NULL;
+		}
+		b->name = strdup(name);
+		b->length = 0.1f;
+		sk->nbones++;
+	}
+	return sk;
+}
+
+//
+// Check that each of the `n` indices at `indices`, of `indexSize` bytes,
+// references one of `nvertices` vertices. Indices are uploaded as they are,
+// and an index past the end would make the GPU read vertices of another mesh
+// of the same geometry page, or past the end of its buffer. The indices are
+// copied out one at a time, since those of version 1 files may not be aligned.
+//
+static bool validIndices(const void *indices, size_t n, uint32_t indexSize, uint32_t nvertices)
+{
+	for (size_t i = 0; i < n; i++) {
+		const unsigned char *p = (const unsigned char *)indices + i * indexSize;
+		uint32_t index;
 
-		if (len > 0) {
-			fread(name, len, 1, fp);
-			name[len] = '\0';
+		if (indexSize == 2) {
+			uint16_t narrow;
+
+			memcpy(&narrow, p, sizeof(narrow));
+			index = narrow;
 		} else {
-			strcpy(name, mdl->name);
+			memcpy(&index, p, sizeof(index));
 		}
 
-		{ // Read shader name and load material
-			int len = fgetc(fp);
-			char shader[len + 1];
+		if (index >= nvertices)
+			return false;
+	}
+	return true;
+}
+
+//
+// Read meshes from a version 1 file, which is a sequence of variable-length
+// records that has to be walked in order.
+//
+static bool rReadMdlMeshesV1(struct mdlFile *f, struct reader *r)
+{
+	uint32_t nmeshes = 0;
+
+	if (! readbytes(r, &nmeshes, 4))
+		return false;
+
+	f->meshes = calloc(nmeshes, sizeof(*f->meshes));
+
+	for (int i = 0; i < nmeshes; i++) {
+		struct mdlMeshDesc *d = &f->meshes[f->nmeshes];
+		uint32_t material = 0;
+		uint32_t nvertices = 0;
+		uint32_t nfaces = 0;
+		const unsigned char *vertices = NULL;
+		const unsigned char *faces = NULL;
+
+		// Read mesh name
+		if (! readstr(r, d->name))
+			return false;
+		if (! *d->name)
+			snprintf(d->name, sizeof(d->name), "%s", f->name);
+
+		// Read shader name
+		if (! readstr(r, d->shader))
+			return false;
+		if (! *d->shader)
+			strcpy(d->shader, "default");
+
+		// XXX: Unused
+		if (! readbytes(r, &material, sizeof(material)))
+			return false;
+
+		if (! (d->skeleton = rReadMdlSkeleton(r))) {
+			fprintf(stderr, "mesh %d has a truncated skeleton.\n", i);
+			return false;
+		}
+		f->nmeshes++;
+
+		// Reference vertices
+		if (! readbytes(r, &nvertices, 4))
+			return false;
+		if (! (vertices = readptr(r, (uint64_t)nvertices * sizeof(struct vertex))))
+			return false;
+
+		// Reference faces
+		if (! readbytes(r, &nfaces, 4))
+			return false;
+		if (! (faces = readptr(r, (uint64_t)nfaces * 3 * sizeof(uint32_t))))
+			return false;
+
+		if (nvertices == 0 || nfaces == 0) {
+			fprintf(stderr, "mesh %d is empty.\n", i);
+			return false;
+		}
+		if (! validIndices(faces, (size_t)nfaces * 3, sizeof(uint32_t), nvertices)) {
+			fprintf(stderr, "mesh %d has an index out of range.\n", i);
+			return false;
+		}
 
-			if (len > 0) {
-				fread(shader, len, 1, fp);
-				shader[len] = '\0';
-			} else {
-				sprintf(shader, "default");
+		d->format = VERTEX_FORMAT_FULL;
+		d->nvertices = nvertices;
+		d->vertices = vertices;
+		d->nfaces = nfaces;
+		d->nindices = (size_t)nfaces * 3;
+		d->indexType = GL_UNSIGNED_INT;
+		d->indices = faces;
+
+		// Version 1 files always store 32-bit indices. Narrow them when they
+		// fit, which costs a temporary copy but halves the index buffer. Like
+		// vertices, the indices may not be aligned in the mapping, so each
+		// one is copied out.
+		if (nvertices <= UINT16_MAX + 1) {
+			uint16_t *narrow = malloc(d->nindices * sizeof(uint16_t));
+
+			for (size_t j = 0; j < d->nindices; j++) {
+				uint32_t index;
+
+				memcpy(&index, faces + j * sizeof(index), sizeof(index));
+				narrow[j] = index;
 			}
-			if (! (mat = rLoadMdlMaterial(name, shader, dir))) {
-				fprintf(stderr, "couldn't load mesh material.\n");
+			d->indexType = GL_UNSIGNED_SHORT;
+			d->indices = d->narrowed = narrow;
+			r->stats->copied += d->nindices * sizeof(uint16_t);
+		}
+
+		// Version 1 files don't record bounds. Vertices follow the names
+		// of the mesh, so their positions are copied out rather than read
+		// in place, where they may not be aligned.
+		d->min = (vec3){ FLT_MAX,  FLT_MAX,  FLT_MAX};
+		d->max = (vec3){-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+		for (size_t j = 0; j < nvertices; j++) {
+			vec3 pos;
+
+			memcpy(&pos, vertices + j * sizeof(struct vertex) + offsetof(struct vertex, pos), sizeof(pos));
+
+			for (int k = 0; k < 3; k++) {
+				d->min.n[k] = fminf(d->min.n[k], pos.n[k]);
+				d->max.n[k] = fmaxf(d->max.n[k], pos.n[k]);
 			}
 		}
+		r->stats->uploaded += nvertices * sizeof(struct vertex) + d->nindices * indexTypeSize(d->indexType);
+	}
+	return true;
+}
 
-		// XXX: Unused
-		fread(&material, sizeof(material), 1, fp);
+//
+// Check that the `n` bytes at offset `off` lie within a file of `size` bytes.
+//
+static bool inbounds(uint64_t off, uint64_t n, size_t size)
+{
+	return off <= size && n <= size - off;
+}
+
+//
+// Read meshes from a version 2 file. The header and offset table are validated
+// up-front, then each mesh is read independently of the others, from its own
+// offsets.
+//
+static bool rReadMdlMeshesV2(struct mdlFile *f)
+{
+	const unsigned char *data = f->data;
+	size_t size = f->size;
+	const struct mdlHeader *h = (const struct mdlHeader *)data;
+	const struct mdlMeshEntry *entries;
+
+	if (size < sizeof(*h) || h->version != MDL_VERSION || h->size != size) {
+		fprintf(stderr, "unsupported or truncated model file.\n");
+		return false;
+	}
+	if (! inbounds(sizeof(*h), (uint64_t)h->nmeshes * sizeof(*entries), size))
+		return false;
+
+	if (h->occluders && ! inbounds(h->occluders, (uint64_t)h->nmeshes * sizeof(struct mdlOccluder), size))
+		return false;
+
+	entries = (const struct mdlMeshEntry *)(data + sizeof(*h));
+	f->meshes = calloc(h->nmeshes, sizeof(*f->meshes));
+
+	for (int i = 0; i < h->nmeshes; i++) {
+		const struct mdlMeshEntry *e = &entries[i];
+		struct mdlMeshDesc *d = &f->meshes[f->nmeshes];
+		struct skeleton *sk;
+
+		uint64_t vsize = (uint64_t)e->nvertices * e->stride;
+		uint64_t isize = (uint64_t)e->nindices * e->indexSize;
+
+		if (e->indexSize != 2 && e->indexSize != 4) {
+			fprintf(stderr, "mesh %d has an invalid index size.\n", i);
+			return false;
+		}
+		if (e->format >= VERTEX_FORMATS || e->stride != vertexFormatSize(e->format)) {
+			fprintf(stderr, "mesh %d has an unknown vertex format.\n", i);
+			return false;
+		}
+		if (! inbounds(e->clusters, (uint64_t)e->nclusters * sizeof(struct mdlCluster), size) || e->clusters % MDL_ALIGNMENT) {
+			fprintf(stderr, "mesh %d has an invalid offset table entry.\n", i);
+			return false;
+		}
+		if (! inbounds(e->lods, (uint64_t)e->nlods * sizeof(struct mdlLod), size) || e->lods % MDL_ALIGNMENT || e->nlods > MDL_MAX_LODS) {
+			fprintf(stderr, "mesh %d has an invalid offset table entry.\n", i);
+			return false;
+		}
+		const struct mdlCluster *clusters = (const struct mdlCluster *)(data + e->clusters);
+		const struct mdlLod *lods = (const struct mdlLod *)(data + e->lods);
+
+		if ((uint64_t)e->nfaces * 3 > e->nindices) {
+			fprintf(stderr, "mesh %d has an invalid index count.\n", i);
+			return false;
+		}
+		for (int j = 0; j < e->nlods; j++) {
+			if ((uint64_t)lods[j].first + lods[j].count > e->nindices || lods[j].count % 3) {
+				fprintf(stderr, "mesh %d has an invalid level of detail.\n", i);
+				return false;
+			}
+		}
+		for (int j = 0; j < e->nclusters; j++) {
+			if ((uint64_t)clusters[j].first + clusters[j].count > (uint64_t)e->nfaces * 3 || clusters[j].count % 3) {
+				fprintf(stderr, "mesh %d has an invalid cluster.\n", i);
+				return false;
+			}
+		}
+		if (! inbounds(e->bones, (uint64_t)e->nbones * sizeof(struct mdlBone), size) ||
+		    ! inbounds(e->vertices, vsize, size) ||
+		    ! inbounds(e->indices, isize, size) ||
+		    e->bones % MDL_ALIGNMENT || e->vertices % MDL_ALIGNMENT || e->indices % MDL_ALIGNMENT) {
+			fprintf(stderr, "mesh %d has an invalid offset table entry.\n", i);
+			return false;
+		}
+		if (e->nvertices == 0 || e->nfaces == 0) {
+			fprintf(stderr, "mesh %d is empty.\n", i);
+			return false;
+		}
+		if (! validIndices(data + e->indices, e->nindices, e->indexSize, e->nvertices)) {
+			fprintf(stderr, "mesh %d has an index out of range.\n", i);
+			return false;
+		}
+
+		snprintf(d->name, sizeof(d->name), "%.*s", (int)sizeof(e->name), e->name);
+		snprintf(d->shader, sizeof(d->shader), "%.*s", (int)sizeof(e->shader), e->shader);
 
-		struct skeleton *sk = malloc(sizeof(*sk));
+		if (! *d->name)
+			snprintf(d->name, sizeof(d->name), "%s", f->name);
+		if (! *d->shader)
+			strcpy(d->shader, "default");
 
-		sk->bones = NULL;
-		sk->nbones = 0;
+		sk = malloc(sizeof(*sk));
+		sk->nbones = e->nbones;
+		sk->bones = malloc(e->nbones * sizeof(struct bone));
 
-		// Read bones
-		fread(&sk->nbones, 4, 1, fp);
+		for (int j = 0; j < e->nbones; j++) {
+			const struct mdlBone *src = (const struct mdlBone *)(data + e->bones) + j;
+			struct bone *b = &sk->bones[j];
 
-		sk->bones = malloc(sk->nbones * sizeof(struct bone));
+			b->name = malloc(sizeof(src->name) + 1);
+			snprintf(b->name, sizeof(src->name) + 1, "%.*s", (int)sizeof(src->name), src->name);
+			memcpy(&b->offset, src->offset, sizeof(b->offset));
+			memcpy(&b->transform, src->transform, sizeof(b->transform));
+			b->parentId = src->parentId;
+			b->length = 0.1f;
 
-		for (int j = 0; j < sk->nbones; j++) {
-			freadstr(&sk->bones[j].name, fp);
-			fread(&sk->bones[j].offset, sizeof(mat4), 1, fp);
-			fread(&sk->bones[j].transform, sizeof(mat4), 1, fp);
-			fread(&sk->bones[j].parentId, 4, 1, fp);
-			sk->bones[j].length = 0.1f;
+			f->stats.copied += sizeof(*src);
 		}
 
-		// Read vertices
-		fread(&nvertices, 4, 1, fp);
-		assert(nvertices > 0);
-		vertices = malloc(nvertices * sizeof(struct vertex));
-		fread(vertices, sizeof(struct vertex), nvertices, fp);
+		d->skeleton = sk;
+		d->format = e->format;
+		d->nvertices = e->nvertices;
+		d->vertices = data + e->vertices;
+		d->indexType = e->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		d->nindices = e->nindices;
+		d->nfaces = e->nfaces;
+		d->indices = data + e->indices;
+
+		memcpy(d->min.n, e->min, sizeof(e->min));
+		memcpy(d->max.n, e->max, sizeof(e->max));
+
+		d->clusters = clusters;
+		d->nclusters = e->nclusters;
+		d->lods = lods;
+		d->nlods = e->nlods;
+
+		if (h->occluders) {
+			const struct mdlOccluder *o = (const struct mdlOccluder *)(data + h->occluders) + i;
+
+			if (! inbounds(o->vertices, (uint64_t)o->nvertices * sizeof(float[3]), size) ||
+			    ! inbounds(o->indices, (uint64_t)o->nindices * sizeof(uint32_t), size) ||
+			    o->vertices % MDL_ALIGNMENT || o->indices % MDL_ALIGNMENT || o->nindices % 3) {
+				fprintf(stderr, "mesh %d has an invalid occluder.\n", i);
+				return false;
+			}
+			d->occluderVertices = (const float *)(data + o->vertices);
+			d->noccluderVertices = o->nvertices;
+			d->occluderIndices = (const uint32_t *)(data + o->indices);
+			d->noccluderIndices = o->nindices;
+
+			for (int j = 0; j < o->nindices; j++) {
+				if (d->occluderIndices[j] >= o->nvertices) {
+					fprintf(stderr, "mesh %d has an invalid occluder.\n", i);
+					return false;
+				}
+			}
+		}
 
-		// Read faces
-		fread(&nfaces, 4, 1, fp);
-		assert(nfaces > 0);
-		faces = malloc(nfaces * sizeof(unsigned int) * 3);
-		fread(faces, sizeof(unsigned int), nfaces * 3, fp);
+		f->nmeshes++;
+		f->stats.copied += sizeof(*e);
+		f->stats.uploaded += vsize + isize;
+	}
+	return true;
+}
 
-		mdl->meshes[i] = rNewMesh(name, mat, nvertices, vertices, nfaces, faces, sk);
+//
+// Read the mesh file of model `name` in `dir` and decode its textures. No GL
+// calls are made, so this can be done off the GL thread. Vertex and index
+// data are referenced straight from a mapping of the file, which stays open
+// until `rFreeMdlFile`. Both the version 1 and version 2 formats are
+// supported.
+//
+bool rReadMdlFile(struct mdlFile *f, const char *dir, const char *name)
+{
+	const char *parts[] = {ASSET_DIR, dir, name};
+	char *path = sdscat(sdsjoin((char **)parts, 3, "/", 1), MESH_EXT);
+	bool ok = false;
+
+	memset(f, 0, sizeof(*f));
+	f->name = name;
+	f->dir = dir;
+
+	rLoadMdlMetadata(name, dir);
+
+	if (! (f->data = assetOpen(path, &f->size))) {
+		fprintf(stderr, "couldn't open %s\n", path);
+		sdsfree(path);
+		return false;
+	}
+	f->stats.mapped += f->size;
+
+	if (f->size >= sizeof(MDL_MAGIC) && ! memcmp(f->data, MDL_MAGIC, sizeof(MDL_MAGIC))) {
+		ok = rReadMdlMeshesV2(f);
+	} else if (f->data[0] == MAGIC_NUMBER) {
+		struct reader r = {f->data + 1, f->data + f->size, &f->stats};
+		ok = rReadMdlMeshesV1(f, &r);
+	} else {
+		fprintf(stderr, "file isn't a lourland model.\n");
+	}
+	if (ok) {
+		for (int i = 0; i < f->nmeshes; i++) {
+			rReadMdlImages(f, i);
+		}
+	} else {
+		fprintf(stderr, "error reading %s\n", path);
+		rFreeMdlFile(f);
 	}
 	sdsfree(path);
 
-	return true;
+	return ok;
 }
 
-void rDrawMdl(struct model *mdl)
+//
+// Release everything `f` still holds, including the file mapping. Meshes built
+// from it must have been uploaded by then.
+//
+void rFreeMdlFile(struct mdlFile *f)
 {
-	mat4 model = mat4identity();
+	const char *parts[] = {ASSET_DIR, f->dir, TEXTURE_DIR};
+
+	for (int i = 0; i < f->nmeshes; i++) {
+		struct mdlMeshDesc *d = &f->meshes[i];
+
+		if (d->skeleton)
+			freeSkeleton(d->skeleton);
+
+		if (d->images) {
+			char *path = sdsjoin((char **)parts, 3, "/", 1);
+
+			rFreeMaterialImages(d->images, path, d->name);
+			free(d->images);
+			sdsfree(path);
+		}
+		free(d->narrowed);
+		free(d->positions);
+	}
+	free(f->meshes);
+
+	if (f->data)
+		assetClose(f->data, f->size);
+
+	memset(f, 0, sizeof(*f));
+}
+
+//
+// Create a model from the file `f`. Unless `upload` is set, its buffers and
+// textures are only allocated, and the caller is responsible for filling
+// them in from `f` before the model is drawn. Meshes are in the same order as
+// in `f`, and take ownership of their skeletons.
+//
+struct model *rNewMdl(struct mdlFile *f, bool upload)
+{
+	struct model *mdl = malloc(sizeof(*mdl));
+
+	mdl->name = strdup(f->name);
+	mdl->meshes = malloc(f->nmeshes * sizeof(struct mesh *));
+	mdl->nmeshes = 0;
+	mdl->min = (vec3){ FLT_MAX,  FLT_MAX,  FLT_MAX};
+	mdl->max = (vec3){-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+	for (int i = 0; i < f->nmeshes; i++) {
+		struct mdlMeshDesc *d = &f->meshes[i];
+		struct material *mat;
+
+		if (! (mat = rLoadMdlMaterial(f, d, upload))) {
+			fprintf(stderr, "couldn't load mesh material.\n");
+		}
+		struct mesh *m = rNewMeshFormat(d->name, mat, d->format, d->nvertices, upload ? d->vertices : NULL,
+		                                d->indexType, d->nindices / 3, upload ? d->indices : NULL, d->skeleton);
+		d->skeleton = NULL;
+
+		// The index buffer holds the full-detail mesh first, followed by
+		// the other levels of detail.
+		m->nfaces = d->nfaces;
+		meshSetBounds(m, d->min, d->max);
+
+		for (int k = 0; k < 3; k++) {
+			mdl->min.n[k] = fminf(mdl->min.n[k], d->min.n[k]);
+			mdl->max.n[k] = fmaxf(mdl->max.n[k], d->max.n[k]);
+		}
+
+		if (d->nclusters > 0) {
+			meshSetClusters(m, d->clusters, d->nclusters);
+			f->stats.copied += d->nclusters * sizeof(struct mdlCluster);
+		}
+		if (d->nlods > 1) {
+			meshSetLods(m, d->lods, d->nlods);
+			f->stats.copied += d->nlods * sizeof(struct mdlLod);
+		}
+		if (d->noccluderIndices > 0) {
+			meshSetOccluder(m, d->occluderVertices, d->noccluderVertices, d->occluderIndices, d->noccluderIndices);
+			f->stats.copied += d->noccluderVertices * sizeof(float[3]) + d->noccluderIndices * sizeof(uint32_t);
+		}
+		mdl->meshes[mdl->nmeshes++] = m;
+	}
+	MDL_LOAD_STATS.mapped += f->stats.mapped;
+	MDL_LOAD_STATS.copied += f->stats.copied;
+	MDL_LOAD_STATS.uploaded += f->stats.uploaded;
+
+	return mdl;
+}
+
+struct mdlLoadStats rMdlLoadStats(void)
+{
+	return MDL_LOAD_STATS;
+}
+
+//
+// Cull the clusters of every mesh of `mdl` against a viewer at `eye`, in model
+// space. Returns the number of triangles the next `rDrawMdl` will submit.
+//
+size_t rCullMdlClusters(struct model *mdl, vec3 eye)
+{
+	size_t n = 0;
+
+	for (int i = 0; i < mdl->nmeshes; i++) {
+		n += meshCullClusters(mdl->meshes[i], eye);
+	}
+	return n;
+}
 
+//
+// Select the level of detail of every mesh of `mdl`, from the projected size
+// of its bounding sphere as seen from `cam`.
+//
+void rSelectMdlLod(struct model *mdl, struct camera *cam)
+{
 	for (int i = 0; i < mdl->nmeshes; i++) {
-		if (! mdl->meshes[i]->isVisible)
+		struct mesh *m = mdl->meshes[i];
+
+		if (m->nlods < 2)
 			continue;
 
-		GLuint program = mdl->meshes[i]->material->shader->handle;
+		meshSelectLod(m, rCameraPixelScale(cam, m->center, m->radius));
+	}
+}
+
+//
+// Queue the visible meshes of `mdl` for drawing, along with their skeletons.
+// The model, then each of its meshes, is culled against the frustum of `cam`,
+// and meshes are then culled against the occluders of the frame.
+// Meshes are sorted front to back by their distance from `cam`.
+//
+void rDrawMdl(struct model *mdl, struct camera *cam)
+{
+	mat4 model = mat4identity();
+
+	// Models are drawn with an identity transform, so their bounds are
+	// already in world space.
+	if (! frustumTestBox(&cam->frustum, mdl->min, mdl->max)) {
+		RENDER_STATS.meshesCulled += mdl->nmeshes;
+		return;
+	}
+	if (mdl->nmeshes > CULL.cap) {
+		CULL.cap = mdl->nmeshes;
+		CULL.visible = realloc(CULL.visible, CULL.cap * sizeof(*CULL.visible));
+	}
+	boxListClear(&CULL.boxes);
+
+	for (int i = 0; i < mdl->nmeshes; i++) {
+		boxListAdd(&CULL.boxes, mdl->meshes[i]->min, mdl->meshes[i]->max);
+	}
+	size_t nvisible = frustumCullBoxes(&cam->frustum, &CULL.boxes, CULL.visible);
+	size_t noccluded = rTestOcclusion(&CULL.boxes, CULL.visible);
+
+	RENDER_STATS.meshesVisible += nvisible - noccluded;
+	RENDER_STATS.meshesCulled += mdl->nmeshes - nvisible;
+	RENDER_STATS.meshesOccluded += noccluded;
 
-		glUseProgram(program);
+	for (int i = 0; i < mdl->nmeshes; i++) {
+		struct mesh *m = mdl->meshes[i];
 
-		// TODO(cloudhead): This value is the same for all meshes, find a way to avoid
-		// respecifying it for every mesh.
-		GLint uniModel = glGetUniformLocation(program, "model");
-		glUniformMatrix4fv(uniModel, 1, GL_FALSE, (float *)model.cols);
+		if (! m->isVisible || ! CULL.visible[i])
+			continue;
+		if (m->nclusters > 0 && m->lod == 0 && m->ndraws == 0)
+			continue;
 
-		glBindVertexArray(mdl->meshes[i]->vao);
-		glBindBuffer(GL_ARRAY_BUFFER, mdl->meshes[i]->vbo); // Make it the active object
+		float depth = vec3len(vec3sub(m->center, cam->pos)) / cam->zfar;
 
-		GLint posAttrib = glGetAttribLocation(program, "position");
-		glEnableVertexAttribArray(posAttrib);
-		glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 0);
+		rSubmitMesh(RENDER_PASS_OPAQUE, m, &model, depth);
+		rDrawSkeleton(m->skeleton, &model);
+	}
+}
 
-		// TODO: Use GL_INT_2_10_10_10_REV instead of GL_FLOAT
-		GLint normAttrib = glGetAttribLocation(program, "normal");
-		glEnableVertexAttribArray(normAttrib);
-		glVertexAttribPointer(normAttrib, 3, GL_FLOAT, GL_TRUE, sizeof(struct vertex), (void *)offsetof(struct vertex, normal));
+//
+// Add the occluder hulls of the meshes of `mdl` to the occluders of the
+// frame.
+//
+void rAddMdlOccluders(struct model *mdl)
+{
+	mat4 model = mat4identity();
 
-		GLint tangentAttrib = glGetAttribLocation(program, "tangent");
-		glEnableVertexAttribArray(tangentAttrib);
-		glVertexAttribPointer(tangentAttrib, 4, GL_FLOAT, GL_TRUE, sizeof(struct vertex), (void *)offsetof(struct vertex, tangent));
+	for (int i = 0; i < mdl->nmeshes; i++) {
+		struct mesh *m = mdl->meshes[i];
 
-		GLint uvAttrib = glGetAttribLocation(program, "texcoord");
-		glEnableVertexAttribArray(uvAttrib);
-		glVertexAttribPointer(uvAttrib, 2, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void *)offsetof(struct vertex, uv));
+		if (m->isVisible && m->noccluderIndices > 0)
+			rAddOccluder(m->occluderVertices, m->noccluderVertices, m->occluderIndices, m->noccluderIndices, &model);
+	}
+}
 
-		GLint bonesAttrib = glGetAttribLocation(program, "bones");
-		glEnableVertexAttribArray(bonesAttrib);
-		glVertexAttribIPointer(bonesAttrib, 4, GL_INT, sizeof(struct vertex), (void *)offsetof(struct vertex, bones));
+//
+// Add the visible meshes of `mdl` to the shadow casters of the frame.
+// Static models only have their far cascades drawn again when they change.
+//
+void rAddMdlShadowCasters(struct model *mdl, bool isStatic)
+{
+	mat4 model = mat4identity();
 
-		GLint weightsAttrib = glGetAttribLocation(program, "weights");
-		glEnableVertexAttribArray(weightsAttrib);
-		glVertexAttribPointer(weightsAttrib, 4, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void *)offsetof(struct vertex, weights));
+	for (int i = 0; i < mdl->nmeshes; i++) {
+		struct mesh *m = mdl->meshes[i];
 
-		// Bind textures
-		for (int j = 0; j < TEXTURE_TYPES; j++) {
-			struct texture *t = mdl->meshes[i]->material->textures[j];
+		if (m->isVisible)
+			rAddShadowCaster(m, &model, isStatic);
+	}
+}
 
-			if (t == NULL)
-				continue;
+//
+// Queue `count` copies of `mdl`, one per transform in `transforms`, with one
+// instanced draw per visible mesh. Meshes whose shader has no instanced
+// variant are submitted once per copy instead, in full since their clusters
+// were culled for the model transform. Instances aren't culled, and their
+// skeletons aren't drawn. Meshes without a material are skipped.
+//
+void rDrawMdlInstanced(struct model *mdl, const mat4 *transforms, size_t count)
+{
+	size_t first = rQueueInstances(transforms, count);
 
-			glActiveTexture(GL_TEXTURE0 + t->index);
+	for (int i = 0; i < mdl->nmeshes; i++) {
+		struct mesh *m = mdl->meshes[i];
 
-			GLint unif = glGetUniformLocation(program, textureSamplerNames[j]);
-			// assert(unif > 0);
+		if (! m->isVisible || ! m->material)
+			continue;
 
-			glUniform1i(unif, t->index);
-			glBindTexture(GL_TEXTURE_2D, t->handle);
-			glBindSampler(t->index, t->sampler);
-			glActiveTexture(GL_TEXTURE0);
+		if (m->material->shader->instanced) {
+			rSubmitInstances(RENDER_PASS_OPAQUE, m, first, count, 0.0f);
+			continue;
+		}
+		for (size_t j = 0; j < count; j++) {
+			rSubmitMeshUnculled(RENDER_PASS_OPAQUE, m, &transforms[j], 0.0f);
 		}
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mdl->meshes[i]->ebo);
-		glDrawElements(GL_TRIANGLES, mdl->meshes[i]->nfaces * 3, GL_UNSIGNED_INT, 0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glUseProgram(0);
-		glBindVertexArray(0);
-
-		glDisable(GL_DEPTH_TEST);
-		rDrawSkeleton(mdl->meshes[i]->skeleton, &model);
-		glEnable(GL_DEPTH_TEST);
 	}
 }
 
 struct model *rOpenMdl(const char *path)
 {
-	struct model *mdl = malloc(sizeof(*mdl));
+	struct mdlFile f;
+	struct model *mdl;
 
-	mdl->name = strdup(path);
-	mdl->nmeshes = 0;
-	mdl->meshes = NULL;
-
-	if (! rLoadMdlMeshes(mdl, path))
+	if (! rReadMdlFile(&f, path, path))
 		return NULL;
 
+	mdl = rNewMdl(&f, true);
+	rFreeMdlFile(&f);
+
 	return mdl;
 }
-
@@ -1,11 +1,72 @@
 
+struct camera;
+
 struct model {
 	const char   *name;
 	struct mesh **meshes;
 	size_t       nmeshes;
+	vec3         min, max; // Bounding box of every mesh, in model space
+};
+
+struct mdlLoadStats {
+	size_t mapped;   // Bytes of model files mapped into memory
+	size_t copied;   // Bytes copied out of the mapping while parsing
+	size_t uploaded; // Bytes handed to the GPU straight from the mapping
+};
+
+//
+// A mesh that has been read from a model file, but not uploaded yet.
+//
+struct mdlMeshDesc {
+	char                    name[256];
+	char                    shader[256];
+	enum vertexFormat       format;
+	size_t                  nvertices;
+	const void              *vertices;
+	GLenum                  indexType;
+	size_t                  nindices; // Across all levels of detail
+	size_t                  nfaces;   // Full-detail triangles
+	const void              *indices;
+	void                    *narrowed; // Heap copy of the indices, if they were narrowed
+	vec3                    *positions; // Decoded positions, for the position stream, or NULL
+	struct skeleton         *skeleton;
+	struct texImage         *images;   // Read textures, one per texture type, or NULL
+	bool                    textured; // Whether it has textures, decoded or cached
+	vec3                    min, max;
+	const struct mdlCluster *clusters;
+	size_t                  nclusters;
+	const struct mdlLod     *lods;
+	size_t                  nlods;
+	const float             *occluderVertices; // Three floats per vertex
+	size_t                  noccluderVertices;
+	const uint32_t          *occluderIndices;
+	size_t                  noccluderIndices;
+};
+
+//
+// A model file that has been read and decoded. Vertex and index data point
+// into the file mapping.
+//
+struct mdlFile {
+	const char          *name;
+	const char          *dir;
+	const unsigned char *data;
+	size_t              size;
+	struct mdlMeshDesc  *meshes;
+	size_t              nmeshes;
+	struct mdlLoadStats stats;
 };
 
 extern struct model *rOpenMdl(const char *);
-extern void rDrawMdl(struct model *);
+extern bool rReadMdlFile(struct mdlFile *, const char *, const char *);
+extern void rFreeMdlFile(struct mdlFile *);
+extern struct model *rNewMdl(struct mdlFile *, bool);
+extern void rDrawMdl(struct model *, struct camera *);
+extern void rAddMdlOccluders(struct model *);
+extern void rAddMdlShadowCasters(struct model *, bool);
+extern void rDrawMdlInstanced(struct model *, const mat4 *, size_t);
+extern size_t rCullMdlClusters(struct model *, vec3);
+extern void rSelectMdlLod(struct model *, struct camera *);
 extern void rFreeMdl(struct model *);
 extern bool rUseMdlShader(struct model *, GLuint);
+extern struct mdlLoadStats rMdlLoadStats(void);
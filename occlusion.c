@@ -0,0 +1,515 @@
+//
+// occlusion.c
+// software occlusion culling
+//
+// The hulls of occluding meshes are rasterized on the CPU into a small depth
+// buffer, and the bounding boxes of meshes are tested against it before they
+// are queued, so that meshes hidden behind occluders are never drawn.
+//
+// The buffer holds the reciprocal of clip space w, which is linear in screen
+// space, so nearer is larger and the buffer clears to zero. Culling errs on
+// the side of drawing: occluder triangles which cross the near plane are
+// dropped rather than clipped, and a box is only occluded if every pixel its
+// projection touches holds an occluder strictly nearer than its nearest
+// corner.
+//
+// Since the buffer is much coarser than the screen, occluders are rasterized
+// conservatively: a triangle only covers the pixels which lie entirely
+// within it, and stores its farthest depth across each of them. A pixel
+// never claims to be occluded where the occluder doesn't reach.
+//
+// The buffer is split into bands of rows, which are rasterized in parallel
+// by a small pool of worker threads, four pixels at a time with SSE. Box tests
+// are split across the same workers.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "linmath.h"
+#include "camera.h"
+#include "cull.h"
+#include "overlay.h"
+#include "occlusion.h"
+
+enum {
+	OCCLUSION_WIDTH   = 256,
+	OCCLUSION_HEIGHT  = 128,
+	OCCLUSION_TILES   = 16, // Bands of rows, rasterized independently
+	OCCLUSION_THREADS = 4,
+	TILE_ROWS         = OCCLUSION_HEIGHT / OCCLUSION_TILES,
+	TEST_BATCH        = 64  // Boxes tested per job
+};
+
+_Static_assert(OCCLUSION_WIDTH % 4 == 0, "rows are a whole number of SSE vectors");
+_Static_assert(OCCLUSION_HEIGHT % OCCLUSION_TILES == 0, "tiles have the same number of rows");
+
+// Reciprocal depth shown as mid-grey in the debug view.
+static const float DEBUG_DEPTH_SCALE = 0.1f;
+
+//
+// An occluder triangle, set up for rasterization. Vertices are in pixels,
+// with `z` the reciprocal of their clip space w, and wound counter-clockwise.
+//
+struct occluderTriangle {
+	float x[3], y[3], z[3];
+	int   minx, maxx; // Pixel bounds, clamped to the buffer
+	int   miny, maxy;
+};
+
+enum occlusionJob {
+	JOB_RASTERIZE, // Rasterize one tile
+	JOB_TEST       // Test one batch of boxes
+};
+
+static struct {
+	_Alignas(16) float      depth[OCCLUSION_HEIGHT][OCCLUSION_WIDTH];
+	mat4                    viewProj;
+	float                   znear;
+	struct occluderTriangle *triangles;
+	size_t                  ntriangles;
+	size_t                  cap;
+	vec4                    *clip; // Scratch space for transformed occluder vertices
+	size_t                  clipCap;
+
+	// Shared with the worker threads, and guarded by `lock`.
+	pthread_t               workers[OCCLUSION_THREADS];
+	pthread_mutex_t         lock;
+	pthread_cond_t          wake;
+	pthread_cond_t          done;
+	bool                    running;
+	unsigned                generation; // Incremented for every batch of jobs
+	enum occlusionJob       job;
+	size_t                  next;
+	size_t                  njobs;
+	size_t                  finished;
+	size_t                  occluded;
+	const struct boxList    *boxes;
+	bool                    *visible;
+
+	struct occlusionStats   stats;
+	int                     image; // Overlay image of the debug view, or -1
+} OCCLUSION;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static vec4 transformPoint(const mat4 *m, vec3 p)
+{
+	__m128 r = _mm_mul_ps(m->cols[0].m128, _mm_set1_ps(p.x));
+	r = _mm_add_ps(r, _mm_mul_ps(m->cols[1].m128, _mm_set1_ps(p.y)));
+	r = _mm_add_ps(r, _mm_mul_ps(m->cols[2].m128, _mm_set1_ps(p.z)));
+	r = _mm_add_ps(r, m->cols[3].m128);
+
+	return (vec4){.m128 = r};
+}
+
+static int clampi(int x, int lo, int hi)
+{
+	return x < lo ? lo : x > hi ? hi : x;
+}
+
+static void rasterizeTriangle(const struct occluderTriangle *t, int y0, int y1)
+{
+	const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+	int miny = t->miny > y0 ? t->miny : y0;
+	int maxy = t->maxy < y1 - 1 ? t->maxy : y1 - 1;
+	__m128 a[3], b[3], c[3];
+
+	if (miny > maxy)
+		return;
+
+	// Edge functions, positive on the inside of each edge. They're evaluated
+	// at pixel centers, and offset by the largest difference to a pixel
+	// corner, so that they're only positive for pixels wholly inside.
+	for (int i = 0; i < 3; i++) {
+		int j = (i + 1) % 3;
+		float ea = t->y[i] - t->y[j];
+		float eb = t->x[j] - t->x[i];
+
+		a[i] = _mm_set1_ps(ea);
+		b[i] = _mm_set1_ps(eb);
+		c[i] = _mm_set1_ps(-(ea * t->x[i] + eb * t->y[i]) - 0.5f * (fabsf(ea) + fabsf(eb)));
+	}
+
+	// Plane of the reciprocal depth across the triangle.
+	float dx1 = t->x[1] - t->x[0], dy1 = t->y[1] - t->y[0], dz1 = t->z[1] - t->z[0];
+	float dx2 = t->x[2] - t->x[0], dy2 = t->y[2] - t->y[0], dz2 = t->z[2] - t->z[0];
+	float area = dx1 * dy2 - dx2 * dy1;
+	float dzdx = (dz1 * dy2 - dz2 * dy1) / area;
+	float dzdy = (dx1 * dz2 - dx2 * dz1) / area;
+	float dzmin = 0.5f * (fabsf(dzdx) + fabsf(dzdy)); // From a pixel center to its farthest corner
+	__m128 zx = _mm_set1_ps(dzdx);
+
+	for (int y = miny; y <= maxy; y++) {
+		__m128 py = _mm_set1_ps(y + 0.5f);
+		__m128 row[3];
+
+		for (int i = 0; i < 3; i++) {
+			row[i] = _mm_add_ps(_mm_mul_ps(b[i], py), c[i]);
+		}
+		__m128 zrow = _mm_set1_ps(t->z[0] + dzdy * (y + 0.5f - t->y[0]) - dzdx * t->x[0] - dzmin);
+
+		for (int x = t->minx & ~3; x <= t->maxx; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps(x), lanes);
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(a[0], px), row[0]);
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(a[1], px), row[1]);
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(a[2], px), row[2]);
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			float *d = &OCCLUSION.depth[y][x];
+			__m128 z = _mm_add_ps(_mm_mul_ps(zx, px), zrow);
+			__m128 old = _mm_load_ps(d);
+
+			_mm_store_ps(d, _mm_blendv_ps(old, _mm_max_ps(old, z), inside));
+		}
+	}
+}
+
+static void rasterizeTile(size_t tile)
+{
+	int y0 = tile * TILE_ROWS;
+
+	memset(OCCLUSION.depth[y0], 0, TILE_ROWS * sizeof(OCCLUSION.depth[0]));
+
+	for (size_t i = 0; i < OCCLUSION.ntriangles; i++) {
+		rasterizeTriangle(&OCCLUSION.triangles[i], y0, y0 + TILE_ROWS);
+	}
+}
+
+//
+// Whether the box at `center` with half extents `extent` is hidden behind
+// the occluders.
+//
+static bool boxOccluded(vec3 center, vec3 extent)
+{
+	float minx = INFINITY, maxx = -INFINITY, miny = INFINITY, maxy = -INFINITY, maxz = 0.0f;
+
+	for (int k = 0; k < 8; k++) {
+		vec3 p = {
+			center.x + (k & 1 ? extent.x : -extent.x),
+			center.y + (k & 2 ? extent.y : -extent.y),
+			center.z + (k & 4 ? extent.z : -extent.z)
+		};
+		vec4 c = transformPoint(&OCCLUSION.viewProj, p);
+
+		// Boxes reaching in front of the near plane are never occluded.
+		if (c.w < OCCLUSION.znear)
+			return false;
+
+		float z = 1.0f / c.w;
+		float x = (c.x * z * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		float y = (c.y * z * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+
+		minx = fminf(minx, x);
+		maxx = fmaxf(maxx, x);
+		miny = fminf(miny, y);
+		maxy = fmaxf(maxy, y);
+		maxz = fmaxf(maxz, z);
+	}
+	if (maxx < 0 || maxy < 0 || minx >= OCCLUSION_WIDTH || miny >= OCCLUSION_HEIGHT)
+		return false;
+
+	// Widening the rectangle to whole vectors can only make the box visible.
+	int x0 = clampi(floorf(minx), 0, OCCLUSION_WIDTH - 1) & ~3;
+	int x1 = clampi(floorf(maxx), 0, OCCLUSION_WIDTH - 1);
+	int y0 = clampi(floorf(miny), 0, OCCLUSION_HEIGHT - 1);
+	int y1 = clampi(floorf(maxy), 0, OCCLUSION_HEIGHT - 1);
+	__m128 z = _mm_set1_ps(maxz);
+
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x += 4) {
+			if (_mm_movemask_ps(_mm_cmple_ps(_mm_load_ps(&OCCLUSION.depth[y][x]), z)))
+				return false;
+		}
+	}
+	return true;
+}
+
+static size_t testBatch(size_t batch)
+{
+	const struct boxList *l = OCCLUSION.boxes;
+	size_t end = (batch + 1) * TEST_BATCH;
+	size_t n = 0;
+
+	for (size_t i = batch * TEST_BATCH; i < end && i < l->n; i++) {
+		if (! OCCLUSION.visible[i])
+			continue;
+
+		vec3 center = {l->cx[i], l->cy[i], l->cz[i]};
+		vec3 extent = {l->ex[i], l->ey[i], l->ez[i]};
+
+		if (boxOccluded(center, extent)) {
+			OCCLUSION.visible[i] = false;
+			n++;
+		}
+	}
+	return n;
+}
+
+//
+// Run jobs of the current batch until there are none left. Called, and
+// returns, with the lock held.
+//
+static void takeJobs(void)
+{
+	while (OCCLUSION.next < OCCLUSION.njobs) {
+		enum occlusionJob job = OCCLUSION.job;
+		size_t i = OCCLUSION.next++;
+		size_t occluded = 0;
+
+		pthread_mutex_unlock(&OCCLUSION.lock);
+
+		if (job == JOB_RASTERIZE) {
+			rasterizeTile(i);
+		} else {
+			occluded = testBatch(i);
+		}
+		pthread_mutex_lock(&OCCLUSION.lock);
+
+		OCCLUSION.occluded += occluded;
+
+		if (++OCCLUSION.finished == OCCLUSION.njobs)
+			pthread_cond_signal(&OCCLUSION.done);
+	}
+}
+
+static void *occlusionMain(void *arg)
+{
+	unsigned generation = 0;
+
+	pthread_mutex_lock(&OCCLUSION.lock);
+
+	while (OCCLUSION.running) {
+		if (OCCLUSION.generation == generation) {
+			pthread_cond_wait(&OCCLUSION.wake, &OCCLUSION.lock);
+			continue;
+		}
+		generation = OCCLUSION.generation;
+		takeJobs();
+	}
+	pthread_mutex_unlock(&OCCLUSION.lock);
+
+	return NULL;
+}
+
+//
+// Run `n` jobs of kind `job` on the workers, and on the calling thread, and
+// wait for all of them to finish.
+//
+static void runJobs(enum occlusionJob job, size_t n)
+{
+	pthread_mutex_lock(&OCCLUSION.lock);
+
+	OCCLUSION.job = job;
+	OCCLUSION.next = 0;
+	OCCLUSION.njobs = n;
+	OCCLUSION.finished = 0;
+	OCCLUSION.generation++;
+	pthread_cond_broadcast(&OCCLUSION.wake);
+
+	takeJobs();
+
+	while (OCCLUSION.finished < OCCLUSION.njobs)
+		pthread_cond_wait(&OCCLUSION.done, &OCCLUSION.lock);
+
+	pthread_mutex_unlock(&OCCLUSION.lock);
+}
+
+void rInitOcclusion(void)
+{
+	OCCLUSION.cap = 1024;
+	OCCLUSION.triangles = malloc(OCCLUSION.cap * sizeof(*OCCLUSION.triangles));
+	OCCLUSION.ntriangles = 0;
+	OCCLUSION.clipCap = 1024;
+	OCCLUSION.clip = malloc(OCCLUSION.clipCap * sizeof(*OCCLUSION.clip));
+	OCCLUSION.running = true;
+	OCCLUSION.generation = 0;
+	OCCLUSION.image = -1;
+
+	pthread_mutex_init(&OCCLUSION.lock, NULL);
+	pthread_cond_init(&OCCLUSION.wake, NULL);
+	pthread_cond_init(&OCCLUSION.done, NULL);
+
+	for (int i = 0; i < OCCLUSION_THREADS; i++) {
+		pthread_create(&OCCLUSION.workers[i], NULL, occlusionMain, NULL);
+	}
+}
+
+void rQuitOcclusion(void)
+{
+	pthread_mutex_lock(&OCCLUSION.lock);
+	OCCLUSION.running = false;
+	pthread_cond_broadcast(&OCCLUSION.wake);
+	pthread_mutex_unlock(&OCCLUSION.lock);
+
+	for (int i = 0; i < OCCLUSION_THREADS; i++) {
+		pthread_join(OCCLUSION.workers[i], NULL);
+	}
+	pthread_cond_destroy(&OCCLUSION.done);
+	pthread_cond_destroy(&OCCLUSION.wake);
+	pthread_mutex_destroy(&OCCLUSION.lock);
+
+	free(OCCLUSION.triangles);
+	free(OCCLUSION.clip);
+}
+
+//
+// Start a new frame of occlusion culling, as seen from `cam`. Occluders are
+// then added, and rasterized, before any box is tested.
+//
+void rBeginOcclusion(struct camera *cam)
+{
+	OCCLUSION.viewProj = mat4mul(cam->proj, cam->view);
+	OCCLUSION.znear = cam->znear;
+	OCCLUSION.ntriangles = 0;
+	OCCLUSION.stats = (struct occlusionStats){0};
+}
+
+//
+// Add the occluder made of `nvertices` vertices and `nindices` indices,
+// placed with `transform`.
+//
+void rAddOccluder(const vec3 *vertices, size_t nvertices, const uint32_t *indices, size_t nindices, const mat4 *transform)
+{
+	mat4 m = mat4mul(OCCLUSION.viewProj, *transform);
+
+	if (nvertices > OCCLUSION.clipCap) {
+		OCCLUSION.clipCap = nvertices;
+		OCCLUSION.clip = realloc(OCCLUSION.clip, OCCLUSION.clipCap * sizeof(*OCCLUSION.clip));
+	}
+	for (size_t i = 0; i < nvertices; i++) {
+		OCCLUSION.clip[i] = transformPoint(&m, vertices[i]);
+	}
+	for (size_t i = 0; i + 2 < nindices; i += 3) {
+		struct occluderTriangle t;
+		bool clipped = false;
+
+		for (int k = 0; k < 3; k++) {
+			vec4 c = OCCLUSION.clip[indices[i + k]];
+
+			if (c.w < OCCLUSION.znear) {
+				clipped = true;
+				break;
+			}
+			t.z[k] = 1.0f / c.w;
+			t.x[k] = (c.x * t.z[k] * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+			t.y[k] = (c.y * t.z[k] * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		}
+		if (clipped)
+			continue;
+
+		float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+
+		if (fabsf(area) < 1e-6f)
+			continue;
+
+		// Both faces occlude, so every triangle is rasterized counter-clockwise.
+		if (area < 0.0f) {
+			float x = t.x[1], y = t.y[1], z = t.z[1];
+			t.x[1] = t.x[2]; t.y[1] = t.y[2]; t.z[1] = t.z[2];
+			t.x[2] = x;      t.y[2] = y;      t.z[2] = z;
+		}
+		float minx = fminf(t.x[0], fminf(t.x[1], t.x[2])), maxx = fmaxf(t.x[0], fmaxf(t.x[1], t.x[2]));
+		float miny = fminf(t.y[0], fminf(t.y[1], t.y[2])), maxy = fmaxf(t.y[0], fmaxf(t.y[1], t.y[2]));
+
+		if (maxx < 0 || maxy < 0 || minx >= OCCLUSION_WIDTH || miny >= OCCLUSION_HEIGHT)
+			continue;
+
+		t.minx = clampi(floorf(minx), 0, OCCLUSION_WIDTH - 1);
+		t.maxx = clampi(floorf(maxx), 0, OCCLUSION_WIDTH - 1);
+		t.miny = clampi(floorf(miny), 0, OCCLUSION_HEIGHT - 1);
+		t.maxy = clampi(floorf(maxy), 0, OCCLUSION_HEIGHT - 1);
+
+		if (OCCLUSION.ntriangles == OCCLUSION.cap) {
+			OCCLUSION.cap *= 2;
+			OCCLUSION.triangles = realloc(OCCLUSION.triangles, OCCLUSION.cap * sizeof(*OCCLUSION.triangles));
+		}
+		OCCLUSION.triangles[OCCLUSION.ntriangles++] = t;
+	}
+	OCCLUSION.stats.occluders++;
+}
+
+//
+// Rasterize every occluder added since `rBeginOcclusion` into the buffer.
+//
+void rRasterizeOcclusion(void)
+{
+	double start = now();
+
+	runJobs(JOB_RASTERIZE, OCCLUSION_TILES);
+
+	OCCLUSION.stats.triangles = OCCLUSION.ntriangles;
+	OCCLUSION.stats.rasterizeMs += now() - start;
+}
+
+//
+// Test the boxes of `l` which are marked in `visible` against the occluders,
+// and unmark the ones which are hidden. Returns the number of boxes which
+// were hidden.
+//
+size_t rTestOcclusion(const struct boxList *l, bool *visible)
+{
+	double start = now();
+
+	// Without occluders, nothing can be hidden.
+	if (OCCLUSION.ntriangles == 0)
+		return 0;
+
+	OCCLUSION.boxes = l;
+	OCCLUSION.visible = visible;
+	OCCLUSION.occluded = 0;
+
+	for (size_t i = 0; i < l->n; i++) {
+		OCCLUSION.stats.tested += visible[i];
+	}
+	runJobs(JOB_TEST, (l->n + TEST_BATCH - 1) / TEST_BATCH);
+
+	OCCLUSION.stats.occluded += OCCLUSION.occluded;
+	OCCLUSION.stats.testMs += now() - start;
+
+	return OCCLUSION.occluded;
+}
+
+struct occlusionStats rOcclusionStats(void)
+{
+	return OCCLUSION.stats;
+}
+
+//
+// Draw the occlusion buffer over the scene, through the overlay, in the rect
+// at `x`, `y`, of `w` by `h` pixels, with nearer occluders brighter.
+//
+void rDrawOcclusionBuffer(int x, int y, int w, int h)
+{
+	static uint32_t pixels[OCCLUSION_HEIGHT][OCCLUSION_WIDTH];
+
+	if (OCCLUSION.image == -1)
+		OCCLUSION.image = rNewOverlayImage(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+
+	for (int j = 0; j < OCCLUSION_HEIGHT; j++) {
+		for (int i = 0; i < OCCLUSION_WIDTH; i++) {
+			float d = OCCLUSION.depth[j][i];
+			uint32_t g = 255.0f * d / (d + DEBUG_DEPTH_SCALE);
+
+			pixels[j][i] = 0xff000000 | g << 16 | g << 8 | g;
+		}
+	}
+	rUpdateOverlayImage(OCCLUSION.image, &pixels[0][0]);
+	rOverlayImage(OCCLUSION.image, x, y, w, h);
+}
@@ -0,0 +1,31 @@
+//
+// occlusion.h
+// software occlusion culling
+//
+// dependencies:
+//
+//   stdbool.h
+//   stddef.h
+//   stdint.h
+//   linmath.h
+//
+struct camera;
+struct boxList;
+
+struct occlusionStats {
+	unsigned occluders;
+	unsigned triangles;   // Occluder triangles rasterized
+	unsigned tested;      // Boxes tested against the buffer
+	unsigned occluded;
+	double   rasterizeMs;
+	double   testMs;
+};
+
+extern void rInitOcclusion(void);
+extern void rQuitOcclusion(void);
+extern void rBeginOcclusion(struct camera *);
+extern void rAddOccluder(const vec3 *, size_t, const uint32_t *, size_t, const mat4 *);
+extern void rRasterizeOcclusion(void);
+extern size_t rTestOcclusion(const struct boxList *, bool *);
+extern struct occlusionStats rOcclusionStats(void);
+extern void rDrawOcclusionBuffer(int, int, int, int);
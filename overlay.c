@@ -0,0 +1,415 @@
+//
+// overlay.c
+// batched 2D overlay
+//
+// Text and flat quads drawn over the scene are collected over the frame into
+// one array of interleaved vertices, and drawn with one program bind and one
+// indexed draw when the overlay is flushed. Vertices are written into the
+// stream buffer, and indexed by a static index buffer which is shared by
+// every quad.
+//
+// Every font is packed into a single atlas texture, so that text of any
+// font can be drawn in the same batch. The atlas also holds a small white
+// rect, which untextured quads sample, so that they only differ from glyphs
+// by their texture coordinates. Fonts are grids of 16 by 16 glyphs, indexed
+// by character. Images, like debug views which change every frame, get a
+// rect of the atlas of their own, and are redrawn by updating it.
+//
+// Coordinates are in the space given to `rInitOverlay`, with the origin at
+// the lower left corner.
+//
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "tga.h"
+#include "pack.h"
+#include "shader.h"
+#include "texture.h"
+#include "renderer.h"
+#include "state.h"
+#include "stream.h"
+#include "overlay.h"
+
+enum {
+	OVERLAY_MAX_QUADS     = 8192, // Per flush, addressable with 16-bit indices
+	OVERLAY_MAX_FONTS     = 8,
+	OVERLAY_MAX_IMAGES    = 8,
+	OVERLAY_ATLAS_SIZE    = 1024,
+	OVERLAY_ATLAS_PADDING = 2,    // Texels between rects, so that filtering doesn't bleed across
+	OVERLAY_WHITE_SIZE    = 4,
+	OVERLAY_GLYPHS        = 16    // Per row and column of a font
+};
+
+struct overlayVertex {
+	float   pos[2];
+	float   uv[2];
+	uint8_t color[4];
+};
+
+//
+// A rect of the atlas, holding a font or an image.
+//
+struct overlayRegion {
+	float u, v; // Lower left corner in the atlas
+	float w, h; // Size in the atlas
+	int   x, y; // Lower left corner, in texels
+	int   width, height;
+};
+
+static struct {
+	struct shader        *shader;
+	GLuint               vao;
+	GLuint               ebo;
+	GLuint               atlas;
+	GLuint               sampler;
+	struct overlayRegion fonts[OVERLAY_MAX_FONTS];
+	int                  nfonts;
+	struct overlayRegion images[OVERLAY_MAX_IMAGES];
+	int                  nimages;
+	int                  shelfX, shelfY; // Where the next rect of the atlas goes
+	int                  shelfHeight;    // Of the tallest rect on the current shelf
+	vec2                 white;          // Texture coordinates of the white rect
+	struct overlayVertex *vertices;
+	size_t               nquads;
+	struct overlayStats  stats;
+	struct overlayStats  last;
+} OVERLAY;
+
+//
+// Find room for a rect of `w` by `h` texels in the atlas, on shelves filled
+// from left to right, and bottom to top. Returns false if it's full.
+//
+static bool allocRect(int w, int h, int *x, int *y)
+{
+	if (OVERLAY.shelfX + w > OVERLAY_ATLAS_SIZE) {
+		OVERLAY.shelfX = 0;
+		OVERLAY.shelfY += OVERLAY.shelfHeight + OVERLAY_ATLAS_PADDING;
+		OVERLAY.shelfHeight = 0;
+	}
+	if (w > OVERLAY_ATLAS_SIZE || OVERLAY.shelfY + h > OVERLAY_ATLAS_SIZE)
+		return false;
+
+	*x = OVERLAY.shelfX;
+	*y = OVERLAY.shelfY;
+
+	OVERLAY.shelfX += w + OVERLAY_ATLAS_PADDING;
+
+	if (h > OVERLAY.shelfHeight)
+		OVERLAY.shelfHeight = h;
+
+	return true;
+}
+
+//
+// Allocate a region of `w` by `h` texels of the atlas. Returns false if it
+// doesn't fit.
+//
+static bool allocRegion(struct overlayRegion *r, int w, int h)
+{
+	int x, y;
+
+	if (! allocRect(w, h, &x, &y))
+		return false;
+
+	*r = (struct overlayRegion){
+		.u = (float)x / OVERLAY_ATLAS_SIZE,
+		.v = (float)y / OVERLAY_ATLAS_SIZE,
+		.w = (float)w / OVERLAY_ATLAS_SIZE,
+		.h = (float)h / OVERLAY_ATLAS_SIZE,
+		.x = x,
+		.y = y,
+		.width = w,
+		.height = h
+	};
+	return true;
+}
+
+//
+// Set up the overlay, with a coordinate space of `width` by `height`. Shaders
+// must be loaded.
+//
+bool rInitOverlay(int width, int height)
+{
+	struct shader *s = rGetShader("overlay");
+
+	if (! s)
+		return false;
+
+	memset(&OVERLAY, 0, sizeof(OVERLAY));
+
+	OVERLAY.shader = s;
+	OVERLAY.vertices = malloc(OVERLAY_MAX_QUADS * 4 * sizeof(*OVERLAY.vertices));
+	OVERLAY.sampler = rNewSampler(GL_LINEAR, GL_LINEAR);
+
+	rUseShader(s);
+	rSetUniform1i(s, "atlas", 0);
+	glUniform2f(rUniformLocation(s, "screenSize"), width, height);
+
+	// The atlas starts out transparent.
+	void *clear = calloc(OVERLAY_ATLAS_SIZE * OVERLAY_ATLAS_SIZE, sizeof(uint32_t));
+
+	glGenTextures(1, &OVERLAY.atlas);
+	rBindTexture(0, GL_TEXTURE_2D, OVERLAY.atlas);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, OVERLAY_ATLAS_SIZE, OVERLAY_ATLAS_SIZE, 0, GL_BGRA, GL_UNSIGNED_BYTE, clear);
+	free(clear);
+
+	uint32_t white[OVERLAY_WHITE_SIZE * OVERLAY_WHITE_SIZE];
+	int x, y;
+
+	memset(white, 0xff, sizeof(white));
+	allocRect(OVERLAY_WHITE_SIZE, OVERLAY_WHITE_SIZE, &x, &y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, OVERLAY_WHITE_SIZE, OVERLAY_WHITE_SIZE, GL_BGRA, GL_UNSIGNED_BYTE, white);
+
+	// Sampled at its center, so that filtering only ever reads white.
+	OVERLAY.white = (vec2){
+		(x + OVERLAY_WHITE_SIZE / 2.0f) / OVERLAY_ATLAS_SIZE,
+		(y + OVERLAY_WHITE_SIZE / 2.0f) / OVERLAY_ATLAS_SIZE
+	};
+
+	GLushort *indices = malloc(OVERLAY_MAX_QUADS * 6 * sizeof(*indices));
+
+	// Corners go clockwise from the lower left, like front faces.
+	for (int q = 0; q < OVERLAY_MAX_QUADS; q++) {
+		GLushort *i = &indices[q * 6], v = q * 4;
+
+		i[0] = v + 0; i[1] = v + 1; i[2] = v + 2;
+		i[3] = v + 2; i[4] = v + 3; i[5] = v + 0;
+	}
+	glGenVertexArrays(1, &OVERLAY.vao);
+	rBindVertexArray(OVERLAY.vao);
+
+	glGenBuffers(1, &OVERLAY.ebo);
+	rBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OVERLAY.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, OVERLAY_MAX_QUADS * 6 * sizeof(*indices), indices, GL_STATIC_DRAW);
+	free(indices);
+
+	// The attributes are pointed at the stream buffer when flushing.
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+
+	rBindVertexArray(0);
+
+	return true;
+}
+
+void rQuitOverlay(void)
+{
+	glDeleteVertexArrays(1, &OVERLAY.vao);
+	glDeleteBuffers(1, &OVERLAY.ebo);
+	glDeleteTextures(1, &OVERLAY.atlas);
+	glDeleteSamplers(1, &OVERLAY.sampler);
+	rInvalidateState();
+
+	free(OVERLAY.vertices);
+}
+
+//
+// Add the font at `path` to the atlas. Returns its index, or -1 if it can't
+// be read or doesn't fit.
+//
+int rLoadOverlayFont(const char *path)
+{
+	struct overlayRegion *r = &OVERLAY.fonts[OVERLAY.nfonts];
+	struct tga t;
+	const void *data;
+	size_t size;
+
+	if (OVERLAY.nfonts == OVERLAY_MAX_FONTS)
+		return -1;
+
+	if (! (data = assetOpen(path, &size)))
+		return -1;
+
+	bool ok = tgaDecodeMemory(&t, data, size);
+	assetClose(data, size);
+
+	if (! ok)
+		return -1;
+
+	if (! allocRegion(r, t.width, t.height)) {
+		tgaFreeImageData(&t);
+		return -1;
+	}
+	rBindTexture(0, GL_TEXTURE_2D, OVERLAY.atlas);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, t.width, t.height, GL_BGRA, GL_UNSIGNED_BYTE, t.data);
+	tgaFreeImageData(&t);
+
+	return OVERLAY.nfonts++;
+}
+
+//
+// Reserve an image of `w` by `h` texels in the atlas, to be filled in with
+// `rUpdateOverlayImage`. Returns its index, or -1 if it doesn't fit.
+//
+int rNewOverlayImage(int w, int h)
+{
+	if (OVERLAY.nimages == OVERLAY_MAX_IMAGES)
+		return -1;
+
+	if (! allocRegion(&OVERLAY.images[OVERLAY.nimages], w, h))
+		return -1;
+
+	return OVERLAY.nimages++;
+}
+
+//
+// Replace the texels of image `image` with the BGRA `pixels`, which must be
+// as large as the image.
+//
+void rUpdateOverlayImage(int image, const uint32_t *pixels)
+{
+	if (image < 0 || image >= OVERLAY.nimages)
+		return;
+
+	const struct overlayRegion *r = &OVERLAY.images[image];
+
+	if (rBindTexture(0, GL_TEXTURE_2D, OVERLAY.atlas))
+		RENDER_STATS.textureSwitches++;
+
+	GL(glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->width, r->height, GL_BGRA, GL_UNSIGNED_BYTE, pixels));
+}
+
+//
+// Add a quad from `x0`, `y0` to `x1`, `y1`, textured from `u0`, `v0` to
+// `u1`, `v1` in the atlas.
+//
+static void addQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, vec4 color)
+{
+	if (OVERLAY.nquads == OVERLAY_MAX_QUADS) {
+		OVERLAY.stats.dropped++;
+		return;
+	}
+	struct overlayVertex *v = &OVERLAY.vertices[OVERLAY.nquads++ * 4];
+	uint8_t c[4];
+
+	for (int i = 0; i < 4; i++) {
+		c[i] = fminf(fmaxf(color.n[i], 0.0f), 1.0f) * 255.0f + 0.5f;
+	}
+	v[0] = (struct overlayVertex){{x0, y0}, {u0, v0}, {c[0], c[1], c[2], c[3]}};
+	v[1] = (struct overlayVertex){{x0, y1}, {u0, v1}, {c[0], c[1], c[2], c[3]}};
+	v[2] = (struct overlayVertex){{x1, y1}, {u1, v1}, {c[0], c[1], c[2], c[3]}};
+	v[3] = (struct overlayVertex){{x1, y0}, {u1, v0}, {c[0], c[1], c[2], c[3]}};
+}
+
+//
+// Draw `len` characters of `str` in font `font`, from `x`, `y`, with glyphs
+// `size` units wide and tall.
+//
+void rOverlayText(int font, const char *str, size_t len, float x, float y, float size, vec4 color)
+{
+	if (font < 0 || font >= OVERLAY.nfonts)
+		return;
+
+	const struct overlayRegion *f = &OVERLAY.fonts[font];
+	float gw = f->w / OVERLAY_GLYPHS, gh = f->h / OVERLAY_GLYPHS;
+
+	// The first row of glyphs is at the top of the font.
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = str[i];
+		float u = f->u + (c % OVERLAY_GLYPHS) * gw;
+		float v = f->v + f->h - (c / OVERLAY_GLYPHS + 1) * gh;
+		float gx = x + i * size;
+
+		addQuad(gx, y, gx + size, y + size, u, v, u + gw, v + gh, color);
+	}
+}
+
+//
+// Draw a flat rect from `x`, `y`, `w` by `h` units.
+//
+void rOverlayRect(float x, float y, float w, float h, vec4 color)
+{
+	addQuad(x, y, x + w, y + h, OVERLAY.white.s, OVERLAY.white.t, OVERLAY.white.s, OVERLAY.white.t, color);
+}
+
+//
+// Draw image `image` in the rect from `x`, `y`, `w` by `h` units.
+//
+void rOverlayImage(int image, float x, float y, float w, float h)
+{
+	if (image < 0 || image >= OVERLAY.nimages)
+		return;
+
+	const struct overlayRegion *r = &OVERLAY.images[image];
+
+	addQuad(x, y, x + w, y + h, r->u, r->v, r->u + r->w, r->v + r->h, vec4new(1.0f, 1.0f, 1.0f, 1.0f));
+}
+
+//
+// Draw a bar graph of the `n` values of `samples`, oldest first from index
+// `first`, in the rect from `x`, `y`, `w` by `h` units. Bars reach the top
+// at `max`, and are cut off above it.
+//
+void rOverlayGraph(const float *samples, size_t n, size_t first, float x, float y, float w, float h, float max, vec4 color)
+{
+	float bw = w / n;
+
+	rOverlayRect(x, y, w, h, vec4new(0.0f, 0.0f, 0.0f, 0.5f));
+
+	for (size_t i = 0; i < n; i++) {
+		float bh = h * fminf(samples[(first + i) % n] / max, 1.0f);
+
+		if (bh > 0.0f)
+			rOverlayRect(x + i * bw, y, bw, bh, color);
+	}
+}
+
+//
+// Draw everything added since the last flush over the scene, then clear it.
+//
+void rFlushOverlay(void)
+{
+	size_t offset, nquads = OVERLAY.nquads;
+
+	OVERLAY.nquads = 0;
+	OVERLAY.last = OVERLAY.stats;
+	OVERLAY.last.quads = nquads;
+	OVERLAY.stats = (struct overlayStats){0};
+
+	if (nquads == 0)
+		return;
+
+	if (! rStreamWrite(OVERLAY.vertices, nquads * 4 * sizeof(*OVERLAY.vertices), &offset)) {
+		OVERLAY.last.dropped += nquads;
+		return;
+	}
+	rUseShader(OVERLAY.shader);
+	RENDER_STATS.programSwitches++;
+
+	rBindVertexArray(OVERLAY.vao);
+	RENDER_STATS.vaoSwitches++;
+
+	rBindBuffer(GL_ARRAY_BUFFER, rStreamBuffer());
+	GL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct overlayVertex), (void *)(offset + offsetof(struct overlayVertex, pos))));
+	GL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct overlayVertex), (void *)(offset + offsetof(struct overlayVertex, uv))));
+	GL(glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct overlayVertex), (void *)(offset + offsetof(struct overlayVertex, color))));
+
+	if (rBindTexture(0, GL_TEXTURE_2D, OVERLAY.atlas))
+		RENDER_STATS.textureSwitches++;
+	rBindSampler(0, OVERLAY.sampler);
+
+	rSetCap(STATE_DEPTH_TEST, false);
+	rSetCap(STATE_BLEND, true);
+	rBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	GL(glDrawElements(GL_TRIANGLES, nquads * 6, GL_UNSIGNED_SHORT, 0));
+	RENDER_STATS.drawCalls++;
+
+	rSetCap(STATE_BLEND, false);
+	rSetCap(STATE_DEPTH_TEST, true);
+}
+
+//
+// Stats of the last flush.
+//
+struct overlayStats rOverlayStats(void)
+{
+	return OVERLAY.last;
+}
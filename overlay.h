@@ -0,0 +1,27 @@
+//
+// overlay.h
+// batched 2D overlay
+//
+// dependencies:
+//
+//   stdbool.h
+//   stddef.h
+//   stdint.h
+//   linmath.h
+//
+struct overlayStats {
+	unsigned quads;   // Drawn in the last flush
+	unsigned dropped; // Which didn't fit in the batch
+};
+
+extern bool rInitOverlay(int, int);
+extern void rQuitOverlay(void);
+extern int rLoadOverlayFont(const char *);
+extern void rOverlayText(int, const char *, size_t, float, float, float, vec4);
+extern int rNewOverlayImage(int, int);
+extern void rUpdateOverlayImage(int, const uint32_t *);
+extern void rOverlayRect(float, float, float, float, vec4);
+extern void rOverlayImage(int, float, float, float, float);
+extern void rOverlayGraph(const float *, size_t, size_t, float, float, float, float, float, vec4);
+extern void rFlushOverlay(void);
+extern struct overlayStats rOverlayStats(void);
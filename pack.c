@@ -0,0 +1,127 @@
+//
+// pack.c
+// asset packs
+//
+// A pack holds every asset in a single file, with a hashed directory at the
+// front. It is mapped into memory once when mounted, and assets are then
+// referenced straight from the mapping, by the same path they have on the
+// file system.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "hash.h"
+#include "util.h"
+#include "pack.h"
+
+static struct {
+	const unsigned char    *data;
+	size_t                 size;
+	const struct packEntry *entries;
+	uint32_t               nbuckets;
+} PACK;
+
+//
+// Map the pack at `path` into memory, and resolve assets from it from now
+// on. Returns false if the pack couldn't be mapped or is invalid, in which
+// case assets keep being read from the file system.
+//
+bool packMount(const char *path)
+{
+	const struct packHeader *h;
+	const unsigned char *data;
+	size_t size;
+
+	if (! (data = mapfile(path, &size)))
+		return false;
+
+	h = (const struct packHeader *)data;
+
+	if (size < sizeof(*h) || memcmp(h->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) ||
+	    h->version != PACK_VERSION || h->size != size ||
+	    h->nbuckets == 0 || h->nbuckets & (h->nbuckets - 1) ||
+	    (uint64_t)h->nbuckets * sizeof(struct packEntry) > size - sizeof(*h)) {
+		fprintf(stderr, "%s isn't a valid asset pack.\n", path);
+		unmapfile(data, size);
+		return false;
+	}
+	packUnmount();
+
+	PACK.data = data;
+	PACK.size = size;
+	PACK.entries = (const struct packEntry *)(data + sizeof(*h));
+	PACK.nbuckets = h->nbuckets;
+
+	return true;
+}
+
+void packUnmount(void)
+{
+	if (PACK.data)
+		unmapfile(PACK.data, PACK.size);
+
+	memset(&PACK, 0, sizeof(PACK));
+}
+
+//
+// Find the asset `name` in the mounted pack, and store its size in `size`.
+// Returns NULL if no pack is mounted, or if it doesn't hold the asset.
+//
+const void *packLookup(const char *name, size_t *size)
+{
+	size_t len = strlen(name);
+
+	if (! PACK.data || len >= PACK_NAME_SIZE)
+		return NULL;
+
+	uint32_t h = hash(name, len);
+
+	for (uint32_t i = 0; i < PACK.nbuckets; i++) {
+		const struct packEntry *e = &PACK.entries[(h + i) & (PACK.nbuckets - 1)];
+
+		if (! e->name[0])
+			return NULL;
+		if (e->hash != h || strncmp(e->name, name, PACK_NAME_SIZE))
+			continue;
+		if (e->offset > PACK.size || e->size > PACK.size - e->offset)
+			return NULL;
+
+		*size = e->size;
+
+		return PACK.data + e->offset;
+	}
+	return NULL;
+}
+
+//
+// Open the asset at `path`, from the mounted pack if it holds it, or else by
+// mapping it from the file system. The asset must be closed with `assetClose`.
+// Returns NULL if the asset couldn't be found.
+//
+const void *assetOpen(const char *path, size_t *size)
+{
+	const void *data;
+
+	if ((data = packLookup(path, size)))
+		return data;
+
+	return mapfile(path, size);
+}
+
+void assetClose(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	// Assets in the pack stay mapped until it is unmounted.
+	if (PACK.data && p >= PACK.data && p < PACK.data + PACK.size)
+		return;
+
+	unmapfile(data, size);
+}
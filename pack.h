@@ -0,0 +1,5 @@
+extern bool packMount(const char *);
+extern void packUnmount(void);
+extern const void *packLookup(const char *, size_t *);
+extern const void *assetOpen(const char *, size_t *);
+extern void assetClose(const void *, size_t);
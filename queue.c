@@ -0,0 +1,364 @@
+//
+// queue.c
+// sorted render queue
+//
+// Draws aren't issued as they're submitted. Every draw item is queued with a
+// 64-bit key, which packs its pass, program, material, vertex array and depth,
+// from the most significant bits down. When the queue is flushed, items are
+// radix sorted by key, so that draws sharing state end up next to each other,
+// and GL state is only changed where it differs from the previous item.
+//
+// Instanced items draw many copies of a mesh in one call, with the instanced
+// variant of the mesh's shader. Their transforms are collected into one
+// array over the frame, which is written to the stream buffer all at once
+// when the queue is flushed, and every item points the vertex array at its
+// own range of it.
+//
+// With deferred shading on, opaque items whose shader has a deferred variant
+// are moved to the G-buffer pass, which sorts before every other pass. The
+// G-buffer is resolved as soon as that pass ends, so the remaining opaque
+// items are drawn forward, over the lit scene.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "texture.h"
+#include "shader.h"
+#include "material.h"
+#include "mesh.h"
+#include "renderer.h"
+#include "state.h"
+#include "queue.h"
+#include "stream.h"
+#include "deferred.h"
+
+//
+// Layout of a sort key. Fields which don't fit are truncated, which can only
+// make the sort less effective, since state changes are decided by comparing
+// the items themselves.
+//
+enum {
+	KEY_DEPTH_SHIFT    = 0,
+	KEY_DEPTH_BITS     = 16,
+	KEY_VAO_SHIFT      = 16,
+	KEY_VAO_BITS       = 14,
+	KEY_MATERIAL_SHIFT = 30,
+	KEY_MATERIAL_BITS  = 14,
+	KEY_SHADER_SHIFT   = 44,
+	KEY_SHADER_BITS    = 16,
+	KEY_PASS_SHIFT     = 60,
+	KEY_PASS_BITS      = 4
+};
+
+_Static_assert(KEY_PASS_SHIFT + KEY_PASS_BITS == 64, "the key fields fill 64 bits");
+_Static_assert(RENDER_PASSES <= 1 << KEY_PASS_BITS, "every pass fits in the key");
+
+struct drawItem {
+	mat4            transform;
+	struct mesh     *mesh;
+	struct shader   *shader;
+	enum renderPass pass;
+	size_t          firstInstance;
+	size_t          ninstances; // Zero if the item isn't instanced
+	bool            uncull;     // Draw the selected level of detail in full
+};
+
+struct sortEntry {
+	uint64_t key;
+	uint32_t item;
+};
+
+static struct {
+	struct drawItem  *items;
+	struct sortEntry *entries;
+	struct sortEntry *scratch;
+	size_t           n;
+	size_t           cap;
+	mat4             *instances;
+	size_t           ninstances;
+	size_t           instanceCap;
+	bool             deferred;    // Whether opaque items go to the G-buffer when they can
+} QUEUE;
+
+static uint64_t keyField(uint64_t value, int shift, int bits)
+{
+	return (value & ((1ull << bits) - 1)) << shift;
+}
+
+void rInitQueue(void)
+{
+	QUEUE.n = 0;
+	QUEUE.cap = 256;
+	QUEUE.items = malloc(QUEUE.cap * sizeof(*QUEUE.items));
+	QUEUE.entries = malloc(QUEUE.cap * sizeof(*QUEUE.entries));
+	QUEUE.scratch = malloc(QUEUE.cap * sizeof(*QUEUE.scratch));
+	QUEUE.ninstances = 0;
+	QUEUE.instanceCap = 256;
+	QUEUE.instances = malloc(QUEUE.instanceCap * sizeof(*QUEUE.instances));
+}
+
+void rQuitQueue(void)
+{
+	free(QUEUE.items);
+	free(QUEUE.entries);
+	free(QUEUE.scratch);
+	free(QUEUE.instances);
+	memset(&QUEUE, 0, sizeof(QUEUE));
+}
+
+static void rQueueItem(struct drawItem item, float depth)
+{
+	if (QUEUE.n == QUEUE.cap) {
+		QUEUE.cap *= 2;
+		QUEUE.items = realloc(QUEUE.items, QUEUE.cap * sizeof(*QUEUE.items));
+		QUEUE.entries = realloc(QUEUE.entries, QUEUE.cap * sizeof(*QUEUE.entries));
+		QUEUE.scratch = realloc(QUEUE.scratch, QUEUE.cap * sizeof(*QUEUE.scratch));
+	}
+	if (depth < 0.0f) depth = 0.0f;
+	if (depth > 1.0f) depth = 1.0f;
+
+	if (QUEUE.deferred && item.pass == RENDER_PASS_OPAQUE && item.shader->deferred) {
+		item.pass = RENDER_PASS_GBUFFER;
+		item.shader = item.shader->deferred;
+	}
+
+	uint64_t key = keyField(item.pass, KEY_PASS_SHIFT, KEY_PASS_BITS)
+	             | keyField(item.shader->handle, KEY_SHADER_SHIFT, KEY_SHADER_BITS)
+	             | keyField(item.mesh->material->id, KEY_MATERIAL_SHIFT, KEY_MATERIAL_BITS)
+	             | keyField(item.mesh->vao, KEY_VAO_SHIFT, KEY_VAO_BITS)
+	             | keyField(depth * ((1 << KEY_DEPTH_BITS) - 1), KEY_DEPTH_SHIFT, KEY_DEPTH_BITS);
+
+	QUEUE.items[QUEUE.n] = item;
+	QUEUE.entries[QUEUE.n] = (struct sortEntry){key, QUEUE.n};
+	QUEUE.n++;
+}
+
+//
+// Queue a draw of `m` with `transform` in pass `pass`. The mesh must stay
+// alive until the queue is flushed. `depth` is the distance of the mesh from
+// the camera, from 0 at the near plane to 1 at the far plane, and orders
+// draws with the same state front to back.
+//
+void rSubmitMesh(enum renderPass pass, struct mesh *m, const mat4 *transform, float depth)
+{
+	struct shader *s = m->material->shader;
+
+	rQueueItem((struct drawItem){*transform, m, s, pass, 0, 0, false}, depth);
+}
+
+//
+// Queue a draw of `m` like `rSubmitMesh`, but over the full range of its
+// selected level of detail. Its clusters are culled for the model transform
+// only, so this is how copies of the mesh under other transforms are drawn.
+//
+void rSubmitMeshUnculled(enum renderPass pass, struct mesh *m, const mat4 *transform, float depth)
+{
+	struct shader *s = m->material->shader;
+
+	rQueueItem((struct drawItem){*transform, m, s, pass, 0, 0, true}, depth);
+}
+
+//
+// Copy `count` instance transforms into the queue, for instanced items to
+// draw with. Returns the index of the first one, which stays valid until the
+// queue is flushed.
+//
+size_t rQueueInstances(const mat4 *transforms, size_t count)
+{
+	size_t first = QUEUE.ninstances;
+
+	if (QUEUE.ninstances + count > QUEUE.instanceCap) {
+		while (QUEUE.ninstances + count > QUEUE.instanceCap)
+			QUEUE.instanceCap *= 2;
+
+		QUEUE.instances = realloc(QUEUE.instances, QUEUE.instanceCap * sizeof(*QUEUE.instances));
+	}
+	memcpy(&QUEUE.instances[first], transforms, count * sizeof(*transforms));
+	QUEUE.ninstances += count;
+
+	return first;
+}
+
+//
+// Queue a single draw of `count` instances of `m`, with the transforms
+// starting at `first` as returned by `rQueueInstances`. The mesh's shader
+// must have an instanced variant.
+//
+void rSubmitInstances(enum renderPass pass, struct mesh *m, size_t first, size_t count, float depth)
+{
+	struct shader *s = m->material->shader->instanced;
+
+	if (count == 0)
+		return;
+
+	rQueueItem((struct drawItem){mat4identity(), m, s, pass, first, count, false}, depth);
+}
+
+//
+// Sort the queue entries by key, least significant byte first. Bytes which
+// are the same in every key are skipped.
+//
+static void radixSort(void)
+{
+	struct sortEntry *src = QUEUE.entries, *dst = QUEUE.scratch;
+
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t counts[256] = {0};
+
+		for (size_t i = 0; i < QUEUE.n; i++) {
+			counts[(src[i].key >> shift) & 0xff]++;
+		}
+		if (counts[(src[0].key >> shift) & 0xff] == QUEUE.n)
+			continue;
+
+		for (size_t b = 0, sum = 0; b < 256; b++) {
+			size_t c = counts[b];
+			counts[b] = sum;
+			sum += c;
+		}
+		for (size_t i = 0; i < QUEUE.n; i++) {
+			dst[counts[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+		struct sortEntry *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	QUEUE.entries = src;
+	QUEUE.scratch = dst;
+}
+
+//
+// Draw opaque items to the G-buffer or not, from the next submission on.
+//
+void rSetDeferredShading(bool enabled)
+{
+	QUEUE.deferred = enabled;
+}
+
+static void rBeginPass(enum renderPass pass)
+{
+	switch (pass) {
+	case RENDER_PASS_GBUFFER:
+		rSetCap(STATE_DEPTH_TEST, true);
+		rSetCap(STATE_BLEND, false);
+		rBeginGeometryPass();
+		break;
+	case RENDER_PASS_OPAQUE:
+		rSetCap(STATE_DEPTH_TEST, true);
+		rSetCap(STATE_BLEND, false);
+		break;
+	case RENDER_PASS_OVERLAY:
+		rSetCap(STATE_DEPTH_TEST, false);
+		rSetCap(STATE_BLEND, true);
+		rBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		break;
+	default:
+		break;
+	}
+}
+
+//
+// Bind the textures of `mat`, and point the samplers of `s` at them when `s`
+// was just made current.
+//
+static void rBindMaterial(struct shader *s, struct material *mat, bool newShader)
+{
+	for (int j = 0; j < TEXTURE_TYPES; j++) {
+		struct texture *t = mat->textures[j];
+
+		if (t == NULL)
+			continue;
+
+		if (newShader)
+			GL(glUniform1i(rUniformLocation(s, rTextureSamplerName(j)), t->index));
+
+		if (rBindTexture(t->index, GL_TEXTURE_2D, t->handle))
+			RENDER_STATS.textureSwitches++;
+
+		rBindSampler(t->index, t->sampler);
+	}
+}
+
+//
+// Sort and draw everything in the queue, then empty it.
+//
+void rFlushQueue(void)
+{
+	struct shader *shader = NULL;
+	struct material *material = NULL;
+	GLuint vao = 0;
+	int pass = -1;
+
+	if (QUEUE.n == 0)
+		return;
+
+	radixSort();
+
+	// Instances are written to the stream buffer once per flush. If they
+	// don't fit, instanced items are skipped.
+	size_t instanceOffset = 0;
+	bool hasInstances = QUEUE.ninstances > 0 &&
+	                    rStreamWrite(QUEUE.instances, QUEUE.ninstances * sizeof(*QUEUE.instances), &instanceOffset);
+
+	for (size_t i = 0; i < QUEUE.n; i++) {
+		struct drawItem *item = &QUEUE.items[QUEUE.entries[i].item];
+		struct mesh *m = item->mesh;
+		bool newShader = false;
+
+		if (item->ninstances > 0 && ! hasInstances)
+			continue;
+
+		if (item->pass != pass) {
+			// The resolve changes the program, textures and vertex array.
+			if (pass == RENDER_PASS_GBUFFER) {
+				rResolveDeferred();
+				shader = NULL;
+				material = NULL;
+				vao = 0;
+			}
+			rBeginPass(item->pass);
+			pass = item->pass;
+		}
+		if (item->shader != shader) {
+			shader = item->shader;
+			rUseShader(shader);
+			RENDER_STATS.programSwitches++;
+
+			// Sampler uniforms belong to the program, so they're set again.
+			newShader = true;
+		}
+		if (m->material != material || newShader) {
+			material = m->material;
+			rBindMaterial(shader, material, newShader);
+		}
+		if (m->vao != vao) {
+			vao = m->vao;
+			rBindVertexArray(vao);
+			RENDER_STATS.vaoSwitches++;
+		}
+		if (item->ninstances > 0) {
+			rBindBuffer(GL_ARRAY_BUFFER, rStreamBuffer());
+			rSetInstanceAttribs(instanceOffset + item->firstInstance * sizeof(*QUEUE.instances));
+			rDrawMeshInstances(m, item->ninstances);
+		} else {
+			rSetUniformMatrix4fv(shader, "model", &item->transform);
+
+			if (item->uncull)
+				rDrawMeshLod(m);
+			else
+				rDrawMeshGeometry(m);
+		}
+	}
+	if (pass == RENDER_PASS_GBUFFER)
+		rResolveDeferred();
+
+	rSetCap(STATE_DEPTH_TEST, true);
+
+	QUEUE.n = 0;
+	QUEUE.ninstances = 0;
+}
@@ -0,0 +1,20 @@
+//
+// Passes of the render queue, in the order they're drawn.
+//
+enum renderPass {
+	RENDER_PASS_GBUFFER, // Opaque meshes drawn to the G-buffer, then resolved
+	RENDER_PASS_OPAQUE,  // Depth tested, front to back
+	RENDER_PASS_OVERLAY, // Blended over the scene, without depth testing
+	RENDER_PASSES
+};
+
+struct mesh;
+
+extern void rInitQueue(void);
+extern void rQuitQueue(void);
+extern void rSubmitMesh(enum renderPass, struct mesh *, const mat4 *, float);
+extern void rSubmitMeshUnculled(enum renderPass, struct mesh *, const mat4 *, float);
+extern size_t rQueueInstances(const mat4 *, size_t);
+extern void rSubmitInstances(enum renderPass, struct mesh *, size_t, size_t, float);
+extern void rSetDeferredShading(bool);
+extern void rFlushQueue(void);
@@ -1,9 +1,24 @@
 #include <GL/glew.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 
-#include "text.h"
+#include "linmath.h"
+#include "overlay.h"
+#include "renderer.h"
+#include "state.h"
+#include "occlusion.h"
+#include "lightcluster.h"
+#include "shadow.h"
+#include "stream.h"
+
+struct renderStats RENDER_STATS;
+
+enum { FRAME_TIME_SAMPLES = 128 };
+
+static const float FRAME_TIME_GRAPH_MAX = 1000.0f / 30.0f; // Frame time at the top of the graph, in ms
 
 void rInitRenderer()
 {
@@ -11,28 +26,127 @@ void rInitRenderer()
 	glewExperimental = GL_TRUE;
 	glewInit();
 
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
-	glFrontFace(GL_CW);
-	glEnable(GL_NORMALIZE);
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_STENCIL_TEST);
-	glEnable(GL_FRAMEBUFFER_SRGB);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	rInvalidateState();
+	rSetCap(STATE_CULL_FACE, true);
+	rCullFace(GL_BACK, GL_CW);
+	rSetCap(STATE_DEPTH_TEST, true);
+	rSetCap(STATE_STENCIL_TEST, true);
+	rSetCap(STATE_FRAMEBUFFER_SRGB, true);
+	rSetCap(STATE_BLEND, true);
+	rBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 void rClear()
 {
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
+	GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+}
+
+//
+// Draw a line of stats in the default font, at height `y`.
+//
+static void drawStatsLine(const char *str, int y)
+{
+	rOverlayText(0, str, strlen(str), 10, y, 16, vec4new(1.0f, 1.0f, 1.0f, 1.0f));
 }
 
+//
+// Draw the frame time `ft`, next to a graph of the last frame times.
+//
 void rDrawFrameTime(double ft)
 {
+	static float samples[FRAME_TIME_SAMPLES];
+	static size_t next;
 	char str[128];
 
+	samples[next] = ft;
+	next = (next + 1) % FRAME_TIME_SAMPLES;
+
 	sprintf(str, "frame time: %.3fms", ft);
-	rDrawText2D(str, strlen(str), 10, 576, 16);
+	drawStatsLine(str, 576);
+
+	rOverlayGraph(samples, FRAME_TIME_SAMPLES, next, 340, 576, FRAME_TIME_SAMPLES, 16, FRAME_TIME_GRAPH_MAX,
+	              vec4new(0.3f, 0.9f, 0.3f, 0.8f));
+}
+
+//
+// Draw the GL call, state switch and mesh visibility counters of the frame.
+//
+void rDrawRenderStats(const struct renderStats *stats)
+{
+	char str[128];
+
+	sprintf(str, "gl calls: %u (%u skipped), draw calls: %u", stats->glCalls, stats->skippedCalls, stats->drawCalls);
+	drawStatsLine(str, 556);
+
+	sprintf(str, "switches: %u programs, %u textures, %u vaos", stats->programSwitches, stats->textureSwitches, stats->vaoSwitches);
+	drawStatsLine(str, 536);
+
+	sprintf(str, "meshes: %u visible, %u culled, %u occluded", stats->meshesVisible, stats->meshesCulled, stats->meshesOccluded);
+	drawStatsLine(str, 516);
+}
+
+//
+// Draw the occluders and triangles rasterized into the occlusion buffer, and
+// the time spent rasterizing and testing against it.
+//
+void rDrawOcclusionStats(const struct occlusionStats *stats)
+{
+	char str[128];
+
+	sprintf(str, "occlusion: %u occluders, %u triangles, %.3fms raster, %.3fms test",
+	        stats->occluders, stats->triangles, stats->rasterizeMs, stats->testMs);
+	drawStatsLine(str, 496);
 }
 
+//
+// Draw how many lights survived culling, how densely they fill the clusters,
+// and the time spent binning them.
+//
+void rDrawLightClusterStats(const struct lightClusterStats *stats)
+{
+	char str[128];
+
+	sprintf(str, "lights: %u/%u visible, %u per cluster at most, %.1f on average, %.3fms binning",
+	        stats->visible, stats->lights, stats->maxLights,
+	        stats->occupied ? (double)stats->references / stats->occupied : 0.0, stats->binMs);
+	drawStatsLine(str, 476);
+}
+
+//
+// Draw the shadow casters and draws of the frame, and how many cascades
+// had their maps rendered again.
+//
+void rDrawShadowStats(const struct shadowStats *stats)
+{
+	char str[128];
+
+	sprintf(str, "shadows: %u casters, %u draws, %u cascades refreshed, %.3fms",
+	        stats->casters, stats->draws, stats->refreshed, stats->renderMs);
+	drawStatsLine(str, 456);
+}
+
+//
+// Draw how much of the stream buffer is in flight, and how often writes
+// wrapped around or stalled waiting on the GPU.
+//
+void rDrawStreamStats(const struct streamStats *stats)
+{
+	char str[128];
+
+	sprintf(str, "stream: %zu/%zu KB in flight, %zu KB in %u writes, %u wraps, %u stalls (%.3fms)",
+	        stats->inFlight / 1024, stats->capacity / 1024, stats->bytes / 1024,
+	        stats->allocations, stats->wraps, stats->stalls, stats->stallMs);
+	drawStatsLine(str, 436);
+}
+
+//
+// Draw the overlay quads batched this frame, and those which didn't fit.
+//
+void rDrawOverlayStats(const struct overlayStats *stats)
+{
+	char str[128];
+
+	sprintf(str, "overlay: %u quads, %u dropped", stats->quads, stats->dropped);
+	drawStatsLine(str, 416);
+}
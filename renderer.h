@@ -1,3 +1,38 @@
+//
+// Counters of the work submitted to the GPU, reset every frame.
+//
+struct renderStats {
+	unsigned glCalls;
+	unsigned skippedCalls; // State changes skipped by the state cache
+	unsigned drawCalls;
+	unsigned programSwitches;
+	unsigned textureSwitches;
+	unsigned vaoSwitches;
+	unsigned meshesVisible; // Meshes which passed frustum culling
+	unsigned meshesCulled;
+	unsigned meshesOccluded; // Meshes which passed frustum culling, but were hidden by occluders
+};
+
+struct occlusionStats;
+struct lightClusterStats;
+struct shadowStats;
+struct streamStats;
+struct overlayStats;
+
+extern struct renderStats RENDER_STATS;
+
+//
+// Issue the GL call `call`, counting it in `RENDER_STATS`. Only calls made on
+// the per-frame paths are counted.
+//
+#define GL(call) (RENDER_STATS.glCalls++, (call))
+
 extern void rInitRenderer();
 extern void rClear();
 extern void rDrawFrameTime(double);
+extern void rDrawRenderStats(const struct renderStats *);
+extern void rDrawOcclusionStats(const struct occlusionStats *);
+extern void rDrawLightClusterStats(const struct lightClusterStats *);
+extern void rDrawShadowStats(const struct shadowStats *);
+extern void rDrawStreamStats(const struct streamStats *);
+extern void rDrawOverlayStats(const struct overlayStats *);
@@ -6,14 +6,49 @@
 #include <assert.h>
 
 #include "util.h"
+#include "pack.h"
 #include "linmath.h"
 #include "shader.h"
 #include "dict.h"
+#include "renderer.h"
+#include "frame.h"
+#include "lightcluster.h"
+#include "shadow.h"
+#include "state.h"
 
 #define elems(a) (sizeof(a) / sizeof(a[0]))
 
 static dict_t SHADERS;
 
+// Suffixes of the names of the variants of a shader.
+static const char INSTANCED_SUFFIX[] = ".instanced";
+static const char DEFERRED_SUFFIX[] = ".deferred";
+
+//
+// Samplers of buffers shared by every program, which stay bound to the same
+// texture unit across programs.
+//
+static const struct {
+	const char *name;
+	GLint      unit;
+} SHARED_SAMPLERS[] = {
+	{"clusterGrid",   LIGHT_CLUSTER_GRID_UNIT},
+	{"clusterLights", LIGHT_CLUSTER_INDEX_UNIT},
+	{"lightData",     LIGHT_CLUSTER_LIGHT_UNIT},
+	{"shadowMap",     SHADOW_UNIT}
+};
+
+static const char *ATTRIB_NAMES[ATTRIBS] = {
+	[ATTRIB_POSITION] = "position",
+	[ATTRIB_NORMAL]   = "normal",
+	[ATTRIB_TANGENT]  = "tangent",
+	[ATTRIB_TEXCOORD] = "texcoord",
+	[ATTRIB_BONES]    = "bones",
+	[ATTRIB_WEIGHTS]  = "weights",
+	[ATTRIB_INSTANCE] = "model",
+	[ATTRIB_COLOR]    = "instanceColor"
+};
+
 //
 // Display compilation errors from the OpenGL shader compiler
 //
@@ -26,8 +61,17 @@ static void printlog(GLuint shader)
 
 void rUseShader(struct shader *s)
 {
-	if (s) { glUseProgram(s->handle); }
-	else   { glUseProgram(0); }
+	rUseProgram(s ? s->handle : 0);
+}
+
+//
+// Location of uniform `name` in `s`, or -1 if the program doesn't use it.
+//
+GLint rUniformLocation(struct shader *s, const char *name)
+{
+	GLint *loc = dictLookup(s->uniforms, name);
+
+	return loc ? *loc : -1;
 }
 
 struct shader *rGetShader(const char *name)
@@ -38,27 +82,71 @@ struct shader *rGetShader(const char *name)
 void rDeleteShader(struct shader *s)
 {
 	glDeleteProgram(s->handle);
+	rInvalidateState();
+	dictFree(s->uniforms);
+	free(s->locations);
 	free(s);
 }
 
 //
-// Compile the shader from file `filename`
+// End of the line holding the `#version` directive of `source`, or its start
+// if there is none. The number of the line which follows is stored in `line`.
 //
-struct shader *rShaderFromPath(const char *filename, GLenum type)
+static const GLchar *versionEnd(const GLchar *source, size_t size, int *line)
 {
-	const GLchar *source = readfile(filename);
+	const GLchar *end = source + size;
 
-	if (source == NULL) {
+	*line = 1;
+
+	for (const GLchar *p = source; p < end; (*line)++) {
+		const GLchar *nl = memchr(p, '\n', end - p);
+		const GLchar *next = nl ? nl + 1 : end;
+
+		if (next - p >= 8 && strncmp(p, "#version", 8) == 0) {
+			(*line)++;
+			return next;
+		}
+		p = next;
+	}
+	*line = 1;
+
+	return source;
+}
+
+//
+// Compile the shader from file `filename`, with `defines` inserted at the top
+// unless it's NULL.
+//
+struct shader *rShaderFromPath(const char *filename, GLenum type, const char *defines)
+{
+	const GLchar *source;
+	size_t size;
+
+	if ((source = assetOpen(filename, &size)) == NULL) {
 		fprintf(stderr, "error opening %s", filename);
 		return NULL;
 	}
 	GLuint handle = glCreateShader(type);
 	struct shader *s = rNewShader(filename, handle);
 
-	glShaderSource(s->handle, 1, &source, NULL);
+	// The defines and the frame uniform block are inserted right after the
+	// `#version` directive, which has to come before anything else. The
+	// `#line` directive keeps the line numbers of compile errors matching
+	// the file.
+	int line;
+	const GLchar *body = versionEnd(source, size, &line);
+	char directive[32];
+
+	snprintf(directive, sizeof(directive), "#line %d\n", line);
+
+	// The source isn't NUL-terminated, so its length is passed explicitly.
+	const GLchar *sources[] = {source, defines ? defines : "", FRAME_BLOCK_SOURCE, directive, body};
+	GLint lens[] = {body - source, -1, -1, -1, size - (body - source)};
+
+	glShaderSource(s->handle, elems(sources), sources, lens);
 	glCompileShader(s->handle);
 
-	free((char *)source);
+	assetClose(source, size);
 
 	GLint status;
 	glGetShaderiv(s->handle, GL_COMPILE_STATUS, &status);
@@ -78,18 +166,49 @@ struct shader *rNewShader(const char *name, GLuint handle)
 	strcpy(s->name, name);
 	s->handle = handle;
 	s->uniforms = dict(NULL);
+	s->locations = NULL;
+	s->instanced = NULL;
+	s->deferred = NULL;
 
 	return s;
 }
 
-bool rLoadShader(const char *name, const char *vertpath, const char *fragpath)
+//
+// Look up the location of every active uniform of `s`, so that setting a
+// uniform never has to query the driver. Array uniforms are reported as
+// "name[0]", and are stored under "name".
+//
+static void rResolveUniforms(struct shader *s)
+{
+	GLint n;
+
+	glGetProgramiv(s->handle, GL_ACTIVE_UNIFORMS, &n);
+	s->locations = malloc(n * sizeof(*s->locations));
+
+	for (GLint i = 0; i < n; i++) {
+		char name[256];
+		GLsizei len;
+		GLint size;
+		GLenum type;
+
+		glGetActiveUniform(s->handle, i, sizeof(name), &len, &size, &type, name);
+
+		if (len > 3 && strcmp(name + len - 3, "[0]") == 0)
+			name[len - 3] = '\0';
+
+		s->locations[i] = glGetUniformLocation(s->handle, name);
+		dictInsert(s->uniforms, name, &s->locations[i]);
+	}
+}
+
+bool rLoadShader(const char *name, const char *vertpath, const char *fragpath, const char *defines)
 {
 	struct shader *vert, *frag;
 
-	if (! (vert = rShaderFromPath(vertpath, GL_VERTEX_SHADER)))
+	if (! (vert = rShaderFromPath(vertpath, GL_VERTEX_SHADER, defines)))
 		return false;
 
-	if (! (frag = rShaderFromPath(fragpath, GL_FRAGMENT_SHADER)))
+	if (! (frag = rShaderFromPath(fragpath, GL_FRAGMENT_SHADER, defines)))
 		return false;
 
 	GLuint program = glCreateProgram();
@@ -98,9 +217,35 @@ bool rLoadShader(const char *name, const char *vertpath, const char *fragpath)
 
 	// Not currently necessary because only one buffer
 	glBindFragDataLocation(program, 0, "fragColor");
+
+	// Explicit `layout(location)` qualifiers in the shader take precedence.
+	// Locations taken by the columns of a matrix have no name.
+	for (int i = 0; i < ATTRIBS; i++) {
+		if (ATTRIB_NAMES[i])
+			glBindAttribLocation(program, i, ATTRIB_NAMES[i]);
+	}
 	glLinkProgram(program);
 
-	dictInsert(SHADERS, name, rNewShader(name, program));
+	// Programs which don't use the frame uniforms have no such block.
+	GLuint block = glGetUniformBlockIndex(program, FRAME_BLOCK_NAME);
+
+	if (block != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, block, FRAME_BLOCK_BINDING);
+
+	// Sampler uniforms can only be set on the current program.
+	rUseProgram(program);
+
+	for (int i = 0; i < elems(SHARED_SAMPLERS); i++) {
+		GLint loc = glGetUniformLocation(program, SHARED_SAMPLERS[i].name);
+
+		if (loc != -1)
+			glUniform1i(loc, SHARED_SAMPLERS[i].unit);
+	}
+
+	struct shader *s = rNewShader(name, program);
+	rResolveUniforms(s);
+
+	dictInsert(SHADERS, name, s);
 
 	return true;
 }
@@ -110,10 +255,22 @@ bool rLoadShaders(struct shaderSource *sources)
 	SHADERS = dict(NULL);
 
 	for (struct shaderSource *s = sources; s->name != NULL; s++) {
-		if (! rLoadShader(s->name, s->vert, s->frag)) {
+		if (! rLoadShader(s->name, s->vert, s->frag, s->defines)) {
 			return false;
 		}
 	}
+
+	// Link every shader to its variants, named after it.
+	for (struct shaderSource *s = sources; s->name != NULL; s++) {
+		struct shader *shader = rGetShader(s->name);
+		char name[256];
+
+		snprintf(name, sizeof(name), "%s%s", s->name, INSTANCED_SUFFIX);
+		shader->instanced = rGetShader(name);
+
+		snprintf(name, sizeof(name), "%s%s", s->name, DEFERRED_SUFFIX);
+		shader->deferred = rGetShader(name);
+	}
 	return true;
 }
 
@@ -131,51 +288,47 @@ void rUnloadShaders(struct shaderSource *sources)
 	dictFree(SHADERS);
 }
 
-// TODO(cloudhead): Optimize lookup with a cache.
 void rSetUniformMatrix4fv(struct shader *s, const char *name, mat4 *m)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = rUniformLocation(s, name)) == -1) {
 		// TODO(cloudhead): Log error.
 		return;
 	}
-	glUniformMatrix4fv(loc, 1, GL_FALSE, (float *)m->cols);
+	GL(glUniformMatrix4fv(loc, 1, GL_FALSE, (float *)m->cols));
 }
 
-// TODO(cloudhead): Optimize lookup with a cache.
 void rSetUniform3fv(struct shader *s, const char *name, vec3 *v)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = rUniformLocation(s, name)) == -1) {
 		// TODO(cloudhead): Log error.
 		return;
 	}
-	glUniform3fv(loc, 1, (float *)v);
+	GL(glUniform3fv(loc, 1, (float *)v));
 }
 
-// TODO(cloudhead): Optimize lookup with a cache.
 void rSetUniform4fv(struct shader *s, const char *name, vec4 *v)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = rUniformLocation(s, name)) == -1) {
 		// TODO(cloudhead): Log error.
 		fprintf(stderr, "couldn't get uniform location for '%s'\n", name);
 		return;
 	}
-	glUniform4fv(loc, 1, (float *)v);
+	GL(glUniform4fv(loc, 1, (float *)v));
 }
 
-// TODO(cloudhead): Optimize lookup with a cache.
 void rSetUniform1i(struct shader *s, const char *name, GLint i)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = rUniformLocation(s, name)) == -1) {
 		// TODO(cloudhead): Log error.
 		return;
 	}
-	glUniform1i(loc, i);
+	GL(glUniform1i(loc, i));
 }
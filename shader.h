@@ -1,13 +1,36 @@
 typedef struct dict *dict_t;
 
+//
+// Vertex attribute locations, bound to the same attribute names in every
+// program before linking, so that a mesh's vertex array works with any shader.
+//
+enum attribLocation {
+	ATTRIB_POSITION,
+	ATTRIB_NORMAL,
+	ATTRIB_TANGENT,
+	ATTRIB_TEXCOORD,
+	ATTRIB_BONES,
+	ATTRIB_WEIGHTS,
+	ATTRIB_INSTANCE, // Per-instance model matrix, which takes four locations
+	ATTRIB_COLOR = ATTRIB_INSTANCE + 4, // Per-instance color
+	ATTRIBS
+};
+
 struct shader {
-	GLuint handle;
-	dict_t uniforms;
-	char   name[];
+	GLuint        handle;
+	dict_t        uniforms;  // Uniform name to location, resolved once at link time
+	GLint         *locations;
+	struct shader *instanced; // Variant which takes its model matrix per instance, if any
+	struct shader *deferred;  // Variant which writes to the G-buffer, if any
+	char          name[];
 };
 
+//
+// Sources of a shader program. `defines`, if set, is inserted at the top of
+// both stages.
+//
 struct shaderSource {
-	char *name, *vert, *frag;
+	char *name, *vert, *frag, *defines;
 };
 
 extern struct shader *rGetShader(const char *);
@@ -16,6 +39,7 @@ extern void rDeleteShader(struct shader *);
 extern bool rLoadShaders(struct shaderSource *);
 extern void rUnloadShaders(struct shaderSource *);
 extern void rUseShader(struct shader *);
+extern GLint rUniformLocation(struct shader *, const char *);
 extern void rSetUniformMatrix4fv(struct shader *, const char *, mat4 *);
 extern void rSetUniform3fv(struct shader *, const char *, vec3 *);
 extern void rSetUniform4fv(struct shader *, const char *, vec4 *);
@@ -8,30 +8,35 @@
 #define RENDER_FLAT_DIFFUSE  3 // Diffuse color only, flat shading
 #define RENDER_FLAT_SPECULAR 4 // Specular color as diffuse, flat shading
 #define RENDER_FLAT_NORMAL   5 // Normals as diffuse, flat shading
+#define RENDER_DEFERRED      6 // Deferred shading, for meshes without a deferred variant
+
+#define SHADOW_CASCADES 4 // Same as FRAME_SHADOW_CASCADES
 
 const float PI = 3.1415926535897932384626433832;
 
 in vec3 fragPosWorld;
 in vec2 textureCoord;
-in vec3 viewDirTan;
-in vec3 lightDirTan;
-in vec3 lightPosWorld;
-in vec3 vertexNormal;
+in vec3 vNormal;
+in vec3 vTangent;
+in vec3 vBitangent;
 
 out vec4 fragColor;
 
-uniform bool      debugMode;
-uniform bool      tonemapEnabled;
-uniform int       renderMode;
 uniform sampler2D diffuseSampler;
 uniform sampler2D specularSampler;
 uniform sampler2D normalSampler;
 
+uniform usamplerBuffer clusterGrid;   // Offset and count of the lights of each cluster
+uniform usamplerBuffer clusterLights; // Light indices of every cluster
+uniform samplerBuffer  lightData;     // Position and range, then color and brightness
+
+uniform sampler2DArrayShadow shadowMap; // Depth of the shadow casting light, one layer per cascade
+
+// Light reaching a fragment, summed over every light.
 struct light {
-	vec4 intensity;
+	vec4 irradiance; // Diffuse light
+	vec4 highlight;  // Specular light
 	vec4 ambience;
-	float attenuation;
-	float incidence;
 };
 
 vec4 tonemap(in vec4 color)
@@ -46,13 +51,13 @@ vec4 tonemap(in vec4 color)
 	return ((color * (A * color + C * B) + D * E) / (color * (A * color + B) + D * F)) - E/F;
 }
 
-vec4 computeFragColor(in vec4 diffuse, in vec4 specular, in float blinnTerm, in light l)
+vec4 computeFragColor(in vec4 diffuse, in vec4 specular, in light l)
 {
 	float W = 11.2; // Whitepoint
 
-	vec4 color = (diffuse * l.intensity * l.incidence * l.attenuation)  +
-		   		 (specular * l.attenuation * blinnTerm) +
-		   		 (diffuse * l.ambience);
+	vec4 color = (diffuse * l.irradiance) +
+	             (specular * l.highlight) +
+	             (diffuse * l.ambience);
 
 	float exposure = 1.0f;
 
@@ -104,13 +109,100 @@ float blinn(in float roughness, in vec3 halfAngle, in vec3 normal)
 	return blinnTerm;
 }
 
-void main()
+//
+// Offset and count of the lights of the cluster of the current fragment.
+//
+uvec2 lightCluster(in vec3 posWorld)
+{
+	float depth = -(view * vec4(posWorld, 1.0)).z;
+	vec3 cell = vec3(gl_FragCoord.xy * clusterScale.xy, log(depth) * clusterScale.z + clusterScale.w);
+	ivec3 c = clamp(ivec3(cell), ivec3(0), clusterSize.xyz - 1);
+
+	return texelFetch(clusterGrid, c.x + clusterSize.x * (c.y + clusterSize.y * c.z)).xy;
+}
+
+//
+// Fraction of the shadow casting light reaching `posWorld`, over 3x3 taps of
+// its cascade, each of which is a bilinear comparison.
+//
+float shadowFactor(in vec3 posWorld, in vec3 normal)
+{
+	float depth = -(view * vec4(posWorld, 1.0)).z;
+	int cascade = 0;
+
+	while (cascade < SHADOW_CASCADES && depth > shadowSplits[cascade]) {
+		cascade++;
+	}
+	if (cascade == SHADOW_CASCADES) {
+		return 1.0;
+	}
+	// Coarser cascades need a larger offset to keep surfaces from shadowing themselves.
+	vec3 offset = normal * 0.02 * float(cascade + 1);
+	vec4 p = shadowMatrices[cascade] * vec4(posWorld + offset, 1.0);
+	vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+	float lit = 0.0;
+
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			lit += texture(shadowMap, vec4(p.xy + vec2(x, y) * texel, float(cascade), p.z));
+		}
+	}
+	return lit / 9.0;
+}
+
+light shadeLights(in float roughness, in vec3 normal, in vec3 viewDir)
 {
 	light l;
+	uvec2 cluster = lightCluster(fragPosWorld);
 
-	l.intensity = vec4(1.0, 1.0, 0.9, 0.0) * 30;
+	l.irradiance = vec4(0.0);
+	l.highlight = vec4(0.0);
 	l.ambience = vec4(0.05, 0.05, 0.08, 0.0) * 3;
 
+	for (uint i = cluster.x; i < cluster.x + cluster.y; i++) {
+		int index = int(texelFetch(clusterLights, int(i)).r);
+		vec4 position = texelFetch(lightData, index * 2);
+		vec4 color = texelFetch(lightData, index * 2 + 1);
+
+		vec3 toLight = position.xyz - fragPosWorld;
+		float lightDistance = length(toLight);
+
+		if (lightDistance > position.w) {
+			continue;
+		}
+		vec3 lightDir = toLight / lightDistance;
+		float attenuation = 1.0 / (1.0 + lightDistance * lightDistance);
+		float incidence = clamp(dot(lightDir, normal), 0, 1);
+
+		if (incidence == 0.0) {
+			continue;
+		}
+		if (index == shadowLight) {
+			attenuation *= shadowFactor(fragPosWorld, normalize(vNormal));
+		}
+		vec3 halfAngle = normalize(lightDir + viewDir);
+		float specTerm = cookTorrance(roughness, halfAngle, normal, viewDir, lightDir);
+
+		l.irradiance += vec4(color.rgb * color.a * incidence * attenuation, 0.0);
+		l.highlight += vec4(color.rgb * attenuation * specTerm, 0.0);
+	}
+	return l;
+}
+
+//
+// Unpack a tangent space normal from a normal map texel. Only x and y are
+// read, since precompressed normal maps don't store z, which is rebuilt from
+// them instead.
+//
+vec3 unpackNormal(in vec4 c)
+{
+	vec2 xy = c.rg * 2.0 - 1.0;
+
+	return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
+
+void main()
+{
 	const float roughness = 0.3;
 	const float specularIntensity = 15.0;
 
@@ -122,30 +214,22 @@ void main()
 	vec4 normalColor = texture(normalSampler, t);
 	vec4 specularColor = texture(specularSampler, textureCoord);
 
-	// Convert RGB values to [-1, 1] range
-	vec3 normal = normalize(normalColor.rgb * 2.0 - 1.0);
+	// Convert RGB values to [-1, 1] range, and out of tangent space
+	mat3 TBN = mat3(normalize(vTangent), normalize(vBitangent), normalize(vNormal));
+	vec3 normal = normalize(TBN * unpackNormal(normalColor));
+	vec3 viewDir = normalize(cameraPos - fragPosWorld);
 
 	vec4 specular = vec4(specularColor.rgb * specularIntensity, 1.0);
 
-	float lightDistance = length(lightPosWorld - fragPosWorld);
-
-	l.attenuation = 1.0 / (1.0 + lightDistance * lightDistance);
-	l.incidence = clamp(dot(lightDirTan, normal), 0, 1);
-
-	vec3 halfAngle = normalize(lightDirTan + viewDirTan);
-	float specTerm = cookTorrance(roughness, halfAngle, normal, viewDirTan, lightDirTan);
-
-	if (l.incidence == 0.0) {
-		specTerm = 0.0;
-	}
+	light l = shadeLights(roughness, normal, viewDir);
 
 	switch (renderMode) {
-		case RENDER_TEXTURED:      fragColor = computeFragColor(diffuse, specular, specTerm, l); break;
-		case RENDER_SHADED:        fragColor = computeFragColor(grey, vec4(1.0), specTerm, l); break;
-		case RENDER_SPECULAR:      fragColor = computeFragColor(vec4(0), specular, specTerm, l); break;
+		case RENDER_TEXTURED:
+		case RENDER_DEFERRED:      fragColor = computeFragColor(diffuse, specular, l); break;
+		case RENDER_SHADED:        fragColor = computeFragColor(grey, vec4(1.0), l); break;
+		case RENDER_SPECULAR:      fragColor = computeFragColor(vec4(0), specular, l); break;
 		case RENDER_FLAT_DIFFUSE:  fragColor = diffuse; break;
 		case RENDER_FLAT_NORMAL:   fragColor = normalColor; break;
 		case RENDER_FLAT_SPECULAR: fragColor = specularColor; break;
 	}
 }
-
@@ -7,39 +7,30 @@ in vec2 texcoord;
 
 out vec3 fragPosWorld;
 out vec2 textureCoord;
-out vec3 viewDirTan;
-out vec3 lightDirTan;
-out vec3 lightPosWorld;
-out vec3 vertexNormal;
+out vec3 vNormal;
+out vec3 vTangent;
+out vec3 vBitangent;
 
-uniform vec3 lightPos;
+// The instanced variant takes its model matrix per instance.
+#ifdef INSTANCED
+in mat4 model;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
+#endif
 
 void main()
 {
-	vec3 bitangent = cross(normal, tangent.xyz) * tangent.w;
-	vec3 lightDirWorld = lightPos - vec3(model * vec4(position, 1.0));
-	vec3 cameraPosWorld = (inverse(view) * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
-	vec3 cameraPosLoc = vec3(inverse(model) * vec4(cameraPosWorld, 1.0));
-	vec3 viewDirLoc = cameraPosLoc - position;
-	vec3 lightDirLoc = vec3(inverse(model) * vec4(lightDirWorld, 0.0));
+	mat3 normalMatrix = transpose(inverse(mat3(model)));
 
-	mat3 TBN = transpose(
-		mat3(
-			tangent.xyz,
-			bitangent,
-			normal
-		)
-	);
-
-	vertexNormal = TBN * normal;
-	lightDirTan = normalize(TBN * lightDirLoc);
-	viewDirTan = normalize(TBN * viewDirLoc);
+	// Lighting is done per fragment in world space, since every fragment may
+	// see different lights. Only the sign of `tangent.w` is meaningful:
+	// packed tangents store it in two normalized bits, which may not convert
+	// to exactly -1.
+	vNormal = normalize(normalMatrix * normal);
+	vTangent = normalize(normalMatrix * tangent.xyz);
+	vBitangent = cross(vNormal, vTangent) * sign(tangent.w);
 
 	gl_Position = proj * view * model * vec4(position, 1);
 	fragPosWorld = (model * vec4(position, 1)).xyz;
 	textureCoord = texcoord;
-	lightPosWorld = lightPos;
-}
\ No newline at end of file
+}
@@ -0,0 +1,10 @@
+#version 330 core
+
+in vec4 vColor;
+
+out vec4 fragColor;
+
+void main()
+{
+	fragColor = vColor;
+}
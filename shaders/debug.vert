@@ -0,0 +1,13 @@
+#version 330 core
+
+in vec3 position;
+in mat4 model;         // Per instance, maps the unit primitive onto the shape
+in vec4 instanceColor; // Per instance
+
+out vec4 vColor;
+
+void main()
+{
+	vColor = instanceColor;
+	gl_Position = viewProj * model * vec4(position, 1.0);
+}
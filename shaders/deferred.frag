@@ -0,0 +1,180 @@
+#version 330 core
+
+//
+// Lighting pass of deferred shading. Every pixel covered by the G-buffer is
+// shaded once, with the lights of its cluster, using the same model as
+// blinn.frag.
+//
+#define SHADOW_CASCADES 4 // Same as FRAME_SHADOW_CASCADES
+
+const float PI = 3.1415926535897932384626433832;
+
+in vec2 vTexcoord;
+
+out vec4 fragColor;
+
+uniform sampler2D albedoSampler;
+uniform sampler2D normalSampler;
+uniform sampler2D depthSampler;
+
+uniform usamplerBuffer clusterGrid;   // Offset and count of the lights of each cluster
+uniform usamplerBuffer clusterLights; // Light indices of every cluster
+uniform samplerBuffer  lightData;     // Position and range, then color and brightness
+
+uniform sampler2DArrayShadow shadowMap; // Depth of the shadow casting light, one layer per cascade
+
+vec4 tonemap(in vec4 color)
+{
+	const float A = 0.22; // Shoulder strength
+	const float B = 0.30; // Linear Strength
+	const float C = 0.10; // Linear Angle
+	const float D = 0.20; // Toe Strength
+	const float E = 0.01; // Toe Numerator
+	const float F = 0.30; // Toe Denominator
+
+	return ((color * (A * color + C * B) + D * E) / (color * (A * color + B) + D * F)) - E/F;
+}
+
+float cookTorrance(in float roughness, in vec3 halfAngle, in vec3 normal, in vec3 viewDir, in vec3 lightDir)
+{
+	float F0 = 0.8; // Reflectance at normal incidence
+	float m2 = roughness * roughness;
+
+	float NdotH = dot(normal, halfAngle);
+	float NdotV = dot(normal, viewDir);
+	float NdotL = dot(normal, lightDir);
+	float VdotH = dot(viewDir, halfAngle);
+
+	// Beckman's distribution function D
+	float x = (NdotH * NdotH - 1.0) / (NdotH * NdotH * m2);
+	float D = exp(x) / (4.0 * m2 * pow(NdotH, 4));
+
+	// Fresnel term F
+	float F = pow(1.0 - NdotV, 5.0);
+	F *= (1.0 - F0);
+	F += F0;
+
+	// Self-shadowing term G
+	float X = 2.0 * NdotH / VdotH;
+	float G = min(1.0, min(X * NdotL, X * NdotV));
+
+	return (D * F * G) / (NdotV * PI);
+}
+
+vec3 octDecode(in vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+//
+// Offset and count of the lights of the cluster of the current fragment.
+//
+uvec2 lightCluster(in vec3 posWorld)
+{
+	float depth = -(view * vec4(posWorld, 1.0)).z;
+	vec3 cell = vec3(gl_FragCoord.xy * clusterScale.xy, log(depth) * clusterScale.z + clusterScale.w);
+	ivec3 c = clamp(ivec3(cell), ivec3(0), clusterSize.xyz - 1);
+
+	return texelFetch(clusterGrid, c.x + clusterSize.x * (c.y + clusterSize.y * c.z)).xy;
+}
+
+//
+// Fraction of the shadow casting light reaching `posWorld`, over 3x3 taps of
+// its cascade, each of which is a bilinear comparison.
+//
+float shadowFactor(in vec3 posWorld, in vec3 normal)
+{
+	float depth = -(view * vec4(posWorld, 1.0)).z;
+	int cascade = 0;
+
+	while (cascade < SHADOW_CASCADES && depth > shadowSplits[cascade]) {
+		cascade++;
+	}
+	if (cascade == SHADOW_CASCADES) {
+		return 1.0;
+	}
+	// Coarser cascades need a larger offset to keep surfaces from shadowing themselves.
+	vec3 offset = normal * 0.02 * float(cascade + 1);
+	vec4 p = shadowMatrices[cascade] * vec4(posWorld + offset, 1.0);
+	vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+	float lit = 0.0;
+
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			lit += texture(shadowMap, vec4(p.xy + vec2(x, y) * texel, float(cascade), p.z));
+		}
+	}
+	return lit / 9.0;
+}
+
+void main()
+{
+	const float roughness = 0.3;
+	const float specularIntensity = 15.0;
+	const float W = 11.2; // Whitepoint
+
+	vec4 ambience = vec4(0.05, 0.05, 0.08, 0.0) * 3;
+
+	float depth = texture(depthSampler, vTexcoord).r;
+
+	// Nothing was drawn here.
+	if (depth == 1.0) {
+		discard;
+	}
+	vec4 albedo = texture(albedoSampler, vTexcoord);
+	vec3 normal = octDecode(texture(normalSampler, vTexcoord).rg);
+
+	vec4 clip = invViewProj * vec4(vec3(vTexcoord, depth) * 2.0 - 1.0, 1.0);
+	vec3 fragPosWorld = clip.xyz / clip.w;
+	vec3 viewDir = normalize(cameraPos - fragPosWorld);
+
+	vec4 diffuse = vec4(albedo.rgb, 1.0);
+	vec4 specular = vec4(vec3(albedo.a * specularIntensity), 1.0);
+	vec4 color = diffuse * ambience;
+
+	uvec2 cluster = lightCluster(fragPosWorld);
+
+	for (uint i = cluster.x; i < cluster.x + cluster.y; i++) {
+		int index = int(texelFetch(clusterLights, int(i)).r);
+		vec4 position = texelFetch(lightData, index * 2);
+		vec4 lightColor = texelFetch(lightData, index * 2 + 1);
+
+		vec3 toLight = position.xyz - fragPosWorld;
+		float lightDistance = length(toLight);
+
+		if (lightDistance > position.w) {
+			continue;
+		}
+		vec3 lightDir = toLight / lightDistance;
+		float attenuation = 1.0 / (1.0 + lightDistance * lightDistance);
+		float incidence = clamp(dot(lightDir, normal), 0, 1);
+
+		if (incidence == 0.0) {
+			continue;
+		}
+		if (index == shadowLight) {
+			attenuation *= shadowFactor(fragPosWorld, normal);
+		}
+		vec3 halfAngle = normalize(lightDir + viewDir);
+		float specTerm = cookTorrance(roughness, halfAngle, normal, viewDir, lightDir);
+
+		color += diffuse * vec4(lightColor.rgb * lightColor.a * incidence * attenuation, 0.0) +
+		         specular * vec4(lightColor.rgb * attenuation * specTerm, 0.0);
+	}
+
+	if (tonemapEnabled) {
+		fragColor = tonemap(color) / tonemap(vec4(W));
+	} else {
+		fragColor = color;
+	}
+	fragColor.a = 1.0;
+
+	// The G-buffer depth is kept, so that forward draws are depth tested
+	// against the scene.
+	gl_FragDepth = depth;
+}
@@ -0,0 +1,16 @@
+#version 330 core
+
+out vec2 vTexcoord;
+
+//
+// A single triangle covering the screen, generated from the vertex index so
+// that no vertex buffer is needed. Its vertices are in clockwise order, like
+// every other front face.
+//
+void main()
+{
+	vec2 p = vec2(gl_VertexID & 2, (gl_VertexID << 1) & 2);
+
+	vTexcoord = p;
+	gl_Position = vec4(p * 2.0 - 1.0, 1.0, 1.0);
+}
@@ -2,8 +2,8 @@
 
 in vec3  position;
 in vec3  normal;
-in int   bones[4];
-in float weights[4];
+in ivec4 bones;
+in vec4  weights;
 
 flat   out vec3 fragPosWorld;
 flat   out vec3 lightDir;
@@ -11,10 +11,12 @@ smooth out vec3 lightPosWorld;
 flat   out vec3 vertexNormal;
 flat   out vec4 vWeightColor;
 
-uniform vec3 lightPos;
+// The instanced variant takes its model matrix per instance.
+#ifdef INSTANCED
+in mat4 model;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
+#endif
 
 void main()
 {
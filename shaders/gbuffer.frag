@@ -1,20 +1,54 @@
 #version 330 core
 
-uniform vec4 color;
+in vec2 vTexcoord;
+in vec3 vNormal;
+in vec3 vTangent;
+in vec3 vBitangent;
 
-in vec2  vTexcoord;
-in vec3  vWorldPos;
-in vec3  vNormal;
+layout(location = 0) out vec4 fAlbedo; // Diffuse albedo, specular intensity in alpha
+layout(location = 1) out vec2 fNormal; // World space normal, octahedral encoded
 
-layout(location = 0) out vec3 fPosition;
-layout(location = 1) out vec3 fDiffuse;
-layout(location = 2) out vec3 fNormal;
-layout(location = 3) out vec3 fTexcoord;
+uniform sampler2D diffuseSampler;
+uniform sampler2D specularSampler;
+uniform sampler2D normalSampler;
+
+//
+// Map a unit vector onto the octahedron, unfolded onto [-1, 1]^2. Two
+// components keep more precision than three, for the same storage.
+//
+vec2 octEncode(in vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return n.xy;
+}
+
+//
+// Unpack a tangent space normal, rebuilding z from x and y as in blinn.frag.
+//
+vec3 unpackNormal(in vec4 c)
+{
+	vec2 xy = c.rg * 2.0 - 1.0;
+
+	return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
 
 void main()
 {
-	fPosition = vWorldPos;
-	fDiffuse = vec3(1);
-	fNormal = normalize(vNormal);
-	fTexcoord = vec3(vTexcoord.st, 0.0);
+	vec2 t = vec2(vTexcoord.s, 1.0 - vTexcoord.t);
+
+	// Sample textures the same way as blinn.frag
+	vec4 diffuse = texture(diffuseSampler, t);
+	vec4 normalColor = texture(normalSampler, t);
+	vec4 specularColor = texture(specularSampler, vTexcoord);
+
+	mat3 TBN = mat3(normalize(vTangent), normalize(vBitangent), normalize(vNormal));
+	vec3 normal = normalize(TBN * unpackNormal(normalColor));
+
+	// Only the luminance of the specular map is kept.
+	fAlbedo = vec4(diffuse.rgb, dot(specularColor.rgb, vec3(0.2126, 0.7152, 0.0722)));
+	fNormal = octEncode(normal);
 }
@@ -2,27 +2,30 @@
 
 in vec3 position;
 in vec3 normal;
+in vec4 tangent;
 in vec2 texcoord;
-in int  padding[8];
 
 out vec2 vTexcoord;
-out vec3 vWorldPos;
 out vec3 vNormal;
-out vec4 _unused;
+out vec3 vTangent;
+out vec3 vBitangent;
 
+// The instanced variant takes its model matrix per instance.
+#ifdef INSTANCED
+in mat4 model;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
+#endif
 
 void main()
 {
-	vTexcoord = texcoord;
-	vWorldPos = position;
-	vNormal = normal;
+	mat3 normalMatrix = transpose(inverse(mat3(model)));
 
-	// XXX: This seems necessary because of the data layout,
-	// which includes bones and weights (each 16 bytes).
-	_unused = vec4(padding[0]);
+	// Only the sign of `tangent.w` is meaningful, as in blinn.vert.
+	vNormal = normalize(normalMatrix * normal);
+	vTangent = normalize(normalMatrix * tangent.xyz);
+	vBitangent = cross(vNormal, vTangent) * sign(tangent.w);
+	vTexcoord = texcoord;
 
-	gl_Position = proj * view * model * vec4(position, 1);
-}
\ No newline at end of file
+	gl_Position = viewProj * model * vec4(position, 1);
+}
@@ -3,8 +3,6 @@
 in vec3 position;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
 
 void main()
 {
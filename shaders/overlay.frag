@@ -0,0 +1,13 @@
+#version 330 core
+
+in vec2 vTexcoord;
+in vec4 vColor;
+
+out vec4 fragColor;
+
+uniform sampler2D atlas;
+
+void main()
+{
+	fragColor = texture(atlas, vTexcoord) * vColor;
+}
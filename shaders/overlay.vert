@@ -0,0 +1,17 @@
+#version 330 core
+
+layout(location = 0) in vec2 position; // Overlay coordinates, from the lower left corner
+layout(location = 1) in vec2 texcoord; // In the atlas
+layout(location = 2) in vec4 color;
+
+uniform vec2 screenSize;
+
+out vec2 vTexcoord;
+out vec4 vColor;
+
+void main()
+{
+	gl_Position = vec4(position / screenSize * 2.0 - 1.0, 0, 1);
+	vTexcoord = texcoord;
+	vColor = color;
+}
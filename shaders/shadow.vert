@@ -0,0 +1,12 @@
+#version 330 core
+
+// Depth-only draws read from the position stream, which has nothing else.
+in vec3 position;
+
+uniform mat4 model;
+uniform mat4 lightViewProj;
+
+void main()
+{
+	gl_Position = lightViewProj * model * vec4(position, 1);
+}
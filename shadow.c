@@ -0,0 +1,446 @@
+//
+// shadow.c
+// cascaded shadow maps
+//
+// The key light casts shadows through a depth texture array, with one layer
+// per cascade. The view frustum, up to `SHADOW_DISTANCE`, is split into
+// slices which grow with distance, and each cascade is an orthographic
+// projection along the light, fit around the bounding sphere of its slice.
+// Cascades are snapped to whole texels, so that shadow edges don't shimmer
+// as the camera moves.
+//
+// Far cascades cover a lot of the scene at a low resolution, and change
+// little from one frame to the next. They are fit with a margin, and only
+// refit once their slice leaves it. Static casters are drawn into a cache
+// layer when the cascade is refit, the light moves or the static casters
+// change, and copied into the cascade every frame that dynamic casters are
+// drawn over them.
+//
+// Casters are drawn with their page's position-only vertex array, culled
+// against each cascade. Depth clamping keeps casters between the light and
+// the near plane of a cascade from being clipped.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <GL/glew.h>
+
+#include "linmath.h"
+#include "camera.h"
+#include "shader.h"
+#include "common.h"
+#include "mesh.h"
+#include "frame.h"
+#include "renderer.h"
+#include "state.h"
+#include "shadow.h"
+
+enum {
+	SHADOW_CASCADES     = FRAME_SHADOW_CASCADES,
+	SHADOW_SIZE         = 1024, // Of each cascade, in texels
+	SHADOW_CACHED_FIRST = 2,    // First cascade which caches its static casters
+	SHADOW_CACHED       = SHADOW_CASCADES - SHADOW_CACHED_FIRST
+};
+
+static const float SHADOW_DISTANCE      = 50.0f; // View distance at which shadows end
+static const float SHADOW_SPLIT_LAMBDA  = 0.75f; // Blend of logarithmic over uniform splits
+static const float SHADOW_CACHE_MARGIN  = 1.5f;  // Radius of cached cascades, relative to their slice
+static const float SHADOW_LIGHT_EPSILON = 1e-5f; // Change of direction at which the light has moved
+static const float SHADOW_SLOPE_BIAS    = 2.0f;
+static const float SHADOW_DEPTH_BIAS    = 4.0f;
+
+struct caster {
+	struct mesh *mesh;
+	mat4        transform;
+	vec3        center; // Bounding sphere, in world space
+	float       radius;
+	bool        isStatic;
+};
+
+struct cascade {
+	mat4  viewProj;   // World space to the cascade's clip space
+	vec3  center;     // Sphere the cascade was fit around, in world space
+	float radius;
+	vec3  min, max;   // Bounds, in light view space
+	bool  dirty;      // Whether the static casters must be drawn again
+	bool  hasDynamic; // Whether dynamic casters were drawn over the static ones
+};
+
+static struct {
+	GLuint             texture; // One layer per cascade
+	GLuint             cache;   // Static casters, one layer per cached cascade
+	GLuint             fbo;
+	GLuint             readFbo; // Reads the cache when copying it
+	struct shader      *shader;
+	int                width, height; // Of the default framebuffer
+	bool               fit;
+	vec3               dir;     // Direction of the light the cascades were fit to
+	mat4               lightView;
+	float              splits[SHADOW_CASCADES];
+	struct cascade     cascades[SHADOW_CASCADES];
+	struct caster      *casters;
+	size_t             ncasters;
+	size_t             cap;
+	uintptr_t          staticKey; // Signature of the static casters in the cache
+	struct shadowStats stats;
+} SHADOWS;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void rNewShadowTexture(GLuint tex, int layers, bool compare)
+{
+	rBindTexture(0, GL_TEXTURE_2D_ARRAY, tex);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SHADOW_SIZE, SHADOW_SIZE, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Linear filtering of comparisons gives bilinear PCF for every tap.
+	if (compare) {
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
+}
+
+//
+// Set up shadow maps, for a default framebuffer of `width` by `height`
+// pixels. Shaders must be loaded.
+//
+void rInitShadows(int width, int height)
+{
+	memset(&SHADOWS, 0, sizeof(SHADOWS));
+
+	SHADOWS.width = width;
+	SHADOWS.height = height;
+	SHADOWS.shader = rGetShader("shadow");
+	SHADOWS.cap = 64;
+	SHADOWS.casters = malloc(SHADOWS.cap * sizeof(*SHADOWS.casters));
+
+	glGenTextures(1, &SHADOWS.texture);
+	glGenTextures(1, &SHADOWS.cache);
+	rNewShadowTexture(SHADOWS.texture, SHADOW_CASCADES, true);
+	rNewShadowTexture(SHADOWS.cache, SHADOW_CACHED, false);
+
+	glGenFramebuffers(1, &SHADOWS.fbo);
+	rBindFramebuffer(GL_DRAW_FRAMEBUFFER, SHADOWS.fbo);
+	glDrawBuffer(GL_NONE);
+
+	glGenFramebuffers(1, &SHADOWS.readFbo);
+	rBindFramebuffer(GL_READ_FRAMEBUFFER, SHADOWS.readFbo);
+	glReadBuffer(GL_NONE);
+
+	rBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Only shadow passes enable polygon offset.
+	glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_DEPTH_BIAS);
+}
+
+void rQuitShadows(void)
+{
+	glDeleteFramebuffers(1, &SHADOWS.fbo);
+	glDeleteFramebuffers(1, &SHADOWS.readFbo);
+	glDeleteTextures(1, &SHADOWS.texture);
+	glDeleteTextures(1, &SHADOWS.cache);
+	rInvalidateState();
+
+	free(SHADOWS.casters);
+}
+
+//
+// Fit `c` around the sphere at `center`, of radius `radius`, snapped to the
+// texels of the light's view.
+//
+static void fitCascade(struct cascade *c, vec3 center, float radius)
+{
+	vec3 p = vec3transform(center, SHADOWS.lightView);
+	float texel = 2.0f * radius / SHADOW_SIZE;
+
+	p.x = floorf(p.x / texel) * texel;
+	p.y = floorf(p.y / texel) * texel;
+
+	c->center = center;
+	c->radius = radius;
+	c->min = (vec3){p.x - radius, p.y - radius, p.z - radius};
+	c->max = (vec3){p.x + radius, p.y + radius, p.z + radius};
+
+	// The light looks down -z, so the nearest bound is the largest.
+	mat4 proj = mat4ortho(c->min.x, c->max.x, c->min.y, c->max.y, -c->max.z, -c->min.z);
+	c->viewProj = mat4mul(proj, SHADOWS.lightView);
+}
+
+//
+// Fit the cascades to the frustum of `cam`, for a light shining along `dir`.
+// Like the frame uniforms, this should be done once the camera has moved.
+//
+void rFitShadowCascades(const struct camera *cam, vec3 dir)
+{
+	float near = cam->znear, far = fminf(cam->zfar, SHADOW_DISTANCE);
+
+	dir = vec3norm(dir);
+
+	bool moved = ! SHADOWS.fit || vec3dot(dir, SHADOWS.dir) < 1.0f - SHADOW_LIGHT_EPSILON;
+
+	if (moved) {
+		vec3 up = fabsf(dir.y) > 0.99f ? (vec3){0, 0, 1} : (vec3){0, 1, 0};
+
+		SHADOWS.dir = dir;
+		SHADOWS.lightView = mat4lookAt((vec3){0, 0, 0}, dir, up);
+	}
+	for (int i = 0; i < SHADOW_CASCADES; i++) {
+		struct cascade *c = &SHADOWS.cascades[i];
+		float t = (float)(i + 1) / SHADOW_CASCADES;
+		float split = SHADOW_SPLIT_LAMBDA * near * powf(far / near, t) + (1.0f - SHADOW_SPLIT_LAMBDA) * (near + (far - near) * t);
+		float start = i > 0 ? SHADOWS.splits[i - 1] : near;
+		vec3 corners[8];
+		vec3 center = {0, 0, 0};
+		float radius = 0.0f;
+
+		SHADOWS.splits[i] = split;
+		rCameraSliceCorners(cam, start, split, corners);
+
+		for (int j = 0; j < 8; j++) {
+			center = vec3add(center, vec3scale(corners[j], 1.0f / 8.0f));
+		}
+		for (int j = 0; j < 8; j++) {
+			radius = fmaxf(radius, vec3len(vec3sub(corners[j], center)));
+		}
+		// Rounding the radius up keeps the texel size of the cascade from
+		// changing as the camera turns.
+		radius = ceilf(radius * 16.0f) / 16.0f;
+
+		if (i >= SHADOW_CACHED_FIRST) {
+			if (! moved && vec3len(vec3sub(center, c->center)) + radius <= c->radius)
+				continue;
+
+			radius *= SHADOW_CACHE_MARGIN;
+			c->dirty = true;
+		}
+		fitCascade(c, center, radius);
+	}
+	SHADOWS.fit = true;
+}
+
+//
+// Add `m`, with `transform`, to the casters of the next `rRenderShadows`.
+// Static casters must be added every frame like any other, but are only
+// drawn into the far cascades when their cache is refreshed.
+//
+void rAddShadowCaster(struct mesh *m, const mat4 *transform, bool isStatic)
+{
+	if (! m->page)
+		return;
+
+	if (SHADOWS.ncasters == SHADOWS.cap) {
+		SHADOWS.cap *= 2;
+		SHADOWS.casters = realloc(SHADOWS.casters, SHADOWS.cap * sizeof(*SHADOWS.casters));
+	}
+	float scale = 0.0f;
+
+	for (int i = 0; i < 3; i++) {
+		vec4 col = transform->cols[i];
+		scale = fmaxf(scale, sqrtf(col.x * col.x + col.y * col.y + col.z * col.z));
+	}
+	SHADOWS.casters[SHADOWS.ncasters++] = (struct caster){
+		.mesh      = m,
+		.transform = *transform,
+		.center    = vec3transform(m->center, *transform),
+		.radius    = m->radius * scale,
+		.isStatic  = isStatic
+	};
+}
+
+//
+// Whether caster `k` may cast a shadow into cascade `c`. Casters nearer to
+// the light than the cascade are kept, since they're depth clamped.
+//
+static bool casterInCascade(const struct caster *k, const struct cascade *c)
+{
+	vec3 p = vec3transform(k->center, SHADOWS.lightView);
+	float r = k->radius;
+
+	return p.x + r >= c->min.x && p.x - r <= c->max.x &&
+	       p.y + r >= c->min.y && p.y - r <= c->max.y &&
+	       p.z + r >= c->min.z;
+}
+
+static void drawCaster(struct caster *k)
+{
+	rSetUniformMatrix4fv(SHADOWS.shader, "model", &k->transform);
+	rBindVertexArray(k->mesh->depthVao);
+	rDrawMeshLod(k->mesh);
+	SHADOWS.stats.draws++;
+}
+
+//
+// Draw the casters of `c` into the bound framebuffer, either only the static
+// or only the dynamic ones, or all of them.
+//
+enum casterKind { CASTERS_STATIC, CASTERS_DYNAMIC, CASTERS_ALL };
+
+static size_t drawCasters(const struct cascade *c, enum casterKind kind)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < SHADOWS.ncasters; i++) {
+		struct caster *k = &SHADOWS.casters[i];
+
+		if (kind == CASTERS_STATIC && ! k->isStatic)
+			continue;
+		if (kind == CASTERS_DYNAMIC && k->isStatic)
+			continue;
+		if (! casterInCascade(k, c))
+			continue;
+
+		drawCaster(k);
+		n++;
+	}
+	return n;
+}
+
+static void attachLayer(GLenum target, GLuint texture, int layer)
+{
+	GL(glFramebufferTextureLayer(target, GL_DEPTH_ATTACHMENT, texture, 0, layer));
+}
+
+//
+// Signature of the current static casters, which changes whenever they do.
+//
+static uintptr_t staticKey(void)
+{
+	uintptr_t key = 0;
+
+	for (size_t i = 0; i < SHADOWS.ncasters; i++) {
+		if (SHADOWS.casters[i].isStatic)
+			key = key * 31 + (uintptr_t)SHADOWS.casters[i].mesh;
+	}
+	return key;
+}
+
+//
+// Draw the casters added since the last call into every cascade, and bind
+// the shadow map for the lighting shaders. The default framebuffer is bound
+// again afterwards.
+//
+void rRenderShadows(void)
+{
+	double start = now();
+
+	SHADOWS.stats = (struct shadowStats){0};
+	SHADOWS.stats.casters = SHADOWS.ncasters;
+
+	if (! SHADOWS.fit) {
+		SHADOWS.ncasters = 0;
+		return;
+	}
+	uintptr_t key = staticKey();
+
+	if (key != SHADOWS.staticKey) {
+		for (int i = SHADOW_CACHED_FIRST; i < SHADOW_CASCADES; i++) {
+			SHADOWS.cascades[i].dirty = true;
+		}
+		SHADOWS.staticKey = key;
+	}
+	rBindFramebuffer(GL_DRAW_FRAMEBUFFER, SHADOWS.fbo);
+	GL(glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE));
+
+	rSetCap(STATE_DEPTH_TEST, true);
+	rSetCap(STATE_BLEND, false);
+	rSetCap(STATE_DEPTH_CLAMP, true);
+	rSetCap(STATE_POLYGON_OFFSET_FILL, true);
+
+	// Drawing back faces moves acne onto the sides facing away from the light,
+	// which are dark anyway.
+	rCullFace(GL_FRONT, GL_CW);
+
+	rUseShader(SHADOWS.shader);
+	RENDER_STATS.programSwitches++;
+
+	for (int i = 0; i < SHADOW_CASCADES; i++) {
+		struct cascade *c = &SHADOWS.cascades[i];
+		bool cached = i >= SHADOW_CACHED_FIRST;
+		bool refreshed = false;
+
+		rSetUniformMatrix4fv(SHADOWS.shader, "lightViewProj", &c->viewProj);
+
+		if (cached && c->dirty) {
+			attachLayer(GL_DRAW_FRAMEBUFFER, SHADOWS.cache, i - SHADOW_CACHED_FIRST);
+			GL(glClear(GL_DEPTH_BUFFER_BIT));
+			drawCasters(c, CASTERS_STATIC);
+
+			c->dirty = false;
+			refreshed = true;
+			SHADOWS.stats.refreshed++;
+		}
+		attachLayer(GL_DRAW_FRAMEBUFFER, SHADOWS.texture, i);
+
+		if (! cached) {
+			GL(glClear(GL_DEPTH_BUFFER_BIT));
+			drawCasters(c, CASTERS_ALL);
+			continue;
+		}
+		bool dynamic = false;
+
+		for (size_t j = 0; j < SHADOWS.ncasters && ! dynamic; j++) {
+			dynamic = ! SHADOWS.casters[j].isStatic && casterInCascade(&SHADOWS.casters[j], c);
+		}
+		// The layer already holds the cache alone, unless it changed or had
+		// dynamic casters drawn over it.
+		if (refreshed || dynamic || c->hasDynamic) {
+			rBindFramebuffer(GL_READ_FRAMEBUFFER, SHADOWS.readFbo);
+			attachLayer(GL_READ_FRAMEBUFFER, SHADOWS.cache, i - SHADOW_CACHED_FIRST);
+			GL(glBlitFramebuffer(0, 0, SHADOW_SIZE, SHADOW_SIZE, 0, 0, SHADOW_SIZE, SHADOW_SIZE, GL_DEPTH_BUFFER_BIT, GL_NEAREST));
+		}
+		if (dynamic)
+			drawCasters(c, CASTERS_DYNAMIC);
+
+		c->hasDynamic = dynamic;
+	}
+	rCullFace(GL_BACK, GL_CW);
+	rSetCap(STATE_POLYGON_OFFSET_FILL, false);
+	rSetCap(STATE_DEPTH_CLAMP, false);
+
+	rBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GL(glViewport(0, 0, SHADOWS.width, SHADOWS.height));
+
+	rBindTexture(SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, SHADOWS.texture);
+	rBindSampler(SHADOW_UNIT, 0);
+
+	SHADOWS.ncasters = 0;
+	SHADOWS.stats.renderMs = now() - start;
+}
+
+//
+// Set the uniforms which map world space to the shadow map, with the light
+// at index `light` casting the shadows.
+//
+void rShadowUniforms(struct frameUniforms *f, int light)
+{
+	// Maps clip space to texture coordinates and depth, from [-1, 1] to [0, 1].
+	mat4 bias = mat4identity();
+
+	bias.cols[0].x = bias.cols[1].y = bias.cols[2].z = 0.5f;
+	bias.cols[3] = vec4new(0.5f, 0.5f, 0.5f, 1.0f);
+
+	for (int i = 0; i < SHADOW_CASCADES; i++) {
+		f->shadowMatrices[i] = mat4mul(bias, SHADOWS.cascades[i].viewProj);
+	}
+	f->shadowSplits = vec4new(SHADOWS.splits[0], SHADOWS.splits[1], SHADOWS.splits[2], SHADOWS.splits[3]);
+	f->shadowLight = SHADOWS.fit ? light : -1;
+}
+
+struct shadowStats rShadowStats(void)
+{
+	return SHADOWS.stats;
+}
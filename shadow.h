@@ -0,0 +1,31 @@
+//
+// shadow.h
+// cascaded shadow maps
+//
+// dependencies:
+//
+//   stdbool.h
+//   GL/glew.h
+//   linmath.h
+//
+struct camera;
+struct mesh;
+struct frameUniforms;
+
+// Texture unit of the shadow map, the same in every program.
+enum { SHADOW_UNIT = 12 };
+
+struct shadowStats {
+	unsigned casters;
+	unsigned draws;     // Caster draws, over every cascade
+	unsigned refreshed; // Cached cascades whose static casters were drawn again
+	double   renderMs;
+};
+
+extern void rInitShadows(int, int);
+extern void rQuitShadows(void);
+extern void rFitShadowCascades(const struct camera *, vec3);
+extern void rAddShadowCaster(struct mesh *, const mat4 *, bool);
+extern void rRenderShadows(void);
+extern void rShadowUniforms(struct frameUniforms *, int);
+extern struct shadowStats rShadowStats(void);
@@ -1,6 +1,7 @@
 #include <GL/glew.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 
@@ -11,17 +12,19 @@
 #include "common.h"
 #include "skeleton.h"
 #include "mesh.h"
-#include "cube.h"
+#include "debugdraw.h"
 
 void rDrawSkeleton(struct skeleton *sk, mat4 *transform)
 {
 	assert(sk);
 
+	if (! rDebugDrawEnabled())
+		return;
+
 	for (int i = 0; i < sk->nbones; i++) {
 		struct bone *b = &sk->bones[i];
+		mat4 t = mat4mul(*transform, b->transform);
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		rDrawSphere(0.05f, 8, b->transform);
+		rDebugSphere(vec3transform((vec3){0, 0, 0}, t), 0.05f, vec4new(1.0f, 0.0f, 0.0f, 0.5f));
 	}
 }
@@ -0,0 +1,352 @@
+//
+// state.c
+// GL state cache
+//
+// Every change of GL state goes through here, and calls which wouldn't change
+// anything are skipped. Values which aren't known, such as right after
+// `rInvalidateState`, never match, so the next change is always issued.
+//
+// Under DEBUG, every skipped call checks the cached value against the driver,
+// and `rValidateState` checks the whole cache.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <GL/glew.h>
+
+#include "renderer.h"
+#include "state.h"
+
+static const GLuint UNKNOWN = 0xffffffff;
+
+static const GLenum CAPS[STATE_CAPS] = {
+	[STATE_BLEND]               = GL_BLEND,
+	[STATE_DEPTH_TEST]          = GL_DEPTH_TEST,
+	[STATE_CULL_FACE]           = GL_CULL_FACE,
+	[STATE_STENCIL_TEST]        = GL_STENCIL_TEST,
+	[STATE_FRAMEBUFFER_SRGB]    = GL_FRAMEBUFFER_SRGB,
+	[STATE_DEPTH_CLAMP]         = GL_DEPTH_CLAMP,
+	[STATE_POLYGON_OFFSET_FILL] = GL_POLYGON_OFFSET_FILL
+};
+
+//
+// Buffer targets, and the queries of what's bound to them.
+//
+static const GLenum BUFFER_TARGETS[][2] = {
+	{GL_ARRAY_BUFFER,         GL_ARRAY_BUFFER_BINDING},
+	{GL_ELEMENT_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER_BINDING},
+	{GL_UNIFORM_BUFFER,       GL_UNIFORM_BUFFER_BINDING},
+	{GL_COPY_READ_BUFFER,     GL_COPY_READ_BUFFER},
+	{GL_COPY_WRITE_BUFFER,    GL_COPY_WRITE_BUFFER},
+	{GL_PIXEL_UNPACK_BUFFER,  GL_PIXEL_UNPACK_BUFFER_BINDING},
+	{GL_TEXTURE_BUFFER,       GL_TEXTURE_BUFFER}
+};
+
+//
+// Texture targets, and the queries of what's bound to them on the active unit.
+//
+static const GLenum TEXTURE_TARGETS[][2] = {
+	{GL_TEXTURE_2D,       GL_TEXTURE_BINDING_2D},
+	{GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY},
+	{GL_TEXTURE_BUFFER,   GL_TEXTURE_BINDING_BUFFER}
+};
+
+#define elems(a) (sizeof(a) / sizeof(a[0]))
+
+enum {
+	BUFFER_TARGETS_N  = elems(BUFFER_TARGETS),
+	TEXTURE_TARGETS_N = elems(TEXTURE_TARGETS)
+};
+
+static struct {
+	GLuint caps[STATE_CAPS]; // GL_TRUE, GL_FALSE or UNKNOWN
+	GLuint blendSrc;
+	GLuint blendDst;
+	GLuint cullFace;
+	GLuint frontFace;
+	GLuint program;
+	GLuint vao;
+	GLuint buffers[BUFFER_TARGETS_N];
+	GLuint drawFramebuffer;
+	GLuint readFramebuffer;
+	GLuint activeTexture; // Index of the active unit
+	GLuint textures[STATE_TEXTURE_UNITS][TEXTURE_TARGETS_N];
+	GLuint samplers[STATE_TEXTURE_UNITS];
+} STATE;
+
+#if defined(DEBUG)
+static void checkValue(const char *what, GLuint cached, GLint actual)
+{
+	if (cached != UNKNOWN && cached != (GLuint)actual) {
+		fprintf(stderr, "state: %s is %d, but is cached as %u\n", what, actual, cached);
+		assert(false);
+	}
+}
+
+static void checkInteger(const char *what, GLenum pname, GLuint cached)
+{
+	GLint actual;
+
+	glGetIntegerv(pname, &actual);
+	checkValue(what, cached, actual);
+}
+
+//
+// Check a value of texture unit `unit`, leaving the active unit alone.
+//
+static void checkUnit(const char *what, GLuint unit, GLenum pname, GLuint cached)
+{
+	GLint active;
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	checkInteger(what, pname, cached);
+	glActiveTexture(active);
+}
+#endif
+
+//
+// Account for a call which was skipped, because it wouldn't have changed
+// the cached value.
+//
+static void skip(const char *what, GLenum pname, GLuint cached)
+{
+	RENDER_STATS.skippedCalls++;
+
+#if defined(DEBUG)
+	checkInteger(what, pname, cached);
+#endif
+}
+
+static int bufferIndex(GLenum target)
+{
+	for (int i = 0; i < BUFFER_TARGETS_N; i++) {
+		if (BUFFER_TARGETS[i][0] == target)
+			return i;
+	}
+	return -1;
+}
+
+static int textureIndex(GLenum target)
+{
+	for (int i = 0; i < TEXTURE_TARGETS_N; i++) {
+		if (TEXTURE_TARGETS[i][0] == target)
+			return i;
+	}
+	return -1;
+}
+
+//
+// Forget everything which is cached. This must be called whenever GL state
+// is changed behind the cache's back, or objects which may be bound are
+// deleted, since their names can be reused.
+//
+void rInvalidateState(void)
+{
+	memset(&STATE, 0xff, sizeof(STATE));
+}
+
+void rSetCap(enum stateCap cap, bool enabled)
+{
+	GLuint value = enabled ? GL_TRUE : GL_FALSE;
+
+	if (STATE.caps[cap] == value) {
+		RENDER_STATS.skippedCalls++;
+#if defined(DEBUG)
+		checkValue("capability", value, glIsEnabled(CAPS[cap]));
+#endif
+		return;
+	}
+	if (enabled) {
+		GL(glEnable(CAPS[cap]));
+	} else {
+		GL(glDisable(CAPS[cap]));
+	}
+	STATE.caps[cap] = value;
+}
+
+void rBlendFunc(GLenum src, GLenum dst)
+{
+	if (STATE.blendSrc == src && STATE.blendDst == dst) {
+		skip("blend function", GL_BLEND_SRC_RGB, src);
+		return;
+	}
+	GL(glBlendFunc(src, dst));
+	STATE.blendSrc = src;
+	STATE.blendDst = dst;
+}
+
+//
+// Cull faces `face`, where front faces are wound in direction `front`.
+//
+void rCullFace(GLenum face, GLenum front)
+{
+	if (STATE.cullFace == face && STATE.frontFace == front) {
+		skip("cull face", GL_CULL_FACE_MODE, face);
+		return;
+	}
+	GL(glCullFace(face));
+	GL(glFrontFace(front));
+	STATE.cullFace = face;
+	STATE.frontFace = front;
+}
+
+void rUseProgram(GLuint program)
+{
+	if (STATE.program == program) {
+		skip("program", GL_CURRENT_PROGRAM, program);
+		return;
+	}
+	GL(glUseProgram(program));
+	STATE.program = program;
+}
+
+void rBindVertexArray(GLuint vao)
+{
+	int element = bufferIndex(GL_ELEMENT_ARRAY_BUFFER);
+
+	if (STATE.vao == vao) {
+		skip("vertex array", GL_VERTEX_ARRAY_BINDING, vao);
+		return;
+	}
+	GL(glBindVertexArray(vao));
+	STATE.vao = vao;
+
+	// The index buffer binding belongs to the vertex array.
+	STATE.buffers[element] = UNKNOWN;
+}
+
+void rBindBuffer(GLenum target, GLuint buffer)
+{
+	int i = bufferIndex(target);
+
+	if (i >= 0 && STATE.buffers[i] == buffer) {
+		skip("buffer", BUFFER_TARGETS[i][1], buffer);
+		return;
+	}
+	GL(glBindBuffer(target, buffer));
+
+	if (i >= 0)
+		STATE.buffers[i] = buffer;
+}
+
+//
+// Bind `buffer` to binding point `index` of `target`, which also binds it to
+// `target` itself.
+//
+void rBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	int i = bufferIndex(target);
+
+	GL(glBindBufferBase(target, index, buffer));
+
+	if (i >= 0)
+		STATE.buffers[i] = buffer;
+}
+
+//
+// Bind `fbo` to `target`, which is GL_DRAW_FRAMEBUFFER, GL_READ_FRAMEBUFFER,
+// or GL_FRAMEBUFFER for both.
+//
+void rBindFramebuffer(GLenum target, GLuint fbo)
+{
+	bool draw = target != GL_READ_FRAMEBUFFER;
+	bool read = target != GL_DRAW_FRAMEBUFFER;
+
+	if ((! draw || STATE.drawFramebuffer == fbo) && (! read || STATE.readFramebuffer == fbo)) {
+		skip("framebuffer", draw ? GL_DRAW_FRAMEBUFFER_BINDING : GL_READ_FRAMEBUFFER_BINDING, fbo);
+		return;
+	}
+	GL(glBindFramebuffer(target, fbo));
+
+	if (draw)
+		STATE.drawFramebuffer = fbo;
+	if (read)
+		STATE.readFramebuffer = fbo;
+}
+
+static void rActiveTexture(GLuint unit)
+{
+	if (STATE.activeTexture == unit)
+		return;
+
+	GL(glActiveTexture(GL_TEXTURE0 + unit));
+	STATE.activeTexture = unit;
+}
+
+//
+// Bind `texture` to `target` of texture unit `unit`. Returns whether the
+// binding changed.
+//
+bool rBindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	int i = textureIndex(target);
+
+	assert(unit < STATE_TEXTURE_UNITS);
+
+	if (i >= 0 && STATE.textures[unit][i] == texture) {
+		RENDER_STATS.skippedCalls++;
+#if defined(DEBUG)
+		checkUnit("texture", unit, TEXTURE_TARGETS[i][1], texture);
+#endif
+		return false;
+	}
+	rActiveTexture(unit);
+	GL(glBindTexture(target, texture));
+
+	if (i >= 0)
+		STATE.textures[unit][i] = texture;
+
+	return true;
+}
+
+void rBindSampler(GLuint unit, GLuint sampler)
+{
+	assert(unit < STATE_TEXTURE_UNITS);
+
+	if (STATE.samplers[unit] == sampler) {
+		RENDER_STATS.skippedCalls++;
+#if defined(DEBUG)
+		checkUnit("sampler", unit, GL_SAMPLER_BINDING, sampler);
+#endif
+		return;
+	}
+	GL(glBindSampler(unit, sampler));
+	STATE.samplers[unit] = sampler;
+}
+
+//
+// Check every cached value against the driver. Only does anything under
+// DEBUG, where a mismatch is fatal.
+//
+void rValidateState(void)
+{
+#if defined(DEBUG)
+	for (int i = 0; i < STATE_CAPS; i++) {
+		checkValue("capability", STATE.caps[i], glIsEnabled(CAPS[i]));
+	}
+	checkInteger("blend source", GL_BLEND_SRC_RGB, STATE.blendSrc);
+	checkInteger("blend destination", GL_BLEND_DST_RGB, STATE.blendDst);
+	checkInteger("cull face", GL_CULL_FACE_MODE, STATE.cullFace);
+	checkInteger("front face", GL_FRONT_FACE, STATE.frontFace);
+	checkInteger("program", GL_CURRENT_PROGRAM, STATE.program);
+	checkInteger("vertex array", GL_VERTEX_ARRAY_BINDING, STATE.vao);
+	checkInteger("draw framebuffer", GL_DRAW_FRAMEBUFFER_BINDING, STATE.drawFramebuffer);
+	checkInteger("read framebuffer", GL_READ_FRAMEBUFFER_BINDING, STATE.readFramebuffer);
+
+	if (STATE.activeTexture != UNKNOWN)
+		checkInteger("active texture", GL_ACTIVE_TEXTURE, GL_TEXTURE0 + STATE.activeTexture);
+
+	for (int i = 0; i < BUFFER_TARGETS_N; i++) {
+		checkInteger("buffer", BUFFER_TARGETS[i][1], STATE.buffers[i]);
+	}
+	for (int u = 0; u < STATE_TEXTURE_UNITS; u++) {
+		for (int i = 0; i < TEXTURE_TARGETS_N; i++) {
+			checkUnit("texture", u, TEXTURE_TARGETS[i][1], STATE.textures[u][i]);
+		}
+		checkUnit("sampler", u, GL_SAMPLER_BINDING, STATE.samplers[u]);
+	}
+#endif
+}
@@ -0,0 +1,28 @@
+//
+// Capabilities whose state is shadowed by the state cache.
+//
+enum stateCap {
+	STATE_BLEND,
+	STATE_DEPTH_TEST,
+	STATE_CULL_FACE,
+	STATE_STENCIL_TEST,
+	STATE_FRAMEBUFFER_SRGB,
+	STATE_DEPTH_CLAMP,
+	STATE_POLYGON_OFFSET_FILL,
+	STATE_CAPS
+};
+
+enum { STATE_TEXTURE_UNITS = 16 };
+
+extern void rInvalidateState(void);
+extern void rValidateState(void);
+extern void rSetCap(enum stateCap, bool);
+extern void rBlendFunc(GLenum, GLenum);
+extern void rCullFace(GLenum, GLenum);
+extern void rUseProgram(GLuint);
+extern void rBindVertexArray(GLuint);
+extern void rBindBuffer(GLenum, GLuint);
+extern void rBindBufferBase(GLenum, GLuint, GLuint);
+extern void rBindFramebuffer(GLenum, GLuint);
+extern bool rBindTexture(GLuint, GLenum, GLuint);
+extern void rBindSampler(GLuint, GLuint);
@@ -0,0 +1,230 @@
+//
+// stream.c
+// streaming ring buffer
+//
+// Vertex data which changes every frame, like text, debug shapes and
+// instance transforms, is written into a single ring buffer instead of
+// buffers of its own. Writes map only the range they need, unsynchronized
+// and invalidated, so the driver neither copies the buffer nor waits for
+// draws which still read from it.
+//
+// Instead, the ring keeps track of which of its bytes may still be read. A
+// fence is inserted at the end of every frame, along with the number of
+// bytes the frame wrote. Bytes are only reused once the fence of the frame
+// which wrote them is signaled, which only stalls if the ring is too small
+// for the frames in flight.
+//
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <GL/glew.h>
+
+#include "renderer.h"
+#include "state.h"
+#include "stream.h"
+
+enum {
+	STREAM_ALIGNMENT  = 16, // Of every write, enough for any vertex attribute
+	STREAM_MAX_FRAMES = 4   // Frames which may be in flight at once
+};
+
+// Waits on a fence are retried in slices of this many nanoseconds.
+static const GLuint64 STREAM_WAIT_NS = 1000000000;
+
+struct streamFrame {
+	GLsync fence;
+	size_t bytes; // Written in the frame, which are freed once `fence` is signaled
+};
+
+static struct {
+	GLuint             buffer;
+	size_t             capacity;
+	size_t             head;    // Offset of the next write
+	size_t             used;    // Bytes before `head` which may still be read
+	bool               isMapped;
+	struct streamFrame frames[STREAM_MAX_FRAMES]; // Oldest first
+	size_t             nframes;
+	struct streamStats stats;   // Of the current frame
+	struct streamStats last;    // Of the last complete frame
+} STREAM;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//
+// Create a ring buffer of `capacity` bytes. Must be called before any
+// geometry is created, since every geometry page reads its instances from it.
+//
+void rInitStream(size_t capacity)
+{
+	memset(&STREAM, 0, sizeof(STREAM));
+
+	STREAM.capacity = capacity;
+
+	glGenBuffers(1, &STREAM.buffer);
+	rBindBuffer(GL_ARRAY_BUFFER, STREAM.buffer);
+	glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+}
+
+void rQuitStream(void)
+{
+	for (size_t i = 0; i < STREAM.nframes; i++) {
+		glDeleteSync(STREAM.frames[i].fence);
+	}
+	glDeleteBuffers(1, &STREAM.buffer);
+	rInvalidateState();
+}
+
+GLuint rStreamBuffer(void)
+{
+	return STREAM.buffer;
+}
+
+//
+// Free the bytes of the oldest frame in flight, once the GPU is done with
+// it. If `wait` isn't set, the frame is only freed if it's already done.
+// Returns whether it was freed.
+//
+static bool retireFrame(bool wait)
+{
+	struct streamFrame *f = &STREAM.frames[0];
+	GLenum status = GL(glClientWaitSync(f->fence, 0, 0));
+
+	if (status == GL_TIMEOUT_EXPIRED) {
+		if (! wait)
+			return false;
+
+		double start = now();
+
+		do {
+			status = GL(glClientWaitSync(f->fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_WAIT_NS));
+		} while (status == GL_TIMEOUT_EXPIRED);
+
+		STREAM.stats.stalls++;
+		STREAM.stats.stallMs += now() - start;
+	}
+	GL(glDeleteSync(f->fence));
+
+	STREAM.used -= f->bytes;
+	STREAM.nframes--;
+	memmove(&STREAM.frames[0], &STREAM.frames[1], STREAM.nframes * sizeof(*STREAM.frames));
+
+	return true;
+}
+
+//
+// Map `size` bytes of the ring for writing, and return a pointer to them,
+// along with their offset into the buffer in `offset`. The range must be
+// unmapped with `rUnmapStream` before anything is drawn, and is only valid
+// for the current frame. Returns NULL if the ring can't hold `size` bytes.
+//
+void *rMapStream(size_t size, size_t *offset)
+{
+	size_t start = (STREAM.head + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT * STREAM_ALIGNMENT;
+	bool wrapped = start + size > STREAM.capacity;
+
+	// Writes are contiguous, so a write which doesn't fit before the end of
+	// the ring starts over at its beginning, skipping what's left.
+	if (wrapped)
+		start = 0;
+
+	size_t need = (wrapped ? STREAM.capacity - STREAM.head : start - STREAM.head) + size;
+
+	if (need > STREAM.capacity)
+		return NULL;
+
+	while (STREAM.used + need > STREAM.capacity) {
+		// The current frame alone doesn't fit.
+		if (STREAM.nframes == 0)
+			return NULL;
+
+		retireFrame(true);
+	}
+	rBindBuffer(GL_ARRAY_BUFFER, STREAM.buffer);
+
+	void *p = GL(glMapBufferRange(GL_ARRAY_BUFFER, start, size,
+	                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	if (! p)
+		return NULL;
+
+	STREAM.head = start + size;
+	STREAM.used += need;
+	STREAM.isMapped = true;
+	STREAM.stats.bytes += need;
+	STREAM.stats.allocations++;
+	STREAM.stats.wraps += wrapped;
+
+	*offset = start;
+
+	return p;
+}
+
+void rUnmapStream(void)
+{
+	if (! STREAM.isMapped)
+		return;
+
+	rBindBuffer(GL_ARRAY_BUFFER, STREAM.buffer);
+	GL(glUnmapBuffer(GL_ARRAY_BUFFER));
+	STREAM.isMapped = false;
+}
+
+//
+// Copy `size` bytes of `data` into the ring, and set `offset` to where they
+// were written. Returns false if they don't fit.
+//
+bool rStreamWrite(const void *data, size_t size, size_t *offset)
+{
+	void *p = rMapStream(size, offset);
+
+	if (! p)
+		return false;
+
+	memcpy(p, data, size);
+	rUnmapStream();
+
+	return true;
+}
+
+//
+// Fence the writes of the frame, once all of its draws are issued. Frames
+// the GPU is done with are freed without waiting.
+//
+void rEndStreamFrame(void)
+{
+	while (STREAM.nframes > 0 && retireFrame(false))
+		;
+
+	if (STREAM.nframes == STREAM_MAX_FRAMES)
+		retireFrame(true);
+
+	size_t bytes = STREAM.stats.bytes;
+
+	// Bytes the frame wrote are also counted in `used`, until its fence
+	// is signaled.
+	STREAM.frames[STREAM.nframes++] = (struct streamFrame){
+		.fence = GL(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)),
+		.bytes = bytes
+	};
+	STREAM.stats.capacity = STREAM.capacity;
+	STREAM.stats.inFlight = STREAM.used;
+	STREAM.last = STREAM.stats;
+	STREAM.stats = (struct streamStats){0};
+}
+
+//
+// Stats of the last complete frame.
+//
+struct streamStats rStreamStats(void)
+{
+	return STREAM.last;
+}
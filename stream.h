@@ -0,0 +1,28 @@
+//
+// stream.h
+// streaming ring buffer
+//
+// dependencies:
+//
+//   stdbool.h
+//   stddef.h
+//   GL/glew.h
+//
+struct streamStats {
+	size_t   capacity;
+	size_t   bytes;       // Written in the frame, including alignment and wrap padding
+	size_t   inFlight;    // Written in frames the GPU may not be done with
+	unsigned allocations;
+	unsigned wraps;
+	unsigned stalls;      // Waits on a fence which wasn't signaled yet
+	double   stallMs;
+};
+
+extern void rInitStream(size_t);
+extern void rQuitStream(void);
+extern GLuint rStreamBuffer(void);
+extern void *rMapStream(size_t, size_t *);
+extern void rUnmapStream(void);
+extern bool rStreamWrite(const void *, size_t, size_t *);
+extern void rEndStreamFrame(void);
+extern struct streamStats rStreamStats(void);
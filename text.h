@@ -1,2 +0,0 @@
-extern bool rInitText2D(const char *);
-extern void rDrawText2D(const char *, int, int, int, int);
@@ -1,9 +1,16 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include <GL/glew.h>
 
+#include "linmath.h"
+#include "common.h"
 #include "texture.h"
 #include "tga.h"
+#include "pack.h"
+#include "state.h"
 
 static const char *TextureExtensions[] = {
 	[TEXTURE_TYPE_DIFFUSE] = "_d.tga",
@@ -11,22 +18,217 @@ static const char *TextureExtensions[] = {
 	[TEXTURE_TYPE_SPECULAR] = "_s.tga"
 };
 
+static const char *CompressedTextureExtensions[] = {
+	[TEXTURE_TYPE_DIFFUSE] = "_d.tex",
+	[TEXTURE_TYPE_NORMAL] = "_n.tex",
+	[TEXTURE_TYPE_SPECULAR] = "_s.tex"
+};
+
+static const char *TextureSamplerNames[] = {
+	[TEXTURE_TYPE_DIFFUSE] = "diffuseSampler",
+	[TEXTURE_TYPE_NORMAL] = "normalSampler",
+	[TEXTURE_TYPE_SPECULAR] = "specularSampler"
+};
+
 static GLint TextureFormats[] = {
 	[TEXTURE_TYPE_DIFFUSE] = GL_RGBA,//GL_SRGB8_ALPHA8,
 	[TEXTURE_TYPE_NORMAL] = GL_RGBA,
 	[TEXTURE_TYPE_SPECULAR] = GL_SRGB8_ALPHA8
 };
 
-struct texture *rTextureFromPath(const char *path, GLint format)
+//
+// Create a texture without any storage, and leave it bound.
+//
+static struct texture *genTexture(void)
+{
+	struct texture *t = malloc(sizeof(*t));
+
+	t->index = 0;
+	t->sampler = -1;
+	t->uniform = -1;
+	t->isLoaded = false;
+
+	glGenTextures(1, &t->handle);
+	rBindTexture(0, GL_TEXTURE_2D, t->handle);
+
+	return t;
+}
+
+// Internal formats of every compressed format, without and with sRGB decoding.
+static const GLenum CompressedFormats[TEX_FORMATS][2] = {
+	[TEX_FORMAT_BC1] = {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT},
+	[TEX_FORMAT_BC3] = {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT},
+	[TEX_FORMAT_BC5] = {GL_COMPRESSED_RG_RGTC2, GL_COMPRESSED_RG_RGTC2}
+};
+
+static const size_t CompressedBlockSizes[TEX_FORMATS] = {
+	[TEX_FORMAT_BC1] = 8,
+	[TEX_FORMAT_BC3] = 16,
+	[TEX_FORMAT_BC5] = 16
+};
+
+//
+// Check that the precompressed file of `size` bytes at `data` is well formed,
+// down to the size of every level, so that uploads never read past its end,
+// and that its levels form a mip chain, starting at the size of the texture
+// and halving down to the last level, so that the texture is complete.
+//
+static bool validTexFile(const unsigned char *data, size_t size)
 {
+	const struct texHeader *h = (const struct texHeader *)data;
+
+	if (size < sizeof(*h) || memcmp(h->magic, TEX_MAGIC, sizeof(h->magic)) || h->version != TEX_VERSION)
+		return false;
+
+	if (h->format >= TEX_FORMATS || h->nlevels == 0 || h->nlevels > TEX_MAX_LEVELS || h->size > size)
+		return false;
+
+	if (sizeof(*h) + h->nlevels * sizeof(struct texLevel) > size)
+		return false;
+
+	const struct texLevel *levels = (const struct texLevel *)(h + 1);
+	uint32_t width = h->width, height = h->height;
+
+	if (width == 0 || height == 0)
+		return false;
+
+	for (uint32_t i = 0; i < h->nlevels; i++) {
+		const struct texLevel *l = &levels[i];
+		size_t blocks = (size_t)((l->width + 3) / 4) * ((l->height + 3) / 4);
+
+		if (l->width != width || l->height != height)
+			return false;
+
+		if (l->size != blocks * CompressedBlockSizes[h->format] || l->offset > size || l->size > size - l->offset)
+			return false;
+
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return true;
+}
+
+//
+// Read the image at `path` into `img`. Precompressed files are mapped and
+// uploaded from the mapping as is, anything else is decoded as a TGA. The
+// image must be freed with `rFreeTexImage`.
+//
+bool rReadTexImage(struct texImage *img, const char *path)
+{
+	const unsigned char *data;
+	size_t size;
 	struct tga t;
+
+	memset(img, 0, sizeof(*img));
+
+	if (! (data = assetOpen(path, &size)))
+		return false;
+
+	if (size >= sizeof(TEX_MAGIC) && ! memcmp(data, TEX_MAGIC, sizeof(TEX_MAGIC))) {
+		const struct texHeader *h = (const struct texHeader *)data;
+
+		if (! validTexFile(data, size)) {
+			assetClose(data, size);
+			return false;
+		}
+		img->format = CompressedFormats[h->format][(h->flags & TEX_FLAG_SRGB) != 0];
+		img->width = h->width;
+		img->height = h->height;
+		img->nlevels = h->nlevels;
+		img->data = data;
+		img->size = size;
+		img->levels = (const struct texLevel *)(h + 1);
+
+		return true;
+	}
+	bool ok = tgaDecodeMemory(&t, data, size);
+	assetClose(data, size);
+
+	if (! ok)
+		return false;
+
+	img->width = t.width;
+	img->height = t.height;
+	img->nlevels = 1;
+	img->pixels = t.data;
+
+	return true;
+}
+
+void rFreeTexImage(struct texImage *img)
+{
+	if (img->data)
+		assetClose(img->data, img->size);
+
+	free(img->pixels);
+	memset(img, 0, sizeof(*img));
+}
+
+//
+// Get the pixels of `level` of `img`, along with its dimensions and size in
+// bytes.
+//
+const void *rTexImageLevel(const struct texImage *img, int level, int *w, int *h, size_t *size)
+{
+	if (! img->format) {
+		*w = img->width;
+		*h = img->height;
+		*size = (size_t)img->width * img->height * sizeof(uint32_t);
+
+		return img->pixels;
+	}
+	const struct texLevel *l = &img->levels[level];
+
+	*w = l->width;
+	*h = l->height;
+	*size = l->size;
+
+	return img->data + l->offset;
+}
+
+//
+// Create a texture from `img`. Decoded pixels are uploaded with `format`,
+// and get their mipmaps generated. Precompressed images keep their own
+// format, and have every level of their mip chain uploaded as is. Unless
+// `upload` is set, the texture is left empty, with storage for every level.
+//
+struct texture *rNewImageTexture(const struct texImage *img, GLint format, bool upload)
+{
+	struct texture *t;
+
+	if (! img->format) {
+		t = rNewTexture(upload ? img->pixels : NULL, img->width, img->height, format);
+
+		if (upload)
+			rGenerateMipmap(t);
+
+		return t;
+	}
+	t = genTexture();
+	t->isLoaded = upload;
+
+	for (int i = 0; i < img->nlevels; i++) {
+		int w, h;
+		size_t size;
+		const void *blocks = rTexImageLevel(img, i, &w, &h, &size);
+
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, img->format, w, h, 0, size, upload ? blocks : NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, img->nlevels - 1);
+
+	return t;
+}
+
+struct texture *rTextureFromPath(const char *path, GLint format)
+{
+	struct texImage img;
 	struct texture *tx;
 
-	if (! tgaDecode(&t, path)) {
+	if (! rReadTexImage(&img, path)) {
 		return NULL;
 	}
-	tx = rNewTexture(t.data, t.width, t.height, format);
-	tgaFreeImageData(&t);
+	tx = rNewImageTexture(&img, format, true);
+	rFreeTexImage(&img);
 
 	return tx;
 }
@@ -48,21 +250,16 @@ GLuint rNewSampler(GLuint minFilter, GLuint magFilter)
 
 void rGenerateMipmap(struct texture *t)
 {
-	glBindTexture(GL_TEXTURE_2D, t->handle);
+	rBindTexture(0, GL_TEXTURE_2D, t->handle);
 	glGenerateMipmap(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 struct texture *rNewTexture(void *pixels, int w, int h, GLint format)
 {
-	struct texture *t = malloc(sizeof(*t));
+	struct texture *t = genTexture();
 
-	t->index = 0;
-	t->sampler = -1;
-	t->uniform = -1;
+	t->isLoaded = pixels != NULL;
 
-	glGenTextures(1, &t->handle);
-	glBindTexture(GL_TEXTURE_2D, t->handle);
 	glTexImage2D(
 		GL_TEXTURE_2D,
 		0, // Mipmap level
@@ -73,7 +270,6 @@ struct texture *rNewTexture(void *pixels, int w, int h, GLint format)
 		GL_UNSIGNED_BYTE, // Data type of the components
 		pixels // Data
 	);
-	glBindTexture(GL_TEXTURE_2D, 0);
 
 	return t;
 }
@@ -83,7 +279,17 @@ const char *rTextureExtension(enum textureType t)
 	return TextureExtensions[t];
 }
 
+const char *rCompressedTextureExtension(enum textureType t)
+{
+	return CompressedTextureExtensions[t];
+}
+
 GLint rTextureFormat(enum textureType t)
 {
 	return TextureFormats[t];
 }
+
+const char *rTextureSamplerName(enum textureType t)
+{
+	return TextureSamplerNames[t];
+}
@@ -5,18 +5,44 @@ enum textureType {
 	TEXTURE_TYPES
 };
 
+struct texLevel;
+
 struct texture {
 	GLuint handle;
 	GLuint sampler;
 	GLint  uniform;
 	int    index;
+	bool   isLoaded; // Whether its pixels and mipmaps have been uploaded
+};
+
+//
+// The pixels of a texture, ready to be uploaded. Either a mapping of a
+// precompressed file, with its whole mip chain, or a decoded TGA, whose
+// mipmaps are generated once it's uploaded.
+//
+struct texImage {
+	GLenum                format;  // Compressed internal format, or 0 for decoded pixels
+	int                   width;
+	int                   height;
+	int                   nlevels; // 1 for decoded pixels
+	uint32_t              *pixels; // Decoded BGRA pixels
+	const unsigned char   *data;   // Mapping of the precompressed file
+	size_t                size;
+	const struct texLevel *levels;
 };
 
 GLuint rNewSampler(GLuint minFilter, GLuint magFilter);
 struct texture *rNewTexture(void *pixels, int w, int h, GLint format);
+struct texture *rNewImageTexture(const struct texImage *img, GLint format, bool upload);
 struct texture *rTextureFromPath(const char *path, GLint format);
 
+bool rReadTexImage(struct texImage *img, const char *path);
+void rFreeTexImage(struct texImage *img);
+const void *rTexImageLevel(const struct texImage *img, int level, int *w, int *h, size_t *size);
+
 void rGenerateMipmap(struct texture *t);
 
 const char *rTextureExtension(enum textureType t);
+const char *rCompressedTextureExtension(enum textureType t);
 GLint rTextureFormat(enum textureType t);
+const char *rTextureSamplerName(enum textureType t);
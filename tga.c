@@ -8,10 +8,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "tga.h"
 
 #define TGA_TYPE_UNCOMPRESSED_RGB 2
+#define TGA_HEADER_SIZE 18
 
 struct pixel {
 	unsigned char r, g, b, a;
@@ -20,22 +22,49 @@ struct pixel {
 bool tgaDecode(struct tga *t, const char *path)
 {
 	FILE *fp = fopen(path, "rb");
+	unsigned char *data;
+	long size;
+	bool ok;
 
 	if (!fp)
-		return NULL;
-
-	fread(&t->header.idlen, 1, 1, fp);
-	fread(&t->header.colormaptype, 1, 1, fp);
-	fread(&t->header.imagetype, 1, 1, fp);
-	fread(&t->header.colormapoff, 2, 1, fp);
-	fread(&t->header.colormaplen, 2, 1, fp);
-	fread(&t->header.colormapdepth, 1, 1, fp);
-	fread(&t->header.x, 2, 1, fp);
-	fread(&t->header.y, 2, 1, fp);
-	fread(&t->width, 2, 1, fp);
-	fread(&t->height, 2, 1, fp);
-	fread(&t->depth, 1, 1, fp);
-	fread(&t->header.imagedesc, 1, 1, fp);
+		return false;
+
+	fseek(fp, 0L, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	data = malloc(size);
+
+	ok = fread(data, size, 1, fp) == 1 && tgaDecodeMemory(t, data, size);
+
+	fclose(fp);
+	free(data);
+
+	return ok;
+}
+
+//
+// Decode the `size` bytes of TGA image at `data`.
+//
+bool tgaDecodeMemory(struct tga *t, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	if (size < TGA_HEADER_SIZE)
+		return false;
+
+	t->header.idlen = p[0];
+	t->header.colormaptype = p[1];
+	t->header.imagetype = p[2];
+	memcpy(&t->header.colormapoff, p + 3, 2);
+	memcpy(&t->header.colormaplen, p + 5, 2);
+	t->header.colormapdepth = p[7];
+	memcpy(&t->header.x, p + 8, 2);
+	memcpy(&t->header.y, p + 10, 2);
+	memcpy(&t->width, p + 12, 2);
+	memcpy(&t->height, p + 14, 2);
+	t->depth = p[16];
+	t->header.imagedesc = p[17];
 
 	printf("%dx%dx%d, type %d\n", t->width, t->height, t->depth, t->header.imagetype);
 
@@ -43,9 +72,13 @@ bool tgaDecode(struct tga *t, const char *path)
 		return false;
 	}
 
+	size_t n = (size_t)t->width * t->height * (t->depth/8);
+
+	if (size - TGA_HEADER_SIZE < n)
+		return false;
+
 	t->data = malloc(sizeof(struct pixel) * t->width * t->height);
-	fread(t->data, t->depth/8, t->width * t->height, fp);
-	fclose(fp);
+	memcpy(t->data, p + TGA_HEADER_SIZE, n);
 
 	return true;
 }
@@ -7,6 +7,7 @@
  *
  *   stdint.h
  *   stdbool.h
+ *   stddef.h
  *
  */
 struct tga {
@@ -29,5 +30,6 @@ struct tga {
 };
 
 bool tgaDecode(struct tga *t, const char *path);
+bool tgaDecodeMemory(struct tga *t, const void *data, size_t size);
 int  tgaEncode(uint32_t *data, short w, short h, char depth, const char *path);
 void tgaFreeImageData(struct tga *t);
@@ -1,6 +1,14 @@
 TARGET_$(dir) := $(dir)/mdlconv
-TARGETS       := $(TARGETS) $(TARGET_$(dir))
-SRC_$(dir)    := $(wildcard $(dir)/*.c)
+PACK_$(dir)   := $(dir)/pack
+TEX_$(dir)    := $(dir)/texconv
+TARGETS       := $(TARGETS) $(TARGET_$(dir)) $(PACK_$(dir)) $(TEX_$(dir))
+SRC_$(dir)    := $(filter-out $(PACK_$(dir)).c $(TEX_$(dir)).c, $(wildcard $(dir)/*.c))
 
 $(TARGET_$(dir)): $(SRC_$(dir))
 	$(CC) $(CFLAGS) $(INCS) -lm -lassimp $(SRC_$(dir)) -o $(TARGET_$(dir))
+
+$(PACK_$(dir)): $(PACK_$(dir)).c hash.c
+	$(CC) $(CFLAGS) $(INCS) -I. $^ -o $@
+
+$(TEX_$(dir)): $(TEX_$(dir)).c tga.c
+	$(CC) $(CFLAGS) $(INCS) -I. $^ -lm -o $@
@@ -1,5 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
@@ -8,12 +14,53 @@
 
 #include "linmath.h"
 #include "common.h"
+#include "meshopt.h"
 
 #define AI_CONFIG_PP_SBP_REMOVE aiPrimitiveType_LINE|aiPrimitiveType_POINT
 #define elems(a) (sizeof(a) / sizeof(a[0]))
 
 static const char MAGIC_NUMBER = 236;
 
+//
+// Mesh data gathered from the scene, before it is written out.
+//
+struct meshData {
+	char              name[64];
+	char              shader[32];
+	uint32_t          material;
+	struct mdlBone    *bones;
+	uint32_t          nbones;
+	struct vertex     *vertices;
+	uint32_t          nvertices;
+	uint32_t          *indices;  // Full-detail indices, followed by each level of detail
+	uint32_t          nindices;
+	uint32_t          nfaces;    // Number of full-detail triangles
+	struct mdlLod     lods[MDL_MAX_LODS];
+	uint32_t          nlods;
+	vec3              min, max;
+	int               format; // Vertex format to write, an `enum vertexFormat`
+	struct mdlCluster *clusters;
+	uint32_t          nclusters;
+	vec3              *occluderVertices;
+	uint32_t          noccluderVertices;
+	uint32_t          *occluderIndices;
+	uint32_t          noccluderIndices;
+};
+
+struct meshList {
+	struct meshData *data;
+	int             n;
+};
+
+static struct {
+	int  version;  // Version of the file format to write
+	bool packed;   // Write compressed vertices
+	bool optimize; // Reorder triangles and vertices for the GPU caches
+	bool clusters; // Split meshes into clusters that can be culled individually
+	int  lods;     // Number of levels of detail to generate, including the first
+	int  occluder; // Largest number of triangles of an occluder, or zero for none
+} OPTIONS = {MDL_VERSION, false, false, false, 1, 0};
+
 static struct aiMatrix4x4 aiMatrix4x4mul(struct aiMatrix4x4 *a, struct aiMatrix4x4 *b)
 {
 	mat4 a1 = (mat4){
@@ -60,7 +107,7 @@ static int fwritestr(char *str, FILE *fp)
 	return fwrite(str, len, 1, fp);
 }
 
-static int fwritemat4(struct aiMatrix4x4 *m, FILE *fp)
+static void aiToFloat16(struct aiMatrix4x4 *m, float out[16])
 {
 	mat4 mat = (mat4){
 		(vec4){m->a1, m->b1, m->c1, m->d1},
@@ -68,8 +115,109 @@ static int fwritemat4(struct aiMatrix4x4 *m, FILE *fp)
 		(vec4){m->a3, m->b3, m->c3, m->d3},
 		(vec4){m->a4, m->b4, m->c4, m->d4}
 	};
+	memcpy(out, &mat, sizeof(mat));
+}
+
+//
+// Write `n` bytes of zero padding.
+//
+static void fwritepad(size_t n, FILE *fp)
+{
+	static const char zeros[MDL_ALIGNMENT] = {0};
+	assert(n <= sizeof(zeros));
+	fwrite(zeros, 1, n, fp);
+}
+
+static uint64_t align(uint64_t off)
+{
+	return (off + MDL_ALIGNMENT - 1) & ~(uint64_t)(MDL_ALIGNMENT - 1);
+}
+
+//
+// Convert `f` to an IEEE 754 half-precision float, rounding to nearest.
+//
+static uint16_t halfFromFloat(float f)
+{
+	uint32_t x, h;
+	memcpy(&x, &f, sizeof(x));
+
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t mant = x & 0x7fffff;
+	int      exp  = (int)((x >> 23) & 0xff) - 127 + 15;
+
+	if (((x >> 23) & 0xff) == 0xff) { // Infinity or NaN
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	}
+	if (exp >= 31) { // Overflow
+		return sign | 0x7c00;
+	}
+	if (exp <= 0) { // Subnormal or zero
+		if (exp < -10)
+			return sign;
+
+		int shift = 14 - exp;
+
+		mant |= 0x800000;
+		h = mant >> shift;
+
+		if ((mant >> (shift - 1)) & 1)
+			h++;
+
+		return sign | h;
+	}
+	h = sign | (exp << 10) | (mant >> 13);
+
+	// Round to nearest. A carry out of the mantissa correctly bumps the exponent.
+	if (mant & 0x1000)
+		h++;
 
-	return fwrite(&mat, 4, 16, stdout);
+	return h;
+}
+
+static float clampf(float f, float lo, float hi)
+{
+	return f < lo ? lo : f > hi ? hi : f;
+}
+
+//
+// Pack a vector into the signed, normalized GL_INT_2_10_10_10_REV layout.
+//
+static uint32_t packSnorm2101010(float x, float y, float z, float w)
+{
+	uint32_t ix = (uint32_t)(int32_t)roundf(clampf(x, -1, 1) * 511.0f) & 0x3ff;
+	uint32_t iy = (uint32_t)(int32_t)roundf(clampf(y, -1, 1) * 511.0f) & 0x3ff;
+	uint32_t iz = (uint32_t)(int32_t)roundf(clampf(z, -1, 1) * 511.0f) & 0x3ff;
+	uint32_t iw = (uint32_t)(int32_t)roundf(clampf(w, -1, 1)) & 0x3;
+
+	return ix | (iy << 10) | (iz << 20) | (iw << 30);
+}
+
+//
+// Convert the vertices of `m` to the compressed layout. Returns the packed
+// array, with a stride of `vertexFormatSize(format)`.
+//
+static void *packVertices(struct meshData *m, enum vertexFormat format)
+{
+	size_t stride = format == VERTEX_FORMAT_PACKED_SKINNED ? sizeof(struct packedVertex)
+	                                                       : offsetof(struct packedVertex, bones);
+	unsigned char *out = calloc(m->nvertices, stride);
+
+	for (int i = 0; i < m->nvertices; i++) {
+		struct vertex *v = &m->vertices[i];
+		struct packedVertex p = {
+			.pos     = {halfFromFloat(v->pos.x), halfFromFloat(v->pos.y), halfFromFloat(v->pos.z), halfFromFloat(1.0f)},
+			.normal  = packSnorm2101010(v->normal.x, v->normal.y, v->normal.z, 0.0f),
+			.tangent = packSnorm2101010(v->tangent.x, v->tangent.y, v->tangent.z, v->tangent.w),
+			.uv      = {halfFromFloat(v->uv.s), halfFromFloat(v->uv.t)}
+		};
+		for (int k = 0; k < 4; k++) {
+			// Unused slots are -1, with a weight of zero.
+			p.bones[k] = v->bones[k] < 0 ? 0 : v->bones[k];
+			p.weights[k] = roundf(clampf(v->weights[k], 0, 1) * 255.0f);
+		}
+		memcpy(out + i * stride, &p, stride);
+	}
+	return out;
 }
 
 static int processMaterialTexture(struct aiMaterial *m, unsigned int type)
@@ -104,33 +252,33 @@ static int processMaterial(struct aiMaterial *m)
 	return 0;
 }
 
-static int processMesh(struct aiMesh *m, char *name, struct aiNode *root)
+static int processMesh(struct aiMesh *m, char *name, struct aiNode *root, struct meshData *out)
 {
 	int nverts = m->mNumVertices;
 	int nbones = m->mNumBones;
+	int nfaces = m->mNumFaces;
 
-	struct vertex vertices[nverts];
+	struct vertex *vertices = malloc(nverts * sizeof(*vertices));
+	struct mdlBone *bones = calloc(nbones, sizeof(*bones));
+	uint32_t *indices = malloc(nfaces * 3 * sizeof(*indices));
 
 	fprintf(stderr, "mesh '%s'\n", name);
-	fwritestr(name, stdout);
+	snprintf(out->name, sizeof(out->name), "%s", name);
 
 	// Shader name
-	char *shader = "default";
-	fwritestr(shader, stdout);
+	strcpy(out->shader, "default");
 
 	// Material index
-	fwrite(&m->mMaterialIndex, sizeof(m->mMaterialIndex), 1, stdout);
+	out->material = m->mMaterialIndex;
 
-	// Bone count
-	fwrite(&nbones, 4, 1, stdout);
 	for (int i = 0; i < nbones; i++) {
 		struct aiString name = m->mBones[i]->mName;
 		struct aiNode *node = findNode(root, name.data);
 
 		assert(node);
 
-		fwritestr(name.data, stdout);
-		fwritemat4(&m->mBones[i]->mOffsetMatrix, stdout);
+		snprintf(bones[i].name, sizeof(bones[i].name), "%s", name.data);
+		aiToFloat16(&m->mBones[i]->mOffsetMatrix, bones[i].offset);
 
 		struct aiNode *n = node;
 		struct aiMatrix4x4 t = node->mTransformation;
@@ -138,8 +286,7 @@ static int processMesh(struct aiMesh *m, char *name, struct aiNode *root)
 			n = n->mParent;
 			t = aiMatrix4x4mul(&n->mTransformation, &t);
 		}
-		// Write transform matrix
-		fwritemat4(&t, stdout);
+		aiToFloat16(&t, bones[i].transform);
 
 		int parentId = -1;
 		assert(node->mParent);
@@ -151,13 +298,16 @@ static int processMesh(struct aiMesh *m, char *name, struct aiNode *root)
 				}
 			}
 		}
-		fwrite(&parentId, 4, 1, stdout);
+		bones[i].parentId = parentId;
 	}
 	assert(m->mVertices);
 	assert(m->mTangents);
 	assert(m->mBitangents);
 	assert(m->mNormals);
 
+	out->min = (vec3){ FLT_MAX,  FLT_MAX,  FLT_MAX};
+	out->max = (vec3){-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
 	for (int i = 0; i < nverts; i++) {
 		// Vertex tangents (should already be normalized)
 		vec3  t = (vec3){m->mTangents[i].x, m->mTangents[i].y, m->mTangents[i].z};
@@ -173,6 +323,10 @@ static int processMesh(struct aiMesh *m, char *name, struct aiNode *root)
 			.bones   = {-1, -1, -1, -1},
 			.weights = {0.0f, 0.0f, 0.0f, 0.0f}
 		};
+		for (int k = 0; k < 3; k++) {
+			out->min.n[k] = fminf(out->min.n[k], vertices[i].pos.n[k]);
+			out->max.n[k] = fmaxf(out->max.n[k], vertices[i].pos.n[k]);
+		}
 	}
 
 	for (int i = 0; i < nbones; i++) {
@@ -196,12 +350,6 @@ static int processMesh(struct aiMesh *m, char *name, struct aiNode *root)
 			}
 		}
 	}
-	// Vertex count
-	fwrite(&nverts, 4, 1, stdout);
-	fwrite(vertices, sizeof(struct vertex), nverts, stdout);
-
-	int nfaces = m->mNumFaces;
-	fwrite(&nfaces, 4, 1, stdout);
 
 	for (int i = 0; i < nfaces; i++) {
 		struct aiFace f = m->mFaces[i];
@@ -209,13 +357,408 @@ static int processMesh(struct aiMesh *m, char *name, struct aiNode *root)
 		assert(f.mNumIndices == 3);
 
 		for (int j = 0; j < 3; j++) {
-			fwrite(&f.mIndices[j], 4, 1, stdout);
+			indices[i * 3 + j] = f.mIndices[j];
 		}
 	}
+	out->bones = bones;
+	out->nbones = nbones;
+	out->vertices = vertices;
+	out->nvertices = nverts;
+	out->indices = indices;
+	out->nfaces = nfaces;
+	out->nindices = nfaces * 3;
+	out->nlods = 0;
+	out->format = VERTEX_FORMAT_FULL;
+	out->clusters = NULL;
+	out->nclusters = 0;
+	out->occluderVertices = NULL;
+	out->noccluderVertices = 0;
+	out->occluderIndices = NULL;
+	out->noccluderIndices = 0;
+
+	// Packed vertices index bones with a byte, so meshes with more bones
+	// keep the full layout.
+	if (OPTIONS.packed && nbones > UINT8_MAX + 1) {
+		fprintf(stderr, "mesh '%s': %d bones don't fit packed vertices, writing full vertices\n", out->name, nbones);
+	} else if (OPTIONS.packed) {
+		out->format = nbones > 0 ? VERTEX_FORMAT_PACKED_SKINNED : VERTEX_FORMAT_PACKED;
+	}
 	return 0;
 }
 
-static int processNode(struct aiNode *node, struct aiMesh **meshes, struct aiNode *root)
+//
+// Reorder the triangles of `m` for the post-transform cache and for reduced
+// overdraw, then its vertices for fetch locality.
+//
+static void optimizeMesh(struct meshData *m)
+{
+	struct cacheStats before = analyzeVertexCache(m->indices, m->nfaces, m->nvertices, 16);
+
+	optimizeVertexCache(m->indices, m->nfaces, m->nvertices);
+	optimizeOverdraw(m->indices, m->nfaces, m->vertices, m->nvertices);
+	m->nvertices = optimizeVertexFetch(m->vertices, m->indices, m->nfaces, m->nvertices);
+
+	struct cacheStats after = analyzeVertexCache(m->indices, m->nfaces, m->nvertices, 16);
+
+	fprintf(stderr, "mesh '%s': ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+		m->name, before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+//
+// Generate a chain of up to `n` levels of detail for `m`, each with about half
+// the triangles of the previous one. Each level is simplified from the
+// full-detail mesh, so that its error is measured against it.
+//
+static void buildLods(struct meshData *m, int n)
+{
+	size_t count = m->nfaces * 3;
+	uint32_t *all = malloc(count * n * sizeof(*all));
+	size_t total = count;
+	int l;
+
+	memcpy(all, m->indices, count * sizeof(*all));
+	m->lods[0] = (struct mdlLod){0, count, 0.0f};
+
+	for (l = 1; l < n; l++) {
+		struct mdlLod *prev = &m->lods[l - 1];
+		size_t target = prev->count / 6 * 3;
+		uint32_t *dst = all + total;
+		float error;
+
+		size_t k = simplifyMesh(dst, m->indices, count, m->vertices, m->nvertices, target, &error);
+
+		// Stop when the mesh can't be simplified any further.
+		if (k == 0 || k >= prev->count)
+			break;
+
+		optimizeVertexCache(dst, k / 3, m->nvertices);
+
+		m->lods[l] = (struct mdlLod){total, k, fmaxf(error, prev->error)};
+		total += k;
+
+		fprintf(stderr, "mesh '%s': lod %d, %zu triangles, error %f\n", m->name, l, k / 3, m->lods[l].error);
+	}
+	free(m->indices);
+
+	m->indices = realloc(all, total * sizeof(*all));
+	m->nindices = total;
+	m->nlods = l;
+}
+
+static const struct vertex *WELD_VERTICES;
+
+static int weldCompare(const void *a, const void *b)
+{
+	const float *pa = WELD_VERTICES[*(const uint32_t *)a].pos.n;
+	const float *pb = WELD_VERTICES[*(const uint32_t *)b].pos.n;
+
+	for (int k = 0; k < 3; k++) {
+		if (pa[k] != pb[k])
+			return pa[k] < pb[k] ? -1 : 1;
+	}
+	return 0;
+}
+
+static int edgeCompare(const void *a, const void *b)
+{
+	uint64_t ea = *(const uint64_t *)a, eb = *(const uint64_t *)b;
+
+	return ea < eb ? -1 : ea > eb;
+}
+
+//
+// Whether the full-detail mesh of `m` encloses a convex volume. Vertices are
+// welded by position, so that seams don't count as open edges. Every edge
+// must then be shared by exactly two triangles, in opposite directions, and
+// no vertex may lie in front of the plane of any triangle.
+//
+static bool isClosedConvex(const struct meshData *m)
+{
+	size_t count = m->nfaces * 3, nedges = 0;
+	uint32_t *order = malloc(m->nvertices * sizeof(*order));
+	uint32_t *weld = malloc(m->nvertices * sizeof(*weld));
+	uint64_t *edges = malloc(count * sizeof(*edges));
+	bool ok = true;
+
+	for (uint32_t i = 0; i < m->nvertices; i++) {
+		order[i] = i;
+	}
+	WELD_VERTICES = m->vertices;
+	qsort(order, m->nvertices, sizeof(*order), weldCompare);
+
+	for (uint32_t i = 0; i < m->nvertices; i++) {
+		bool same = i > 0 && weldCompare(&order[i - 1], &order[i]) == 0;
+
+		weld[order[i]] = same ? weld[order[i - 1]] : order[i];
+	}
+	for (size_t i = 0; i < count; i += 3) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t a = weld[m->indices[i + k]], b = weld[m->indices[i + (k + 1) % 3]];
+
+			// Degenerate triangles don't bound anything.
+			if (a != b)
+				edges[nedges++] = (uint64_t)a << 32 | b;
+		}
+	}
+	qsort(edges, nedges, sizeof(*edges), edgeCompare);
+
+	for (size_t i = 0; i < nedges && ok; i++) {
+		uint64_t reverse = edges[i] << 32 | edges[i] >> 32;
+
+		ok = (i == 0 || edges[i] != edges[i - 1]) && bsearch(&reverse, edges, nedges, sizeof(*edges), edgeCompare);
+	}
+
+	// Orient the planes outwards, whichever way the mesh is wound.
+	vec3 extent = vec3sub(m->max, m->min);
+	float epsilon = 1e-4f * vec3len(extent), volume = 0.0f;
+
+	for (size_t i = 0; i < count && ok; i += 3) {
+		vec3 p0 = m->vertices[m->indices[i]].pos, p1 = m->vertices[m->indices[i + 1]].pos, p2 = m->vertices[m->indices[i + 2]].pos;
+
+		volume += vec3dot(p0, vec3cross(p1, p2));
+	}
+	for (size_t i = 0; i < count && ok; i += 3) {
+		vec3 p0 = m->vertices[m->indices[i]].pos, p1 = m->vertices[m->indices[i + 1]].pos, p2 = m->vertices[m->indices[i + 2]].pos;
+		vec3 n = vec3cross(vec3sub(p1, p0), vec3sub(p2, p0));
+		float len = vec3len(n);
+
+		if (len == 0.0f)
+			continue;
+
+		for (uint32_t v = 0; v < m->nvertices && ok; v++) {
+			float d = vec3dot(n, vec3sub(m->vertices[v].pos, p0)) / len;
+
+			ok = (volume < 0.0f ? -d : d) <= epsilon;
+		}
+	}
+	free(order);
+	free(weld);
+	free(edges);
+
+	return ok;
+}
+
+//
+// Simplify the full-detail mesh of `m` down to at most about `n` triangles,
+// for use as an occluder, with only the positions of the vertices it
+// references. Only closed, convex meshes get an occluder: simplification only
+// ever merges a vertex into another, so every triangle of the occluder is
+// spanned by vertices of the mesh, and lies within its volume. Occluders of
+// other meshes could bulge past their surface, and hide what's visible.
+//
+static void buildOccluder(struct meshData *m, int n)
+{
+	if (! isClosedConvex(m)) {
+		fprintf(stderr, "mesh '%s': not closed and convex, no occluder\n", m->name);
+		return;
+	}
+	size_t count = m->nfaces * 3;
+	uint32_t *indices = malloc(count * sizeof(*indices));
+	uint32_t *remap = malloc(m->nvertices * sizeof(*remap));
+	float error;
+
+	size_t k = simplifyMesh(indices, m->indices, count, m->vertices, m->nvertices, (size_t)n * 3, &error);
+
+	memset(remap, 0xff, m->nvertices * sizeof(*remap));
+	m->occluderVertices = malloc(k * sizeof(*m->occluderVertices));
+	m->noccluderVertices = 0;
+
+	for (size_t i = 0; i < k; i++) {
+		uint32_t v = indices[i];
+
+		if (remap[v] == UINT32_MAX) {
+			remap[v] = m->noccluderVertices;
+			m->occluderVertices[m->noccluderVertices++] = m->vertices[v].pos;
+		}
+		indices[i] = remap[v];
+	}
+	m->occluderIndices = indices;
+	m->noccluderIndices = k;
+
+	free(remap);
+
+	fprintf(stderr, "mesh '%s': occluder, %zu triangles, %u vertices, error %f\n",
+		m->name, k / 3, m->noccluderVertices, error);
+}
+
+static void freeMesh(struct meshData *m)
+{
+	free(m->occluderVertices);
+	free(m->occluderIndices);
+	free(m->clusters);
+	free(m->bones);
+	free(m->vertices);
+	free(m->indices);
+}
+
+//
+// Write meshes in the original, sequential format.
+//
+static void writeV1(struct meshData *meshes, int n, FILE *fp)
+{
+	unsigned char magic = MAGIC_NUMBER;
+	fwrite(&magic, 1, 1, fp);
+	fwrite(&n, 4, 1, fp);
+
+	for (int i = 0; i < n; i++) {
+		struct meshData *m = &meshes[i];
+
+		fwritestr(m->name, fp);
+		fwritestr(m->shader, fp);
+		fwrite(&m->material, sizeof(m->material), 1, fp);
+
+		fwrite(&m->nbones, 4, 1, fp);
+		for (int j = 0; j < m->nbones; j++) {
+			fwritestr(m->bones[j].name, fp);
+			fwrite(m->bones[j].offset, 4, 16, fp);
+			fwrite(m->bones[j].transform, 4, 16, fp);
+			fwrite(&m->bones[j].parentId, 4, 1, fp);
+		}
+		fwrite(&m->nvertices, 4, 1, fp);
+		fwrite(m->vertices, sizeof(struct vertex), m->nvertices, fp);
+
+		fwrite(&m->nfaces, 4, 1, fp);
+		fwrite(m->indices, 4, m->nfaces * 3, fp);
+	}
+}
+
+static size_t vertexSize(int format)
+{
+	switch (format) {
+	case VERTEX_FORMAT_PACKED:         return offsetof(struct packedVertex, bones);
+	case VERTEX_FORMAT_PACKED_SKINNED: return sizeof(struct packedVertex);
+	default:                           return sizeof(struct vertex);
+	}
+}
+
+//
+// Write meshes in the version 2 container format. Offsets are all computed
+// up-front, so the output doesn't need to be seekable.
+//
+static void writeV2(struct meshData *meshes, int n, FILE *fp)
+{
+	struct mdlHeader header = {.version = MDL_VERSION, .nmeshes = n};
+	struct mdlMeshEntry *entries = calloc(n, sizeof(*entries));
+	struct mdlOccluder *occluders = calloc(n, sizeof(*occluders));
+	uint64_t off = sizeof(header) + n * sizeof(*entries);
+
+	memcpy(header.magic, MDL_MAGIC, sizeof(header.magic));
+
+	for (int i = 0; i < n; i++) {
+		struct meshData *m = &meshes[i];
+		struct mdlMeshEntry *e = &entries[i];
+		uint64_t start = align(off);
+
+		strcpy(e->name, m->name);
+		strcpy(e->shader, m->shader);
+		e->material = m->material;
+		e->nbones = m->nbones;
+		e->nvertices = m->nvertices;
+		e->nfaces = m->nfaces;
+		e->format = m->format;
+		e->stride = vertexSize(m->format);
+		e->indexSize = m->nvertices <= UINT16_MAX + 1 ? sizeof(uint16_t) : sizeof(uint32_t);
+		e->nclusters = m->nclusters;
+		e->nlods = m->nlods;
+		e->nindices = m->nindices;
+
+		e->bones = start;
+		e->vertices = align(e->bones + m->nbones * sizeof(struct mdlBone));
+		e->indices = align(e->vertices + m->nvertices * e->stride);
+		e->clusters = align(e->indices + m->nindices * e->indexSize);
+		e->lods = align(e->clusters + m->nclusters * sizeof(struct mdlCluster));
+		off = e->lods + m->nlods * sizeof(struct mdlLod);
+		e->size = off - start;
+
+		memcpy(e->min, m->min.n, sizeof(e->min));
+		memcpy(e->max, m->max.n, sizeof(e->max));
+	}
+	if (OPTIONS.occluder > 0) {
+		header.occluders = align(off);
+		off = header.occluders + n * sizeof(*occluders);
+
+		for (int i = 0; i < n; i++) {
+			struct meshData *m = &meshes[i];
+			struct mdlOccluder *o = &occluders[i];
+
+			o->nvertices = m->noccluderVertices;
+			o->nindices = m->noccluderIndices;
+			o->vertices = align(off);
+			o->indices = align(o->vertices + o->nvertices * sizeof(float[3]));
+			off = o->indices + o->nindices * sizeof(uint32_t);
+		}
+	}
+	header.size = off;
+
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(entries, sizeof(*entries), n, fp);
+	off = sizeof(header) + n * sizeof(*entries);
+
+	for (int i = 0; i < n; i++) {
+		struct meshData *m = &meshes[i];
+		struct mdlMeshEntry *e = &entries[i];
+
+		fwritepad(e->bones - off, fp);
+		fwrite(m->bones, sizeof(struct mdlBone), m->nbones, fp);
+		off = e->bones + m->nbones * sizeof(struct mdlBone);
+
+		fwritepad(e->vertices - off, fp);
+		if (m->format == VERTEX_FORMAT_FULL) {
+			fwrite(m->vertices, sizeof(struct vertex), m->nvertices, fp);
+		} else {
+			void *packed = packVertices(m, m->format);
+			fwrite(packed, e->stride, m->nvertices, fp);
+			free(packed);
+
+			fprintf(stderr, "mesh '%s': packed %u vertices, %zu -> %zu bytes\n", m->name, m->nvertices,
+				m->nvertices * sizeof(struct vertex), (size_t)m->nvertices * e->stride);
+		}
+		off = e->vertices + m->nvertices * e->stride;
+
+		fwritepad(e->indices - off, fp);
+		if (e->indexSize == sizeof(uint16_t)) {
+			for (int j = 0; j < m->nindices; j++) {
+				uint16_t index = m->indices[j];
+				fwrite(&index, sizeof(index), 1, fp);
+			}
+		} else {
+			fwrite(m->indices, sizeof(uint32_t), m->nindices, fp);
+		}
+		off = e->indices + m->nindices * e->indexSize;
+
+		fwritepad(e->clusters - off, fp);
+		fwrite(m->clusters, sizeof(struct mdlCluster), m->nclusters, fp);
+		off = e->clusters + m->nclusters * sizeof(struct mdlCluster);
+
+		fwritepad(e->lods - off, fp);
+		fwrite(m->lods, sizeof(struct mdlLod), m->nlods, fp);
+		off = e->lods + m->nlods * sizeof(struct mdlLod);
+	}
+	if (header.occluders) {
+		fwritepad(header.occluders - off, fp);
+		fwrite(occluders, sizeof(*occluders), n, fp);
+		off = header.occluders + n * sizeof(*occluders);
+
+		for (int i = 0; i < n; i++) {
+			struct meshData *m = &meshes[i];
+			struct mdlOccluder *o = &occluders[i];
+
+			fwritepad(o->vertices - off, fp);
+			for (int j = 0; j < o->nvertices; j++) {
+				fwrite(m->occluderVertices[j].n, sizeof(float), 3, fp);
+			}
+			off = o->vertices + o->nvertices * sizeof(float[3]);
+
+			fwritepad(o->indices - off, fp);
+			fwrite(m->occluderIndices, sizeof(uint32_t), o->nindices, fp);
+			off = o->indices + o->nindices * sizeof(uint32_t);
+		}
+	}
+	free(entries);
+	free(occluders);
+}
+
+static int processNode(struct aiNode *node, struct aiMesh **meshes, struct aiNode *root, struct meshList *out)
 {
 	int nNodes = node->mNumChildren;
 
@@ -228,9 +771,10 @@ static int processNode(struct aiNode *node, struct aiMesh **meshes, struct aiNod
 			struct aiMesh *m = meshes[index];
 			assert(m);
 
-			processMesh(m, n->mName.data, root);
+			out->data = realloc(out->data, (out->n + 1) * sizeof(*out->data));
+			processMesh(m, n->mName.data, root, &out->data[out->n++]);
 		}
-		processNode(n, meshes, root);
+		processNode(n, meshes, root, out);
 	}
 	return 0;
 }
@@ -258,10 +802,6 @@ static int process(const char *path)
 	struct aiMesh **meshes = scene->mMeshes;
 	struct aiMaterial **materials = scene->mMaterials;
 
-	// Header
-	unsigned char magic = MAGIC_NUMBER;
-	fwrite(&magic, 1, 1, stdout);
-
 	if (0) {
 		// Materials
 		fprintf(stderr, "loading materials (%d)..\n", nMaterials);
@@ -274,20 +814,98 @@ static int process(const char *path)
 
 	// Nodes & Meshes
 	fprintf(stderr, "loading meshes (%d)..\n", nMeshes);
-	fwrite(&nMeshes, 4, 1, stdout);
 
-	processNode(scene->mRootNode, meshes, scene->mRootNode);
+	struct meshList list = {NULL, 0};
+	processNode(scene->mRootNode, meshes, scene->mRootNode, &list);
+
+	if (OPTIONS.optimize) {
+		for (int i = 0; i < list.n; i++) {
+			optimizeMesh(&list.data[i]);
+		}
+	}
+	if (OPTIONS.lods > 1) {
+		for (int i = 0; i < list.n; i++) {
+			buildLods(&list.data[i], OPTIONS.lods);
+		}
+	}
+	if (OPTIONS.clusters) {
+		for (int i = 0; i < list.n; i++) {
+			struct meshData *m = &list.data[i];
+
+			m->nclusters = buildClusters(m->indices, m->nfaces, m->vertices, m->nvertices, &m->clusters);
+			fprintf(stderr, "mesh '%s': %u clusters\n", m->name, m->nclusters);
+		}
+	}
+	if (OPTIONS.occluder > 0) {
+		for (int i = 0; i < list.n; i++) {
+			buildOccluder(&list.data[i], OPTIONS.occluder);
+		}
+	}
+	if (OPTIONS.version == 1) {
+		writeV1(list.data, list.n, stdout);
+	} else {
+		writeV2(list.data, list.n, stdout);
+	}
+	for (int i = 0; i < list.n; i++) {
+		freeMesh(&list.data[i]);
+	}
+	free(list.data);
 
 	aiReleaseImport(scene);
 
 	return 0;
 }
 
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-1] [-p] [-O] [-c] [-l <levels>] [-o <triangles>] <filepath>\n", prog);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -1  write the version 1 format, for older loaders\n");
+	fprintf(stderr, "  -p  write compressed vertices (version 2 only)\n");
+	fprintf(stderr, "  -O  optimise triangle and vertex order, and report ACMR/ATVR\n");
+	fprintf(stderr, "  -c  split meshes into clusters with culling bounds (version 2 only)\n");
+	fprintf(stderr, "  -l  generate up to <levels> levels of detail per mesh (version 2 only)\n");
+	fprintf(stderr, "  -o  generate an occluder of at most about <triangles> triangles per closed, convex mesh (version 2 only)\n");
+	exit(1);
+}
+
 int main(int argc, char *argv[])
 {
-	if (argc < 2) {
-		fprintf(stderr, "usage: %s <filepath>\n", argv[0]);
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (! strcmp(argv[i], "-1")) {
+			OPTIONS.version = 1;
+		} else if (! strcmp(argv[i], "-p")) {
+			OPTIONS.packed = true;
+		} else if (! strcmp(argv[i], "-O")) {
+			OPTIONS.optimize = true;
+		} else if (! strcmp(argv[i], "-c")) {
+			OPTIONS.clusters = true;
+		} else if (! strcmp(argv[i], "-l") && i + 1 < argc) {
+			OPTIONS.lods = atoi(argv[++i]);
+
+			if (OPTIONS.lods < 1 || OPTIONS.lods > MDL_MAX_LODS) {
+				fprintf(stderr, "error: levels of detail must be between 1 and %d\n", MDL_MAX_LODS);
+				exit(1);
+			}
+		} else if (! strcmp(argv[i], "-o") && i + 1 < argc) {
+			OPTIONS.occluder = atoi(argv[++i]);
+
+			if (OPTIONS.occluder < 1) {
+				fprintf(stderr, "error: occluders must have at least one triangle\n");
+				exit(1);
+			}
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (i != argc - 1) {
+		usage(argv[0]);
+	}
+	if ((OPTIONS.packed || OPTIONS.clusters || OPTIONS.lods > 1 || OPTIONS.occluder > 0) && OPTIONS.version == 1) {
+		fprintf(stderr, "error: -p, -c, -l and -o require the version 2 format\n");
 		exit(1);
 	}
-	return process(argv[1]);
+	return process(argv[i]);
 }
@@ -0,0 +1,436 @@
+//
+// meshopt.c
+// offline mesh optimisation
+//
+// Triangles are reordered for the post-transform vertex cache using Tom
+// Forsyth's linear-speed algorithm, then grouped into patches which are
+// sorted to reduce overdraw, following Sander et al. (Tipsify). Finally,
+// vertices are reordered by first use, for fetch locality.
+//
+// Optimised index buffers can also be split into clusters of a bounded number
+// of triangles and vertices, each with a bounding sphere and normal cone.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "meshopt.h"
+
+enum {
+	LRU_CACHE_SIZE  = 32, // Cache size modelled by the optimiser
+	FIFO_CACHE_SIZE = 16, // Cache size used to find patch boundaries
+	CLUSTER_TRIS    = 124,
+	CLUSTER_VERTS   = 64
+};
+
+//
+// Simulate a FIFO cache of `size` entries over the index buffer.
+//
+struct cacheStats analyzeVertexCache(const uint32_t *indices, size_t nfaces, size_t nvertices, int size)
+{
+	int32_t *timestamps = malloc(nvertices * sizeof(*timestamps));
+	size_t misses = 0, unique = 0;
+	int32_t now = size + 1;
+
+	for (size_t i = 0; i < nvertices; i++) {
+		timestamps[i] = -1;
+	}
+	for (size_t i = 0; i < nfaces * 3; i++) {
+		uint32_t v = indices[i];
+
+		if (timestamps[v] == -1)
+			unique++;
+
+		if (timestamps[v] == -1 || now - timestamps[v] > size) {
+			timestamps[v] = now++;
+			misses++;
+		}
+	}
+	free(timestamps);
+
+	return (struct cacheStats){
+		.acmr = nfaces ? (float)misses / nfaces : 0,
+		.atvr = unique ? (float)misses / unique : 0
+	};
+}
+
+static float vertexScore(int cachePos, uint32_t remaining)
+{
+	const float decayPower = 1.5f;
+	const float lastTriScore = 0.75f;
+	const float valenceScale = 2.0f;
+	const float valencePower = 0.5f;
+
+	float score = 0.0f;
+
+	if (remaining == 0)
+		return -1.0f;
+
+	if (cachePos >= 0) {
+		if (cachePos < 3) {
+			// Vertices of the last triangle get a fixed score, so that
+			// strips aren't favoured over fans.
+			score = lastTriScore;
+		} else {
+			score = powf(1.0f - (cachePos - 3) / (float)(LRU_CACHE_SIZE - 3), decayPower);
+		}
+	}
+	// Boost vertices with few remaining triangles, to avoid leaving isolated
+	// triangles behind which would need their vertices to be reloaded.
+	return score + valenceScale * powf(remaining, -valencePower);
+}
+
+//
+// Reorder the triangles in `indices` for the post-transform vertex cache.
+//
+void optimizeVertexCache(uint32_t *indices, size_t nfaces, size_t nvertices)
+{
+	uint32_t *remaining = calloc(nvertices, sizeof(*remaining));
+	uint32_t *offsets   = calloc(nvertices + 1, sizeof(*offsets));
+	uint32_t *adjacency = malloc(nfaces * 3 * sizeof(*adjacency));
+	int      *cachePos  = malloc(nvertices * sizeof(*cachePos));
+	float    *vscore    = malloc(nvertices * sizeof(*vscore));
+	float    *tscore    = malloc(nfaces * sizeof(*tscore));
+	bool     *emitted   = calloc(nfaces, sizeof(*emitted));
+	uint32_t *out       = malloc(nfaces * 3 * sizeof(*out));
+
+	uint32_t cache[LRU_CACHE_SIZE + 3];
+	int ncache = 0;
+
+	// Build the vertex to triangle adjacency lists.
+	for (size_t i = 0; i < nfaces * 3; i++) {
+		remaining[indices[i]]++;
+	}
+	for (size_t v = 0; v < nvertices; v++) {
+		offsets[v + 1] = offsets[v] + remaining[v];
+	}
+	{
+		uint32_t *fill = malloc(nvertices * sizeof(*fill));
+		memcpy(fill, offsets, nvertices * sizeof(*fill));
+
+		for (size_t i = 0; i < nfaces * 3; i++) {
+			adjacency[fill[indices[i]]++] = i / 3;
+		}
+		free(fill);
+	}
+	for (size_t v = 0; v < nvertices; v++) {
+		cachePos[v] = -1;
+		vscore[v] = vertexScore(-1, remaining[v]);
+	}
+
+	int best = -1;
+	float bestScore = -1.0f;
+
+	for (size_t t = 0; t < nfaces; t++) {
+		const uint32_t *tri = &indices[t * 3];
+		tscore[t] = vscore[tri[0]] + vscore[tri[1]] + vscore[tri[2]];
+
+		if (tscore[t] > bestScore) {
+			bestScore = tscore[t];
+			best = t;
+		}
+	}
+
+	size_t scan = 0;
+
+	for (size_t n = 0; n < nfaces; n++) {
+		if (best < 0) {
+			// Dead end: none of the cached vertices has any triangles left,
+			// so restart from the next triangle in input order.
+			while (emitted[scan])
+				scan++;
+			best = scan;
+		}
+		const uint32_t *tri = &indices[best * 3];
+		uint32_t next[LRU_CACHE_SIZE + 3];
+		int nnext = 0;
+
+		memcpy(&out[n * 3], tri, 3 * sizeof(*tri));
+		emitted[best] = true;
+
+		// Move the triangle's vertices to the front of the cache.
+		for (int k = 0; k < 3; k++) {
+			bool dup = false;
+
+			for (int j = 0; j < nnext; j++)
+				dup = dup || next[j] == tri[k];
+			if (! dup)
+				next[nnext++] = tri[k];
+
+			remaining[tri[k]]--;
+		}
+		for (int i = 0; i < ncache; i++) {
+			if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+				next[nnext++] = cache[i];
+		}
+
+		// Update the scores of every vertex that was in, or has just left
+		// the cache, and find the best adjacent triangle.
+		for (int i = 0; i < nnext; i++) {
+			uint32_t v = next[i];
+
+			cachePos[v] = i < LRU_CACHE_SIZE ? i : -1;
+			vscore[v] = vertexScore(cachePos[v], remaining[v]);
+		}
+		best = -1;
+		bestScore = -1.0f;
+
+		for (int i = 0; i < nnext; i++) {
+			uint32_t v = next[i];
+
+			for (uint32_t j = offsets[v]; j < offsets[v + 1]; j++) {
+				uint32_t t = adjacency[j];
+				const uint32_t *adj = &indices[t * 3];
+
+				if (emitted[t])
+					continue;
+
+				tscore[t] = vscore[adj[0]] + vscore[adj[1]] + vscore[adj[2]];
+
+				if (tscore[t] > bestScore) {
+					bestScore = tscore[t];
+					best = t;
+				}
+			}
+		}
+		ncache = nnext < LRU_CACHE_SIZE ? nnext : LRU_CACHE_SIZE;
+		memcpy(cache, next, ncache * sizeof(*cache));
+	}
+	memcpy(indices, out, nfaces * 3 * sizeof(*indices));
+
+	free(remaining);
+	free(offsets);
+	free(adjacency);
+	free(cachePos);
+	free(vscore);
+	free(tscore);
+	free(emitted);
+	free(out);
+}
+
+struct patch {
+	size_t start;  // First triangle
+	size_t count;  // Number of triangles
+	float  sortKey;
+};
+
+static int patchCompare(const void *a, const void *b)
+{
+	float ka = ((const struct patch *)a)->sortKey;
+	float kb = ((const struct patch *)b)->sortKey;
+
+	return (ka < kb) - (ka > kb);
+}
+
+//
+// Reorder the patches of a cache-optimised index buffer so that outward
+// facing patches on the periphery of the mesh are drawn first, reducing
+// overdraw without destroying cache locality. Patches are delimited where
+// the simulated FIFO cache misses on all three vertices of a triangle.
+//
+void optimizeOverdraw(uint32_t *indices, size_t nfaces, const struct vertex *vertices, size_t nvertices)
+{
+	struct patch *patches = malloc(nfaces * sizeof(*patches));
+	int32_t *timestamps = malloc(nvertices * sizeof(*timestamps));
+	uint32_t *out = malloc(nfaces * 3 * sizeof(*out));
+	size_t npatches = 0;
+	int32_t now = FIFO_CACHE_SIZE + 1;
+	vec3 centroid = {0, 0, 0};
+
+	for (size_t i = 0; i < nvertices; i++) {
+		timestamps[i] = -1;
+	}
+	for (size_t t = 0; t < nfaces; t++) {
+		int misses = 0;
+
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = indices[t * 3 + k];
+
+			if (timestamps[v] == -1 || now - timestamps[v] > FIFO_CACHE_SIZE) {
+				timestamps[v] = now++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3) {
+			patches[npatches++] = (struct patch){t, 0, 0};
+		}
+		patches[npatches - 1].count++;
+	}
+
+	for (size_t i = 0; i < nvertices; i++) {
+		centroid = vec3add(centroid, vertices[i].pos);
+	}
+	centroid = vec3scale(centroid, 1.0f / nvertices);
+
+	for (size_t c = 0; c < npatches; c++) {
+		struct patch *cl = &patches[c];
+		vec3 center = {0, 0, 0}, normal = {0, 0, 0};
+
+		for (size_t i = cl->start * 3; i < (cl->start + cl->count) * 3; i++) {
+			const struct vertex *v = &vertices[indices[i]];
+
+			center = vec3add(center, v->pos);
+			normal = vec3add(normal, v->normal);
+		}
+		center = vec3scale(center, 1.0f / (cl->count * 3));
+
+		if (vec3len(normal) > 0.0f)
+			normal = vec3norm(normal);
+
+		cl->sortKey = vec3dot(vec3sub(center, centroid), normal);
+	}
+	qsort(patches, npatches, sizeof(*patches), patchCompare);
+
+	uint32_t *p = out;
+
+	for (size_t c = 0; c < npatches; c++) {
+		memcpy(p, &indices[patches[c].start * 3], patches[c].count * 3 * sizeof(*p));
+		p += patches[c].count * 3;
+	}
+	memcpy(indices, out, nfaces * 3 * sizeof(*indices));
+
+	free(patches);
+	free(timestamps);
+	free(out);
+}
+
+//
+// Reorder vertices in the order they are first referenced by the index buffer,
+// and rewrite the indices to match. Unreferenced vertices are dropped. Returns
+// the new vertex count.
+//
+size_t optimizeVertexFetch(struct vertex *vertices, uint32_t *indices, size_t nfaces, size_t nvertices)
+{
+	uint32_t *remap = malloc(nvertices * sizeof(*remap));
+	struct vertex *out = malloc(nvertices * sizeof(*out));
+	uint32_t next = 0;
+
+	memset(remap, 0xff, nvertices * sizeof(*remap));
+
+	for (size_t i = 0; i < nfaces * 3; i++) {
+		uint32_t v = indices[i];
+
+		if (remap[v] == UINT32_MAX) {
+			out[next] = vertices[v];
+			remap[v] = next++;
+		}
+		indices[i] = remap[v];
+	}
+	memcpy(vertices, out, next * sizeof(*vertices));
+
+	free(remap);
+	free(out);
+
+	return next;
+}
+
+//
+// Compute the bounding sphere and normal cone of the `count` indices at
+// `indices`.
+//
+static struct mdlCluster clusterBounds(const uint32_t *indices, size_t count, const struct vertex *vertices)
+{
+	struct mdlCluster c = {.count = count};
+	vec3 center = {0, 0, 0}, axis = {0, 0, 0};
+	vec3 normals[CLUSTER_TRIS];
+	float radius = 0.0f, mindp = 1.0f;
+	size_t ntris = count / 3;
+
+	for (size_t i = 0; i < count; i++) {
+		center = vec3add(center, vertices[indices[i]].pos);
+	}
+	center = vec3scale(center, 1.0f / count);
+
+	for (size_t i = 0; i < count; i++) {
+		radius = fmaxf(radius, vec3len(vec3sub(vertices[indices[i]].pos, center)));
+	}
+
+	for (size_t t = 0; t < ntris; t++) {
+		const struct vertex *a = &vertices[indices[t * 3 + 0]];
+		const struct vertex *b = &vertices[indices[t * 3 + 1]];
+		const struct vertex *c = &vertices[indices[t * 3 + 2]];
+
+		vec3 n = vec3cross(vec3sub(b->pos, a->pos), vec3sub(c->pos, a->pos));
+		vec3 shading = vec3add(vec3add(a->normal, b->normal), c->normal);
+
+		// The winding order is flipped on import, so orient face normals
+		// to agree with the shading normals rather than trusting it.
+		if (vec3dot(n, shading) < 0.0f)
+			n = vec3scale(n, -1.0f);
+
+		normals[t] = vec3len(n) > 0.0f ? vec3norm(n) : n;
+		axis = vec3add(axis, normals[t]);
+	}
+	if (vec3len(axis) > 0.0f)
+		axis = vec3norm(axis);
+
+	for (size_t t = 0; t < ntris; t++) {
+		if (vec3len(normals[t]) > 0.0f)
+			mindp = fminf(mindp, vec3dot(axis, normals[t]));
+	}
+
+	memcpy(c.center, center.n, sizeof(c.center));
+	memcpy(c.axis, axis.n, sizeof(c.axis));
+	c.radius = radius;
+
+	// When normals span more than a hemisphere, the cluster can't be
+	// back-facing, and the cutoff is set so that the test never passes.
+	c.cutoff = mindp <= 0.0f ? 1.0f : sqrtf(1.0f - mindp * mindp);
+
+	return c;
+}
+
+//
+// Split the index buffer into clusters of consecutive triangles, each of which
+// references at most `CLUSTER_VERTS` vertices. Works best on an index buffer
+// that was optimised for the vertex cache. Returns the number of clusters.
+//
+size_t buildClusters(const uint32_t *indices, size_t nfaces, const struct vertex *vertices, size_t nvertices, struct mdlCluster **out)
+{
+	struct mdlCluster *clusters = malloc(nfaces * sizeof(*clusters));
+	uint32_t *marks = malloc(nvertices * sizeof(*marks));
+	size_t nclusters = 0, start = 0;
+	int nverts = 0;
+
+	memset(marks, 0xff, nvertices * sizeof(*marks));
+
+	for (size_t t = 0; t <= nfaces; t++) {
+		int fresh = 0;
+
+		if (t < nfaces) {
+			for (int k = 0; k < 3; k++) {
+				if (marks[indices[t * 3 + k]] != nclusters)
+					fresh++;
+			}
+		}
+		if (t == nfaces || t - start == CLUSTER_TRIS || nverts + fresh > CLUSTER_VERTS) {
+			if (t > start) {
+				clusters[nclusters] = clusterBounds(&indices[start * 3], (t - start) * 3, vertices);
+				clusters[nclusters].first = start * 3;
+				nclusters++;
+			}
+			if (t == nfaces)
+				break;
+
+			start = t;
+			nverts = 0;
+		}
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = indices[t * 3 + k];
+
+			if (marks[v] != nclusters) {
+				marks[v] = nclusters;
+				nverts++;
+			}
+		}
+	}
+	free(marks);
+	*out = realloc(clusters, nclusters * sizeof(*clusters));
+
+	return nclusters;
+}
@@ -0,0 +1,22 @@
+//
+// meshopt.h
+// offline mesh optimisation
+//
+// dependencies:
+//
+//   stdint.h
+//   stddef.h
+//   linmath.h
+//   common.h
+//
+struct cacheStats {
+	float acmr; // Average cache miss ratio: transformed vertices per triangle
+	float atvr; // Average transform to vertex ratio: 1.0 is optimal
+};
+
+extern struct cacheStats analyzeVertexCache(const uint32_t *, size_t, size_t, int);
+extern void optimizeVertexCache(uint32_t *, size_t, size_t);
+extern void optimizeOverdraw(uint32_t *, size_t, const struct vertex *, size_t);
+extern size_t optimizeVertexFetch(struct vertex *, uint32_t *, size_t, size_t);
+extern size_t buildClusters(const uint32_t *, size_t, const struct vertex *, size_t, struct mdlCluster **);
+extern size_t simplifyMesh(uint32_t *, const uint32_t *, size_t, const struct vertex *, size_t, size_t, float *);
@@ -0,0 +1,213 @@
+//
+// pack.c
+// asset packer
+//
+// Usage: pack <output> <path>...
+//
+// Every file under each `path` is added to the pack under its path, as given
+// on the command line. Files are laid out in path order, so that the assets
+// of a model end up next to each other.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "hash.h"
+
+struct file {
+	char     *path;
+	uint64_t size;
+	uint64_t offset;
+};
+
+struct fileList {
+	struct file *data;
+	size_t      n;
+	size_t      cap;
+};
+
+enum { MAX_PATH = 1024 };
+
+char *strdup(const char *);
+
+static uint64_t align(uint64_t off)
+{
+	return (off + PACK_ALIGNMENT - 1) & ~(uint64_t)(PACK_ALIGNMENT - 1);
+}
+
+static void fwritepad(uint64_t n, FILE *fp)
+{
+	static const char zero[PACK_ALIGNMENT] = {0};
+
+	fwrite(zero, 1, n, fp);
+}
+
+static void addFile(struct fileList *list, const char *path, uint64_t size)
+{
+	if (strlen(path) >= PACK_NAME_SIZE) {
+		fprintf(stderr, "error: path '%s' is too long\n", path);
+		exit(1);
+	}
+	if (list->n == list->cap) {
+		list->cap = list->cap ? list->cap * 2 : 64;
+		list->data = realloc(list->data, list->cap * sizeof(*list->data));
+	}
+	list->data[list->n++] = (struct file){strdup(path), size, 0};
+}
+
+//
+// Add the file at `path` to `list`, or every file under it if it's a
+// directory.
+//
+static void addPath(struct fileList *list, const char *path)
+{
+	struct stat st;
+	struct dirent *ent;
+	DIR *dir;
+
+	if (stat(path, &st) == -1) {
+		fprintf(stderr, "error: couldn't stat '%s'\n", path);
+		exit(1);
+	}
+	if (S_ISREG(st.st_mode)) {
+		addFile(list, path, st.st_size);
+		return;
+	}
+	if (! S_ISDIR(st.st_mode))
+		return;
+
+	if (! (dir = opendir(path))) {
+		fprintf(stderr, "error: couldn't open '%s'\n", path);
+		exit(1);
+	}
+	while ((ent = readdir(dir))) {
+		char child[MAX_PATH];
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+		addPath(list, child);
+	}
+	closedir(dir);
+}
+
+static int fileCompare(const void *a, const void *b)
+{
+	return strcmp(((const struct file *)a)->path, ((const struct file *)b)->path);
+}
+
+static bool copyFile(const struct file *f, FILE *out)
+{
+	char buf[1 << 16];
+	uint64_t left = f->size;
+	FILE *in;
+
+	if (! (in = fopen(f->path, "rb")))
+		return false;
+
+	while (left > 0) {
+		size_t n = left < sizeof(buf) ? left : sizeof(buf);
+
+		if (fread(buf, 1, n, in) != n)
+			break;
+
+		fwrite(buf, 1, n, out);
+		left -= n;
+	}
+	fclose(in);
+
+	return left == 0;
+}
+
+static void writePack(struct fileList *list, FILE *fp)
+{
+	struct packHeader h = {{0}};
+	uint32_t nbuckets = 1;
+
+	// Keep the directory at most half full, so that probes stay short.
+	while (nbuckets < list->n * 2)
+		nbuckets <<= 1;
+
+	struct packEntry *dir = calloc(nbuckets, sizeof(*dir));
+	uint64_t end = sizeof(h) + nbuckets * sizeof(*dir);
+	uint64_t off = align(end);
+
+	for (size_t i = 0; i < list->n; i++) {
+		struct file *f = &list->data[i];
+		uint32_t key = hash(f->path, strlen(f->path));
+		uint32_t b = key & (nbuckets - 1);
+
+		while (dir[b].name[0])
+			b = (b + 1) & (nbuckets - 1);
+
+		f->offset = off;
+		end = off + f->size;
+		off = align(end);
+
+		snprintf(dir[b].name, sizeof(dir[b].name), "%s", f->path);
+		dir[b].hash = key;
+		dir[b].offset = f->offset;
+		dir[b].size = f->size;
+	}
+	memcpy(h.magic, PACK_MAGIC, sizeof(h.magic));
+	h.version = PACK_VERSION;
+	h.nentries = list->n;
+	h.nbuckets = nbuckets;
+	h.size = end;
+
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(dir, sizeof(*dir), nbuckets, fp);
+	off = sizeof(h) + nbuckets * sizeof(*dir);
+
+	for (size_t i = 0; i < list->n; i++) {
+		struct file *f = &list->data[i];
+
+		fwritepad(f->offset - off, fp);
+
+		if (! copyFile(f, fp)) {
+			fprintf(stderr, "error: couldn't read '%s'\n", f->path);
+			exit(1);
+		}
+		off = f->offset + f->size;
+	}
+	free(dir);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fileList list = {NULL, 0, 0};
+	FILE *fp;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <output> <path>...\n", argv[0]);
+		return 1;
+	}
+	for (int i = 2; i < argc; i++) {
+		addPath(&list, argv[i]);
+	}
+	qsort(list.data, list.n, sizeof(*list.data), fileCompare);
+
+	if (! (fp = fopen(argv[1], "wb"))) {
+		fprintf(stderr, "error: couldn't open '%s' for writing\n", argv[1]);
+		return 1;
+	}
+	writePack(&list, fp);
+	fclose(fp);
+
+	fprintf(stderr, "%s: %zu assets\n", argv[1], list.n);
+
+	for (size_t i = 0; i < list.n; i++) {
+		free(list.data[i].path);
+	}
+	free(list.data);
+
+	return 0;
+}
@@ -0,0 +1,309 @@
+//
+// simplify.c
+// quadric error mesh simplification
+//
+// Meshes are simplified by collapsing edges, picking the cheapest collapses
+// first according to the quadric error metric of Garland & Heckbert. Only
+// half-edge collapses are performed, where one vertex is merged into its
+// neighbour, so the simplified index buffer can share the vertex buffer of
+// the original mesh. Vertices on open borders and on attribute seams are
+// locked, to preserve the silhouette and texture mapping.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "meshopt.h"
+
+//
+// Symmetric 4x4 matrix, stored as its upper triangle.
+//
+struct quadric {
+	double a2, ab, ac, ad;
+	double     b2, bc, bd;
+	double         c2, cd;
+	double             d2;
+};
+
+struct collapse {
+	uint32_t from, to;
+	double   cost;
+};
+
+static void quadricAdd(struct quadric *q, const struct quadric *r)
+{
+	q->a2 += r->a2; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+	q->b2 += r->b2; q->bc += r->bc; q->bd += r->bd;
+	q->c2 += r->c2; q->cd += r->cd;
+	q->d2 += r->d2;
+}
+
+//
+// Squared distance of `p` to the planes accumulated in `q`.
+//
+static double quadricError(const struct quadric *q, vec3 p)
+{
+	double x = p.x, y = p.y, z = p.z;
+
+	double e = q->a2 * x * x + 2 * q->ab * x * y + 2 * q->ac * x * z + 2 * q->ad * x
+	         + q->b2 * y * y + 2 * q->bc * y * z + 2 * q->bd * y
+	         + q->c2 * z * z + 2 * q->cd * z
+	         + q->d2;
+
+	return e < 0 ? 0 : e;
+}
+
+static vec3 triangleNormal(vec3 a, vec3 b, vec3 c)
+{
+	return vec3cross(vec3sub(b, a), vec3sub(c, a));
+}
+
+static int collapseCompare(const void *a, const void *b)
+{
+	double ca = ((const struct collapse *)a)->cost;
+	double cb = ((const struct collapse *)b)->cost;
+
+	return (ca > cb) - (ca < cb);
+}
+
+static const struct vertex *SORT_VERTICES;
+
+static int positionCompare(const void *a, const void *b)
+{
+	vec3 pa = SORT_VERTICES[*(const uint32_t *)a].pos;
+	vec3 pb = SORT_VERTICES[*(const uint32_t *)b].pos;
+
+	for (int k = 0; k < 3; k++) {
+		if (pa.n[k] != pb.n[k])
+			return pa.n[k] < pb.n[k] ? -1 : 1;
+	}
+	return 0;
+}
+
+static uint64_t edgeKey(uint32_t a, uint32_t b)
+{
+	return (uint64_t)a << 32 | b;
+}
+
+//
+// Lock vertices that share their position with another vertex, which lie on
+// an attribute seam, and vertices on an open border, where an edge has no
+// matching edge in the opposite direction.
+//
+static void findLockedVertices(bool *locked, const uint32_t *indices, size_t nindices, const struct vertex *vertices, size_t nvertices)
+{
+	uint32_t *order = malloc(nvertices * sizeof(*order));
+
+	for (size_t i = 0; i < nvertices; i++) {
+		order[i] = i;
+	}
+	SORT_VERTICES = vertices;
+	qsort(order, nvertices, sizeof(*order), positionCompare);
+
+	for (size_t i = 1; i < nvertices; i++) {
+		if (positionCompare(&order[i - 1], &order[i]) == 0) {
+			locked[order[i - 1]] = locked[order[i]] = true;
+		}
+	}
+	free(order);
+
+	// Open-addressed set of directed edges.
+	size_t cap = 1;
+	while (cap < nindices * 2)
+		cap <<= 1;
+
+	uint64_t *edges = malloc(cap * sizeof(*edges));
+	memset(edges, 0xff, cap * sizeof(*edges));
+
+	for (size_t i = 0; i < nindices; i++) {
+		uint64_t key = edgeKey(indices[i], indices[i - i % 3 + (i + 1) % 3]);
+		size_t h = (key * 0x9e3779b97f4a7c15ull) >> 32 & (cap - 1);
+
+		while (edges[h] != UINT64_MAX && edges[h] != key)
+			h = (h + 1) & (cap - 1);
+		edges[h] = key;
+	}
+	for (size_t i = 0; i < nindices; i++) {
+		uint32_t a = indices[i], b = indices[i - i % 3 + (i + 1) % 3];
+		uint64_t key = edgeKey(b, a);
+		size_t h = (key * 0x9e3779b97f4a7c15ull) >> 32 & (cap - 1);
+
+		while (edges[h] != UINT64_MAX && edges[h] != key)
+			h = (h + 1) & (cap - 1);
+
+		if (edges[h] == UINT64_MAX)
+			locked[a] = locked[b] = true;
+	}
+	free(edges);
+}
+
+//
+// Check that moving `from` onto `to` doesn't flip any of the triangles around
+// `from` which survive the collapse.
+//
+static bool collapseFlips(const uint32_t *indices, const uint32_t *adj, size_t nadj, uint32_t from, uint32_t to, const struct vertex *vertices)
+{
+	for (size_t i = 0; i < nadj; i++) {
+		const uint32_t *tri = &indices[adj[i] * 3];
+		vec3 p[3], q[3];
+
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+			continue;
+
+		for (int k = 0; k < 3; k++) {
+			p[k] = vertices[tri[k]].pos;
+			q[k] = tri[k] == from ? vertices[to].pos : p[k];
+		}
+		vec3 n0 = triangleNormal(p[0], p[1], p[2]);
+		vec3 n1 = triangleNormal(q[0], q[1], q[2]);
+
+		if (vec3dot(n0, n1) <= 0.0f)
+			return true;
+	}
+	return false;
+}
+
+//
+// Simplify the triangles in `indices` down to about `target` indices, and
+// write the result to `dst`, which must be able to hold `nindices` indices.
+// The largest error introduced, as a distance in model units, is stored in
+// `error`. Returns the number of indices written.
+//
+size_t simplifyMesh(uint32_t *dst, const uint32_t *indices, size_t nindices, const struct vertex *vertices, size_t nvertices, size_t target, float *error)
+{
+	struct quadric *quadrics = calloc(nvertices, sizeof(*quadrics));
+	bool *locked = calloc(nvertices, sizeof(*locked));
+	bool *touched = malloc(nvertices * sizeof(*touched));
+	uint32_t *remap = malloc(nvertices * sizeof(*remap));
+	uint32_t *offsets = malloc((nvertices + 1) * sizeof(*offsets));
+	uint32_t *adjacency = malloc(nindices * sizeof(*adjacency));
+	struct collapse *collapses = malloc(nindices * sizeof(*collapses));
+	double maxCost = 0.0;
+	size_t n = nindices;
+
+	memcpy(dst, indices, nindices * sizeof(*dst));
+	findLockedVertices(locked, indices, nindices, vertices, nvertices);
+
+	// Accumulate the plane of every triangle into its vertices' quadrics.
+	for (size_t i = 0; i < nindices; i += 3) {
+		vec3 a = vertices[indices[i + 0]].pos;
+		vec3 b = vertices[indices[i + 1]].pos;
+		vec3 c = vertices[indices[i + 2]].pos;
+		vec3 nrm = triangleNormal(a, b, c);
+
+		if (vec3len(nrm) == 0.0f)
+			continue;
+
+		nrm = vec3norm(nrm);
+
+		double x = nrm.x, y = nrm.y, z = nrm.z, d = -vec3dot(nrm, a);
+		struct quadric q = {
+			x * x, x * y, x * z, x * d,
+			       y * y, y * z, y * d,
+			              z * z, z * d,
+			                     d * d
+		};
+		for (int k = 0; k < 3; k++) {
+			quadricAdd(&quadrics[indices[i + k]], &q);
+		}
+	}
+
+	while (n > target) {
+		size_t ncollapses = 0, applied = 0;
+
+		// Build the vertex to triangle adjacency of the current mesh.
+		memset(offsets, 0, (nvertices + 1) * sizeof(*offsets));
+
+		for (size_t i = 0; i < n; i++) {
+			offsets[dst[i] + 1]++;
+		}
+		for (size_t v = 0; v < nvertices; v++) {
+			offsets[v + 1] += offsets[v];
+		}
+		for (size_t i = 0; i < n; i++) {
+			adjacency[offsets[dst[i]]++] = i / 3;
+		}
+		for (size_t v = nvertices; v > 0; v--) {
+			offsets[v] = offsets[v - 1];
+		}
+		offsets[0] = 0;
+
+		// Rank every candidate half-edge collapse by its cost.
+		for (size_t i = 0; i < n; i++) {
+			uint32_t from = dst[i];
+			uint32_t to = dst[i - i % 3 + (i + 1) % 3];
+
+			if (locked[from])
+				continue;
+
+			struct quadric q = quadrics[from];
+			quadricAdd(&q, &quadrics[to]);
+
+			collapses[ncollapses++] = (struct collapse){from, to, quadricError(&q, vertices[to].pos)};
+		}
+		qsort(collapses, ncollapses, sizeof(*collapses), collapseCompare);
+
+		for (size_t v = 0; v < nvertices; v++) {
+			touched[v] = false;
+			remap[v] = v;
+		}
+
+		// Apply collapses cheapest first. Every collapse removes about two
+		// triangles, and a vertex is only involved in one collapse per pass.
+		for (size_t i = 0; i < ncollapses && applied * 6 < n - target; i++) {
+			struct collapse *c = &collapses[i];
+			const uint32_t *adj = &adjacency[offsets[c->from]];
+			size_t nadj = offsets[c->from + 1] - offsets[c->from];
+
+			if (touched[c->from] || touched[c->to])
+				continue;
+			if (collapseFlips(dst, adj, nadj, c->from, c->to, vertices))
+				continue;
+
+			remap[c->from] = c->to;
+			quadricAdd(&quadrics[c->to], &quadrics[c->from]);
+			maxCost = fmax(maxCost, c->cost);
+
+			for (size_t j = 0; j < nadj; j++) {
+				for (int k = 0; k < 3; k++) {
+					touched[dst[adj[j] * 3 + k]] = true;
+				}
+			}
+			applied++;
+		}
+		if (applied == 0)
+			break;
+
+		// Remap indices and drop the triangles which became degenerate.
+		size_t m = 0;
+
+		for (size_t i = 0; i < n; i += 3) {
+			uint32_t a = remap[dst[i]], b = remap[dst[i + 1]], c = remap[dst[i + 2]];
+
+			if (a == b || b == c || c == a)
+				continue;
+
+			dst[m++] = a;
+			dst[m++] = b;
+			dst[m++] = c;
+		}
+		n = m;
+	}
+	*error = sqrt(maxCost);
+
+	free(quadrics);
+	free(locked);
+	free(touched);
+	free(remap);
+	free(offsets);
+	free(adjacency);
+	free(collapses);
+
+	return n;
+}
@@ -0,0 +1,591 @@
+//
+// texconv.c
+// texture converter
+//
+// Usage: texconv [-f bc1|bc3|bc5] [-l|-s] <input.tga> <output.tex>
+//
+// Converts a 32-bit TGA into a precompressed texture, with its whole mip
+// chain baked down to 1x1. The format defaults to BC5 for normal maps, which
+// are recognised by their `_n.tga` suffix, and otherwise to BC1, or BC3 if
+// any texel isn't opaque.
+//
+// Color is taken to be encoded the way the renderer samples the TGA, which
+// is as sRGB for specular maps, recognised by their `_s.tga` suffix, and as
+// linear for anything else, so that converting a texture doesn't change how
+// it looks. `-s` and `-l` take color to be sRGB or linear regardless. sRGB
+// mipmaps are filtered in linear space, and re-encoded to sRGB before
+// compression, so that they don't darken as they shrink, and the texture is
+// flagged as sRGB. Normal maps are filtered as vectors, and renormalized at
+// every level.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "linmath.h"
+#include "common.h"
+#include "tga.h"
+
+//
+// An image being filtered. Texels are four floats each, in linear space for
+// color, and in [-1, 1] for normals.
+//
+struct image {
+	int   width;
+	int   height;
+	float *texels;
+};
+
+struct level {
+	int           width;
+	int           height;
+	unsigned char *blocks;
+	size_t        size;
+};
+
+static struct {
+	int  format; // An `enum texFormat`, or -1 to pick one from the input
+	int  srgb;   // 1 or 0 to take color to be sRGB or linear, -1 to follow the input
+} OPTIONS = {-1, -1};
+
+static const char *FORMAT_NAMES[TEX_FORMATS] = {
+	[TEX_FORMAT_BC1] = "bc1",
+	[TEX_FORMAT_BC3] = "bc3",
+	[TEX_FORMAT_BC5] = "bc5"
+};
+
+static const size_t BLOCK_SIZES[TEX_FORMATS] = {
+	[TEX_FORMAT_BC1] = 8,
+	[TEX_FORMAT_BC3] = 16,
+	[TEX_FORMAT_BC5] = 16
+};
+
+static float srgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint8_t unorm8(float c)
+{
+	c = c < 0.0f ? 0.0f : c > 1.0f ? 1.0f : c;
+
+	return (uint8_t)(c * 255.0f + 0.5f);
+}
+
+static bool hasSuffix(const char *s, const char *suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+
+	return n >= m && ! strcmp(s + n - m, suffix);
+}
+
+static void normalize3(float *v)
+{
+	float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+	if (len > 0.0f) {
+		v[0] /= len;
+		v[1] /= len;
+		v[2] /= len;
+	}
+}
+
+//
+// Convert the BGRA pixels of `t` into `img`, decoding sRGB color when `srgb`
+// is set, and unpacking normals when `normals` is set.
+//
+static void readImage(struct image *img, const struct tga *t, bool srgb, bool normals)
+{
+	img->width = t->width;
+	img->height = t->height;
+	img->texels = malloc((size_t)img->width * img->height * 4 * sizeof(float));
+
+	for (size_t i = 0; i < (size_t)img->width * img->height; i++) {
+		uint32_t p = t->data[i];
+		float *c = &img->texels[i * 4];
+
+		c[0] = ((p >> 16) & 0xff) / 255.0f;
+		c[1] = ((p >> 8) & 0xff) / 255.0f;
+		c[2] = (p & 0xff) / 255.0f;
+		c[3] = (p >> 24) / 255.0f;
+
+		for (int k = 0; k < 3; k++) {
+			if (normals)
+				c[k] = c[k] * 2.0f - 1.0f;
+			else if (srgb)
+				c[k] = srgbToLinear(c[k]);
+		}
+		if (normals)
+			normalize3(c);
+	}
+}
+
+//
+// Halve `src` into `dst` with a box filter. Odd texels at the edge are
+// averaged with themselves.
+//
+static void downsample(struct image *dst, const struct image *src, bool normals)
+{
+	dst->width = src->width > 1 ? src->width / 2 : 1;
+	dst->height = src->height > 1 ? src->height / 2 : 1;
+	dst->texels = malloc((size_t)dst->width * dst->height * 4 * sizeof(float));
+
+	for (int y = 0; y < dst->height; y++) {
+		int y0 = y * 2, y1 = y * 2 + 1 < src->height ? y * 2 + 1 : src->height - 1;
+
+		for (int x = 0; x < dst->width; x++) {
+			int x0 = x * 2, x1 = x * 2 + 1 < src->width ? x * 2 + 1 : src->width - 1;
+			float *c = &dst->texels[((size_t)y * dst->width + x) * 4];
+
+			for (int k = 0; k < 4; k++) {
+				c[k] = (src->texels[((size_t)y0 * src->width + x0) * 4 + k] +
+				        src->texels[((size_t)y0 * src->width + x1) * 4 + k] +
+				        src->texels[((size_t)y1 * src->width + x0) * 4 + k] +
+				        src->texels[((size_t)y1 * src->width + x1) * 4 + k]) * 0.25f;
+			}
+			if (normals)
+				normalize3(c);
+		}
+	}
+}
+
+//
+// Gather the 4x4 block at `bx`, `by` of `img` as RGBA bytes, re-encoding
+// color to sRGB when `srgb` is set. Texels past the edge repeat the last row
+// or column.
+//
+static void readBlock(uint8_t block[16][4], const struct image *img, int bx, int by, bool srgb, bool normals)
+{
+	for (int i = 0; i < 16; i++) {
+		int x = bx * 4 + i % 4, y = by * 4 + i / 4;
+
+		x = x < img->width ? x : img->width - 1;
+		y = y < img->height ? y : img->height - 1;
+
+		const float *c = &img->texels[((size_t)y * img->width + x) * 4];
+
+		for (int k = 0; k < 3; k++) {
+			if (normals)
+				block[i][k] = unorm8(c[k] * 0.5f + 0.5f);
+			else
+				block[i][k] = unorm8(srgb ? linearToSrgb(c[k]) : c[k]);
+		}
+		block[i][3] = unorm8(c[3]);
+	}
+}
+
+//
+// Quantize `c`, in [0, 255], to [0, `max`].
+//
+static int quantize(float c, int max)
+{
+	c = c < 0.0f ? 0.0f : c > 255.0f ? 255.0f : c;
+
+	return (int)(c * max / 255.0f + 0.5f);
+}
+
+static uint16_t pack565(const float *c)
+{
+	return quantize(c[0], 31) << 11 | quantize(c[1], 63) << 5 | quantize(c[2], 31);
+}
+
+static void unpack565(uint16_t v, float *c)
+{
+	int r = v >> 11 & 31, g = v >> 5 & 63, b = v & 31;
+
+	c[0] = (r << 3 | r >> 2);
+	c[1] = (g << 2 | g >> 4);
+	c[2] = (b << 3 | b >> 2);
+}
+
+//
+// Pick the closest of the four colors between `c0` and `c1` for every texel
+// of `block`. Returns the squared error.
+//
+static float fitIndices(uint8_t block[16][4], uint16_t c0, uint16_t c1, uint8_t *indices)
+{
+	float palette[4][3], error = 0.0f;
+
+	unpack565(c0, palette[0]);
+	unpack565(c1, palette[1]);
+
+	for (int k = 0; k < 3; k++) {
+		palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+		palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+	}
+	for (int i = 0; i < 16; i++) {
+		float best = INFINITY;
+
+		for (int j = 0; j < 4; j++) {
+			float d = 0.0f;
+
+			for (int k = 0; k < 3; k++) {
+				d += (block[i][k] - palette[j][k]) * (block[i][k] - palette[j][k]);
+			}
+			if (d < best) {
+				best = d;
+				indices[i] = j;
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+//
+// Solve for the endpoints which best reproduce `block` with `indices`, in
+// the least squares sense. Returns false if the indices don't constrain them.
+//
+static bool refineEndpoints(uint8_t block[16][4], const uint8_t *indices, uint16_t *c0, uint16_t *c1)
+{
+	static const float WEIGHTS[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {0}, bx[3] = {0};
+
+	for (int i = 0; i < 16; i++) {
+		float a = WEIGHTS[indices[i]], b = 1.0f - a;
+
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+
+		for (int k = 0; k < 3; k++) {
+			ax[k] += a * block[i][k];
+			bx[k] += b * block[i][k];
+		}
+	}
+	float det = aa * bb - ab * ab;
+
+	if (fabsf(det) < 1e-6f)
+		return false;
+
+	float e0[3], e1[3];
+
+	for (int k = 0; k < 3; k++) {
+		e0[k] = (ax[k] * bb - bx[k] * ab) / det;
+		e1[k] = (bx[k] * aa - ax[k] * ab) / det;
+	}
+	*c0 = pack565(e0);
+	*c1 = pack565(e1);
+
+	return true;
+}
+
+//
+// Encode the color of `block` as a BC1 block, always in four-color mode, as
+// BC3 requires.
+//
+static void encodeColorBlock(uint8_t block[16][4], uint8_t *out)
+{
+	float mean[3] = {0}, cov[6] = {0};
+
+	for (int i = 0; i < 16; i++) {
+		for (int k = 0; k < 3; k++) {
+			mean[k] += block[i][k] / 16.0f;
+		}
+	}
+	for (int i = 0; i < 16; i++) {
+		float r = block[i][0] - mean[0], g = block[i][1] - mean[1], b = block[i][2] - mean[2];
+
+		cov[0] += r * r;
+		cov[1] += r * g;
+		cov[2] += r * b;
+		cov[3] += g * g;
+		cov[4] += g * b;
+		cov[5] += b * b;
+	}
+
+	// Find the principal axis of the colors by power iteration, and use the
+	// extent of the colors along it as the first endpoints.
+	float axis[3] = {1.0f, 1.0f, 1.0f};
+
+	for (int n = 0; n < 8; n++) {
+		float v[3] = {
+			cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+			cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+			cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+		};
+		float len = fmaxf(fabsf(v[0]), fmaxf(fabsf(v[1]), fabsf(v[2])));
+
+		if (len < 1e-6f)
+			break;
+
+		for (int k = 0; k < 3; k++) {
+			axis[k] = v[k] / len;
+		}
+	}
+	normalize3(axis);
+
+	float tmin = INFINITY, tmax = -INFINITY;
+
+	for (int i = 0; i < 16; i++) {
+		float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+
+		tmin = fminf(tmin, t);
+		tmax = fmaxf(tmax, t);
+	}
+	float e0[3], e1[3];
+
+	for (int k = 0; k < 3; k++) {
+		e0[k] = mean[k] + axis[k] * tmax;
+		e1[k] = mean[k] + axis[k] * tmin;
+	}
+	uint16_t c0 = pack565(e0), c1 = pack565(e1), r0, r1;
+	uint8_t indices[16], refined[16];
+	float error = fitIndices(block, c0, c1, indices);
+
+	if (refineEndpoints(block, indices, &r0, &r1) && fitIndices(block, r0, r1, refined) < error) {
+		c0 = r0;
+		c1 = r1;
+		memcpy(indices, refined, sizeof(indices));
+	}
+
+	// Four-color mode needs `c0 > c1`, which swaps the roles of the indices.
+	if (c0 < c1) {
+		uint16_t t = c0;
+
+		c0 = c1;
+		c1 = t;
+
+		for (int i = 0; i < 16; i++) {
+			indices[i] ^= 1;
+		}
+	} else if (c0 == c1) {
+		memset(indices, 0, sizeof(indices));
+	}
+	uint32_t bits = 0;
+
+	for (int i = 0; i < 16; i++) {
+		bits |= (uint32_t)indices[i] << (i * 2);
+	}
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+
+	for (int i = 0; i < 4; i++) {
+		out[4 + i] = bits >> (i * 8);
+	}
+}
+
+//
+// Encode channel `k` of `block` as a BC4 block, between its extremes, in
+// eight-value mode.
+//
+static void encodeChannelBlock(uint8_t block[16][4], int k, uint8_t *out)
+{
+	uint8_t lo = 255, hi = 0;
+	uint64_t bits = 0;
+
+	for (int i = 0; i < 16; i++) {
+		lo = block[i][k] < lo ? block[i][k] : lo;
+		hi = block[i][k] > hi ? block[i][k] : hi;
+	}
+	out[0] = hi;
+	out[1] = lo;
+
+	for (int i = 0; i < 16 && hi > lo; i++) {
+		// Steps from `hi` to `lo` are indices 0, 2, 3, ..., 7, 1.
+		int step = ((hi - block[i][k]) * 7 + (hi - lo) / 2) / (hi - lo);
+		int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+
+		bits |= (uint64_t)index << (i * 3);
+	}
+	for (int i = 0; i < 6; i++) {
+		out[2 + i] = bits >> (i * 8);
+	}
+}
+
+static void encodeLevel(struct level *l, const struct image *img, enum texFormat format, bool srgb)
+{
+	int bw = (img->width + 3) / 4, bh = (img->height + 3) / 4;
+	size_t blockSize = BLOCK_SIZES[format];
+	uint8_t block[16][4];
+
+	l->width = img->width;
+	l->height = img->height;
+	l->size = (size_t)bw * bh * blockSize;
+	l->blocks = malloc(l->size);
+
+	for (int by = 0; by < bh; by++) {
+		for (int bx = 0; bx < bw; bx++) {
+			unsigned char *out = l->blocks + ((size_t)by * bw + bx) * blockSize;
+
+			readBlock(block, img, bx, by, srgb, format == TEX_FORMAT_BC5);
+
+			switch (format) {
+			case TEX_FORMAT_BC1:
+				encodeColorBlock(block, out);
+				break;
+			case TEX_FORMAT_BC3:
+				encodeChannelBlock(block, 3, out);
+				encodeColorBlock(block, out + 8);
+				break;
+			case TEX_FORMAT_BC5:
+				encodeChannelBlock(block, 0, out);
+				encodeChannelBlock(block, 1, out + 8);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+static uint64_t align(uint64_t off)
+{
+	return (off + TEX_ALIGNMENT - 1) & ~(uint64_t)(TEX_ALIGNMENT - 1);
+}
+
+static void fwritepad(uint64_t n, FILE *fp)
+{
+	static const char zero[TEX_ALIGNMENT] = {0};
+
+	fwrite(zero, 1, n, fp);
+}
+
+static void writeTexture(const struct level *levels, int nlevels, enum texFormat format, uint32_t flags, FILE *fp)
+{
+	struct texHeader h = {{0}};
+	struct texLevel table[TEX_MAX_LEVELS] = {{0}};
+	uint64_t off = sizeof(h) + nlevels * sizeof(*table), end = off;
+
+	for (int i = 0; i < nlevels; i++) {
+		off = align(end);
+		table[i] = (struct texLevel){levels[i].width, levels[i].height, off, levels[i].size, 0};
+		end = off + levels[i].size;
+	}
+	memcpy(h.magic, TEX_MAGIC, sizeof(h.magic));
+	h.version = TEX_VERSION;
+	h.format = format;
+	h.flags = flags;
+	h.width = levels[0].width;
+	h.height = levels[0].height;
+	h.nlevels = nlevels;
+	h.size = end;
+
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(table, sizeof(*table), nlevels, fp);
+	off = sizeof(h) + nlevels * sizeof(*table);
+
+	for (int i = 0; i < nlevels; i++) {
+		fwritepad(table[i].offset - off, fp);
+		fwrite(levels[i].blocks, 1, levels[i].size, fp);
+		off = table[i].offset + table[i].size;
+	}
+}
+
+static bool isOpaque(const struct tga *t)
+{
+	for (size_t i = 0; i < (size_t)t->width * t->height; i++) {
+		if (t->data[i] >> 24 != 0xff)
+			return false;
+	}
+	return true;
+}
+
+static int convert(const char *input, const char *output)
+{
+	struct level levels[TEX_MAX_LEVELS];
+	struct image img, next;
+	struct tga t;
+	int nlevels = 0;
+	FILE *fp;
+
+	if (! tgaDecode(&t, input)) {
+		fprintf(stderr, "error: couldn't decode '%s'\n", input);
+		return 1;
+	}
+	if (t.depth != 32 || t.width <= 0 || t.height <= 0) {
+		fprintf(stderr, "error: '%s' isn't a 32-bit image\n", input);
+		return 1;
+	}
+	enum texFormat format = OPTIONS.format;
+
+	if (OPTIONS.format == -1)
+		format = hasSuffix(input, "_n.tga") ? TEX_FORMAT_BC5 : isOpaque(&t) ? TEX_FORMAT_BC1 : TEX_FORMAT_BC3;
+
+	bool normals = format == TEX_FORMAT_BC5;
+	bool srgb = ! normals && (OPTIONS.srgb == -1 ? hasSuffix(input, "_s.tga") : OPTIONS.srgb);
+
+	readImage(&img, &t, srgb, normals);
+	tgaFreeImageData(&t);
+
+	for (;;) {
+		encodeLevel(&levels[nlevels++], &img, format, srgb);
+
+		if (img.width == 1 && img.height == 1)
+			break;
+
+		downsample(&next, &img, normals);
+		free(img.texels);
+		img = next;
+	}
+	free(img.texels);
+
+	if (! (fp = fopen(output, "wb"))) {
+		fprintf(stderr, "error: couldn't open '%s' for writing\n", output);
+		return 1;
+	}
+	writeTexture(levels, nlevels, format, srgb ? TEX_FLAG_SRGB : 0, fp);
+	fclose(fp);
+
+	size_t size = 0;
+
+	for (int i = 0; i < nlevels; i++) {
+		size += levels[i].size;
+		free(levels[i].blocks);
+	}
+	fprintf(stderr, "%s: %dx%d, %s%s, %d levels, %zu bytes\n", output, levels[0].width, levels[0].height,
+	        FORMAT_NAMES[format], srgb ? " (srgb)" : "", nlevels, size);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f bc1|bc3|bc5] [-l|-s] <input.tga> <output.tex>\n", prog);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -f  compress to the given format, instead of picking one from the input\n");
+	fprintf(stderr, "  -l  treat color as linear, even for specular maps\n");
+	fprintf(stderr, "  -s  treat color as sRGB encoded, even for diffuse maps\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (! strcmp(argv[i], "-f") && i + 1 < argc) {
+			i++;
+
+			for (OPTIONS.format = 0; OPTIONS.format < TEX_FORMATS; OPTIONS.format++) {
+				if (! strcmp(argv[i], FORMAT_NAMES[OPTIONS.format]))
+					break;
+			}
+			if (OPTIONS.format == TEX_FORMATS) {
+				fprintf(stderr, "error: unknown format '%s'\n", argv[i]);
+				exit(1);
+			}
+		} else if (! strcmp(argv[i], "-l")) {
+			OPTIONS.srgb = 0;
+		} else if (! strcmp(argv[i], "-s")) {
+			OPTIONS.srgb = 1;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (i != argc - 2) {
+		usage(argv[0]);
+	}
+	return convert(argv[i], argv[i + 1]);
+}
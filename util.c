@@ -6,6 +6,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 void fatalf(const char *fmt, ...)
 {
@@ -52,3 +56,36 @@ int freadstr(char **strp, FILE *fp)
 
 	return len;
 }
+
+//
+// Map the file at `path` read-only into memory and store its size in `size`.
+// Returns NULL if the file couldn't be opened or mapped.
+//
+const void *mapfile(const char *path, size_t *size)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED) {
+		return NULL;
+	}
+	*size = st.st_size;
+
+	return addr;
+}
+
+void unmapfile(const void *addr, size_t size)
+{
+	munmap((void *)addr, size);
+}
@@ -2,3 +2,5 @@ extern GLuint createShader(const char *, GLenum);
 extern const char *readfile(const char *);
 extern void fatalf(const char *, ...);
 extern int freadstr(char **, FILE *);
+extern const void *mapfile(const char *, size_t *);
+extern void unmapfile(const void *, size_t);